@@ -20,8 +20,9 @@ $LDFLAGS = "-m i386pe -T src/boot/link.ld"
 # Object files list
 $OBJS = @(
     "obj/kasm.o", "obj/kc.o", "obj/idt.o", "obj/isr.o", "obj/syscall.o",
+    "obj/irqasm.o", "obj/irq.o", "obj/timer.o", "obj/boottime.o",
     "obj/kb.o", "obj/string.o", "obj/system.o", "obj/util.o", "obj/shell.o",
-    "obj/math.o", "obj/vga.o", "obj/fat32.o", "obj/ata.o", "obj/eynfs.o",
+    "obj/math.o", "obj/vga.o", "obj/fat32.o", "obj/ata.o", "obj/ahci.o", "obj/virtio_blk.o", "obj/block.o", "obj/pci.o", "obj/eynfs.o",
     "obj/rei.o", "obj/shell_commands.o", "obj/fs_commands.o", "obj/fdisk_commands.o",
     "obj/format_command.o", "obj/write_editor.o", "obj/tui.o", "obj/help_tui.o",
     "obj/assemble.o", "obj/instruction_set.o", "obj/run_command.o", "obj/history.o",
@@ -105,6 +106,7 @@ function Build-All {
     # Compile assembly files
     Assemble-AsmFile "src/boot/kernel.asm" "obj/kasm.o"
     Assemble-AsmFile "src/cpu/syscall.asm" "obj/syscall.o"
+    Assemble-AsmFile "src/cpu/irq.asm" "obj/irqasm.o"
 
     # Compile C files
     $cFiles = @(
@@ -112,6 +114,9 @@ function Build-All {
         @("src/cpu/idt.c", "obj/idt.o"),
         @("src/drivers/kb.c", "obj/kb.o"),
         @("src/cpu/isr.c", "obj/isr.o"),
+        @("src/cpu/irq.c", "obj/irq.o"),
+        @("src/cpu/timer.c", "obj/timer.o"),
+        @("src/cpu/boottime.c", "obj/boottime.o"),
         @("src/utilities/shell/string.c", "obj/string.o"),
         @("src/cpu/system.c", "obj/system.o"),
         @("src/utilities/util.c", "obj/util.o"),
@@ -120,6 +125,10 @@ function Build-All {
         @("src/drivers/vga.c", "obj/vga.o"),
         @("src/drivers/fat32.c", "obj/fat32.o"),
         @("src/drivers/ata.c", "obj/ata.o"),
+        @("src/drivers/ahci.c", "obj/ahci.o"),
+        @("src/drivers/virtio_blk.c", "obj/virtio_blk.o"),
+        @("src/drivers/block.c", "obj/block.o"),
+        @("src/drivers/pci.c", "obj/pci.o"),
         @("src/drivers/eynfs.c", "obj/eynfs.o"),
         @("src/drivers/rei.c", "obj/rei.o"),
         @("src/utilities/shell/shell_commands.c", "obj/shell_commands.o"),
@@ -2,14 +2,22 @@
 import os
 import struct
 
-EYNFS_BLOCK_SIZE = 512
+EYNFS_BLOCK_SIZE = 512  # Sector size; the superblock's block_size gives the block size
+EYNFS_BLOCK_SIZES = (512, 1024, 2048, 4096)
 EYNFS_NAME_MAX = 32
 EYNFS_TYPE_FILE = 1
 EYNFS_TYPE_DIR = 2
 SUPERBLOCK_LBA = 2048
+EYNFS_FLAG_EXTENTS = 0x01
+EYNFS_INLINE_MARK = 0xA5  # Second byte of a slot holding an inline file's data
+EYNFS_EXTENT_MAGIC = 0x544E5845  # 'EXNT'
+EXTENT_HEADER_STRUCT = '<IIII'
+EYNFS_JOURNAL_MAGIC = 0x4C4E524A  # 'JRNL'
+EYNFS_JOURNAL_DESC_MAGIC = 0x4353444A  # 'JDSC'
+JOURNAL_HEADER_STRUCT = '<IIII'
 
 # EYNFS superblock structure
-SUPERBLOCK_STRUCT = '<IIIIIII8s'
+SUPERBLOCK_STRUCT = '<IIIIIIIIII'
 # EYNFS directory entry structure
 DIR_ENTRY_STRUCT = f'<{EYNFS_NAME_MAX}sBBHIIII'
 DIR_ENTRY_SIZE = struct.calcsize(DIR_ENTRY_STRUCT)
@@ -22,7 +30,7 @@ def read_superblock(f):
     f.seek(SUPERBLOCK_LBA * EYNFS_BLOCK_SIZE)
     data = f.read(struct.calcsize(SUPERBLOCK_STRUCT))
     fields = struct.unpack(SUPERBLOCK_STRUCT, data)
-    return {
+    sb = {
         'magic': fields[0],
         'version': fields[1],
         'block_size': fields[2],
@@ -30,19 +38,43 @@ def read_superblock(f):
         'root_dir_block': fields[4],
         'free_block_map': fields[5],
         'name_table_block': fields[6],
+        # Older images have a single bitmap sector (0 here)
+        'bitmap_blocks': fields[7] or 1,
+        'journal_block': fields[8],
+        'journal_blocks': fields[9],
     }
+    if sb['block_size'] not in EYNFS_BLOCK_SIZES:
+        raise RuntimeError(f"Unsupported EYNFS block size {sb['block_size']}")
+    return sb
 
-def read_dir_chain(f, start_block):
+def journal_pending(f, sb):
+    """Whether the metadata journal holds transactions the kernel hasn't replayed yet."""
+    if not sb['journal_block'] or sb['journal_blocks'] < 4:
+        return False
+    bs = sb['block_size']
+    f.seek(sb['journal_block'] * bs)
+    magic, sequence, _, _ = struct.unpack(JOURNAL_HEADER_STRUCT, f.read(16))
+    if magic != EYNFS_JOURNAL_MAGIC:
+        return False
+    f.seek((sb['journal_block'] + 1) * bs)
+    desc_magic, desc_sequence, _, _ = struct.unpack(JOURNAL_HEADER_STRUCT, f.read(16))
+    return desc_magic == EYNFS_JOURNAL_DESC_MAGIC and desc_sequence == sequence
+
+def entries_per_block(sb):
+    return (sb['block_size'] - 4) // DIR_ENTRY_SIZE
+
+def read_dir_chain(f, sb, start_block):
     """Read the full directory chain into a list of entries and block numbers."""
+    bs = sb['block_size']
     entries = []
     blocks = []
     block = start_block
     while block:
-        f.seek(block * EYNFS_BLOCK_SIZE)
-        data = f.read(EYNFS_BLOCK_SIZE)
+        f.seek(block * bs)
+        data = f.read(bs)
         next_block = struct.unpack('<I', data[:4])[0]
         block_entries = []
-        for i in range(4, EYNFS_BLOCK_SIZE, DIR_ENTRY_SIZE):
+        for i in range(4, bs, DIR_ENTRY_SIZE):
             entry_data = data[i:i+DIR_ENTRY_SIZE]
             if len(entry_data) < DIR_ENTRY_SIZE:
                 break
@@ -56,53 +88,74 @@ def read_dir_chain(f, start_block):
 def find_free_dir_slot(entries):
     for idx, entry in enumerate(entries):
         name = entry[0].split(b'\0',1)[0]
-        if not name:
+        if not name and entry[0][1] != EYNFS_INLINE_MARK:
             return idx
     return len(entries)
 
 def find_free_block(f, sb):
-    # Simple scan for a free block in the bitmap
+    # First-fit scan of the (multi-block) bitmap, resuming after the last block handed out
+    bs = sb['block_size']
     bitmap_block = sb['free_block_map']
-    f.seek(bitmap_block * EYNFS_BLOCK_SIZE)
-    bitmap = bytearray(f.read(EYNFS_BLOCK_SIZE))
-    for i in range(sb['total_blocks']):
+    if 'bitmap' not in sb:
+        f.seek(bitmap_block * bs)
+        sb['bitmap'] = bytearray(f.read(sb['bitmap_blocks'] * bs))
+        sb['next_free'] = 0
+    bitmap = sb['bitmap']
+    limit = min(sb['total_blocks'], len(bitmap) * 8)
+    for i in range(sb['next_free'], limit):
         byte = i // 8
         bit = i % 8
         if not (bitmap[byte] & (1 << bit)):
-            # Mark as used
+            # Mark as used and write back just that bitmap block
             bitmap[byte] |= (1 << bit)
-            f.seek(bitmap_block * EYNFS_BLOCK_SIZE)
-            f.write(bitmap)
+            index = byte // bs
+            f.seek((bitmap_block + index) * bs)
+            f.write(bitmap[index * bs:(index + 1) * bs])
+            sb['next_free'] = i + 1
             return i
     raise RuntimeError('No free blocks')
 
 def write_file_data(f, sb, data):
-    # Write file data to new blocks, return first block and size
-    prev_block = 0
-    first_block = 0
+    """Write file data to full blocks, return (extents, size).
+
+    Blocks come from a first-fit scan, so they are normally one contiguous extent."""
+    bs = sb['block_size']
+    extents = []
     size = len(data)
     written = 0
     while written < size:
         block = find_free_block(f, sb)
-        if not first_block:
-            first_block = block
-        chunk = data[written:written+EYNFS_BLOCK_SIZE-4]
-        block_data = bytearray(EYNFS_BLOCK_SIZE)
-        # next_block = 0 for now
-        struct.pack_into('<I', block_data, 0, 0)
-        block_data[4:4+len(chunk)] = chunk
-        if prev_block:
-            # Update previous block's next pointer (only 4 bytes)
-            f.seek(prev_block * EYNFS_BLOCK_SIZE)
-            f.write(struct.pack('<I', block))
-        f.seek(block * EYNFS_BLOCK_SIZE)
-        f.write(block_data)
-        prev_block = block
+        chunk = data[written:written+bs]
+        f.seek(block * bs)
+        f.write(chunk.ljust(bs, b'\0'))
+        if extents and extents[-1][0] + extents[-1][1] == block:
+            extents[-1][1] += 1
+        else:
+            extents.append([block, 1])
         written += len(chunk)
-    return first_block, size
+    return extents, size
+
+def write_extent_map(f, sb, extents):
+    """Store the extents after the first in linked map blocks, return the first map block."""
+    spill = extents[1:]
+    if not spill:
+        return 0
+    bs = sb['block_size']
+    per_block = (bs - struct.calcsize(EXTENT_HEADER_STRUCT)) // 8
+    chunks = [spill[i:i+per_block] for i in range(0, len(spill), per_block)]
+    blocks = [find_free_block(f, sb) for _ in chunks]
+    for i, chunk in enumerate(chunks):
+        next_block = blocks[i + 1] if i + 1 < len(blocks) else 0
+        data = bytearray(bs)
+        struct.pack_into(EXTENT_HEADER_STRUCT, data, 0, EYNFS_EXTENT_MAGIC, len(chunk), next_block, 0)
+        for k, (start, count) in enumerate(chunk):
+            struct.pack_into('<II', data, 16 + k * 8, start, count)
+        f.seek(blocks[i] * bs)
+        f.write(data)
+    return blocks[0]
 
-def update_dir_entry(f, block, entry_idx, entry):
-    f.seek(block * EYNFS_BLOCK_SIZE + 4 + entry_idx * DIR_ENTRY_SIZE)
+def update_dir_entry(f, sb, block, entry_idx, entry):
+    f.seek(block * sb['block_size'] + 4 + entry_idx * DIR_ENTRY_SIZE)
     f.write(struct.pack(DIR_ENTRY_STRUCT, *entry))
 
 def find_dir_block(f, sb, path):
@@ -111,7 +164,7 @@ def find_dir_block(f, sb, path):
     parts = [p for p in path.strip('/').split('/') if p]
     block = sb['root_dir_block']
     for part in parts:
-        entries, _ = read_dir_chain(f, block)
+        entries, _ = read_dir_chain(f, sb, block)
         found = False
         for entry in entries:
             name = entry[0].split(b'\0',1)[0].decode('utf-8')
@@ -124,7 +177,8 @@ def find_dir_block(f, sb, path):
     return block
 
 def add_dir(f, sb, parent_block, dirname):
-    entries, blocks = read_dir_chain(f, parent_block)
+    bs = sb['block_size']
+    entries, blocks = read_dir_chain(f, sb, parent_block)
     slot = find_free_dir_slot(entries)
     
     # If no free slot in existing blocks, allocate a new block
@@ -136,15 +190,15 @@ def add_dir(f, sb, parent_block, dirname):
         new_parent_block = find_free_block(f, sb)
         
         # Link the last block to the new block
-        f.seek(last_block * EYNFS_BLOCK_SIZE)
-        data = bytearray(f.read(EYNFS_BLOCK_SIZE))
+        f.seek(last_block * bs)
+        data = bytearray(f.read(bs))
         struct.pack_into('<I', data, 0, new_parent_block)  # Set next_block pointer
-        f.seek(last_block * EYNFS_BLOCK_SIZE)
+        f.seek(last_block * bs)
         f.write(data)
         
         # Initialize the new block
-        f.seek(new_parent_block * EYNFS_BLOCK_SIZE)
-        new_block_data = bytearray(EYNFS_BLOCK_SIZE)
+        f.seek(new_parent_block * bs)
+        new_block_data = bytearray(bs)
         struct.pack_into('<I', new_block_data, 0, 0)  # next_block = 0
         f.write(new_block_data)
         
@@ -159,17 +213,18 @@ def add_dir(f, sb, parent_block, dirname):
     entry = (
         name_bytes, EYNFS_TYPE_DIR, 0, 0, 0, new_block, 0, 0
     )
-    block_num, _ = blocks[slot // ((EYNFS_BLOCK_SIZE-4)//DIR_ENTRY_SIZE)]
-    entry_idx = slot % ((EYNFS_BLOCK_SIZE-4)//DIR_ENTRY_SIZE)
-    update_dir_entry(f, block_num, entry_idx, entry)
+    block_num, _ = blocks[slot // entries_per_block(sb)]
+    entry_idx = slot % entries_per_block(sb)
+    update_dir_entry(f, sb, block_num, entry_idx, entry)
     # Zero out the new directory block
-    f.seek(new_block * EYNFS_BLOCK_SIZE)
-    f.write(bytearray(EYNFS_BLOCK_SIZE))
+    f.seek(new_block * bs)
+    f.write(bytearray(bs))
     print(f"Created directory {dirname} at block {new_block}")
     return new_block
 
 def add_file(f, sb, dir_block, filename, filedata):
-    entries, blocks = read_dir_chain(f, dir_block)
+    bs = sb['block_size']
+    entries, blocks = read_dir_chain(f, sb, dir_block)
     slot = find_free_dir_slot(entries)
     
     # If no free slot in existing blocks, allocate a new block
@@ -181,15 +236,15 @@ def add_file(f, sb, dir_block, filename, filedata):
         new_block = find_free_block(f, sb)
         
         # Link the last block to the new block
-        f.seek(last_block * EYNFS_BLOCK_SIZE)
-        data = bytearray(f.read(EYNFS_BLOCK_SIZE))
+        f.seek(last_block * bs)
+        data = bytearray(f.read(bs))
         struct.pack_into('<I', data, 0, new_block)  # Set next_block pointer
-        f.seek(last_block * EYNFS_BLOCK_SIZE)
+        f.seek(last_block * bs)
         f.write(data)
         
         # Initialize the new block
-        f.seek(new_block * EYNFS_BLOCK_SIZE)
-        new_block_data = bytearray(EYNFS_BLOCK_SIZE)
+        f.seek(new_block * bs)
+        new_block_data = bytearray(bs)
         struct.pack_into('<I', new_block_data, 0, 0)  # next_block = 0
         f.write(new_block_data)
         
@@ -198,34 +253,40 @@ def add_file(f, sb, dir_block, filename, filedata):
         slot = len(entries)  # First entry in the new block
         print(f"Allocated new directory block {new_block} for {filename}")
     
-    first_block, size = write_file_data(f, sb, filedata)
+    extents, size = write_file_data(f, sb, filedata)
+    first_block, first_count = extents[0] if extents else (0, 0)
+    map_block = write_extent_map(f, sb, extents)
     name_bytes = filename.encode('utf-8')[:EYNFS_NAME_MAX-1] + b'\0'
     name_bytes = name_bytes.ljust(EYNFS_NAME_MAX, b'\0')
     entry = (
-        name_bytes, EYNFS_TYPE_FILE, 0, 0, size, first_block, 0, 0
+        name_bytes, EYNFS_TYPE_FILE, EYNFS_FLAG_EXTENTS, 0, size, first_block, first_count, map_block
     )
-    block_num, _ = blocks[slot // ((EYNFS_BLOCK_SIZE-4)//DIR_ENTRY_SIZE)]
-    entry_idx = slot % ((EYNFS_BLOCK_SIZE-4)//DIR_ENTRY_SIZE)
-    update_dir_entry(f, block_num, entry_idx, entry)
-    print(f"Copied {filename} to EYNFS. Size: {size} bytes, First block: {first_block}")
+    block_num, _ = blocks[slot // entries_per_block(sb)]
+    entry_idx = slot % entries_per_block(sb)
+    update_dir_entry(f, sb, block_num, entry_idx, entry)
+    print(f"Copied {filename} to EYNFS. Size: {size} bytes, First block: {first_block}, Extents: {len(extents)}")
 
 def clear_root_directory(f, sb):
     # Zero out all directory entries in the root directory chain
+    bs = sb['block_size']
     block = sb['root_dir_block']
     while block:
-        f.seek(block * EYNFS_BLOCK_SIZE)
-        data = bytearray(f.read(EYNFS_BLOCK_SIZE))
+        f.seek(block * bs)
+        data = bytearray(f.read(bs))
         next_block = struct.unpack('<I', data[:4])[0]
         # Zero out all entries (but keep the next pointer)
-        for i in range(4, EYNFS_BLOCK_SIZE):
+        for i in range(4, bs):
             data[i] = 0
-        f.seek(block * EYNFS_BLOCK_SIZE)
+        f.seek(block * bs)
         f.write(data)
         block = next_block
 
 def main():
     with open(IMG, 'r+b') as f:
         sb = read_superblock(f)
+        # Replaying the journal later would undo these writes
+        if journal_pending(f, sb):
+            raise RuntimeError("The image's journal hasn't been replayed; boot EYN-OS on it once first")
         clear_root_directory(f, sb)
         for root, dirs, files in os.walk(TESTDIR):
             rel_dir = os.path.relpath(root, TESTDIR)
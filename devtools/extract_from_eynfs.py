@@ -4,11 +4,16 @@ import struct
 
 EYNFS_MAGIC = 0x45594E46
 EYNFS_NAME_MAX = 32
-EYNFS_BLOCK_SIZE = 512
+EYNFS_BLOCK_SIZE = 512  # Sector size; the superblock's block_size gives the block size
 SUPERBLOCK_LBA = 2048
+EYNFS_FLAG_EXTENTS = 0x01
+EYNFS_FLAG_INLINE = 0x02
+EYNFS_INLINE_MARK = 0xA5
+EYNFS_INLINE_SLOT_BYTES = 50
+EYNFS_EXTENT_MAGIC = 0x544E5845  # 'EXNT'
 
 # EYNFS superblock struct
-SUPERBLOCK_STRUCT = '<IIIIIIII'
+SUPERBLOCK_STRUCT = '<IIIIIIIII'
 # EYNFS dir entry struct
 DIRENT_STRUCT = f'<{EYNFS_NAME_MAX}sBBHII2I'
 DIRENT_SIZE = struct.calcsize(DIRENT_STRUCT)
@@ -26,23 +31,24 @@ def read_superblock(f):
         'root_dir_block': sb[4],
         'free_block_map': sb[5],
         'name_table_block': sb[6],
-        'reserved': sb[7:]
+        'bitmap_blocks': sb[7],
+        'reserved': sb[8:]
     }
 
 print(f"DIRENT_SIZE (Python): {DIRENT_SIZE}")
 
-def read_dir_table(f, start_block):
+def read_dir_table(f, start_block, bs):
     entries = []
     current_block = start_block
     while current_block:
-        f.seek(current_block * EYNFS_BLOCK_SIZE)
-        block_data = f.read(EYNFS_BLOCK_SIZE)
-        if len(block_data) < EYNFS_BLOCK_SIZE:
+        f.seek(current_block * bs)
+        block_data = f.read(bs)
+        if len(block_data) < bs:
             break
         print(f"RAW BLOCK DATA: {block_data[:64].hex()}")
         next_block = struct.unpack('<I', block_data[:4])[0]
         offset = 4
-        while offset + DIRENT_SIZE <= EYNFS_BLOCK_SIZE:
+        while offset + DIRENT_SIZE <= bs:
             data = block_data[offset:offset+DIRENT_SIZE]
             if not data or len(data) < DIRENT_SIZE:
                 break
@@ -66,18 +72,56 @@ def read_dir_table(f, start_block):
         current_block = next_block
     return entries
 
-def extract_file(f, entry, out_path):
+def file_extents(f, entry, bs):
+    """(start, count) extents of a v12 file: the first from the entry, the rest from map blocks."""
+    extents = [(entry['first_block'], entry['extra'][0])]
+    map_block = entry['extra'][1]
+    while map_block:
+        f.seek(map_block * bs)
+        data = f.read(bs)
+        magic, count, next_block, _ = struct.unpack('<IIII', data[:16])
+        if magic != EYNFS_EXTENT_MAGIC:
+            raise RuntimeError(f'Bad extent map block {map_block}')
+        for k in range(count):
+            extents.append(struct.unpack('<II', data[16 + k * 8:24 + k * 8]))
+        map_block = next_block
+    return extents
+
+def extract_file(f, entry, out_path, bs):
     size = entry['size']
-    block = entry['first_block']
     with open(out_path, 'wb') as out:
-        while size > 0:
-            f.seek(block * EYNFS_BLOCK_SIZE)
-            to_read = min(size, EYNFS_BLOCK_SIZE)
-            data = f.read(to_read)
-            out.write(data)
+        if entry['flags'] & EYNFS_FLAG_INLINE:
+            # v13: data slots following the entry in its directory block
+            f.seek(entry['first_block'] * bs)
+            data = f.read(bs)
+            slot = entry['extra'][0]
+            for k in range(entry['extra'][1]):
+                at = 4 + (slot + k) * DIRENT_SIZE
+                if data[at] != 0 or data[at + 1] != EYNFS_INLINE_MARK:
+                    raise RuntimeError(f"Bad inline data slot in block {entry['first_block']}")
+                chunk = min(size, EYNFS_INLINE_SLOT_BYTES)
+                out.write(data[at + 2:at + 2 + chunk])
+                size -= chunk
+            return
+        if entry['flags'] & EYNFS_FLAG_EXTENTS:
+            # v12: full blocks, contiguous within each extent
+            for start, count in file_extents(f, entry, bs):
+                if size <= 0:
+                    break
+                f.seek(start * bs)
+                to_read = min(size, count * bs)
+                out.write(f.read(to_read))
+                size -= to_read
+            return
+        # v11: chain of blocks, each with a 4-byte next pointer
+        block = entry['first_block']
+        while size > 0 and block:
+            f.seek(block * bs)
+            data = f.read(bs)
+            to_read = min(size, bs - 4)
+            out.write(data[4:4 + to_read])
             size -= to_read
-            # For now, assume files are contiguous (no block chaining)
-            block += 1
+            block = struct.unpack('<I', data[:4])[0]
 
 def main():
     if len(sys.argv) != 4:
@@ -90,20 +134,22 @@ def main():
         if sb['magic'] != EYNFS_MAGIC:
             print("Not a valid EYNFS image.")
             sys.exit(1)
+        bs = sb['block_size']
+        print(f"Block size: {bs}")
         # Print raw bytes of first 4 directory entries
-        f.seek(sb['root_dir_block'] * EYNFS_BLOCK_SIZE)
+        f.seek(sb['root_dir_block'] * bs + 4)
         print("First 4 raw directory entries:")
         for i in range(4):
             data = f.read(DIRENT_SIZE)
             print(data.hex())
         # Now read and parse entries as before
-        entries = read_dir_table(f, sb['root_dir_block'])
+        entries = read_dir_table(f, sb['root_dir_block'], bs)
         print("Files in root directory:")
         for entry in entries:
             print(f"  '{entry['name']}'")
         for entry in entries:
             if entry['name'] == filename:
-                extract_file(f, entry, out_path)
+                extract_file(f, entry, out_path, bs)
                 print(f"Extracted {filename} to {out_path}")
                 return
         print(f"File {filename} not found in root directory.")
@@ -5,7 +5,6 @@
 #include "include/eynfs.h"
 
 #define DEFAULT_SIZE_SECTORS 1024000 // 500MB
-#define RESERVED_BLOCKS 4
 #define ZERO_BLOCKS 2048
 
 void die(const char* msg) {
@@ -15,11 +14,13 @@ void die(const char* msg) {
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        printf("Usage: %s <disk.img> [size_in_sectors]\n", argv[0]);
+        printf("Usage: %s <disk.img> [size_in_sectors] [block_size]\n", argv[0]);
         return 1;
     }
     const char* img_path = argv[1];
     uint32_t size = (argc >= 3) ? (uint32_t)strtoul(argv[2], NULL, 10) : DEFAULT_SIZE_SECTORS;
+    uint32_t block_size = (argc >= 4) ? (uint32_t)strtoul(argv[3], NULL, 10) : EYNFS_BLOCK_SIZE;
+    if (!EYNFS_VALID_BLOCK_SIZE(block_size)) die("Block size must be 512, 1024, 2048 or 4096");
     FILE* f = fopen(img_path, "r+b");
     if (!f) die("Failed to open image file");
 
@@ -32,42 +33,65 @@ int main(int argc, char** argv) {
     fflush(f);
     fseek(f, 0, SEEK_SET);
 
-    // Calculate block LBAs
-    uint32_t superblock_lba = ZERO_BLOCKS;
-    uint32_t bitmap_lba = ZERO_BLOCKS + 1;
-    uint32_t nametable_lba = ZERO_BLOCKS + 2;
-    uint32_t rootdir_lba = ZERO_BLOCKS + 3;
+    // Lay the volume out in blocks: the superblock is in the block holding sector 2048, the
+    // bitmap needs one block per block_size * 8 blocks, and the metadata journal follows the
+    // root directory
+    uint32_t total_blocks = size / (block_size / EYNFS_BLOCK_SIZE);
+    uint32_t bitmap_blocks = EYNFS_BITMAP_BLOCKS(total_blocks, block_size);
+    uint32_t blocks_per_bitmap_block = EYNFS_BLOCKS_PER_BITMAP_BLOCK(block_size);
+    uint32_t superblock_block = ZERO_BLOCKS * EYNFS_BLOCK_SIZE / block_size;
+    uint32_t bitmap_block = superblock_block + 1;
+    uint32_t nametable_block = bitmap_block + bitmap_blocks;
+    uint32_t rootdir_block = nametable_block + 1;
+    uint32_t journal_block = rootdir_block + 1;
+    uint32_t journal_blocks = EYNFS_JOURNAL_BLOCKS(block_size);
+    uint32_t first_data_block = journal_block + journal_blocks;
 
     // Write superblock
     eynfs_superblock_t sb = {0};
     sb.magic = EYNFS_MAGIC;
     sb.version = EYNFS_VERSION;
-    sb.block_size = EYNFS_BLOCK_SIZE;
-    sb.total_blocks = size;
-    sb.root_dir_block = rootdir_lba;
-    sb.free_block_map = bitmap_lba;
-    sb.name_table_block = nametable_lba;
-    fseek(f, superblock_lba * EYNFS_BLOCK_SIZE, SEEK_SET);
+    sb.block_size = block_size;
+    sb.total_blocks = total_blocks;
+    sb.root_dir_block = rootdir_block;
+    sb.free_block_map = bitmap_block;
+    sb.name_table_block = nametable_block;
+    sb.bitmap_blocks = bitmap_blocks;
+    sb.journal_block = journal_block;
+    sb.journal_blocks = journal_blocks;
+    fseek(f, (long)ZERO_BLOCKS * EYNFS_BLOCK_SIZE, SEEK_SET);
     if (fwrite(&sb, 1, sizeof(sb), f) != sizeof(sb)) die("Failed to write superblock");
 
-    // Write zeroed free block bitmap, mark reserved blocks as used
-    uint8_t bitmap[EYNFS_BLOCK_SIZE] = {0};
-    for (int i = 0; i < RESERVED_BLOCKS; i++) bitmap[i/8] |= (1 << (i%8));
-    fseek(f, bitmap_lba * EYNFS_BLOCK_SIZE, SEEK_SET);
-    if (fwrite(bitmap, 1, EYNFS_BLOCK_SIZE, f) != EYNFS_BLOCK_SIZE) die("Failed to write bitmap");
+    // Write the free block bitmap. Everything below the first data block (the zeroed area,
+    // superblock, bitmap, name table, root directory and journal) is in use, as are the bits past
+    // the end of the volume in the last bitmap block.
+    uint8_t* bitmap = malloc(block_size);
+    if (!bitmap) die("Out of memory");
+    fseek(f, (long)bitmap_block * block_size, SEEK_SET);
+    for (uint32_t s = 0; s < bitmap_blocks; s++) {
+        memset(bitmap, 0, block_size);
+        for (uint32_t i = 0; i < blocks_per_bitmap_block; i++) {
+            uint32_t block = s * blocks_per_bitmap_block + i;
+            if (block < first_data_block || block >= total_blocks) bitmap[i/8] |= (1 << (i%8));
+        }
+        if (fwrite(bitmap, 1, block_size, f) != block_size) die("Failed to write bitmap");
+    }
 
-    // Write empty name table
-    uint8_t name_table[EYNFS_BLOCK_SIZE] = {0};
-    fseek(f, nametable_lba * EYNFS_BLOCK_SIZE, SEEK_SET);
-    if (fwrite(name_table, 1, EYNFS_BLOCK_SIZE, f) != EYNFS_BLOCK_SIZE) die("Failed to write name table");
+    // Write empty name table and root directory block
+    memset(bitmap, 0, block_size);
+    fseek(f, (long)nametable_block * block_size, SEEK_SET);
+    if (fwrite(bitmap, 1, block_size, f) != block_size) die("Failed to write name table");
+    fseek(f, (long)rootdir_block * block_size, SEEK_SET);
+    if (fwrite(bitmap, 1, block_size, f) != block_size) die("Failed to write root directory");
 
-    // Write empty root directory block
-    uint8_t root_dir[EYNFS_BLOCK_SIZE] = {0};
-    fseek(f, rootdir_lba * EYNFS_BLOCK_SIZE, SEEK_SET);
-    if (fwrite(root_dir, 1, EYNFS_BLOCK_SIZE, f) != EYNFS_BLOCK_SIZE) die("Failed to write root directory");
+    // An empty journal: the driver writes its header on first mount
+    for (uint32_t i = 0; i < journal_blocks; i++) {
+        if (fwrite(bitmap, 1, block_size, f) != block_size) die("Failed to write journal");
+    }
+    free(bitmap);
 
     fflush(f);
     fclose(f);
-    printf("EYNFS format complete: %s (%u sectors)\n", img_path, size);
+    printf("EYNFS format complete: %s (%u sectors, %u-byte blocks)\n", img_path, size, block_size);
     return 0;
-} 
\ No newline at end of file
+}
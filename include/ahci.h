@@ -0,0 +1,25 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "types.h"
+#include "ata.h"
+
+// Ports (SATA disks) we drive; each takes one of the ATA drive numbers 4-7
+#define AHCI_MAX_PORTS 4
+
+// Find an AHCI HBA on the PCI bus, bring up its ports and register each disk with the ATA layer
+void ahci_init(void);
+
+// Queue a request on a port. Returns 0 if queued, -1 if the port cannot take it.
+int ahci_submit(uint8 unit, ata_request_t* req);
+
+// Reap completed commands (ata_wait calls this with interrupts disabled)
+void ahci_poll(uint8 unit);
+
+// Fail everything in flight on a port and restart it
+void ahci_abort(uint8 unit);
+
+// Re-read a port's IDENTIFY DEVICE data. Fails while commands are in flight.
+int ahci_identify(uint8 unit, uint16* identify_data);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "types.h"
+
+// Request life cycle
+#define ATA_REQ_IDLE    0
+#define ATA_REQ_QUEUED  1  // Waiting behind another request on the channel
+#define ATA_REQ_ACTIVE  2  // Command issued to the drive
+#define ATA_REQ_DONE    3
+#define ATA_REQ_ERROR   4
+
+// Request flags
+#define ATA_REQ_WRITE     0x01
+#define ATA_REQ_FORCE_PIO 0x02  // Skip the DMA engine
+#define ATA_REQ_DMA_FAILED 0x04 // Internal: DMA failed once, retrying with PIO
+#define ATA_REQ_FLUSH     0x08  // No data (count 0): write the drive's cache to the media
+
+// Controller behind an ATA drive number
+#define ATA_BACKEND_IDE  0  // Legacy IDE ports, drives 0-3
+#define ATA_BACKEND_AHCI 1  // AHCI port, registered as drives 4-7
+#define ATA_BACKEND_VIRTIO 2 // virtio-blk PCI function, registered as drives 4-7
+
+// Default deadline for a whole request, measured with the PIT
+#define ATA_REQUEST_TIMEOUT_MS 5000
+// FLUSH CACHE may take much longer than a transfer (the spec allows up to 30 s)
+#define ATA_FLUSH_TIMEOUT_MS 30000
+
+// Drive table entry, filled in once by the probe (or ata_register_drive)
+typedef struct {
+    uint8 present;
+    uint8 type;  // 0=IDE, 1=SATA, 2=RAID
+    char model[41];
+    uint32 sectors;
+    uint32 size_mb;
+    uint8 multiple;  // Sectors per DRQ block for READ/WRITE MULTIPLE (0 = unsupported)
+    uint8 dma;       // 1 if transfers go through the bus-master DMA engine
+    uint8 lba48;     // 1 if the drive takes the 48-bit (EXT) command set
+    uint8 write_cache; // 1 if the volatile write cache is on, so writes need ata_flush to be durable
+    uint8 backend;   // ATA_BACKEND_* controller that owns the drive
+    uint8 unit;      // Backend-specific index (AHCI port slot)
+} drive_info_t;
+
+// Latency histogram buckets: bucket 0 counts requests finishing in under 1 ms, bucket b those
+// taking [2^(b-1), 2^b) ms. The last bucket also collects everything slower.
+#define ATA_LATENCY_BUCKETS 16
+
+// Per-drive I/O counters (all backends)
+typedef struct {
+    uint32 requests;          // Requests finished, successfully or not
+    uint32 commands;          // Device commands issued; a large request takes several
+    uint32 flushes;
+    uint32 sectors_read;
+    uint32 sectors_written;
+    uint64 bytes;             // Data moved in either direction
+    uint32 poll_iterations;   // Status polls spent waiting (register spins and ata_wait rounds)
+    uint32 timeouts;          // Stalled requests that had to be aborted
+    uint32 errors;            // Requests that finished with ATA_REQ_ERROR
+    uint32 latency[ATA_LATENCY_BUCKETS];
+} ata_io_stats_t;
+
+struct ata_request;
+
+// Completion callback. Runs in interrupt context (or in the waiter when polling): keep it short
+// and do not issue further blocking I/O from it.
+typedef void (*ata_callback_t)(struct ata_request* req, void* context);
+
+// One transfer of `count` sectors. The caller owns the memory and must keep it (and buf)
+// alive until the request leaves the QUEUED/ACTIVE states.
+typedef struct ata_request {
+    uint8 drive;
+    uint8 flags;
+    volatile uint8 status;
+    uint32 lba;
+    uint32 count;
+    uint8* buf;
+    uint32 done;              // Sectors completed so far
+    uint32 issued;            // Sectors handed to the hardware (backends that split across slots)
+    uint32 submit_ms;         // timer_ms() at submission, for the latency histogram
+    ata_callback_t callback;  // Optional
+    void* context;
+    struct ata_request* next; // Channel queue link
+} ata_request_t;
+
+// Fill in a request; flags is ATA_REQ_WRITE for writes, 0 for reads
+void ata_request_init(ata_request_t* req, uint8 drive, uint32 lba, uint32 count, uint8* buf, uint8 flags);
+
+// Queue a request on its drive's channel. Returns 0 if queued, -1 if the drive cannot take it.
+// The channel starts it immediately when idle; completion is signalled from IRQ 14/15.
+int ata_submit(ata_request_t* req);
+
+// Sleep (hlt) until the request completes or timeout_ms passes; a timed-out command is aborted.
+// Returns 0 on success, -1 on error or timeout.
+int ata_wait(ata_request_t* req, uint32 timeout_ms);
+
+// Non-zero once the request has finished (successfully or not)
+int ata_request_complete(const ata_request_t* req);
+
+// Batch several submissions: between plug and unplug the backend may hold back its doorbell so
+// the requests reach the device together. No-ops on backends that start commands one by one.
+void ata_plug(uint8 drive);
+void ata_unplug(uint8 drive);
+
+// Counters for a drive (NULL if out of range) / zero them (drive 0xFF = every drive)
+const ata_io_stats_t* ata_get_stats(uint8 drive);
+void ata_reset_stats(uint8 drive);
+
+// For backends: count one device command issued for req, and retire req (records its stats,
+// sets the final status and runs the callback)
+void ata_stats_command(const ata_request_t* req);
+void ata_request_finish(ata_request_t* req, uint8 status);
+
+// Cached drive table: no command is sent, but drives 0-3 wait for the boot probe to settle
+drive_info_t* ata_get_drive_info(uint8 drive);
+int ata_drive_present(uint8 drive);
+uint32 ata_drive_sectors(uint8 drive);
+
+// Claim a free drive number (4-7) for a disk behind another controller. Fills in the drive
+// table from its IDENTIFY data and returns the drive number, or -1 if the table is full.
+int ata_register_drive(uint8 backend, uint8 unit, const uint16* identify_data);
+
+// Barrier: returns once every write the drive has completed is on the media (FLUSH CACHE /
+// FLUSH CACHE EXT). Writes complete as soon as the drive's cache accepts them, so callers issue
+// this at their consistency points. Returns 0 at once when the drive has no write cache.
+int ata_flush(uint8 drive);
+
+// Synchronous helpers built on ata_submit/ata_wait (also declared in system.h)
+int ata_read_sectors(uint8 drive, uint32 lba, uint32 count, uint8* buf);
+int ata_write_sectors(uint8 drive, uint32 lba, uint32 count, const uint8* buf);
+
+#endif
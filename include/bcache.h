@@ -0,0 +1,60 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+
+// Buffer cache: sectors of every block device, keyed by (drive, LBA) and kept in LRU order.
+// It takes a share of the kernel heap on first use. block_read/block_write go through it;
+// writes stay in RAM (dirty) until evicted or written back by block_flush. Requests submitted
+// directly to the block layer keep it coherent through bcache_update/bcache_writeback_range.
+
+// Share of the kernel heap the cache claims (1/8)
+#define BCACHE_HEAP_SHARE 8
+// Below this many sectors the cache stays off and every call goes straight to the disk
+#define BCACHE_MIN_SECTORS 16
+// Transfers larger than 1/4 of the cache pass through it, so streaming one big file doesn't
+// flush out everything else; a 4 KiB block is always kept
+#define BCACHE_STREAM_SHARE 4
+#define BCACHE_STREAM_MIN 8
+// A drive's dirty sectors are written back, together and in LBA order, once the oldest has
+// waited this long or they fill more than 1/BCACHE_DIRTY_SHARE of the cache
+#define BCACHE_DIRTY_AGE_MS 5000
+#define BCACHE_DIRTY_SHARE 2
+
+typedef struct {
+    uint32 capacity;    // Sectors the cache can hold (0 while off)
+    uint32 max_transfer; // Largest transfer kept in the cache, in sectors
+    uint32 used;
+    uint32 dirty;
+    uint32 hits;        // Sectors served from RAM
+    uint32 misses;      // Sectors that had to be read
+    uint32 writebacks;  // Dirty sectors written to disk
+    uint32 evictions;
+} bcache_stats_t;
+
+// Read through the cache: cached sectors are copied, the runs between them read in one request
+int bcache_read(uint8 drive, uint32 lba, uint32 count, uint8* buf);
+// Write-back: the sectors are only marked dirty (written through if they can't be cached)
+int bcache_write(uint8 drive, uint32 lba, uint32 count, const uint8* buf);
+// Copy sectors out of the cache without any I/O. 0 only if every one of them was cached.
+int bcache_lookup(uint8 drive, uint32 lba, uint32 count, uint8* buf);
+// Keep clean copies of sectors just read around the cache
+void bcache_insert(uint8 drive, uint32 lba, uint32 count, const uint8* buf);
+
+// Coherency hooks for requests that bypass the cache (called by block_submit): cached copies
+// of sectors being written take the new data, dirty sectors about to be read are written first
+void bcache_update(uint8 drive, uint32 lba, uint32 count, const uint8* buf);
+int bcache_writeback_range(uint8 drive, uint32 lba, uint32 count);
+
+// Write every dirty sector of the drive, in LBA order (no drive cache flush; see block_flush)
+int bcache_writeback(uint8 drive);
+// Write back, then drop the drive's cached sectors
+int bcache_invalidate(uint8 drive);
+// Background write-back, for when the system is idle: write back every drive whose dirty
+// sectors are too old or too many (bcache_write applies the same limits as it goes)
+int bcache_flush_idle(void);
+
+void bcache_get_stats(bcache_stats_t* stats);
+void bcache_reset_stats(void);
+
+#endif
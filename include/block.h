@@ -0,0 +1,105 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "types.h"
+#include "ata.h"
+
+#define BLOCK_SECTOR_SIZE 512
+#define BLOCK_MAX_DEVICES 8     // One per ATA drive number
+
+// Largest transfer the elevator builds by merging adjacent requests
+#define BLOCK_MAX_MERGE_SECTORS 128
+
+// Dispatched transfers that can be outstanding at once (across all devices)
+#define BLOCK_MAX_INFLIGHT 16
+
+// Request life cycle
+#define BLOCK_REQ_IDLE     0
+#define BLOCK_REQ_PENDING  1  // Sitting in the device queue, may still be merged
+#define BLOCK_REQ_ACTIVE   2  // Part of a transfer handed to the driver
+#define BLOCK_REQ_DONE     3
+#define BLOCK_REQ_ERROR    4
+
+// Request flags
+#define BLOCK_REQ_WRITE 0x01
+
+struct block_request;
+struct block_io;
+
+// Completion callback; may run in interrupt context
+typedef void (*block_callback_t)(struct block_request* req, void* context);
+
+// One filesystem-level transfer. Like ata_request_t, the caller owns the memory and keeps it
+// (and buf) alive until block_wait returns.
+typedef struct block_request {
+    uint8 drive;
+    uint8 flags;
+    volatile uint8 status;
+    uint32 lba;
+    uint32 count;
+    uint8* buf;
+    block_callback_t callback;  // Optional
+    void* context;
+    struct block_io* io;        // Transfer carrying this request once dispatched
+    struct block_request* next; // Queue / merge list link
+} block_request_t;
+
+// A transfer sent to the driver: one or more requests merged over contiguous LBAs
+typedef struct block_io {
+    uint8 state;
+    uint8* bounce;              // Merged buffer when the requests' buffers are not contiguous
+    block_request_t* requests;  // Requests covered, in LBA order
+    ata_request_t ata;
+} block_io_t;
+
+// Driver entry points behind a block device
+typedef struct {
+    const char* name;
+    uint32 (*capacity)(uint8 drive);               // In sectors, 0 if unknown
+    int (*submit)(uint8 drive, block_io_t* io);    // Start io->ata; 0 if queued
+    int (*wait)(block_io_t* io, uint32 timeout_ms);
+    void (*plug)(uint8 drive);                     // Optional doorbell batching
+    void (*unplug)(uint8 drive);
+    int (*flush)(uint8 drive);                     // Make completed writes durable
+} block_ops_t;
+
+typedef struct {
+    uint8 drive;
+    const block_ops_t* ops;
+    uint8 plugged;
+    block_request_t* queue;     // Pending requests, kept sorted by LBA
+    uint32 submitted;           // Requests accepted
+    uint32 dispatched;          // Transfers sent to the driver
+    uint32 merged;              // Requests folded into a neighbour's transfer
+} block_device_t;
+
+// Look up the block device for an ATA drive number (NULL if there is no such drive)
+block_device_t* block_get_device(uint8 drive);
+
+void block_request_init(block_request_t* req, uint8 drive, uint32 lba, uint32 count, uint8* buf, uint8 flags);
+
+// Queue a request. While the device is plugged it waits for block_unplug so it can be merged
+// with its neighbours; otherwise the queue is dispatched at once. Returns 0 if queued.
+int block_submit(block_request_t* req);
+
+// Hold requests on the device queue / sort, merge and dispatch everything held
+void block_plug(uint8 drive);
+void block_unplug(uint8 drive);
+
+// Wait for a request (dispatching its queue first if needed). Returns 0 on success.
+int block_wait(block_request_t* req, uint32 timeout_ms);
+
+// Write barrier: write back the buffer cache's dirty sectors, dispatch the queue, wait for every
+// transfer in flight on the drive, then flush the drive's write cache. Returns 0 once everything
+// written so far is on the media.
+int block_flush(uint8 drive);
+
+// Synchronous helpers, served through the buffer cache (bcache.h): reads are answered from RAM
+// when they can be, and writes stay there until evicted or written back by block_flush
+int block_read(uint8 drive, uint32 lba, uint32 count, uint8* buf);
+int block_write(uint8 drive, uint32 lba, uint32 count, const uint8* buf);
+
+// Write the same sector to `count` consecutive LBAs (zeroing FAT and bitmap areas)
+int block_fill(uint8 drive, uint32 lba, uint32 count, const uint8* sector);
+
+#endif
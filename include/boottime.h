@@ -0,0 +1,34 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include "types.h"
+
+// Phases the boot timeline can hold
+#define BOOT_MAX_PHASES 16
+
+// Start/end stamps are in microseconds since the first phase began. Phases that finish in the
+// background (the IDE probe) may end after the shell has started.
+typedef struct {
+    const char* name;
+    uint32 start_us;
+    uint32 end_us;
+    uint8 done;
+} boot_phase_t;
+
+// Open a phase and return its id for boot_phase_end (-1 once the timeline is closed or full)
+int boot_phase_begin(const char* name);
+void boot_phase_end(int id);
+
+// Stop accepting new phases; called as the shell starts
+void boot_timeline_close(void);
+
+// Shell start time, the number of recorded phases, and each phase in the order begun
+uint32 boot_shell_start_us(void);
+int boot_phase_count(void);
+const boot_phase_t* boot_phase_get(int index);
+
+// Microsecond resolution comes from the TSC; without one every stamp is a whole PIT millisecond
+// and phases that ran before timer_init read as 0
+int boot_timeline_precise(void);
+
+#endif
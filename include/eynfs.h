@@ -10,11 +10,26 @@
 #define EYNFS_NAME_MAX 32
 
 // Filesystem version
-#define EYNFS_VERSION 11
+#define EYNFS_VERSION 14
+// First versions with extent-mapped files, inline files and the metadata journal
+#define EYNFS_VERSION_EXTENTS 12
+#define EYNFS_VERSION_INLINE 13
+#define EYNFS_VERSION_JOURNAL 14
+// Last version where every file is a chain of blocks with a 4-byte next pointer in each.
+// v12 drivers still read such files, so a v11 image can be upgraded in place.
+#define EYNFS_VERSION_CHAINED 11
 
-// Block size for EYNFS (used throughout the FS)
+// Default block size, and the sector size the superblock is addressed in
 #define EYNFS_BLOCK_SIZE 512
 
+// Block sizes mkfs can choose; the one in use is stored in the superblock. Block n starts
+// at sector n * (block_size / 512), and the superblock always sits in the first 512 bytes
+// of the block holding sector 2048.
+#define EYNFS_MIN_BLOCK_SIZE 512
+#define EYNFS_MAX_BLOCK_SIZE 4096
+#define EYNFS_VALID_BLOCK_SIZE(bs) \
+    ((bs) == 512 || (bs) == 1024 || (bs) == 2048 || (bs) == 4096)
+
 // Directory entry types
 typedef enum {
     EYNFS_TYPE_FILE = 1,
@@ -30,9 +45,44 @@ typedef struct {
     uint32_t root_dir_block;// Block number of root directory
     uint32_t free_block_map;// Block number of free block bitmap (optional/future)
     uint32_t name_table_block; // Block number of name table
-    uint32_t reserved[2];   // Reserved for future use
+    uint32_t bitmap_blocks; // Blocks in the free block bitmap (0 on older images: one block)
+    uint32_t journal_block; // First block of the metadata journal (0 = no journal)
+    uint32_t journal_blocks;// Journal length in blocks, header included
 } eynfs_superblock_t;
 
+// Each bitmap block tracks block_size * 8 blocks
+#define EYNFS_BLOCKS_PER_BITMAP_BLOCK(block_size) ((block_size) * 8)
+#define EYNFS_BITMAP_BLOCKS(total_blocks, block_size) \
+    (((total_blocks) + EYNFS_BLOCKS_PER_BITMAP_BLOCK(block_size) - 1) / EYNFS_BLOCKS_PER_BITMAP_BLOCK(block_size))
+
+// Directory blocks start with a 4-byte next pointer followed by whole entries
+#define EYNFS_DIR_ENTRIES_PER_BLOCK(block_size) (((block_size) - 4) / sizeof(eynfs_dir_entry_t))
+
+// Directory entry flags
+#define EYNFS_FLAG_EXTENTS 0x01 // File data is described by extents (v12) rather than a block chain
+#define EYNFS_FLAG_INLINE  0x02 // File data is kept in the directory itself (v13)
+
+// Extent: `count` physically contiguous blocks starting at `start`, each holding a full
+// block_size bytes of file data
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} eynfs_extent_t;
+
+// Extent map block (on-disk). For a file with EYNFS_FLAG_EXTENTS set, first_block and extra[0]
+// hold its first extent and extra[1] the first map block (0 if that extent is the whole file).
+// Map blocks list the remaining extents in file order and link to each other through `next`.
+#define EYNFS_EXTENT_MAGIC 0x544E5845 // 'EXNT'
+typedef struct {
+    uint32_t magic;
+    uint32_t count;    // Extents in this block
+    uint32_t next;     // Next map block, 0 for the last
+    uint32_t reserved;
+} eynfs_extent_header_t;
+
+#define EYNFS_EXTENTS_PER_BLOCK(block_size) \
+    (((block_size) - sizeof(eynfs_extent_header_t)) / sizeof(eynfs_extent_t))
+
 // Directory entry structure (on-disk)
 typedef struct __attribute__((packed)) {
     char name[EYNFS_NAME_MAX]; // Null-terminated name
@@ -44,6 +94,87 @@ typedef struct __attribute__((packed)) {
     uint32_t extra[2];         // Reserved for future expansion
 } eynfs_dir_entry_t;
 
+// Inline files. A file of at most EYNFS_INLINE_MAX bytes keeps its data in the directory slots
+// right after its own entry rather than in data blocks, so reading it costs nothing beyond the
+// lookup. first_block is the directory block holding those slots, extra[0] the position of the
+// first one in that block and extra[1] how many there are. A data slot starts with a zero byte,
+// so anything listing names skips it as empty; the mark byte tells it apart from a free slot.
+#define EYNFS_INLINE_MARK 0xA5
+#define EYNFS_INLINE_SLOT_BYTES 50
+#define EYNFS_INLINE_MAX_SLOTS 8
+#define EYNFS_INLINE_MAX (EYNFS_INLINE_SLOT_BYTES * EYNFS_INLINE_MAX_SLOTS)
+
+typedef struct __attribute__((packed)) {
+    uint8_t empty;     // Always 0
+    uint8_t mark;      // EYNFS_INLINE_MARK
+    uint8_t data[EYNFS_INLINE_SLOT_BYTES];
+} eynfs_inline_slot_t;
+
+#define EYNFS_SLOT_IS_INLINE(e) ((e)->name[0] == '\0' && (uint8_t)(e)->name[1] == EYNFS_INLINE_MARK)
+
+// Directory hash index. A directory spanning more than one block gets an index so a lookup
+// reads a fixed handful of blocks instead of the whole chain. The last 16 bytes of its first
+// block (never used by entries, at any block size) hold an eynfs_dir_index_tail_t naming the
+// index root; the root lists leaf blocks, and a name's hash picks a leaf and a starting slot
+// within it. Each slot records the directory block and table position of one entry.
+// Drivers without index support rewrite the tail with zeros, which just drops the index.
+#define EYNFS_DIR_INDEX_MAGIC 0x58444944 // 'DIDX'
+#define EYNFS_DIR_ROOT_MAGIC  0x52584944 // 'DIXR'
+#define EYNFS_DIR_LEAF_MAGIC  0x4C584944 // 'DIXL'
+
+typedef struct {
+    uint32_t magic;
+    uint32_t root;     // Index root block
+    uint32_t reserved[2];
+} eynfs_dir_index_tail_t;
+
+// Header shared by root and leaf blocks; root blocks are followed by uint32_t leaf block
+// numbers, leaf blocks by slots
+typedef struct {
+    uint32_t magic;
+    uint32_t count;    // Root: leaves. Leaf: slots in use, tombstones included
+    uint32_t reserved[2];
+} eynfs_dir_index_header_t;
+
+#define EYNFS_DIR_SLOT_TOMBSTONE 0xFFFFFFFF // Slot whose entry was deleted
+typedef struct {
+    uint32_t block;    // Directory block holding the entry, 0 = empty slot
+    uint16_t index;    // Entry's position in the directory table
+    uint16_t tag;      // High half of the name hash, to skip most mismatches unread
+} eynfs_dir_index_slot_t;
+
+#define EYNFS_DIR_INDEX_LEAVES(block_size) \
+    (((block_size) - sizeof(eynfs_dir_index_header_t)) / sizeof(uint32_t))
+#define EYNFS_DIR_INDEX_SLOTS(block_size) \
+    (((block_size) - sizeof(eynfs_dir_index_header_t)) / sizeof(eynfs_dir_index_slot_t))
+
+// Metadata journal (v14). mkfs reserves journal_blocks blocks at journal_block: a header block
+// holding the sequence number of the first transaction to replay, then the log. A committed
+// transaction is a descriptor block (a header followed by the home block number of each image),
+// the block images, and a commit block whose checksum covers the descriptor and images. At mount
+// the log is replayed from its first block for as long as sequence numbers follow on and
+// checksums match. File data is never journaled; it reaches the disk before the metadata naming it.
+#define EYNFS_JOURNAL_MAGIC        0x4C4E524A // 'JRNL'
+#define EYNFS_JOURNAL_DESC_MAGIC   0x4353444A // 'JDSC'
+#define EYNFS_JOURNAL_COMMIT_MAGIC 0x544D434A // 'JCMT'
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;    // Descriptor and commit blocks: images in the transaction
+    uint32_t checksum; // Commit block: checksum of the descriptor and images
+} eynfs_journal_header_t;
+
+#define EYNFS_JOURNAL_TAGS(block_size) \
+    (((block_size) - sizeof(eynfs_journal_header_t)) / sizeof(uint32_t))
+
+// Journal size mkfs reserves: EYNFS_JOURNAL_BYTES, but never fewer than the minimum blocks
+#define EYNFS_JOURNAL_BYTES 32768
+#define EYNFS_JOURNAL_MIN_BLOCKS 16
+#define EYNFS_JOURNAL_BLOCKS(block_size) \
+    (EYNFS_JOURNAL_BYTES / (block_size) > EYNFS_JOURNAL_MIN_BLOCKS ? \
+     EYNFS_JOURNAL_BYTES / (block_size) : EYNFS_JOURNAL_MIN_BLOCKS)
+
 // Modular FS API (function pointers for generic file operations)
 typedef struct {
     int (*open)(const char *path, int mode);
@@ -57,6 +188,8 @@ typedef struct {
 } fs_ops_t;
 
 // Function prototypes for EYNFS API
+// The first superblock read on a drive mounts it; later reads are answered from memory, and
+// a write reaches the disk only if it changes a field
 int eynfs_read_superblock(uint8 drive, uint32 lba, eynfs_superblock_t *sb);
 int eynfs_write_superblock(uint8 drive, uint32 lba, const eynfs_superblock_t *sb);
 int eynfs_read_dir_table(uint8 drive, uint32 lba, eynfs_dir_entry_t *entries, size_t max_entries);
@@ -67,10 +200,55 @@ int eynfs_traverse_path(uint8 drive, const eynfs_superblock_t *sb, const char *p
 int eynfs_create_entry(uint8 drive, eynfs_superblock_t *sb, uint32_t parent_block, const char *name, uint8_t type);
 int eynfs_delete_entry(uint8 drive, eynfs_superblock_t *sb, uint32_t parent_block, const char *name);
 int eynfs_read_file(uint8 drive, const eynfs_superblock_t *sb, const eynfs_dir_entry_t *entry, void *buf, size_t bufsize, size_t offset);
+
+// Where a chained (v11) file was last read: `block` is the `index`th block of the chain
+// starting at first_block. A read at or past it walks on from there instead of from the start.
+typedef struct {
+    uint32_t first_block; // 0 = nothing read yet
+    uint32_t block;
+    uint32_t index;
+} eynfs_read_cursor_t;
+
+// Reading one file a chunk at a time. The context keeps a cursor, so reading an N-block file
+// front to back costs N block reads however small the chunks are.
+typedef struct {
+    uint8 drive;
+    eynfs_dir_entry_t entry;
+    eynfs_read_cursor_t cursor;
+} eynfs_read_ctx_t;
+void eynfs_read_ctx_init(eynfs_read_ctx_t *ctx, uint8 drive, const eynfs_dir_entry_t *entry);
+int eynfs_read_ctx_read(eynfs_read_ctx_t *ctx, void *buf, size_t bufsize, size_t offset);
+
 int eynfs_write_file(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const void *buf, size_t size, uint32_t parent_block, uint32_t entry_index);
+// Write at a byte offset, updating only the blocks touched and growing the file as needed
+int eynfs_pwrite(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const void *buf, size_t size, size_t offset, uint32_t parent_block, uint32_t entry_index);
+int eynfs_append(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const void *buf, size_t size, uint32_t parent_block, uint32_t entry_index);
+// Reserve contiguous blocks for the file to grow to `size` bytes, leaving its size unchanged
+int eynfs_fallocate(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, size_t size, uint32_t parent_block, uint32_t entry_index);
 int eynfs_alloc_block(uint8 drive, eynfs_superblock_t *sb);
 int eynfs_free_block(uint8 drive, eynfs_superblock_t *sb, uint32_t block);
-int eynfs_format_partition(uint8 drive, uint8 partition_num);
+
+// Free-space queries, answered from the resident bitmap
+int eynfs_count_free_blocks(uint8 drive, const eynfs_superblock_t *sb); // -1 on error
+int eynfs_block_in_use(uint8 drive, const eynfs_superblock_t *sb, uint32_t block); // 1, 0, or -1 on error
+int eynfs_format_partition(uint8 drive, uint8 partition_num, uint32_t block_size);
+
+// Convert every chained (v11) file on the drive to extents and mark the filesystem v12.
+// Returns the number of files converted, or -1 on error.
+int eynfs_upgrade(uint8 drive);
+
+// Write out what open descriptors on the drive hold back, commit its pending metadata and
+// write it all home, leaving the journal empty. The drive stays mounted.
+int eynfs_flush(uint8 drive);
+
+// Commit each drive's running journal transaction once it is EYNFS_JOURNAL_GROUP_MS old. Called while
+// the system is idle, so the last group of a burst doesn't wait for another operation.
+int eynfs_commit_idle(void);
+
+// Flush the drive, then forget its cached superblock and detach its journal; the next
+// superblock read mounts it afresh. Call before anything rewrites the filesystem underneath
+// the driver (e.g. format).
+int eynfs_unmount(uint8 drive);
 
 // New improved file operations
 int eynfs_open(const char* path, int mode);
@@ -25,6 +25,7 @@ void cd(string input);
 void makedir(string ch);
 void deldir(string ch);
 void fscheck(string ch);
+void fsupgrade(string ch);
 void resolve_path(const char* input, const char* cwd, char* out, size_t outsz);
 
 #endif 
\ No newline at end of file
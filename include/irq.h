@@ -0,0 +1,62 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "types.h"
+#include "isr.h"
+
+// Hardware interrupts are remapped above the CPU exception vectors
+#define IRQ_BASE_VECTOR 0x20
+#define IRQ_COUNT 16
+
+#define IRQ_TIMER 0
+#define IRQ_CASCADE 2
+#define IRQ_ATA_PRIMARY 14
+#define IRQ_ATA_SECONDARY 15
+
+// PCI INTx lines are often shared between devices
+#define IRQ_MAX_SHARED 4
+
+typedef void (*irq_handler_t)(regs_t* r);
+
+// Remap the PICs, mask every line and install the IRQ gates. Interrupts stay disabled.
+void irq_install(void);
+
+// Register a handler for an IRQ line and unmask it. Up to IRQ_MAX_SHARED handlers may share
+// a line; each must check its own device. handler = NULL removes them all and masks the line.
+void irq_install_handler(int irq, irq_handler_t handler);
+void irq_uninstall_handler(int irq);
+
+// Remove one handler from a shared line, masking the line once no handler is left
+void irq_remove_handler(int irq, irq_handler_t handler);
+
+// Enable interrupts once the handlers the kernel relies on are in place
+void irq_enable(void);
+
+// Save EFLAGS and disable interrupts / restore the saved interrupt state
+uint32 irq_save(void);
+void irq_restore(uint32 flags);
+
+// Non-zero if the CPU currently accepts maskable interrupts
+int irq_enabled(void);
+
+// Called by the assembly stubs in irq.asm
+void irq_dispatch(regs_t* r);
+
+void irq0();
+void irq1();
+void irq2();
+void irq3();
+void irq4();
+void irq5();
+void irq6();
+void irq7();
+void irq8();
+void irq9();
+void irq10();
+void irq11();
+void irq12();
+void irq13();
+void irq14();
+void irq15();
+
+#endif
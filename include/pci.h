@@ -0,0 +1,62 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <types.h>
+
+// PCI configuration mechanism #1 ports
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space offsets
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_PROG_IF        0x09
+#define PCI_SUBCLASS       0x0A
+#define PCI_CLASS          0x0B
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_BAR4           0x20
+#define PCI_BAR5           0x24
+#define PCI_INTERRUPT_LINE 0x3C
+
+// Command register bits
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+
+// Mass storage class codes
+#define PCI_CLASS_STORAGE       0x01
+#define PCI_SUBCLASS_IDE        0x01
+#define PCI_SUBCLASS_SATA       0x06
+
+// A function found on the bus
+typedef struct {
+    uint8 bus;
+    uint8 slot;
+    uint8 func;
+    uint16 vendor_id;
+    uint16 device_id;
+    uint8 class_code;
+    uint8 subclass;
+    uint8 prog_if;
+    uint8 irq_line;
+} pci_device_t;
+
+uint32 pci_config_read32(uint8 bus, uint8 slot, uint8 func, uint8 offset);
+uint16 pci_config_read16(uint8 bus, uint8 slot, uint8 func, uint8 offset);
+uint8 pci_config_read8(uint8 bus, uint8 slot, uint8 func, uint8 offset);
+void pci_config_write32(uint8 bus, uint8 slot, uint8 func, uint8 offset, uint32 value);
+void pci_config_write16(uint8 bus, uint8 slot, uint8 func, uint8 offset, uint16 value);
+
+// Find the index'th function matching class/subclass (index 0 = first). Returns 0 if found.
+int pci_find_class(uint8 class_code, uint8 subclass, int index, pci_device_t* out);
+// Find the index'th function matching vendor/device. Returns 0 if found.
+int pci_find_device(uint16 vendor_id, uint16 device_id, int index, pci_device_t* out);
+// Read a BAR with the type bits masked off
+uint32 pci_read_bar(const pci_device_t* dev, int bar);
+// Turn on I/O/memory decoding and bus mastering for a function
+void pci_enable_bus_master(const pci_device_t* dev);
+
+#endif // PCI_H
@@ -21,6 +21,8 @@ string readStr_with_history(command_history_t* history);
 void add_to_history(command_history_t* history, const char* command);
 void clear_history(command_history_t* history);
 void show_history(command_history_t* history);
+// Called while waiting for input; runs the background write-back
+void shell_idle(void);
 
 // Global history instance
 extern command_history_t g_command_history;
@@ -11,6 +11,9 @@ void calc(string ch);
 void lsata();
 void drives_cmd(string ch);
 void drive_cmd(string ch);
+void sync_cmd(string ch);
+// Write out everything held in memory for every drive. -1 if any of them failed.
+int sync_drives(void);
 void memory_cmd(string ch);
 void size(string ch);
 void log_cmd(string ch);
@@ -9,12 +9,19 @@ void sleep(uint8 times);
 void Shutdown(void);
 int ata_read_sector(uint8 drive, uint32 lba, uint8* buf);
 int ata_write_sector(uint8 drive, uint32 lba, const uint8* buf);
+int ata_read_sectors(uint8 drive, uint32 lba, uint32 count, uint8* buf);
+int ata_write_sectors(uint8 drive, uint32 lba, uint32 count, const uint8* buf);
 int ata_identify(uint8 drive, uint16* identify_data);
 void ata_init_drives(void);
 int ata_detect_drive(uint8 drive);
 int ata_drive_present(uint8 drive);
+uint32 ata_drive_sectors(uint8 drive);
 uint16 inw(uint16 _port);
 void outw(uint16 _port, uint16 _data);
+uint32 inportl(uint16 _port);
+void outportl(uint16 _port, uint32 _data);
+void insw(uint16 _port, void* _buf, uint32 _count);
+void outsw(uint16 _port, const void* _buf, uint32 _count);
 
 
 
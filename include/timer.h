@@ -0,0 +1,34 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+// PIT channel 0 rate; one tick per millisecond
+#define TIMER_HZ 1000
+
+// Program the PIT and hook IRQ 0. Time only advances once interrupts are enabled.
+void timer_init(void);
+
+// Milliseconds since timer_init (wraps after ~49 days)
+uint32 timer_ms(void);
+
+// Non-zero when the tick counter is advancing (handler installed and interrupts enabled).
+// Code with deadlines must fall back to a bounded spin count when this is 0.
+int timer_running(void);
+
+// Polls per millisecond assumed while the PIT is not ticking (port/MMIO reads cost ~1us)
+#define TIMER_SPINS_PER_MS 1000
+
+// Deadline measured with the PIT, or with a spin budget (one unit per expiry check)
+// when the timer is not running yet
+typedef struct {
+    uint32 start;
+    uint32 timeout_ms;
+    uint32 spins;
+    uint8 timed;
+} timer_deadline_t;
+
+void timer_deadline_start(timer_deadline_t* d, uint32 timeout_ms);
+int timer_deadline_expired(timer_deadline_t* d);
+
+#endif
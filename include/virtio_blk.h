@@ -0,0 +1,30 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "types.h"
+#include "ata.h"
+
+// virtio-blk functions we drive; each takes one of the ATA drive numbers 4-7
+#define VIRTIO_BLK_MAX_DEVICES 4
+
+// Find legacy/transitional virtio-blk PCI functions, set up their virtqueue and register
+// each disk with the ATA layer
+void virtio_blk_init(void);
+
+// Queue a request. Returns 0 if queued, -1 if the device cannot take it.
+int virtio_blk_submit(uint8 unit, ata_request_t* req);
+
+// Hold back / send the queue notification so chains added in between go out as one batch
+void virtio_blk_plug(uint8 unit);
+void virtio_blk_unplug(uint8 unit);
+
+// Reap the used ring (ata_wait calls this with interrupts disabled)
+void virtio_blk_poll(uint8 unit);
+
+// Reset the device, failing everything in flight
+void virtio_blk_abort(uint8 unit);
+
+// IDENTIFY-style data synthesized from the device config (model, LBA48 capacity)
+int virtio_blk_identify(uint8 unit, uint16* identify_data);
+
+#endif
@@ -0,0 +1,134 @@
+#include <types.h>
+#include <system.h>
+#include <string.h>
+#include <timer.h>
+#include <boottime.h>
+
+#define EFLAGS_ID      0x00200000  // Writable only on CPUs with CPUID
+#define CPUID_EDX_TSC  0x00000010
+
+static boot_phase_t boot_phases[BOOT_MAX_PHASES];
+static int boot_phase_total = 0;
+static uint8 boot_closed = 0;
+
+// Raw stamps; converted to microseconds when read back, once the TSC rate is known
+static uint64 boot_raw_start[BOOT_MAX_PHASES];
+static uint64 boot_raw_end[BOOT_MAX_PHASES];
+static uint64 boot_raw_shell = 0;
+
+// Time source: TSC cycles when the CPU has one, PIT milliseconds otherwise
+static uint8 boot_clock_ready = 0;
+static uint8 boot_has_tsc = 0;
+static uint64 boot_tsc_base = 0;
+static uint32 boot_cycles_per_us = 0;  // Calibrated against the PIT on first use after it ticks
+
+static int boot_cpu_has_tsc(void) {
+    uint32 before, after;
+    __asm__ __volatile__(
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl %2, %1\n\t"
+        "pushl %1\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %1\n\t"
+        "pushl %0\n\t"
+        "popfl"
+        : "=&r"(before), "=&r"(after) : "i"(EFLAGS_ID));
+    if (!((before ^ after) & EFLAGS_ID)) return 0; // No CPUID (386/early 486)
+
+    uint32 eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & CPUID_EDX_TSC) ? 1 : 0;
+}
+
+static uint64 boot_rdtsc(void) {
+    uint64 tsc;
+    __asm__ __volatile__("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+static void boot_clock_init(void) {
+    boot_clock_ready = 1;
+    boot_has_tsc = boot_cpu_has_tsc();
+    if (boot_has_tsc) boot_tsc_base = boot_rdtsc();
+}
+
+// Measure the TSC rate over a few PIT ticks. Needs the timer running.
+static void boot_calibrate(void) {
+    if (boot_cycles_per_us || !timer_running()) return;
+    uint32 t0 = timer_ms();
+    while (timer_ms() == t0) { }
+    uint64 c0 = boot_rdtsc();
+    uint32 t1 = timer_ms();
+    while (timer_ms() - t1 < 10) { }
+    uint32 cycles = (uint32)(boot_rdtsc() - c0); // 10 ms fits in 32 bits below ~400 GHz
+    uint32 per_us = cycles / 10000;
+    boot_cycles_per_us = per_us ? per_us : 1;
+}
+
+// Current stamp: raw TSC cycles (converted when read back) or PIT milliseconds in microseconds
+static uint64 boot_stamp(void) {
+    if (!boot_clock_ready) boot_clock_init();
+    if (boot_has_tsc) return boot_rdtsc() - boot_tsc_base;
+    return (uint64)timer_ms() * 1000;
+}
+
+// 64-by-32 division without libgcc: divide the high word, then the remainder with the low word
+static uint32 boot_div64(uint64 n, uint32 d) {
+    uint32 hi = (uint32)(n >> 32);
+    uint32 lo = (uint32)n;
+    if (hi >= d) return 0xFFFFFFFF;
+    uint32 q, r;
+    __asm__("divl %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+    return q;
+}
+
+static uint32 boot_to_us(uint64 stamp) {
+    if (!boot_has_tsc) return (uint32)stamp;
+    boot_calibrate();
+    if (!boot_cycles_per_us) return 0;
+    return boot_div64(stamp, boot_cycles_per_us);
+}
+
+int boot_phase_begin(const char* name) {
+    if (boot_closed || boot_phase_total >= BOOT_MAX_PHASES) return -1;
+    int id = boot_phase_total++;
+    boot_phases[id].name = name;
+    boot_phases[id].done = 0;
+    boot_raw_start[id] = boot_stamp();
+    return id;
+}
+
+void boot_phase_end(int id) {
+    if (id < 0 || id >= boot_phase_total) return;
+    boot_raw_end[id] = boot_stamp();
+    boot_phases[id].done = 1;
+}
+
+void boot_timeline_close(void) {
+    boot_raw_shell = boot_stamp();
+    boot_closed = 1;
+}
+
+uint32 boot_shell_start_us(void) {
+    return boot_to_us(boot_raw_shell);
+}
+
+int boot_phase_count(void) {
+    return boot_phase_total;
+}
+
+const boot_phase_t* boot_phase_get(int index) {
+    if (index < 0 || index >= boot_phase_total) return NULL;
+    boot_phase_t* p = &boot_phases[index];
+    p->start_us = boot_to_us(boot_raw_start[index]);
+    p->end_us = p->done ? boot_to_us(boot_raw_end[index]) : p->start_us;
+    return p;
+}
+
+int boot_timeline_precise(void) {
+    if (!boot_clock_ready) boot_clock_init();
+    return boot_has_tsc;
+}
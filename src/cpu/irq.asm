@@ -0,0 +1,49 @@
+; 32 bit stubs for hardware interrupts IRQ 0-15 (remapped to vectors 0x20-0x2F)
+
+bits 32
+
+extern irq_dispatch
+
+; Each stub pushes a synthetic error code and its vector so the common path
+; can hand irq_dispatch a regs_t laid out like the syscall stub's.
+%macro IRQ_STUB 1
+global irq%1
+irq%1:
+    push dword 0            ; err_code
+    push dword %1 + 32      ; int_no
+    jmp irq_common
+%endmacro
+
+section .text
+IRQ_STUB 0
+IRQ_STUB 1
+IRQ_STUB 2
+IRQ_STUB 3
+IRQ_STUB 4
+IRQ_STUB 5
+IRQ_STUB 6
+IRQ_STUB 7
+IRQ_STUB 8
+IRQ_STUB 9
+IRQ_STUB 10
+IRQ_STUB 11
+IRQ_STUB 12
+IRQ_STUB 13
+IRQ_STUB 14
+IRQ_STUB 15
+
+irq_common:
+    ; Save general registers; ESP now points at saved EDI (start of regs_t)
+    pusha
+    cld
+
+    push esp
+    call irq_dispatch
+    add esp, 4
+
+    popa
+
+    ; Pop our synthetic fields
+    add esp, 8 ; discard int_no, err_code
+
+    iretd
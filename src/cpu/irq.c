@@ -0,0 +1,159 @@
+#include <types.h>
+#include <idt.h>
+#include <irq.h>
+#include <system.h>
+
+// 8259A programmable interrupt controllers
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+
+#define PIC_ICW1_INIT 0x11  // Edge triggered, cascaded, ICW4 follows
+#define PIC_ICW4_8086 0x01
+#define PIC_EOI       0x20
+#define PIC_READ_ISR  0x0B
+
+#define EFLAGS_IF 0x200
+
+static irq_handler_t irq_handlers[IRQ_COUNT][IRQ_MAX_SHARED];
+
+// Lines are masked unless a handler is registered; bit n set = IRQ n masked
+static uint16 irq_mask = 0xFFFF;
+
+static void irq_write_mask(void) {
+    outportb(PIC1_DATA, (uint8)(irq_mask & 0xFF));
+    outportb(PIC2_DATA, (uint8)(irq_mask >> 8));
+}
+
+// Move IRQ 0-15 from vectors 0x08-0x0F/0x70-0x77 (which collide with CPU exceptions) to 0x20-0x2F
+static void pic_remap(void) {
+    outportb(PIC1_COMMAND, PIC_ICW1_INIT);
+    outportb(PIC2_COMMAND, PIC_ICW1_INIT);
+    outportb(PIC1_DATA, IRQ_BASE_VECTOR);      // Master vector offset
+    outportb(PIC2_DATA, IRQ_BASE_VECTOR + 8);  // Slave vector offset
+    outportb(PIC1_DATA, 1 << IRQ_CASCADE);     // Slave sits on master line 2
+    outportb(PIC2_DATA, IRQ_CASCADE);          // Slave cascade identity
+    outportb(PIC1_DATA, PIC_ICW4_8086);
+    outportb(PIC2_DATA, PIC_ICW4_8086);
+}
+
+void irq_install(void) {
+    for (int i = 0; i < IRQ_COUNT; i++) {
+        for (int j = 0; j < IRQ_MAX_SHARED; j++) irq_handlers[i][j] = 0;
+    }
+
+    pic_remap();
+    irq_mask = 0xFFFF;
+    irq_write_mask();
+
+    set_idt_gate(IRQ_BASE_VECTOR + 0, (uint32)irq0);
+    set_idt_gate(IRQ_BASE_VECTOR + 1, (uint32)irq1);
+    set_idt_gate(IRQ_BASE_VECTOR + 2, (uint32)irq2);
+    set_idt_gate(IRQ_BASE_VECTOR + 3, (uint32)irq3);
+    set_idt_gate(IRQ_BASE_VECTOR + 4, (uint32)irq4);
+    set_idt_gate(IRQ_BASE_VECTOR + 5, (uint32)irq5);
+    set_idt_gate(IRQ_BASE_VECTOR + 6, (uint32)irq6);
+    set_idt_gate(IRQ_BASE_VECTOR + 7, (uint32)irq7);
+    set_idt_gate(IRQ_BASE_VECTOR + 8, (uint32)irq8);
+    set_idt_gate(IRQ_BASE_VECTOR + 9, (uint32)irq9);
+    set_idt_gate(IRQ_BASE_VECTOR + 10, (uint32)irq10);
+    set_idt_gate(IRQ_BASE_VECTOR + 11, (uint32)irq11);
+    set_idt_gate(IRQ_BASE_VECTOR + 12, (uint32)irq12);
+    set_idt_gate(IRQ_BASE_VECTOR + 13, (uint32)irq13);
+    set_idt_gate(IRQ_BASE_VECTOR + 14, (uint32)irq14);
+    set_idt_gate(IRQ_BASE_VECTOR + 15, (uint32)irq15);
+}
+
+void irq_install_handler(int irq, irq_handler_t handler) {
+    if (irq < 0 || irq >= IRQ_COUNT) return;
+
+    uint32 flags = irq_save();
+    if (handler) {
+        int slot = -1;
+        for (int j = 0; j < IRQ_MAX_SHARED; j++) {
+            if (irq_handlers[irq][j] == handler) {
+                slot = j;
+                break;
+            }
+            if (!irq_handlers[irq][j] && slot < 0) slot = j;
+        }
+        if (slot < 0) {
+            irq_restore(flags);
+            return;
+        }
+        irq_handlers[irq][slot] = handler;
+
+        irq_mask &= ~(1 << irq);
+        if (irq >= 8) irq_mask &= ~(1 << IRQ_CASCADE);
+    } else {
+        for (int j = 0; j < IRQ_MAX_SHARED; j++) irq_handlers[irq][j] = 0;
+        irq_mask |= (1 << irq);
+        if ((irq_mask & 0xFF00) == 0xFF00) irq_mask |= (1 << IRQ_CASCADE);
+    }
+    irq_write_mask();
+    irq_restore(flags);
+}
+
+void irq_uninstall_handler(int irq) {
+    irq_install_handler(irq, 0);
+}
+
+void irq_remove_handler(int irq, irq_handler_t handler) {
+    if (irq < 0 || irq >= IRQ_COUNT || !handler) return;
+
+    uint32 flags = irq_save();
+    int left = 0;
+    for (int j = 0; j < IRQ_MAX_SHARED; j++) {
+        if (irq_handlers[irq][j] == handler) irq_handlers[irq][j] = 0;
+        if (irq_handlers[irq][j]) left = 1;
+    }
+    if (!left) {
+        irq_mask |= (1 << irq);
+        if ((irq_mask & 0xFF00) == 0xFF00) irq_mask |= (1 << IRQ_CASCADE);
+        irq_write_mask();
+    }
+    irq_restore(flags);
+}
+
+void irq_enable(void) {
+    __asm__ __volatile__("sti");
+}
+
+uint32 irq_save(void) {
+    uint32 flags;
+    __asm__ __volatile__("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void irq_restore(uint32 flags) {
+    if (flags & EFLAGS_IF) __asm__ __volatile__("sti" : : : "memory");
+}
+
+int irq_enabled(void) {
+    uint32 flags;
+    __asm__ __volatile__("pushfl; popl %0" : "=r"(flags));
+    return (flags & EFLAGS_IF) ? 1 : 0;
+}
+
+void irq_dispatch(regs_t* r) {
+    int irq = (int)r->int_no - IRQ_BASE_VECTOR;
+    if (irq < 0 || irq >= IRQ_COUNT) return;
+
+    // IRQ 7/15 can be spurious (line dropped before the PIC latched it); those must not be acknowledged
+    if (irq == 7 || irq == 15) {
+        uint16 command = (irq == 7) ? PIC1_COMMAND : PIC2_COMMAND;
+        outportb(command, PIC_READ_ISR);
+        if (!(inportb(command) & 0x80)) {
+            if (irq == 15) outportb(PIC1_COMMAND, PIC_EOI); // Master still saw the cascade
+            return;
+        }
+    }
+
+    for (int j = 0; j < IRQ_MAX_SHARED; j++) {
+        if (irq_handlers[irq][j]) irq_handlers[irq][j](r);
+    }
+
+    if (irq >= 8) outportb(PIC2_COMMAND, PIC_EOI);
+    outportb(PIC1_COMMAND, PIC_EOI);
+}
@@ -177,7 +177,7 @@ static void handle_error(int isr_num, error_context_t* ctx) {
         case ERROR_FATAL:
             printf("%c[FATAL] Critical error - system halt\n", 255, 0, 0);
             printf("%cError count: %d\n", 255, 255, 255, system_error_count);
-            asm("hlt");
+            asm("cli; hlt");
             break;
             
         case ERROR_RECOVERABLE:
@@ -29,6 +29,29 @@ void outw(uint16 _port, uint16 _data)
     __asm__ __volatile__ ("outw %1, %0" : : "dN" (_port), "a" (_data));
 }
 
+uint32 inportl(uint16 _port)
+{
+    uint32 rv;
+    __asm__ __volatile__ ("inl %1, %0" : "=a" (rv) : "dN" (_port));
+    return rv;
+}
+
+void outportl(uint16 _port, uint32 _data)
+{
+    __asm__ __volatile__ ("outl %1, %0" : : "dN" (_port), "a" (_data));
+}
+
+// Bulk word transfers (rep insw/outsw) for PIO data ports
+void insw(uint16 _port, void* _buf, uint32 _count)
+{
+    __asm__ __volatile__ ("rep insw" : "+D" (_buf), "+c" (_count) : "d" (_port) : "memory");
+}
+
+void outsw(uint16 _port, const void* _buf, uint32 _count)
+{
+    __asm__ __volatile__ ("rep outsw" : "+S" (_buf), "+c" (_count) : "d" (_port) : "memory");
+}
+
 // Simple timer-based sleep using CPU cycles but with better efficiency
 void sleep(uint8 times) {
     extern volatile int g_user_interrupt;
@@ -0,0 +1,50 @@
+#include <types.h>
+#include <system.h>
+#include <irq.h>
+#include <timer.h>
+
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND  0x43
+#define PIT_BASE_HZ  1193182
+
+#define PIT_CH0_LOHI_SQUARE 0x36  // Channel 0, lo/hi byte access, mode 3
+
+static volatile uint32 timer_ticks = 0;
+static uint8 timer_installed = 0;
+
+static void timer_handler(regs_t* r) {
+    (void)r;
+    timer_ticks++;
+}
+
+void timer_init(void) {
+    uint16 divisor = (uint16)(PIT_BASE_HZ / TIMER_HZ);
+
+    outportb(PIT_COMMAND, PIT_CH0_LOHI_SQUARE);
+    outportb(PIT_CHANNEL0, (uint8)(divisor & 0xFF));
+    outportb(PIT_CHANNEL0, (uint8)(divisor >> 8));
+
+    timer_ticks = 0;
+    irq_install_handler(IRQ_TIMER, timer_handler);
+    timer_installed = 1;
+}
+
+uint32 timer_ms(void) {
+    return timer_ticks * (1000 / TIMER_HZ);
+}
+
+int timer_running(void) {
+    return timer_installed && irq_enabled();
+}
+
+void timer_deadline_start(timer_deadline_t* d, uint32 timeout_ms) {
+    d->start = timer_ms();
+    d->timeout_ms = timeout_ms;
+    d->spins = 0;
+    d->timed = timer_running() ? 1 : 0;
+}
+
+int timer_deadline_expired(timer_deadline_t* d) {
+    if (d->timed) return (timer_ms() - d->start) >= d->timeout_ms;
+    return ++d->spins >= d->timeout_ms * TIMER_SPINS_PER_MS;
+}
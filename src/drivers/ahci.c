@@ -0,0 +1,534 @@
+#include <types.h>
+#include <system.h>
+#include <string.h>
+#include <pci.h>
+#include <irq.h>
+#include <timer.h>
+#include <ata.h>
+#include <ahci.h>
+
+// Generic host control registers (offsets from ABAR)
+#define AHCI_CAP  0x00
+#define AHCI_GHC  0x04
+#define AHCI_IS   0x08
+#define AHCI_PI   0x0C
+
+#define AHCI_CAP_SNCQ  0x40000000  // Native command queuing supported
+#define AHCI_GHC_IE    0x00000002  // Interrupt enable
+#define AHCI_GHC_AE    0x80000000  // AHCI enable
+
+// Port registers (offsets from the port's register block)
+#define AHCI_PORT_BASE  0x100
+#define AHCI_PORT_SIZE  0x80
+#define AHCI_PxCLB   0x00
+#define AHCI_PxCLBU  0x04
+#define AHCI_PxFB    0x08
+#define AHCI_PxFBU   0x0C
+#define AHCI_PxIS    0x10
+#define AHCI_PxIE    0x14
+#define AHCI_PxCMD   0x18
+#define AHCI_PxTFD   0x20
+#define AHCI_PxSIG   0x24
+#define AHCI_PxSSTS  0x28
+#define AHCI_PxSCTL  0x2C
+#define AHCI_PxSERR  0x30
+#define AHCI_PxSACT  0x34
+#define AHCI_PxCI    0x38
+
+#define AHCI_PxCMD_ST   0x0001  // Start processing the command list
+#define AHCI_PxCMD_FRE  0x0010  // FIS receive enable
+#define AHCI_PxCMD_FR   0x4000  // FIS receive running
+#define AHCI_PxCMD_CR   0x8000  // Command list running
+
+#define AHCI_PxIS_DHRS  0x00000001  // Device to host register FIS
+#define AHCI_PxIS_PSS   0x00000002  // PIO setup FIS
+#define AHCI_PxIS_SDBS  0x00000008  // Set device bits FIS (NCQ completion)
+#define AHCI_PxIS_DPS   0x00000020  // Descriptor processed
+#define AHCI_PxIS_IFS   0x08000000  // Interface fatal error
+#define AHCI_PxIS_HBDS  0x10000000  // Host bus data error
+#define AHCI_PxIS_HBFS  0x20000000  // Host bus fatal error
+#define AHCI_PxIS_TFES  0x40000000  // Task file error
+#define AHCI_PxIS_ERRORS (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_TFD_ERR  0x01
+#define AHCI_TFD_DRQ  0x08
+#define AHCI_TFD_BSY  0x80
+
+#define AHCI_SSTS_DET_PRESENT  3  // Device present and PHY communication established
+#define AHCI_SSTS_IPM_ACTIVE   1
+#define AHCI_SIG_ATA  0x00000101  // Plain SATA disk (not ATAPI / port multiplier)
+
+#define AHCI_PROG_IF  0x01  // SATA controller in AHCI mode
+
+// Register - host to device FIS
+#define FIS_TYPE_REG_H2D  0x27
+#define FIS_H2D_COMMAND   0x80  // C bit: the FIS carries a command
+#define FIS_DEVICE_LBA    0x40
+
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60  // READ FPDMA QUEUED (NCQ)
+#define ATA_CMD_WRITE_FPDMA     0x61  // WRITE FPDMA QUEUED (NCQ)
+#define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_SET_FEATURES    0xEF
+#define ATA_CMD_FLUSH_CACHE     0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+
+#define ATA_FEATURE_WCACHE_ENABLE 0x02
+
+#define AHCI_MAX_SLOTS 32
+// One PRD covers up to 4 MiB; 8 of them cover a full 65536-sector command
+#define AHCI_PRDT_ENTRIES 8
+#define AHCI_PRD_MAX_BYTES 0x400000
+#define AHCI_MAX_SECTORS_EXT 65536
+#define AHCI_MAX_SECTORS_28  256
+
+#define AHCI_PORT_TIMEOUT_MS 500
+#define AHCI_CMD_TIMEOUT_MS  1000
+
+// Command header: one per slot in a port's 1 KiB command list
+typedef struct __attribute__((packed)) {
+    uint16 flags;          // Bits 4:0 command FIS length in dwords, bit 6 write
+    uint16 prdtl;          // PRD entries in the command table
+    volatile uint32 prdbc; // Bytes transferred (written by the HBA)
+    uint32 ctba;           // Command table address (128-byte aligned)
+    uint32 ctbau;
+    uint32 reserved[4];
+} ahci_cmd_header_t;
+
+#define AHCI_CMD_FIS_DWORDS 5
+#define AHCI_CMD_WRITE      0x0040
+
+// Physical region descriptor
+typedef struct __attribute__((packed)) {
+    uint32 dba;
+    uint32 dbau;
+    uint32 reserved;
+    uint32 dbc;            // Byte count - 1 (bits 21:0)
+} ahci_prd_t;
+
+// Command table: the FIS to send plus the scatter/gather list (256 bytes, stays 128-byte aligned)
+typedef struct __attribute__((packed)) {
+    uint8 cfis[64];
+    uint8 acmd[16];
+    uint8 reserved[48];
+    ahci_prd_t prdt[AHCI_PRDT_ENTRIES];
+} ahci_cmd_table_t;
+
+// DMA structures the HBA reads and writes; static so they are physically contiguous and aligned
+static ahci_cmd_header_t ahci_cmd_lists[AHCI_MAX_PORTS][AHCI_MAX_SLOTS] __attribute__((aligned(1024)));
+static uint8 ahci_fis_areas[AHCI_MAX_PORTS][256] __attribute__((aligned(256)));
+static ahci_cmd_table_t ahci_cmd_tables[AHCI_MAX_PORTS][AHCI_MAX_SLOTS] __attribute__((aligned(128)));
+static uint16 ahci_identify_buf[256] __attribute__((aligned(4)));
+
+typedef struct {
+    uint32 regs;          // Port register block (MMIO; no paging, so used directly)
+    uint8 port_no;        // Index in the HBA's port space
+    uint8 present;
+    uint8 ncq;            // Use READ/WRITE FPDMA QUEUED
+    uint8 lba48;
+    uint8 flushing;       // A FLUSH CACHE is in flight; nothing else may be issued beside it
+    uint32 depth;         // Slots we may have in flight
+    uint32 issued;        // Bit per slot handed to the HBA
+    ata_request_t* slot_req[AHCI_MAX_SLOTS];
+    uint32 slot_count[AHCI_MAX_SLOTS];
+    ata_request_t* head;  // Requests waiting for slots; the head may be partly issued
+    ata_request_t* tail;
+} ahci_port_t;
+
+static ahci_port_t ahci_ports[AHCI_MAX_PORTS];
+static uint8 ahci_port_count = 0;
+static uint32 ahci_abar = 0;
+static uint32 ahci_slots = 1;
+
+static uint32 ahci_read(uint32 addr) {
+    return *(volatile uint32*)addr;
+}
+
+static void ahci_write(uint32 addr, uint32 value) {
+    *(volatile uint32*)addr = value;
+}
+
+// Stop the command and FIS engines so the list/FIS pointers may be changed
+static int ahci_port_stop(uint32 port) {
+    timer_deadline_t d;
+    ahci_write(port + AHCI_PxCMD, ahci_read(port + AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    timer_deadline_start(&d, AHCI_PORT_TIMEOUT_MS);
+    while (ahci_read(port + AHCI_PxCMD) & AHCI_PxCMD_CR) {
+        if (timer_deadline_expired(&d)) return -1;
+    }
+
+    ahci_write(port + AHCI_PxCMD, ahci_read(port + AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    timer_deadline_start(&d, AHCI_PORT_TIMEOUT_MS);
+    while (ahci_read(port + AHCI_PxCMD) & AHCI_PxCMD_FR) {
+        if (timer_deadline_expired(&d)) return -1;
+    }
+    return 0;
+}
+
+// COMRESET the link: used when the device stays busy after an error
+static void ahci_port_reset(uint32 port) {
+    timer_deadline_t d;
+    uint32 sctl = ahci_read(port + AHCI_PxSCTL) & ~0x0F;
+    ahci_write(port + AHCI_PxSCTL, sctl | 1);
+    timer_deadline_start(&d, 2); // DET=1 must be held for at least 1 ms
+    while (!timer_deadline_expired(&d));
+    ahci_write(port + AHCI_PxSCTL, sctl);
+
+    timer_deadline_start(&d, AHCI_PORT_TIMEOUT_MS);
+    while ((ahci_read(port + AHCI_PxSSTS) & 0x0F) != AHCI_SSTS_DET_PRESENT) {
+        if (timer_deadline_expired(&d)) break;
+    }
+    ahci_write(port + AHCI_PxSERR, 0xFFFFFFFF);
+}
+
+// Start the engines once the device is idle
+static int ahci_port_start(uint32 port) {
+    timer_deadline_t d;
+    timer_deadline_start(&d, AHCI_PORT_TIMEOUT_MS);
+    while (ahci_read(port + AHCI_PxTFD) & (AHCI_TFD_BSY | AHCI_TFD_DRQ)) {
+        if (timer_deadline_expired(&d)) {
+            ahci_port_reset(port);
+            break;
+        }
+    }
+    ahci_write(port + AHCI_PxCMD, ahci_read(port + AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    ahci_write(port + AHCI_PxCMD, ahci_read(port + AHCI_PxCMD) | AHCI_PxCMD_ST);
+    return 0;
+}
+
+// Fill a slot's command header, FIS and PRD table
+static void ahci_build_command(int unit, int slot, uint8 command, uint32 lba, uint8 device,
+                               uint16 features, uint16 count, uint8* buf, uint32 bytes, int write) {
+    ahci_cmd_header_t* header = &ahci_cmd_lists[unit][slot];
+    ahci_cmd_table_t* table = &ahci_cmd_tables[unit][slot];
+
+    memset(table->cfis, 0, sizeof(table->cfis));
+    uint8* fis = table->cfis;
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = FIS_H2D_COMMAND;
+    fis[2] = command;
+    fis[3] = (uint8)(features & 0xFF);
+    fis[4] = (uint8)(lba & 0xFF);
+    fis[5] = (uint8)((lba >> 8) & 0xFF);
+    fis[6] = (uint8)((lba >> 16) & 0xFF);
+    fis[7] = device;
+    fis[8] = (uint8)((lba >> 24) & 0xFF);
+    fis[11] = (uint8)(features >> 8);
+    fis[12] = (uint8)(count & 0xFF);
+    fis[13] = (uint8)(count >> 8);
+
+    // The buffer is physically contiguous, so it only needs splitting at the PRD size limit
+    uint32 addr = (uint32)buf;
+    int i = 0;
+    while (bytes > 0 && i < AHCI_PRDT_ENTRIES) {
+        uint32 piece = bytes > AHCI_PRD_MAX_BYTES ? AHCI_PRD_MAX_BYTES : bytes;
+        table->prdt[i].dba = addr;
+        table->prdt[i].dbau = 0;
+        table->prdt[i].reserved = 0;
+        table->prdt[i].dbc = piece - 1;
+        addr += piece;
+        bytes -= piece;
+        i++;
+    }
+
+    header->flags = AHCI_CMD_FIS_DWORDS | (write ? AHCI_CMD_WRITE : 0);
+    header->prdtl = (uint16)i;
+    header->prdbc = 0;
+}
+
+// Run one non-queued command on slot 0 and poll for it. Only used while the port is idle.
+static int ahci_exec_polled(int unit, uint8 command, uint16 features, uint8* buf, uint32 bytes) {
+    ahci_port_t* p = &ahci_ports[unit];
+    ahci_build_command(unit, 0, command, 0, 0, features, 0, buf, bytes, 0);
+    ahci_write(p->regs + AHCI_PxCI, 1);
+
+    timer_deadline_t d;
+    timer_deadline_start(&d, AHCI_CMD_TIMEOUT_MS);
+    while (ahci_read(p->regs + AHCI_PxCI) & 1) {
+        if (timer_deadline_expired(&d)) {
+            ahci_port_stop(p->regs);
+            ahci_port_start(p->regs);
+            return -1;
+        }
+    }
+    if (ahci_read(p->regs + AHCI_PxTFD) & AHCI_TFD_ERR) return -1;
+    return 0;
+}
+
+// Hand as much of the waiting requests to free slots as the queue depth allows
+static void ahci_issue(ahci_port_t* p) {
+    int unit = (int)(p - ahci_ports);
+
+    while (p->head) {
+        // Non-queued commands must run one at a time
+        if ((!p->ncq && p->issued) || p->flushing) return;
+
+        int slot = -1;
+        for (uint32 s = 0; s < p->depth; s++) {
+            if (!(p->issued & (1u << s))) {
+                slot = (int)s;
+                break;
+            }
+        }
+        if (slot < 0) return;
+
+        ata_request_t* req = p->head;
+        if (req->flags & ATA_REQ_FLUSH) {
+            // FLUSH CACHE is not queued: let every NCQ command drain first, then run it alone
+            if (p->issued) return;
+            ahci_build_command(unit, slot, p->lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE, 0,
+                               FIS_DEVICE_LBA, 0, 0, NULL, 0, 0);
+            p->slot_req[slot] = req;
+            p->slot_count[slot] = 0;
+            p->issued |= 1u << slot;
+            p->flushing = 1;
+            req->status = ATA_REQ_ACTIVE;
+            ata_stats_command(req);
+            p->head = req->next;
+            if (!p->head) p->tail = NULL;
+            req->next = NULL;
+            ahci_write(p->regs + AHCI_PxCI, 1u << slot);
+            return;
+        }
+
+        int write = (req->flags & ATA_REQ_WRITE) ? 1 : 0;
+        uint32 lba = req->lba + req->issued;
+        uint8* buf = req->buf + req->issued * 512;
+        uint32 count = req->count - req->issued;
+        uint32 max_count = (p->ncq || p->lba48) ? AHCI_MAX_SECTORS_EXT : AHCI_MAX_SECTORS_28;
+        if (count > max_count) count = max_count;
+
+        if (p->ncq) {
+            // FPDMA QUEUED: sector count in the features field, tag in count bits 7:3
+            ahci_build_command(unit, slot, write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA, lba,
+                               FIS_DEVICE_LBA, (uint16)count, (uint16)(slot << 3), buf, count * 512, write);
+        } else if (p->lba48) {
+            ahci_build_command(unit, slot, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT, lba,
+                               FIS_DEVICE_LBA, 0, (uint16)count, buf, count * 512, write);
+        } else {
+            // 28-bit: LBA bits 27:24 live in the device register
+            ahci_build_command(unit, slot, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA, lba & 0x00FFFFFF,
+                               FIS_DEVICE_LBA | ((lba >> 24) & 0x0F), 0, (uint16)count, buf, count * 512, write);
+        }
+
+        p->slot_req[slot] = req;
+        p->slot_count[slot] = count;
+        p->issued |= 1u << slot;
+        req->status = ATA_REQ_ACTIVE;
+        ata_stats_command(req);
+        req->issued += count;
+        if (req->issued == req->count) {
+            p->head = req->next;
+            if (!p->head) p->tail = NULL;
+            req->next = NULL;
+        }
+
+        if (p->ncq) ahci_write(p->regs + AHCI_PxSACT, 1u << slot);
+        ahci_write(p->regs + AHCI_PxCI, 1u << slot);
+    }
+}
+
+static void ahci_finish(ata_request_t* req, uint8 status) {
+    ata_request_finish(req, status);
+}
+
+// A failed NCQ command aborts every outstanding one: restart the port and fail them all
+static void ahci_port_recover(ahci_port_t* p) {
+    ahci_port_stop(p->regs);
+    ahci_write(p->regs + AHCI_PxSERR, 0xFFFFFFFF);
+    ahci_write(p->regs + AHCI_PxIS, 0xFFFFFFFF);
+
+    for (int s = 0; s < AHCI_MAX_SLOTS; s++) {
+        if (!(p->issued & (1u << s))) continue;
+        ata_request_t* req = p->slot_req[s];
+        p->slot_req[s] = NULL;
+        if (!req || req->status != ATA_REQ_ACTIVE) continue;
+
+        // A partly issued request is still at the head of the wait queue
+        if (p->head == req) {
+            p->head = req->next;
+            if (!p->head) p->tail = NULL;
+            req->next = NULL;
+        }
+        ahci_finish(req, ATA_REQ_ERROR);
+    }
+    p->issued = 0;
+    p->flushing = 0;
+
+    ahci_port_start(p->regs);
+    ahci_issue(p);
+}
+
+// Reap finished slots. Runs from the HBA interrupt and from ata_wait as a poll.
+static void ahci_port_service(ahci_port_t* p) {
+    uint32 is = ahci_read(p->regs + AHCI_PxIS);
+    ahci_write(p->regs + AHCI_PxIS, is);
+    ahci_write(ahci_abar + AHCI_IS, 1u << p->port_no);
+
+    if (is & AHCI_PxIS_ERRORS) {
+        ahci_port_recover(p);
+        return;
+    }
+
+    // CI clears when the device accepts an NCQ command; SACT clears when it is done
+    uint32 busy = ahci_read(p->regs + AHCI_PxCI);
+    if (p->ncq) busy |= ahci_read(p->regs + AHCI_PxSACT);
+    uint32 finished = p->issued & ~busy;
+
+    for (int s = 0; finished; s++) {
+        if (!(finished & (1u << s))) continue;
+        finished &= ~(1u << s);
+        p->issued &= ~(1u << s);
+
+        ata_request_t* req = p->slot_req[s];
+        p->slot_req[s] = NULL;
+        if (req && (req->flags & ATA_REQ_FLUSH)) p->flushing = 0;
+        if (!req || req->status != ATA_REQ_ACTIVE) continue;
+
+        req->done += p->slot_count[s];
+        if (req->done == req->count) ahci_finish(req, ATA_REQ_DONE);
+    }
+
+    ahci_issue(p);
+}
+
+static void ahci_irq(regs_t* r) {
+    (void)r;
+    uint32 pending = ahci_read(ahci_abar + AHCI_IS);
+    for (int i = 0; i < ahci_port_count; i++) {
+        if (pending & (1u << ahci_ports[i].port_no)) ahci_port_service(&ahci_ports[i]);
+    }
+}
+
+// Point a port at its command list and FIS area, start it and identify the disk behind it
+static int ahci_port_setup(int unit, uint32 port, uint8 port_no) {
+    ahci_port_t* p = &ahci_ports[unit];
+    memset(p, 0, sizeof(*p));
+    p->regs = port;
+    p->port_no = port_no;
+
+    if (ahci_port_stop(port) != 0) return -1;
+
+    memset(ahci_cmd_lists[unit], 0, sizeof(ahci_cmd_lists[unit]));
+    memset(ahci_fis_areas[unit], 0, sizeof(ahci_fis_areas[unit]));
+    memset(ahci_cmd_tables[unit], 0, sizeof(ahci_cmd_tables[unit]));
+    for (int s = 0; s < AHCI_MAX_SLOTS; s++) {
+        ahci_cmd_lists[unit][s].ctba = (uint32)&ahci_cmd_tables[unit][s];
+        ahci_cmd_lists[unit][s].ctbau = 0;
+    }
+
+    ahci_write(port + AHCI_PxCLB, (uint32)ahci_cmd_lists[unit]);
+    ahci_write(port + AHCI_PxCLBU, 0);
+    ahci_write(port + AHCI_PxFB, (uint32)ahci_fis_areas[unit]);
+    ahci_write(port + AHCI_PxFBU, 0);
+    ahci_write(port + AHCI_PxSERR, 0xFFFFFFFF);
+    ahci_write(port + AHCI_PxIS, 0xFFFFFFFF);
+    ahci_write(port + AHCI_PxIE, 0);
+    ahci_port_start(port);
+
+    // Let writes complete into the drive's cache; ata_flush provides the barriers. Drives
+    // without a write cache reject this, which is fine.
+    ahci_exec_polled(unit, ATA_CMD_SET_FEATURES, ATA_FEATURE_WCACHE_ENABLE, NULL, 0);
+
+    if (ahci_exec_polled(unit, ATA_CMD_IDENTIFY, 0, (uint8*)ahci_identify_buf, 512) != 0) return -1;
+
+    // NCQ needs both the HBA (CAP.SNCQ) and the drive (word 76 bit 8); depth from word 75
+    uint32 cap = ahci_read(ahci_abar + AHCI_CAP);
+    p->lba48 = (ahci_identify_buf[83] & 0x0400) ? 1 : 0;
+    p->ncq = ((cap & AHCI_CAP_SNCQ) && (ahci_identify_buf[76] & 0x0100)) ? 1 : 0;
+    p->depth = 1;
+    if (p->ncq) {
+        p->depth = (ahci_identify_buf[75] & 0x1F) + 1;
+        if (p->depth > ahci_slots) p->depth = ahci_slots;
+    }
+
+    int drive = ata_register_drive(ATA_BACKEND_AHCI, (uint8)unit, ahci_identify_buf);
+    if (drive < 0) return -1;
+
+    p->present = 1;
+    ahci_write(port + AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_SDBS |
+                                 AHCI_PxIS_DPS | AHCI_PxIS_ERRORS);
+    return 0;
+}
+
+void ahci_init(void) {
+    pci_device_t hba;
+    ahci_port_count = 0;
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, 0, &hba) != 0) return;
+    if (hba.prog_if != AHCI_PROG_IF) return;
+
+    uint32 abar = pci_read_bar(&hba, 5);
+    if (abar == 0) return;
+    pci_enable_bus_master(&hba);
+    ahci_abar = abar;
+
+    ahci_write(abar + AHCI_GHC, ahci_read(abar + AHCI_GHC) | AHCI_GHC_AE);
+    ahci_slots = ((ahci_read(abar + AHCI_CAP) >> 8) & 0x1F) + 1;
+
+    uint32 implemented = ahci_read(abar + AHCI_PI);
+    for (int i = 0; i < 32 && ahci_port_count < AHCI_MAX_PORTS; i++) {
+        if (!(implemented & (1u << i))) continue;
+        uint32 port = abar + AHCI_PORT_BASE + i * AHCI_PORT_SIZE;
+
+        uint32 ssts = ahci_read(port + AHCI_PxSSTS);
+        if ((ssts & 0x0F) != AHCI_SSTS_DET_PRESENT || ((ssts >> 8) & 0x0F) != AHCI_SSTS_IPM_ACTIVE) continue;
+        if (ahci_read(port + AHCI_PxSIG) != AHCI_SIG_ATA) continue;
+
+        if (ahci_port_setup(ahci_port_count, port, (uint8)i) == 0) ahci_port_count++;
+    }
+
+    if (ahci_port_count == 0) return;
+
+    ahci_write(abar + AHCI_IS, 0xFFFFFFFF);
+    if (hba.irq_line < IRQ_COUNT) irq_install_handler(hba.irq_line, ahci_irq);
+    ahci_write(abar + AHCI_GHC, ahci_read(abar + AHCI_GHC) | AHCI_GHC_IE);
+}
+
+int ahci_submit(uint8 unit, ata_request_t* req) {
+    if (unit >= ahci_port_count || !ahci_ports[unit].present) return -1;
+    if ((uint32)req->buf & 1) return -1; // PRD data must be word aligned
+
+    ahci_port_t* p = &ahci_ports[unit];
+    req->status = ATA_REQ_QUEUED;
+    req->done = 0;
+    req->issued = 0;
+    req->next = NULL;
+
+    uint32 flags = irq_save();
+    if (p->tail) {
+        p->tail->next = req;
+    } else {
+        p->head = req;
+    }
+    p->tail = req;
+    ahci_issue(p);
+    irq_restore(flags);
+    return 0;
+}
+
+void ahci_poll(uint8 unit) {
+    if (unit >= ahci_port_count) return;
+    ahci_port_service(&ahci_ports[unit]);
+}
+
+void ahci_abort(uint8 unit) {
+    if (unit >= ahci_port_count) return;
+    ahci_port_recover(&ahci_ports[unit]);
+}
+
+int ahci_identify(uint8 unit, uint16* identify_data) {
+    if (unit >= ahci_port_count || !ahci_ports[unit].present) return -1;
+
+    uint32 flags = irq_save();
+    int result = -1;
+    if (ahci_ports[unit].issued == 0 && !ahci_ports[unit].head) {
+        result = ahci_exec_polled(unit, ATA_CMD_IDENTIFY, 0, (uint8*)ahci_identify_buf, 512);
+    }
+    irq_restore(flags);
+
+    if (result == 0) memcpy(identify_data, ahci_identify_buf, 512);
+    return result;
+}
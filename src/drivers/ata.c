@@ -1,6 +1,14 @@
 #include <types.h>
 #include <system.h>
+#include <string.h>
 #include <vga.h>
+#include <pci.h>
+#include <irq.h>
+#include <timer.h>
+#include <ata.h>
+#include <ahci.h>
+#include <virtio_blk.h>
+#include <boottime.h>
 
 #define ATA_PRIMARY_IO 0x1F0
 #define ATA_SECONDARY_IO 0x170
@@ -27,10 +35,23 @@
 
 // Enhanced commands for SATA compatibility
 #define ATA_CMD_READ_PIO   0x20
+#define ATA_CMD_READ_PIO_EXT   0x24
+#define ATA_CMD_READ_DMA_EXT   0x25
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
 #define ATA_CMD_WRITE_PIO  0x30
+#define ATA_CMD_WRITE_PIO_EXT  0x34
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE  0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE   0xC6
+#define ATA_CMD_READ_DMA       0xC8
+#define ATA_CMD_WRITE_DMA      0xCA
 #define ATA_CMD_IDENTIFY   0xEC
 #define ATA_CMD_IDENTIFY_PACKET 0xA1
 #define ATA_CMD_SET_FEATURES 0xEF
+#define ATA_CMD_FLUSH_CACHE     0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
 #define ATA_CMD_SLEEP      0xE6
 #define ATA_CMD_STANDBY    0xE2
 #define ATA_CMD_IDLE       0xE3
@@ -44,99 +65,704 @@
 #define ATA_SR_IDX     0x02
 #define ATA_SR_ERR     0x01
 
+// Bus-master IDE registers, relative to the channel's BMIDE base (BAR4, +8 for secondary)
+#define ATA_BM_COMMAND     0x00
+#define ATA_BM_STATUS      0x02
+#define ATA_BM_PRDT        0x04
+
+#define ATA_BM_CMD_START   0x01
+#define ATA_BM_CMD_READ    0x08  // Transfer direction: device to memory
+#define ATA_BM_SR_ACTIVE   0x01
+#define ATA_BM_SR_ERR      0x02
+#define ATA_BM_SR_IRQ      0x04
+
+// Device control register bits
+#define ATA_CTRL_SRST      0x04
+
 // SATA specific features
 #define ATA_FEATURE_SATA_ENABLE 0x10
 #define ATA_FEATURE_SATA_DISABLE 0x90
 
-// Drive detection structure
-typedef struct {
-    uint8 present;
-    uint8 type;  // 0=IDE, 1=SATA, 2=RAID
-    char model[41];
-    uint32 sectors;
-    uint32 size_mb;
-} drive_info_t;
+// SET FEATURES subcommands
+#define ATA_FEATURE_WCACHE_ENABLE 0x02
 
 static drive_info_t detected_drives[8];
+static ata_io_stats_t ata_stats[8];
+
+// Largest DRQ block we ask for with SET MULTIPLE MODE
+#define ATA_MAX_MULTIPLE 16
+// A single 28-bit command moves at most 256 sectors (sector count 0 = 256)
+#define ATA_MAX_SECTORS_PER_CMD 256
+// A 48-bit (EXT) command moves up to 65536 sectors (sector count 0 = 65536)
+#define ATA_MAX_SECTORS_PER_CMD_EXT 65536
+// 28-bit commands cannot address at or beyond this LBA
+#define ATA_LBA28_LIMIT 0x10000000
+
+// Physical Region Descriptor: one physically contiguous piece of a DMA buffer
+typedef struct __attribute__((packed)) {
+    uint32 phys_addr;
+    uint16 byte_count;  // 0 encodes 64 KiB
+    uint16 flags;       // ATA_PRD_EOT on the last entry
+} ata_prd_t;
+
+#define ATA_PRD_EOT 0x8000
+// Enough 64 KiB regions for a full-size EXT command (32 MiB) on a page-aligned buffer;
+// an unaligned buffer needs one more, and the command is then trimmed to what fits.
+#define ATA_PRDT_ENTRIES 512
+
+// One PRD table per channel. A 4 KiB table aligned to 4 KiB never crosses a 64 KiB boundary.
+static ata_prd_t ata_prdt[2][ATA_PRDT_ENTRIES] __attribute__((aligned(4096)));
+
+// I/O base of the PCI IDE controller's bus-master registers (0 = no DMA engine)
+static uint16 ata_bmide_base = 0;
+
+// Per-channel request queue. The head request owns the channel; one ATA command
+// (up to 256 sectors of it, 65536 on LBA48 drives) is in flight at a time.
+typedef struct {
+    uint16 io_base;
+    uint16 bm_base;          // Bus-master registers for this channel (0 = no DMA engine)
+    ata_request_t* head;
+    ata_request_t* tail;
+    uint32 cmd_count;        // Sectors in the command in flight
+    uint32 cmd_done;         // Sectors moved by it so far (PIO)
+    uint8 cmd_dma;           // Command in flight uses the DMA engine
+    uint8 probe_unit;        // Position being identified at boot (0 master, 1 slave, 2 = done)
+    uint32 probe_start;      // timer_ms() when its IDENTIFY went out
+} ata_channel_t;
+
+static ata_channel_t ata_channels[2];
+
+// Boot probe: both channels identify their drives at once, in the background. Each channel
+// steps from its interrupt or the timer tick; callers that need the drive table wait for it.
+#define ATA_PROBE_DONE 2
+static volatile uint8 ata_probing = 0;   // Channels still probing
+static int ata_probe_phase = -1;         // Boot timeline entry
+
+#define ATA_PROBE_TIMEOUT_MS 100
+#define ATA_BSY_TIMEOUT_MS   1000
+#define ATA_RESET_TIMEOUT_MS 2000
+
+static ata_channel_t* ata_channel_of(uint8 drive) {
+    return &ata_channels[(drive & 2) ? 1 : 0];
+}
 
 static void ata_io_wait(uint16 io_base) {
     for (int i = 0; i < 4; i++) inportb(io_base + ATA_REG_ALTSTATUS);
 }
 
-static int ata_poll(uint16 io_base) {
-    for (int i = 0; i < 100000; i++) {
-        uint8 status = inportb(io_base + ATA_REG_STATUS);
-        if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRDY)) return 0;
+// Wait for BSY to clear. Uses the alternate status register so a pending interrupt is not acknowledged.
+// The polls are charged to `drive`.
+static int ata_wait_not_busy(uint16 io_base, uint8 drive, uint32 timeout_ms) {
+    timer_deadline_t d;
+    timer_deadline_start(&d, timeout_ms);
+    while (inportb(io_base + ATA_REG_ALTSTATUS) & ATA_SR_BSY) {
+        ata_stats[drive].poll_iterations++;
+        if (timer_deadline_expired(&d)) return -1;
     }
-    return -1;
+    return 0;
 }
 
-// Enhanced drive detection for SATA compatibility
-int ata_detect_drive(uint8 drive) {
+// Wait for BSY to clear, then for DRQ (data ready). Fails on timeout or device error.
+static int ata_wait_drq(uint16 io_base, uint8 drive, uint32 timeout_ms) {
+    timer_deadline_t d;
+    timer_deadline_start(&d, timeout_ms);
+    for (;;) {
+        uint8 status = inportb(io_base + ATA_REG_ALTSTATUS);
+        if (!(status & ATA_SR_BSY)) {
+            if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+            if (status & ATA_SR_DRQ) return 0;
+        }
+        ata_stats[drive].poll_iterations++;
+        if (timer_deadline_expired(&d)) return -1;
+    }
+}
+
+// Program the task file for a 28-bit LBA command
+static void ata_setup_lba28(uint16 io_base, uint8 drive, uint32 lba, uint32 count) {
+    uint8 slavebit = (drive & 1) ? 0xF0 : 0xE0;
+    outportb(io_base + ATA_REG_HDDEVSEL, slavebit | ((lba >> 24) & 0x0F));
+    outportb(io_base + ATA_REG_SECCOUNT0, (uint8)(count & 0xFF)); // 256 is encoded as 0
+    outportb(io_base + ATA_REG_LBA0, (uint8)(lba & 0xFF));
+    outportb(io_base + ATA_REG_LBA1, (uint8)((lba >> 8) & 0xFF));
+    outportb(io_base + ATA_REG_LBA2, (uint8)((lba >> 16) & 0xFF));
+}
+
+// Program the task file for a 48-bit LBA command. Each register is a two-deep FIFO:
+// the high-order bytes go in first, then the low-order bytes.
+static void ata_setup_lba48(uint16 io_base, uint8 drive, uint32 lba, uint32 count) {
+    uint8 slavebit = (drive & 1) ? 0x50 : 0x40; // LBA mode; no address bits in this register
+    outportb(io_base + ATA_REG_HDDEVSEL, slavebit);
+    outportb(io_base + ATA_REG_SECCOUNT0, (uint8)((count >> 8) & 0xFF)); // 65536 is encoded as 0
+    outportb(io_base + ATA_REG_LBA0, (uint8)((lba >> 24) & 0xFF));
+    outportb(io_base + ATA_REG_LBA1, 0); // LBA bits 47:32; the block API is 32-bit
+    outportb(io_base + ATA_REG_LBA2, 0);
+    outportb(io_base + ATA_REG_SECCOUNT0, (uint8)(count & 0xFF));
+    outportb(io_base + ATA_REG_LBA0, (uint8)(lba & 0xFF));
+    outportb(io_base + ATA_REG_LBA1, (uint8)((lba >> 8) & 0xFF));
+    outportb(io_base + ATA_REG_LBA2, (uint8)((lba >> 16) & 0xFF));
+}
+
+// Issue SET MULTIPLE MODE for `multiple` sectors per DRQ block
+static int ata_apply_multiple(uint8 drive, uint8 multiple) {
     uint16 io_base = (drive & 2) ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
-    uint8 slavebit = (drive & 1) ? 0xB0 : 0xA0;
-    
-    // Reset the drive first
+    uint8 slavebit = (drive & 1) ? 0xF0 : 0xE0;
+
+    outportb(io_base + ATA_REG_HDDEVSEL, slavebit);
+    ata_io_wait(io_base);
+    outportb(io_base + ATA_REG_SECCOUNT0, multiple);
+    outportb(io_base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_io_wait(io_base);
+
+    if (ata_wait_not_busy(io_base, drive, ATA_BSY_TIMEOUT_MS) != 0) return -1;
+    if (inportb(io_base + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+    return 0;
+}
+
+// Issue SET FEATURES with the given subcommand (polled; the channel must be idle)
+static int ata_set_features(uint8 drive, uint8 feature) {
+    uint16 io_base = (drive & 2) ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
+    uint8 slavebit = (drive & 1) ? 0xF0 : 0xE0;
+
     outportb(io_base + ATA_REG_HDDEVSEL, slavebit);
     ata_io_wait(io_base);
+    outportb(io_base + ATA_REG_FEATURES, feature);
+    outportb(io_base + ATA_REG_COMMAND, ATA_CMD_SET_FEATURES);
+    ata_io_wait(io_base);
+
+    if (ata_wait_not_busy(io_base, drive, ATA_BSY_TIMEOUT_MS) != 0) return -1;
+    if (inportb(io_base + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+    return 0;
+}
+
+// Turn on the drive's write cache when it has one (word 82 bit 5), so a write completes once
+// the data is accepted instead of once it reaches the platters
+static void ata_enable_write_cache(uint8 drive, const uint16* identify_data) {
+    detected_drives[drive].write_cache = 0;
+    if (!(identify_data[82] & 0x0020)) return;
+    if (ata_set_features(drive, ATA_FEATURE_WCACHE_ENABLE) != 0) return;
+    detected_drives[drive].write_cache = 1;
+}
+
+// Enable READ/WRITE MULTIPLE with the largest DRQ block the drive supports (up to ATA_MAX_MULTIPLE)
+static void ata_set_multiple_mode(uint8 drive, const uint16* identify_data) {
+    detected_drives[drive].multiple = 0;
+
+    // Word 47 bits 7:0 = maximum sectors per DRQ block for the MULTIPLE commands
+    uint8 max_multiple = identify_data[47] & 0xFF;
+    if (max_multiple < 2) return;
+
+    // Use the largest power of two the drive accepts
+    uint8 multiple = 1;
+    while ((multiple << 1) <= max_multiple && (multiple << 1) <= ATA_MAX_MULTIPLE) multiple <<= 1;
+
+    if (ata_apply_multiple(drive, multiple) != 0) return;
+    detected_drives[drive].multiple = multiple;
+}
+
+// Locate the PCI IDE controller and enable its bus-master DMA engine if it has one
+static void ata_dma_init(void) {
+    pci_device_t ide;
+    ata_bmide_base = 0;
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0, &ide) != 0) return;
+    if (!(ide.prog_if & 0x80)) return; // Controller is not bus-master capable
     
-    // Try to detect if drive is present
-    uint8 status = inportb(io_base + ATA_REG_STATUS);
-    if (status == 0) {
-        return -1; // No drive present
-    }
+    // BAR4 must be an I/O BAR
+    uint32 bar4 = pci_config_read32(ide.bus, ide.slot, ide.func, PCI_BAR4);
+    if (!(bar4 & 1) || (bar4 & ~0x3) == 0) return;
     
-    // Try to identify the drive
-    uint16 identify_data[256];
-    int result = ata_identify(drive, identify_data);
+    pci_enable_bus_master(&ide);
+    ata_bmide_base = (uint16)(bar4 & ~0x3);
+}
+
+// Pulse SRST on a channel to abort a stuck command, then restore per-drive settings the reset cleared
+static void ata_soft_reset(uint16 io_base) {
+    uint16 ctrl = io_base + ATA_REG_ALTSTATUS;
+    outportb(ctrl, ATA_CTRL_SRST);
+    ata_io_wait(io_base);
+    outportb(ctrl, 0); // Also leaves nIEN clear so the drive keeps raising interrupts
+    ata_io_wait(io_base);
+    uint8 first = (io_base == ATA_SECONDARY_IO) ? 2 : 0;
+    ata_wait_not_busy(io_base, first, ATA_RESET_TIMEOUT_MS);
+
+    for (uint8 drive = first; drive < first + 2; drive++) {
+        if (detected_drives[drive].present && detected_drives[drive].multiple) {
+            if (ata_apply_multiple(drive, detected_drives[drive].multiple) != 0) {
+                detected_drives[drive].multiple = 0;
+            }
+        }
+        if (detected_drives[drive].present && detected_drives[drive].write_cache) {
+            ata_set_features(drive, ATA_FEATURE_WCACHE_ENABLE);
+        }
+    }
+}
+
+// Describe buf in the channel's PRD table, splitting it at 64 KiB boundaries.
+// Returns the number of bytes covered, or 0 if the buffer cannot be used for DMA.
+static uint32 ata_build_prdt(int channel, const uint8* buf, uint32 len) {
+    uint32 addr = (uint32)buf; // No paging: virtual addresses are physical
+    if (addr & 1) return 0;    // PRD regions must start on a word boundary
     
-    if (result == 0) {
-        // Drive found, extract information
-        detected_drives[drive].present = 1;
-        
-        // Extract model name
-        for (int i = 0; i < 20; i++) {
-            detected_drives[drive].model[i*2] = (identify_data[27+i] >> 8) & 0xFF;
-            detected_drives[drive].model[i*2+1] = identify_data[27+i] & 0xFF;
+    uint32 covered = 0;
+    int i = 0;
+    while (covered < len && i < ATA_PRDT_ENTRIES) {
+        uint32 piece = ((addr + 0x10000) & ~0xFFFF) - addr;
+        if (piece > len - covered) piece = len - covered;
+        ata_prdt[channel][i].phys_addr = addr;
+        ata_prdt[channel][i].byte_count = (uint16)(piece & 0xFFFF);
+        ata_prdt[channel][i].flags = 0;
+        addr += piece;
+        covered += piece;
+        i++;
+    }
+    if (i == 0) return 0;
+    ata_prdt[channel][i - 1].flags = ATA_PRD_EOT;
+    return covered;
+}
+
+static void ata_start_command(ata_channel_t* ch);
+
+// Retire the channel's head request and start the next one
+static void ata_complete(ata_channel_t* ch, uint8 status) {
+    ata_request_t* req = ch->head;
+    if (!req) return;
+
+    ch->head = req->next;
+    if (!ch->head) ch->tail = NULL;
+    req->next = NULL;
+
+    // Keep the drive busy before running the callback
+    ata_start_command(ch);
+
+    ata_request_finish(req, status);
+}
+
+// The command in flight finished (result 0) or failed (-1)
+static void ata_command_done(ata_channel_t* ch, int result) {
+    ata_request_t* req = ch->head;
+    if (!req) return;
+
+    if (result != 0) {
+        if (ch->cmd_dma) {
+            // Retry the rest of the request with PIO
+            req->flags |= ATA_REQ_DMA_FAILED;
+            ata_start_command(ch);
+            return;
         }
-        detected_drives[drive].model[40] = '\0';
-        
-        // Get drive size
-        detected_drives[drive].sectors = identify_data[60] | (identify_data[61] << 16);
-        detected_drives[drive].size_mb = (detected_drives[drive].sectors / 2048);
-        
-        // Determine drive type based on identify data
-        if (identify_data[83] & 0x0400) {
-            detected_drives[drive].type = 1; // SATA
+        ata_complete(ch, ATA_REQ_ERROR);
+        return;
+    }
+
+    // PIO succeeded where DMA did not, so the DMA path is unusable on this drive
+    if (!ch->cmd_dma && (req->flags & ATA_REQ_DMA_FAILED)) {
+        detected_drives[req->drive].dma = 0;
+    }
+
+    req->done += ch->cmd_count;
+    if (req->done < req->count) {
+        ata_start_command(ch);
+        return;
+    }
+    ata_complete(ch, ATA_REQ_DONE);
+}
+
+// Sectors in the next PIO DRQ block of the command in flight
+static uint32 ata_pio_block(ata_channel_t* ch, ata_request_t* req) {
+    uint32 block = detected_drives[req->drive].multiple ? detected_drives[req->drive].multiple : 1;
+    if (block > ch->cmd_count - ch->cmd_done) block = ch->cmd_count - ch->cmd_done;
+    return block;
+}
+
+static void ata_pio_write_block(ata_channel_t* ch, ata_request_t* req) {
+    uint32 block = ata_pio_block(ch, req);
+    outsw(ch->io_base + ATA_REG_DATA, req->buf + (req->done + ch->cmd_done) * 512, block * 256);
+    ch->cmd_done += block;
+    ata_io_wait(ch->io_base); // Let BSY rise before anyone samples the status
+}
+
+// Issue the next command of the head request. Called with interrupts disabled.
+static void ata_start_command(ata_channel_t* ch) {
+    ata_request_t* req = ch->head;
+    if (!req) return;
+
+    uint8 drive = req->drive;
+    uint16 io_base = ch->io_base;
+    int write = (req->flags & ATA_REQ_WRITE) ? 1 : 0;
+    uint32 lba = req->lba + req->done;
+    uint8* buf = req->buf + req->done * 512;
+    uint32 count = req->count - req->done;
+    uint8 ext = detected_drives[drive].lba48;
+    uint32 max_count = ext ? ATA_MAX_SECTORS_PER_CMD_EXT : ATA_MAX_SECTORS_PER_CMD;
+    if (count > max_count) count = max_count;
+
+    req->status = ATA_REQ_ACTIVE;
+    ata_stats_command(req);
+    ch->cmd_count = count;
+    ch->cmd_done = 0;
+    ch->cmd_dma = 0;
+
+    if (ata_wait_not_busy(io_base, drive, ATA_BSY_TIMEOUT_MS) != 0) {
+        ata_complete(ch, ATA_REQ_ERROR);
+        return;
+    }
+
+    if (req->flags & ATA_REQ_FLUSH) {
+        // Non-data command: the drive interrupts once the cache is on the media
+        outportb(io_base + ATA_REG_HDDEVSEL, (drive & 1) ? 0xF0 : 0xE0);
+        ata_io_wait(io_base);
+        outportb(io_base + ATA_REG_COMMAND, ext ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+        ata_io_wait(io_base);
+        return;
+    }
+
+    // Prefer the DMA engine; PIO stays as the fallback
+    int channel = (int)(ch - ata_channels);
+    uint32 dma_count = 0;
+    if (ch->bm_base && detected_drives[drive].dma &&
+        !(req->flags & (ATA_REQ_FORCE_PIO | ATA_REQ_DMA_FAILED))) {
+        // Trim the command to what the PRD table can describe
+        dma_count = ata_build_prdt(channel, buf, count * 512) / 512;
+        if (dma_count > 0 && dma_count < count) {
+            ata_build_prdt(channel, buf, dma_count * 512);
+        }
+    }
+    if (dma_count > 0) {
+        uint16 bm = ch->bm_base;
+        count = dma_count;
+        ch->cmd_count = count;
+        uint8 direction = write ? 0 : ATA_BM_CMD_READ;
+
+        // Stop the engine, load the PRD table and clear stale error/interrupt bits (write 1 to clear)
+        outportb(bm + ATA_BM_COMMAND, direction);
+        outportl(bm + ATA_BM_PRDT, (uint32)ata_prdt[channel]);
+        outportb(bm + ATA_BM_STATUS, inportb(bm + ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+        ch->cmd_dma = 1;
+        if (ext) {
+            ata_setup_lba48(io_base, drive, lba, count);
+            outportb(io_base + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
         } else {
-            detected_drives[drive].type = 0; // IDE
+            ata_setup_lba28(io_base, drive, lba, count);
+            outportb(io_base + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
         }
-        
-        return 0;
+        outportb(bm + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+        return;
+    }
+
+    uint8 multiple = detected_drives[drive].multiple;
+    uint8 command;
+    if (ext) {
+        ata_setup_lba48(io_base, drive, lba, count);
+        if (write) command = multiple ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_PIO_EXT;
+        else command = multiple ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_PIO_EXT;
+    } else {
+        ata_setup_lba28(io_base, drive, lba, count);
+        if (write) command = multiple ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_PIO;
+        else command = multiple ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_PIO;
+    }
+    outportb(io_base + ATA_REG_COMMAND, command);
+    ata_io_wait(io_base);
+
+    if (write) {
+        // The drive asks for the first block without raising an interrupt
+        if (ata_wait_drq(io_base, drive, ATA_BSY_TIMEOUT_MS) != 0) {
+            ata_command_done(ch, -1);
+            return;
+        }
+        ata_pio_write_block(ch, req);
     }
-    
-    return -1;
 }
 
-// Initialize all drives during system startup
-void ata_init_drives() {
-    // Clear drive info
-    for (int i = 0; i < 8; i++) {
-        detected_drives[i].present = 0;
-        detected_drives[i].type = 0;
-        detected_drives[i].sectors = 0;
-        detected_drives[i].size_mb = 0;
-        detected_drives[i].model[0] = '\0';
+// Advance the channel's state machine. Runs from IRQ 14/15 and from ata_wait as a poll, so it
+// only acts on what the hardware status says and is harmless when nothing has happened yet.
+static void ata_channel_service(ata_channel_t* ch) {
+    ata_request_t* req = ch->head;
+    if (!req || req->status != ATA_REQ_ACTIVE) {
+        inportb(ch->io_base + ATA_REG_STATUS); // Acknowledge a stray interrupt
+        return;
+    }
+
+    if (ch->cmd_dma) {
+        // The controller latches the drive's INTRQ in its status register when the transfer ends
+        uint16 bm = ch->bm_base;
+        uint8 bm_status = inportb(bm + ATA_BM_STATUS);
+        if (!(bm_status & (ATA_BM_SR_IRQ | ATA_BM_SR_ERR))) return;
+
+        outportb(bm + ATA_BM_COMMAND, (req->flags & ATA_REQ_WRITE) ? 0 : ATA_BM_CMD_READ); // Clear START
+        uint8 status = inportb(ch->io_base + ATA_REG_STATUS); // Acknowledges the drive interrupt
+        outportb(bm + ATA_BM_STATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+        int failed = (bm_status & ATA_BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF));
+        ata_command_done(ch, failed ? -1 : 0);
+        return;
+    }
+
+    uint8 status = inportb(ch->io_base + ATA_REG_STATUS);
+    if (status & ATA_SR_BSY) return;
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        ata_command_done(ch, -1);
+        return;
+    }
+
+    if (req->flags & ATA_REQ_FLUSH) {
+        ata_command_done(ch, 0);
+        return;
+    }
+
+    if (!(req->flags & ATA_REQ_WRITE)) {
+        // Each interrupt announces one DRQ block of `multiple` sectors
+        if (!(status & ATA_SR_DRQ)) return;
+        uint32 block = ata_pio_block(ch, req);
+        insw(ch->io_base + ATA_REG_DATA, req->buf + (req->done + ch->cmd_done) * 512, block * 256);
+        ch->cmd_done += block;
+        if (ch->cmd_done == ch->cmd_count) ata_command_done(ch, 0);
+        return;
+    }
+
+    if (ch->cmd_done < ch->cmd_count) {
+        if (status & ATA_SR_DRQ) ata_pio_write_block(ch, req);
+        return;
+    }
+
+    // Interrupt after the last block: the drive has taken all the data
+    if (!(status & ATA_SR_DRQ)) ata_command_done(ch, 0);
+}
+
+// Give up on the command in flight: reset the channel and fail it (DMA commands get one PIO retry)
+static void ata_abort(ata_channel_t* ch) {
+    if (!ch->head) return;
+    if (ch->cmd_dma) {
+        outportb(ch->bm_base + ATA_BM_COMMAND, 0);
+        outportb(ch->bm_base + ATA_BM_STATUS, ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    }
+    ata_soft_reset(ch->io_base);
+    ata_command_done(ch, -1);
+}
+
+static void ata_probe_step(ata_channel_t* ch);
+
+static void ata_channel_interrupt(ata_channel_t* ch) {
+    if (ch->probe_unit < ATA_PROBE_DONE) {
+        ata_probe_step(ch);
+    } else {
+        ata_channel_service(ch);
+    }
+}
+
+static void ata_irq_primary(regs_t* r) {
+    (void)r;
+    ata_channel_interrupt(&ata_channels[0]);
+}
+
+static void ata_irq_secondary(regs_t* r) {
+    (void)r;
+    ata_channel_interrupt(&ata_channels[1]);
+}
+
+void ata_request_init(ata_request_t* req, uint8 drive, uint32 lba, uint32 count, uint8* buf, uint8 flags) {
+    req->drive = drive;
+    req->flags = flags & (ATA_REQ_WRITE | ATA_REQ_FORCE_PIO | ATA_REQ_FLUSH);
+    req->status = ATA_REQ_IDLE;
+    req->lba = lba;
+    req->count = count;
+    req->buf = buf;
+    req->done = 0;
+    req->callback = NULL;
+    req->context = NULL;
+    req->next = NULL;
+}
+
+int ata_request_complete(const ata_request_t* req) {
+    return req->status == ATA_REQ_DONE || req->status == ATA_REQ_ERROR;
+}
+
+const ata_io_stats_t* ata_get_stats(uint8 drive) {
+    if (drive >= 8) return NULL;
+    return &ata_stats[drive];
+}
+
+void ata_reset_stats(uint8 drive) {
+    uint32 flags = irq_save();
+    if (drive == 0xFF) {
+        memset(ata_stats, 0, sizeof(ata_stats));
+    } else if (drive < 8) {
+        memset(&ata_stats[drive], 0, sizeof(ata_stats[drive]));
+    }
+    irq_restore(flags);
+}
+
+void ata_stats_command(const ata_request_t* req) {
+    ata_stats[req->drive].commands++;
+}
+
+void ata_request_finish(ata_request_t* req, uint8 status) {
+    ata_io_stats_t* st = &ata_stats[req->drive];
+    st->requests++;
+    if (req->flags & ATA_REQ_FLUSH) {
+        st->flushes++;
+    } else if (req->flags & ATA_REQ_WRITE) {
+        st->sectors_written += req->done;
+    } else {
+        st->sectors_read += req->done;
+    }
+    st->bytes += (uint64)req->done * 512;
+    if (status == ATA_REQ_ERROR) st->errors++;
+
+    // Bucket = number of significant bits in the latency, so 0 ms lands in bucket 0
+    uint32 ms = timer_ms() - req->submit_ms;
+    uint32 bucket = 0;
+    while (ms && bucket < ATA_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    st->latency[bucket]++;
+
+    req->status = status;
+    if (req->callback) req->callback(req, req->context);
+}
+
+int ata_submit(ata_request_t* req) {
+    if (!ata_drive_present(req->drive)) {
+        return -1;
+    }
+    // Only a flush carries no data
+    if ((req->count == 0) != ((req->flags & ATA_REQ_FLUSH) != 0)) {
+        return -1;
+    }
+    // Stay inside the addressable range (28-bit drives stop at 128 GiB)
+    uint32 limit = detected_drives[req->drive].sectors;
+    if (!detected_drives[req->drive].lba48 && limit > ATA_LBA28_LIMIT) limit = ATA_LBA28_LIMIT;
+    if (limit && req->count && (req->lba >= limit || req->count > limit - req->lba)) {
+        return -1;
+    }
+    req->submit_ms = timer_ms();
+
+    if (detected_drives[req->drive].backend == ATA_BACKEND_AHCI) {
+        return ahci_submit(detected_drives[req->drive].unit, req);
+    }
+    if (detected_drives[req->drive].backend == ATA_BACKEND_VIRTIO) {
+        return virtio_blk_submit(detected_drives[req->drive].unit, req);
+    }
+
+    ata_channel_t* ch = ata_channel_of(req->drive);
+    req->status = ATA_REQ_QUEUED;
+    req->done = 0;
+    req->next = NULL;
+    req->flags &= ~ATA_REQ_DMA_FAILED;
+
+    uint32 flags = irq_save();
+    if (ch->tail) {
+        ch->tail->next = req;
+    } else {
+        ch->head = req;
+    }
+    ch->tail = req;
+    if (ch->head == req) ata_start_command(ch);
+    irq_restore(flags);
+    return 0;
+}
+
+// Sectors a request has moved so far, including the partial IDE command in flight
+static uint32 ata_request_progress(const ata_request_t* req) {
+    if (detected_drives[req->drive].backend != ATA_BACKEND_IDE) return req->done;
+    return req->done + ata_channel_of(req->drive)->cmd_done;
+}
+
+// Run the drive's completion path by hand. Called with interrupts disabled.
+static void ata_backend_poll(uint8 drive) {
+    if (detected_drives[drive].backend == ATA_BACKEND_AHCI) {
+        ahci_poll(detected_drives[drive].unit);
+    } else if (detected_drives[drive].backend == ATA_BACKEND_VIRTIO) {
+        virtio_blk_poll(detected_drives[drive].unit);
+    } else {
+        ata_channel_service(ata_channel_of(drive));
+    }
+}
+
+static void ata_backend_abort(uint8 drive) {
+    if (detected_drives[drive].backend == ATA_BACKEND_AHCI) {
+        ahci_abort(detected_drives[drive].unit);
+    } else if (detected_drives[drive].backend == ATA_BACKEND_VIRTIO) {
+        virtio_blk_abort(detected_drives[drive].unit);
+    } else {
+        ata_abort(ata_channel_of(drive));
+    }
+}
+
+int ata_wait(ata_request_t* req, uint32 timeout_ms) {
+    timer_deadline_t d;
+    timer_deadline_start(&d, timeout_ms);
+    uint32 progress = ata_request_progress(req);
+
+    while (!ata_request_complete(req)) {
+        ata_stats[req->drive].poll_iterations++;
+
+        // Poll once in case the interrupt was lost or interrupts are still off
+        uint32 flags = irq_save();
+        ata_backend_poll(req->drive);
+        irq_restore(flags);
+        if (ata_request_complete(req)) break;
+
+        // The deadline restarts whenever the request makes progress, so timeout_ms bounds each
+        // stall rather than the whole transfer
+        if (ata_request_progress(req) != progress) {
+            progress = ata_request_progress(req);
+            timer_deadline_start(&d, timeout_ms);
+        } else if (timer_deadline_expired(&d)) {
+            ata_stats[req->drive].timeouts++;
+            flags = irq_save();
+            ata_backend_abort(req->drive);
+            irq_restore(flags);
+            timer_deadline_start(&d, timeout_ms);
+            continue;
+        }
+
+        // Sleep until the next interrupt (disk or timer tick); sti;hlt closes the wakeup race
+        if (irq_enabled()) {
+            __asm__ __volatile__("cli");
+            if (!ata_request_complete(req)) {
+                __asm__ __volatile__("sti; hlt");
+            } else {
+                __asm__ __volatile__("sti");
+            }
+        }
     }
+
+    return req->status == ATA_REQ_DONE ? 0 : -1;
+}
+
+// Fill in model, capacity and type from IDENTIFY DEVICE data
+static void ata_parse_identify(drive_info_t* info, const uint16* identify_data) {
+    // Extract model name
+    for (int i = 0; i < 20; i++) {
+        info->model[i*2] = (identify_data[27+i] >> 8) & 0xFF;
+        info->model[i*2+1] = identify_data[27+i] & 0xFF;
+    }
+    info->model[40] = '\0';
     
-    // Probe only primary drives (0,1) first for faster boot
-    // Secondary drives (2,3) are less common and can be detected on-demand
-    for (int drive = 0; drive < 2; drive++) {
-        ata_detect_drive(drive);
+    // Word 83 bit 10: 48-bit address feature set. Capacity is then in words 100-103,
+    // otherwise in words 60-61.
+    info->lba48 = (identify_data[83] & 0x0400) ? 1 : 0;
+    if (info->lba48) {
+        uint32 low = identify_data[100] | ((uint32)identify_data[101] << 16);
+        uint32 high = identify_data[102] | ((uint32)identify_data[103] << 16);
+        // LBAs are 32-bit above this driver, so anything past 2 TiB is out of reach
+        info->sectors = high ? 0xFFFFFFFF : low;
+        info->size_mb = (low >> 11) | (identify_data[102] << 21);
+    } else {
+        info->sectors = identify_data[60] | (identify_data[61] << 16);
+        info->size_mb = (info->sectors / 2048);
+    }
+    
+    // Word 76 (Serial ATA capabilities) is 0 or 0xFFFF on parallel ATA devices
+    if (identify_data[76] != 0 && identify_data[76] != 0xFFFF) {
+        info->type = 1; // SATA
+    } else {
+        info->type = 0; // IDE
     }
 }
 
-int ata_identify(uint8 drive, uint16* identify_data) {
+// Select an IDE position and send IDENTIFY DEVICE. Returns -1 if nothing answers.
+static int ata_identify_start(uint8 drive) {
     uint16 io_base = (drive & 2) ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
     uint8 slavebit = (drive & 1) ? 0xB0 : 0xA0;
     
@@ -156,144 +782,298 @@ int ata_identify(uint8 drive, uint16* identify_data) {
     
     uint8 status = inportb(io_base + ATA_REG_STATUS);
     
-    if (status == 0) {
+    // 0 = nothing attached, 0xFF = floating bus (no controller behind the ports)
+    if (status == 0 || status == 0xFF) {
         return -1;
     }
-    
-    // Wait for BSY to clear (reduced timeout for faster boot)
-    int timeout = 10000; // Reduced from 1000000
-    while ((inportb(io_base + ATA_REG_STATUS) & ATA_SR_BSY) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+    return 0;
+}
+
+// Read the 256 IDENTIFY words once DRQ is up
+static void ata_identify_read(uint16 io_base, uint16* identify_data) {
+    for (int i = 0; i < 256; i++) {
+        identify_data[i] = inw(io_base + ATA_REG_DATA);
     }
+}
+
+// Record an IDE drive that answered IDENTIFY and apply its transfer settings
+static void ata_setup_drive(uint8 drive, const uint16* identify_data) {
+    detected_drives[drive].present = 1;
+    detected_drives[drive].backend = ATA_BACKEND_IDE;
+    ata_parse_identify(&detected_drives[drive], identify_data);
     
-    // Wait for DRQ to set (reduced timeout for faster boot)
-    timeout = 10000; // Reduced from 1000000
-    while (!(inportb(io_base + ATA_REG_STATUS) & ATA_SR_DRQ) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+    // Switch to multi-sector DRQ blocks so bulk transfers interrupt/poll once per block
+    ata_set_multiple_mode(drive, identify_data);
+    ata_enable_write_cache(drive, identify_data);
+    
+    // Word 49 bit 8: DMA supported. Use it when the controller has a bus-master engine.
+    detected_drives[drive].dma = (ata_bmide_base && (identify_data[49] & 0x0100)) ? 1 : 0;
+}
+
+// Identify the channel's next position, or finish the channel when none is left
+static void ata_probe_next(ata_channel_t* ch) {
+    int channel = (int)(ch - ata_channels);
+    for (; ch->probe_unit < ATA_PROBE_DONE; ch->probe_unit++) {
+        if (ata_identify_start((uint8)(channel * 2 + ch->probe_unit)) == 0) {
+            ch->probe_start = timer_ms();
+            return;
+        }
     }
+    if (--ata_probing == 0) boot_phase_end(ata_probe_phase);
+}
+
+// Settle the position being probed if it answered, failed or ran out of time. Called with
+// interrupts disabled.
+static void ata_probe_step(ata_channel_t* ch) {
+    if (ch->probe_unit >= ATA_PROBE_DONE) return;
     
-    // Read identify data
-    for (int i = 0; i < 256; i++) {
-        identify_data[i] = inw(io_base + ATA_REG_DATA);
+    uint8 drive = (uint8)((ch - ata_channels) * 2 + ch->probe_unit);
+    uint8 status = inportb(ch->io_base + ATA_REG_ALTSTATUS);
+    if ((status & ATA_SR_BSY) || !(status & (ATA_SR_DRQ | ATA_SR_ERR | ATA_SR_DF))) {
+        if (timer_ms() - ch->probe_start < ATA_PROBE_TIMEOUT_MS) return;
+    } else if (!(status & (ATA_SR_ERR | ATA_SR_DF))) {
+        uint16 identify_data[256];
+        ata_identify_read(ch->io_base, identify_data);
+        ata_setup_drive(drive, identify_data);
     }
+    // ATAPI devices abort IDENTIFY with ERR; silent positions time out
     
-    return 0;
+    inportb(ch->io_base + ATA_REG_STATUS); // Acknowledge the interrupt
+    ch->probe_unit++;
+    ata_probe_next(ch);
 }
 
-int ata_read_sector(uint8 drive, uint32 lba, uint8* buf) {
-    if (drive >= 8 || !detected_drives[drive].present) {
-        return -1;
+static void ata_probe_tick(regs_t* r) {
+    (void)r;
+    if (ata_probing) {
+        ata_probe_step(&ata_channels[0]);
+        ata_probe_step(&ata_channels[1]);
     }
-    
+    if (!ata_probing) irq_remove_handler(IRQ_TIMER, ata_probe_tick); // Boot probe finished
+}
+
+// Sleep until the boot probe has settled drives 0-3. Needs interrupts enabled.
+static void ata_probe_wait(void) {
+    while (ata_probing) {
+        uint32 flags = irq_save();
+        ata_probe_step(&ata_channels[0]);
+        ata_probe_step(&ata_channels[1]);
+        irq_restore(flags);
+        
+        if (ata_probing && irq_enabled()) {
+            __asm__ __volatile__("cli");
+            if (ata_probing) {
+                __asm__ __volatile__("sti; hlt");
+            } else {
+                __asm__ __volatile__("sti");
+            }
+        }
+    }
+}
+
+// Synchronous probe of one IDE position
+int ata_detect_drive(uint8 drive) {
     uint16 io_base = (drive & 2) ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
-    uint8 slavebit = (drive & 1) ? 0xF0 : 0xE0;
-    
-    // Set up LBA addressing
-    outportb(io_base + ATA_REG_HDDEVSEL, slavebit | ((lba >> 24) & 0x0F));
-    outportb(io_base + ATA_REG_SECCOUNT0, 1);
-    outportb(io_base + ATA_REG_LBA0, (uint8)(lba & 0xFF));
-    outportb(io_base + ATA_REG_LBA1, (uint8)((lba >> 8) & 0xFF));
-    outportb(io_base + ATA_REG_LBA2, (uint8)((lba >> 16) & 0xFF));
-    
-    // Send read command
-    outportb(io_base + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+    uint8 slavebit = (drive & 1) ? 0xB0 : 0xA0;
     
-    // Wait for BSY to clear (reduced timeout for faster boot)
-    int timeout = 10000; // Reduced from 1000000
-    while ((inportb(io_base + ATA_REG_STATUS) & ATA_SR_BSY) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
-    }
+    // Reset the drive first
+    outportb(io_base + ATA_REG_HDDEVSEL, slavebit);
+    ata_io_wait(io_base);
     
-    // Wait for DRQ to set (reduced timeout for faster boot)
-    timeout = 10000; // Reduced from 1000000
-    while (!(inportb(io_base + ATA_REG_STATUS) & ATA_SR_DRQ) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+    // Try to detect if drive is present
+    uint8 status = inportb(io_base + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF) {
+        return -1; // No drive present
     }
     
-    // Read data
-    for (int i = 0; i < 256; i++) {
-        uint16 data = inw(io_base + ATA_REG_DATA);
-        buf[i*2] = data & 0xFF;
-        buf[i*2+1] = (data >> 8) & 0xFF;
+    // Try to identify the drive
+    uint16 identify_data[256];
+    if (ata_identify(drive, identify_data) != 0) {
+        return -1;
     }
-    
-    ata_io_wait(io_base);
+    ata_setup_drive(drive, identify_data);
     return 0;
 }
 
-int ata_write_sector(uint8 drive, uint32 lba, const uint8* buf) {
-    if (drive >= 8 || !detected_drives[drive].present) {
-        return -1;
+// Initialize all drives during system startup
+void ata_init_drives() {
+    // A probe still running from an earlier call owns the channels
+    ata_probe_wait();
+    
+    // Clear drive info
+    for (int i = 0; i < 8; i++) {
+        detected_drives[i].present = 0;
+        detected_drives[i].type = 0;
+        detected_drives[i].sectors = 0;
+        detected_drives[i].size_mb = 0;
+        detected_drives[i].multiple = 0;
+        detected_drives[i].dma = 0;
+        detected_drives[i].lba48 = 0;
+        detected_drives[i].write_cache = 0;
+        detected_drives[i].backend = ATA_BACKEND_IDE;
+        detected_drives[i].unit = 0;
+        detected_drives[i].model[0] = '\0';
     }
     
-    uint16 io_base = (drive & 2) ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
-    uint8 slavebit = (drive & 1) ? 0xF0 : 0xE0;
+    ata_dma_init();
     
-    // Set up LBA addressing
-    outportb(io_base + ATA_REG_HDDEVSEL, slavebit | ((lba >> 24) & 0x0F));
-    outportb(io_base + ATA_REG_SECCOUNT0, 1);
-    outportb(io_base + ATA_REG_LBA0, (uint8)(lba & 0xFF));
-    outportb(io_base + ATA_REG_LBA1, (uint8)((lba >> 8) & 0xFF));
-    outportb(io_base + ATA_REG_LBA2, (uint8)((lba >> 16) & 0xFF));
+    ata_channels[0].io_base = ATA_PRIMARY_IO;
+    ata_channels[1].io_base = ATA_SECONDARY_IO;
+    for (int c = 0; c < 2; c++) {
+        ata_channels[c].bm_base = ata_bmide_base ? (uint16)(ata_bmide_base + c * 8) : 0;
+        ata_channels[c].head = NULL;
+        ata_channels[c].tail = NULL;
+        ata_channels[c].cmd_dma = 0;
+        ata_channels[c].probe_unit = ATA_PROBE_DONE;
+        // Clear nIEN so the drives raise INTRQ on completion
+        outportb(ata_channels[c].io_base + ATA_REG_ALTSTATUS, 0);
+    }
+    irq_install_handler(IRQ_ATA_PRIMARY, ata_irq_primary);
+    irq_install_handler(IRQ_ATA_SECONDARY, ata_irq_secondary);
     
-    // Send write command
-    outportb(io_base + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-
-    // Wait for BSY to clear and DRQ to set (reduced timeout for faster boot)
-    int timeout = 10000; // Reduced from 1000000
-    while ((inportb(io_base + ATA_REG_STATUS) & ATA_SR_BSY) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+    // Identify drives 0-3 on both channels at once, in the background, while the other
+    // controllers are set up and the shell starts. The probe deadlines need the PIT, so without
+    // it the positions are probed one after another here.
+    if (timer_running()) {
+        irq_install_handler(IRQ_TIMER, ata_probe_tick);
+        ata_probe_phase = boot_phase_begin("IDE probe (background)");
+        uint32 flags = irq_save();
+        ata_probing = 2;
+        for (int c = 0; c < 2; c++) {
+            ata_channels[c].probe_unit = 0;
+            ata_probe_next(&ata_channels[c]);
+        }
+        irq_restore(flags);
+    } else {
+        for (int drive = 0; drive < 4; drive++) {
+            ata_detect_drive(drive);
+        }
     }
     
-    timeout = 10000; // Reduced from 1000000
-    while (!(inportb(io_base + ATA_REG_STATUS) & ATA_SR_DRQ) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+    // SATA disks on an AHCI controller take drive numbers 4-7
+    ahci_init();
+    // virtio-blk disks (QEMU -drive if=virtio) fill any drive numbers left over
+    virtio_blk_init();
+}
+
+void ata_plug(uint8 drive) {
+    if (drive < 8 && detected_drives[drive].present && detected_drives[drive].backend == ATA_BACKEND_VIRTIO) {
+        virtio_blk_plug(detected_drives[drive].unit);
     }
+}
 
-    // Write the data
-    for (int i = 0; i < 256; i++) {
-        uint16 data = buf[i*2] | (buf[i*2+1] << 8);
-        outw(io_base + ATA_REG_DATA, data);
+void ata_unplug(uint8 drive) {
+    if (drive < 8 && detected_drives[drive].present && detected_drives[drive].backend == ATA_BACKEND_VIRTIO) {
+        virtio_blk_unplug(detected_drives[drive].unit);
     }
+}
 
-    ata_io_wait(io_base);
+int ata_register_drive(uint8 backend, uint8 unit, const uint16* identify_data) {
+    for (int drive = 4; drive < 8; drive++) {
+        if (detected_drives[drive].present) continue;
+        
+        ata_parse_identify(&detected_drives[drive], identify_data);
+        detected_drives[drive].present = 1;
+        detected_drives[drive].backend = backend;
+        detected_drives[drive].unit = unit;
+        detected_drives[drive].multiple = 0;
+        detected_drives[drive].dma = 1; // Backends other than IDE always move data by DMA
+        // Word 85 bit 5: write cache enabled (the backend turned it on before identifying)
+        detected_drives[drive].write_cache = (identify_data[85] & 0x0020) ? 1 : 0;
+        return drive;
+    }
+    return -1;
+}
 
-    // Wait for BSY to clear and DRDY to set after writing
-    timeout = 1000000;
-    while ((inportb(io_base + ATA_REG_STATUS) & ATA_SR_BSY) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+int ata_identify(uint8 drive, uint16* identify_data) {
+    // Drives 4-7 belong to other controllers; there is nothing behind the IDE ports for them
+    if (drive >= 4) {
+        if (drive >= 8 || !detected_drives[drive].present) return -1;
+        if (detected_drives[drive].backend == ATA_BACKEND_AHCI) {
+            return ahci_identify(detected_drives[drive].unit, identify_data);
+        }
+        if (detected_drives[drive].backend == ATA_BACKEND_VIRTIO) {
+            return virtio_blk_identify(detected_drives[drive].unit, identify_data);
+        }
+        return -1;
+    }
+    
+    ata_probe_wait();
+    uint16 io_base = (drive & 2) ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
+    if (ata_identify_start(drive) != 0) {
+        return -1;
     }
     
-    timeout = 1000000;
-    while (!(inportb(io_base + ATA_REG_STATUS) & ATA_SR_DRDY) && --timeout);
-    if (timeout == 0) { 
-        return -1; 
+    // Wait for the data (short deadline for faster boot; ATAPI devices abort with ERR)
+    if (ata_wait_drq(io_base, drive, ATA_PROBE_TIMEOUT_MS) != 0) {
+        return -1;
     }
+    
+    ata_identify_read(io_base, identify_data);
+    return 0;
+}
 
-    // Check for errors
-    uint8 status = inportb(io_base + ATA_REG_STATUS);
-    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+// Queue a transfer and sleep until it completes
+static int ata_transfer(uint8 drive, uint32 lba, uint32 count, uint8* buf, uint8 flags) {
+    if (!ata_drive_present(drive)) {
         return -1;
     }
+    if (count == 0) return 0;
+    
+    ata_request_t req;
+    ata_request_init(&req, drive, lba, count, buf, flags);
+    if (ata_submit(&req) != 0) return -1;
+    return ata_wait(&req, ATA_REQUEST_TIMEOUT_MS);
+}
 
-    return 0;
+int ata_flush(uint8 drive) {
+    if (!ata_drive_present(drive)) return -1;
+    if (!detected_drives[drive].write_cache) return 0;
+
+    // Queued like a transfer, so it runs after every write submitted before it
+    ata_request_t req;
+    ata_request_init(&req, drive, 0, 0, NULL, ATA_REQ_FLUSH);
+    if (ata_submit(&req) != 0) return -1;
+    return ata_wait(&req, ATA_FLUSH_TIMEOUT_MS);
+}
+
+// Read `count` consecutive sectors starting at `lba` into buf.
+// Goes through the channel queue: DMA when available, otherwise READ MULTIPLE with one
+// interrupt per DRQ block.
+int ata_read_sectors(uint8 drive, uint32 lba, uint32 count, uint8* buf) {
+    return ata_transfer(drive, lba, count, buf, 0);
+}
+
+// Write `count` consecutive sectors starting at `lba` from buf.
+int ata_write_sectors(uint8 drive, uint32 lba, uint32 count, const uint8* buf) {
+    return ata_transfer(drive, lba, count, (uint8*)buf, ATA_REQ_WRITE);
+}
+
+int ata_read_sector(uint8 drive, uint32 lba, uint8* buf) {
+    return ata_read_sectors(drive, lba, 1, buf);
+}
+
+int ata_write_sector(uint8 drive, uint32 lba, const uint8* buf) {
+    return ata_write_sectors(drive, lba, 1, buf);
 }
 
 // Get drive information
 drive_info_t* ata_get_drive_info(uint8 drive) {
     if (drive >= 8) return NULL;
+    if (drive < 4) ata_probe_wait();
     return &detected_drives[drive];
 }
 
+// Capacity in sectors (0 if the drive is not present)
+uint32 ata_drive_sectors(uint8 drive) {
+    if (!ata_drive_present(drive)) return 0;
+    return detected_drives[drive].sectors;
+}
+
 // Check if drive is present
+// (drives 0-3 wait for the boot probe to settle them)
 int ata_drive_present(uint8 drive) {
     if (drive >= 8) return 0;
+    if (drive < 4) ata_probe_wait();
     return detected_drives[drive].present;
 } 
\ No newline at end of file
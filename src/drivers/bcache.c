@@ -0,0 +1,378 @@
+#include <types.h>
+#include <system.h>
+#include <string.h>
+#include <util.h>
+#include <ata.h>
+#include <block.h>
+#include <bcache.h>
+#include <timer.h>
+
+#define BCACHE_NONE 0xFFFFFFFF
+
+// Cache states
+#define BCACHE_UNSET 0  // Memory not claimed yet
+#define BCACHE_READY 1
+#define BCACHE_OFF   2  // Not enough heap: pass-through
+
+// Entry flags
+#define BCACHE_VALID 0x01
+#define BCACHE_DIRTY 0x02
+
+// Dirty sectors queued under one plug while writing back
+#define BCACHE_WRITEBACK_BATCH BLOCK_MAX_MERGE_SECTORS
+
+typedef struct {
+    uint32 lba;
+    uint8 drive;
+    uint8 flags;
+    uint32 hash_next;   // Bucket chain, or the free list while unused
+    uint32 prev;        // LRU list, most recently used first
+    uint32 next;
+} bcache_entry_t;
+
+static uint8 bcache_state = BCACHE_UNSET;
+static bcache_entry_t* bcache_entries;
+static uint8* bcache_data;          // capacity sectors, one per entry
+static uint32* bcache_buckets;
+static uint32 bcache_hash_mask;
+static uint32 bcache_lru_head = BCACHE_NONE;
+static uint32 bcache_lru_tail = BCACHE_NONE;
+static uint32 bcache_free = BCACHE_NONE;
+static uint32 bcache_dirty[BLOCK_MAX_DEVICES];
+static uint32 bcache_dirty_since[BLOCK_MAX_DEVICES]; // timer_ms() when the drive's oldest dirty sector was written
+static bcache_stats_t bcache_stats;
+
+// Claim the cache's memory on first use, halving the size until the heap can supply it
+static int bcache_init(void) {
+    if (bcache_state != BCACHE_UNSET) return bcache_state == BCACHE_READY;
+    bcache_state = BCACHE_OFF;
+
+    uint32 count = get_heap_size() / BCACHE_HEAP_SHARE / (BLOCK_SECTOR_SIZE + sizeof(bcache_entry_t) + sizeof(uint32));
+    uint32 buckets = 0;
+    for (; count >= BCACHE_MIN_SECTORS; count /= 2) {
+        for (buckets = 1; buckets < count; buckets <<= 1);
+        bcache_entries = (bcache_entry_t*)malloc(count * sizeof(bcache_entry_t));
+        bcache_data = bcache_entries ? (uint8*)malloc(count * BLOCK_SECTOR_SIZE) : NULL;
+        bcache_buckets = bcache_data ? (uint32*)malloc(buckets * sizeof(uint32)) : NULL;
+        if (bcache_buckets) break;
+        if (bcache_data) free(bcache_data);
+        if (bcache_entries) free(bcache_entries);
+    }
+    if (count < BCACHE_MIN_SECTORS) return 0;
+
+    for (uint32 i = 0; i < buckets; i++) bcache_buckets[i] = BCACHE_NONE;
+    for (uint32 i = 0; i < count; i++) {
+        bcache_entries[i].flags = 0;
+        bcache_entries[i].hash_next = i + 1 < count ? i + 1 : BCACHE_NONE;
+    }
+    bcache_free = 0;
+    bcache_hash_mask = buckets - 1;
+    bcache_stats.capacity = count;
+    bcache_stats.max_transfer = count / BCACHE_STREAM_SHARE;
+    if (bcache_stats.max_transfer < BCACHE_STREAM_MIN) bcache_stats.max_transfer = BCACHE_STREAM_MIN;
+    bcache_state = BCACHE_READY;
+    return 1;
+}
+
+static uint32 bcache_hash(uint8 drive, uint32 lba) {
+    return (lba * 2654435761u + drive) & bcache_hash_mask;
+}
+
+static uint32 bcache_find(uint8 drive, uint32 lba) {
+    uint32 i = bcache_buckets[bcache_hash(drive, lba)];
+    while (i != BCACHE_NONE && (bcache_entries[i].lba != lba || bcache_entries[i].drive != drive)) {
+        i = bcache_entries[i].hash_next;
+    }
+    return i;
+}
+
+static uint8* bcache_sector(uint32 i) {
+    return bcache_data + i * BLOCK_SECTOR_SIZE;
+}
+
+static void bcache_lru_unlink(uint32 i) {
+    bcache_entry_t* e = &bcache_entries[i];
+    if (e->prev != BCACHE_NONE) bcache_entries[e->prev].next = e->next;
+    else bcache_lru_head = e->next;
+    if (e->next != BCACHE_NONE) bcache_entries[e->next].prev = e->prev;
+    else bcache_lru_tail = e->prev;
+}
+
+static void bcache_lru_push(uint32 i) {
+    bcache_entry_t* e = &bcache_entries[i];
+    e->prev = BCACHE_NONE;
+    e->next = bcache_lru_head;
+    if (bcache_lru_head != BCACHE_NONE) bcache_entries[bcache_lru_head].prev = i;
+    else bcache_lru_tail = i;
+    bcache_lru_head = i;
+}
+
+static void bcache_touch(uint32 i) {
+    if (bcache_lru_head == i) return;
+    bcache_lru_unlink(i);
+    bcache_lru_push(i);
+}
+
+static void bcache_mark_clean(uint32 i) {
+    bcache_entry_t* e = &bcache_entries[i];
+    if (!(e->flags & BCACHE_DIRTY)) return;
+    e->flags &= ~BCACHE_DIRTY;
+    bcache_dirty[e->drive]--;
+    bcache_stats.dirty--;
+}
+
+// Take an entry out of the hash and LRU lists and put it on the free list
+static void bcache_drop(uint32 i) {
+    bcache_entry_t* e = &bcache_entries[i];
+    uint32* link = &bcache_buckets[bcache_hash(e->drive, e->lba)];
+    while (*link != i) link = &bcache_entries[*link].hash_next;
+    *link = e->hash_next;
+    bcache_lru_unlink(i);
+    e->flags = 0;
+    e->hash_next = bcache_free;
+    bcache_free = i;
+    bcache_stats.used--;
+}
+
+// An entry for (drive, lba), inserted at the head of the LRU list with undefined contents.
+// The least recently used sector is evicted when the cache is full; if it is dirty, its
+// drive's dirty sectors are written back together first. BCACHE_NONE if that fails.
+static uint32 bcache_alloc(uint8 drive, uint32 lba) {
+    if (bcache_free == BCACHE_NONE) {
+        uint32 victim = bcache_lru_tail;
+        if ((bcache_entries[victim].flags & BCACHE_DIRTY) && bcache_writeback(bcache_entries[victim].drive) != 0) {
+            return BCACHE_NONE;
+        }
+        bcache_drop(victim);
+        bcache_stats.evictions++;
+    }
+    uint32 i = bcache_free;
+    bcache_entry_t* e = &bcache_entries[i];
+    bcache_free = e->hash_next;
+    e->lba = lba;
+    e->drive = drive;
+    e->flags = BCACHE_VALID;
+    uint32 bucket = bcache_hash(drive, lba);
+    e->hash_next = bcache_buckets[bucket];
+    bcache_buckets[bucket] = i;
+    bcache_lru_push(i);
+    bcache_stats.used++;
+    return i;
+}
+
+// Uncached synchronous transfer
+static int bcache_io(uint8 drive, uint32 lba, uint32 count, uint8* buf, uint8 flags) {
+    block_request_t req;
+    block_request_init(&req, drive, lba, count, buf, flags);
+    if (block_submit(&req) != 0) return -1;
+    return block_wait(&req, ATA_REQUEST_TIMEOUT_MS);
+}
+
+static int bcache_cacheable(uint8 drive, uint32 count) {
+    return drive < BLOCK_MAX_DEVICES && bcache_init() && count <= bcache_stats.max_transfer;
+}
+
+// Write the drive's dirty sectors back if the oldest has waited too long or there are too many
+static int bcache_balance(uint8 drive) {
+    if (!bcache_dirty[drive]) return 0;
+    if (bcache_dirty[drive] <= bcache_stats.capacity / BCACHE_DIRTY_SHARE &&
+        !(timer_running() && timer_ms() - bcache_dirty_since[drive] >= BCACHE_DIRTY_AGE_MS)) return 0;
+    return bcache_writeback(drive);
+}
+
+int bcache_read(uint8 drive, uint32 lba, uint32 count, uint8* buf) {
+    if (!bcache_cacheable(drive, count)) return bcache_io(drive, lba, count, buf, 0);
+
+    uint32 i = 0;
+    while (i < count) {
+        uint32 slot = bcache_find(drive, lba + i);
+        if (slot != BCACHE_NONE) {
+            memcpy(buf + i * BLOCK_SECTOR_SIZE, bcache_sector(slot), BLOCK_SECTOR_SIZE);
+            bcache_touch(slot);
+            bcache_stats.hits++;
+            i++;
+            continue;
+        }
+        // Read the whole run of missing sectors with one request
+        uint32 run = 1;
+        while (i + run < count && bcache_find(drive, lba + i + run) == BCACHE_NONE) run++;
+        if (bcache_io(drive, lba + i, run, buf + i * BLOCK_SECTOR_SIZE, 0) != 0) return -1;
+        bcache_stats.misses += run;
+        bcache_insert(drive, lba + i, run, buf + i * BLOCK_SECTOR_SIZE);
+        i += run;
+    }
+    return 0;
+}
+
+int bcache_write(uint8 drive, uint32 lba, uint32 count, const uint8* buf) {
+    if (!bcache_cacheable(drive, count)) return bcache_io(drive, lba, count, (uint8*)buf, BLOCK_REQ_WRITE);
+
+    for (uint32 i = 0; i < count; i++) {
+        uint32 slot = bcache_find(drive, lba + i);
+        if (slot == BCACHE_NONE) slot = bcache_alloc(drive, lba + i);
+        if (slot == BCACHE_NONE) {
+            return bcache_io(drive, lba + i, count - i, (uint8*)buf + i * BLOCK_SECTOR_SIZE, BLOCK_REQ_WRITE);
+        }
+        memcpy(bcache_sector(slot), buf + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        if (!(bcache_entries[slot].flags & BCACHE_DIRTY)) {
+            bcache_entries[slot].flags |= BCACHE_DIRTY;
+            if (bcache_dirty[drive]++ == 0) bcache_dirty_since[drive] = timer_ms();
+            bcache_stats.dirty++;
+        }
+        bcache_touch(slot);
+    }
+    bcache_balance(drive); // A sector whose write-back fails stays dirty and is retried; block_flush reports the error
+    return 0;
+}
+
+int bcache_lookup(uint8 drive, uint32 lba, uint32 count, uint8* buf) {
+    if (bcache_state != BCACHE_READY || drive >= BLOCK_MAX_DEVICES) return -1;
+    for (uint32 i = 0; i < count; i++) {
+        if (bcache_find(drive, lba + i) == BCACHE_NONE) {
+            bcache_stats.misses += count;
+            return -1;
+        }
+    }
+    for (uint32 i = 0; i < count; i++) {
+        uint32 slot = bcache_find(drive, lba + i);
+        memcpy(buf + i * BLOCK_SECTOR_SIZE, bcache_sector(slot), BLOCK_SECTOR_SIZE);
+        bcache_touch(slot);
+    }
+    bcache_stats.hits += count;
+    return 0;
+}
+
+void bcache_insert(uint8 drive, uint32 lba, uint32 count, const uint8* buf) {
+    if (!bcache_cacheable(drive, count)) return;
+    for (uint32 i = 0; i < count; i++) {
+        // A sector already cached is at least as new as what the disk returned
+        if (bcache_find(drive, lba + i) != BCACHE_NONE) continue;
+        uint32 slot = bcache_alloc(drive, lba + i);
+        if (slot == BCACHE_NONE) return;
+        memcpy(bcache_sector(slot), buf + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+    }
+}
+
+void bcache_update(uint8 drive, uint32 lba, uint32 count, const uint8* buf) {
+    if (bcache_state != BCACHE_READY || drive >= BLOCK_MAX_DEVICES || bcache_stats.used == 0) return;
+    for (uint32 i = 0; i < count; i++) {
+        uint32 slot = bcache_find(drive, lba + i);
+        if (slot == BCACHE_NONE) continue;
+        // Write-back hands the cached sector itself to the block layer. A dirty sector stays
+        // dirty: the write may still fail, and writing it back again only repeats it.
+        if (bcache_sector(slot) != buf + i * BLOCK_SECTOR_SIZE) {
+            memcpy(bcache_sector(slot), buf + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        }
+    }
+}
+
+int bcache_writeback_range(uint8 drive, uint32 lba, uint32 count) {
+    if (bcache_state != BCACHE_READY || drive >= BLOCK_MAX_DEVICES || !bcache_dirty[drive]) return 0;
+    for (uint32 i = 0; i < count; i++) {
+        uint32 slot = bcache_find(drive, lba + i);
+        if (slot == BCACHE_NONE || !(bcache_entries[slot].flags & BCACHE_DIRTY)) continue;
+        if (bcache_io(drive, lba + i, 1, bcache_sector(slot), BLOCK_REQ_WRITE) != 0) return -1;
+        bcache_mark_clean(slot);
+        bcache_stats.writebacks++;
+    }
+    return 0;
+}
+
+// Completion of a write-back request; context is the entry written
+static void bcache_writeback_done(block_request_t* req, void* context) {
+    if (req->status == BLOCK_REQ_DONE) bcache_mark_clean((uint32)context);
+}
+
+int bcache_writeback(uint8 drive) {
+    if (bcache_state != BCACHE_READY || drive >= BLOCK_MAX_DEVICES || !bcache_dirty[drive]) return 0;
+
+    uint32 n = 0;
+    uint32* order = (uint32*)malloc(bcache_dirty[drive] * sizeof(uint32));
+    block_request_t* reqs = (block_request_t*)malloc(BCACHE_WRITEBACK_BATCH * sizeof(block_request_t));
+    int result = 0;
+    if (!order || !reqs) {
+        // No memory to batch: one sector at a time
+        for (uint32 i = 0; i < bcache_stats.capacity; i++) {
+            bcache_entry_t* e = &bcache_entries[i];
+            if (e->drive != drive || !(e->flags & BCACHE_DIRTY)) continue;
+            if (bcache_io(drive, e->lba, 1, bcache_sector(i), BLOCK_REQ_WRITE) != 0) {
+                result = -1;
+            } else {
+                bcache_mark_clean(i);
+                bcache_stats.writebacks++;
+            }
+        }
+        if (order) free(order);
+        if (reqs) free(reqs);
+        return result;
+    }
+
+    for (uint32 i = 0; i < bcache_stats.capacity; i++) {
+        if (bcache_entries[i].drive == drive && (bcache_entries[i].flags & BCACHE_DIRTY)) order[n++] = i;
+    }
+    // Shell sort by LBA so the elevator can merge neighbours into long writes
+    for (uint32 gap = n / 2; gap > 0; gap /= 2) {
+        for (uint32 i = gap; i < n; i++) {
+            uint32 slot = order[i];
+            uint32 j = i;
+            for (; j >= gap && bcache_entries[order[j - gap]].lba > bcache_entries[slot].lba; j -= gap) {
+                order[j] = order[j - gap];
+            }
+            order[j] = slot;
+        }
+    }
+
+    // Each sector is marked clean when its write completes; one that fails stays dirty
+    for (uint32 done = 0; done < n;) {
+        uint32 queued = 0;
+        block_plug(drive);
+        for (; done < n && queued < BCACHE_WRITEBACK_BATCH; done++) {
+            uint32 slot = order[done];
+            block_request_init(&reqs[queued], drive, bcache_entries[slot].lba, 1, bcache_sector(slot), BLOCK_REQ_WRITE);
+            reqs[queued].callback = bcache_writeback_done;
+            reqs[queued].context = (void*)slot;
+            if (block_submit(&reqs[queued]) != 0) { result = -1; continue; }
+            queued++;
+        }
+        block_unplug(drive);
+        for (uint32 k = 0; k < queued; k++) {
+            if (block_wait(&reqs[k], ATA_REQUEST_TIMEOUT_MS) != 0) result = -1;
+            else bcache_stats.writebacks++;
+        }
+    }
+    free(reqs);
+    free(order);
+    return result;
+}
+
+int bcache_invalidate(uint8 drive) {
+    if (bcache_state != BCACHE_READY || drive >= BLOCK_MAX_DEVICES) return 0;
+    int result = bcache_writeback(drive);
+    for (uint32 i = 0; i < bcache_stats.capacity; i++) {
+        bcache_entry_t* e = &bcache_entries[i];
+        // A sector that failed to write back is the only copy of its data
+        if (e->drive == drive && e->flags == BCACHE_VALID) bcache_drop(i);
+    }
+    return result;
+}
+
+int bcache_flush_idle(void) {
+    if (bcache_state != BCACHE_READY || bcache_stats.dirty == 0) return 0;
+    int result = 0;
+    for (uint8 drive = 0; drive < BLOCK_MAX_DEVICES; drive++) {
+        if (bcache_balance(drive) != 0) result = -1;
+    }
+    return result;
+}
+
+void bcache_get_stats(bcache_stats_t* stats) {
+    bcache_init();
+    *stats = bcache_stats;
+}
+
+void bcache_reset_stats(void) {
+    bcache_stats.hits = 0;
+    bcache_stats.misses = 0;
+    bcache_stats.writebacks = 0;
+    bcache_stats.evictions = 0;
+}
@@ -0,0 +1,284 @@
+#include <types.h>
+#include <system.h>
+#include <string.h>
+#include <util.h>
+#include <ata.h>
+#include <block.h>
+#include <bcache.h>
+
+// Transfer slot states
+#define BLOCK_IO_FREE     0
+#define BLOCK_IO_INFLIGHT 1
+#define BLOCK_IO_DONE     2  // Finished; its bounce buffer is released on the next allocation
+
+// Requests block_fill keeps queued at once
+#define BLOCK_FILL_BATCH BLOCK_MAX_MERGE_SECTORS
+
+static block_device_t block_devices[BLOCK_MAX_DEVICES];
+static block_io_t block_ios[BLOCK_MAX_INFLIGHT];
+
+// ATA drive numbers (IDE, AHCI and virtio-blk alike) are the only devices for now
+static uint32 block_ata_capacity(uint8 drive) {
+    return ata_drive_sectors(drive);
+}
+
+static int block_ata_submit(uint8 drive, block_io_t* io) {
+    (void)drive;
+    return ata_submit(&io->ata);
+}
+
+static int block_ata_wait(block_io_t* io, uint32 timeout_ms) {
+    return ata_wait(&io->ata, timeout_ms);
+}
+
+static const block_ops_t block_ata_ops = {
+    "ata",
+    block_ata_capacity,
+    block_ata_submit,
+    block_ata_wait,
+    ata_plug,
+    ata_unplug,
+    ata_flush,
+};
+
+block_device_t* block_get_device(uint8 drive) {
+    if (drive >= BLOCK_MAX_DEVICES) return NULL;
+    block_device_t* dev = &block_devices[drive];
+    if (!dev->ops) {
+        dev->drive = drive;
+        dev->ops = &block_ata_ops;
+    }
+    return dev;
+}
+
+void block_request_init(block_request_t* req, uint8 drive, uint32 lba, uint32 count, uint8* buf, uint8 flags) {
+    req->drive = drive;
+    req->flags = flags & BLOCK_REQ_WRITE;
+    req->status = BLOCK_REQ_IDLE;
+    req->lba = lba;
+    req->count = count;
+    req->buf = buf;
+    req->callback = NULL;
+    req->context = NULL;
+    req->io = NULL;
+    req->next = NULL;
+}
+
+// Driver callback: hand the result to every request the transfer covered
+static void block_io_complete(ata_request_t* ata, void* context) {
+    block_io_t* io = (block_io_t*)context;
+    uint8 status = (ata->status == ATA_REQ_DONE) ? BLOCK_REQ_DONE : BLOCK_REQ_ERROR;
+    uint32 offset = 0;
+
+    block_request_t* req = io->requests;
+    io->requests = NULL;
+    while (req) {
+        block_request_t* next = req->next; // The callback may recycle req
+        if (io->bounce && !(req->flags & BLOCK_REQ_WRITE) && status == BLOCK_REQ_DONE) {
+            memcpy(req->buf, io->bounce + offset, req->count * BLOCK_SECTOR_SIZE);
+        }
+        offset += req->count * BLOCK_SECTOR_SIZE;
+        req->next = NULL;
+        req->status = status;
+        if (req->callback) req->callback(req, req->context);
+        req = next;
+    }
+
+    // free() is not safe here; a bounced transfer is reclaimed by the next allocation
+    io->state = io->bounce ? BLOCK_IO_DONE : BLOCK_IO_FREE;
+}
+
+// Get a free transfer slot, waiting for one in flight if all are busy
+static block_io_t* block_io_alloc(void) {
+    for (;;) {
+        block_io_t* busy = NULL;
+        for (int i = 0; i < BLOCK_MAX_INFLIGHT; i++) {
+            block_io_t* io = &block_ios[i];
+            if (io->state == BLOCK_IO_DONE) {
+                free(io->bounce);
+                io->bounce = NULL;
+                io->state = BLOCK_IO_FREE;
+            }
+            if (io->state == BLOCK_IO_FREE) return io;
+            if (!busy) busy = io;
+        }
+        block_device_t* dev = block_get_device(busy->ata.drive);
+        dev->ops->wait(busy, ATA_REQUEST_TIMEOUT_MS);
+    }
+}
+
+// Whether `next` can join a transfer that currently ends with `last` and spans `count` sectors
+static int block_can_merge(const block_request_t* last, const block_request_t* next, uint32 count) {
+    if ((last->flags & BLOCK_REQ_WRITE) != (next->flags & BLOCK_REQ_WRITE)) return 0;
+    if (last->lba + last->count != next->lba) return 0;
+    return count + next->count <= BLOCK_MAX_MERGE_SECTORS;
+}
+
+// Elevator: the queue is already in LBA order, so walk it once, coalescing runs of adjacent
+// requests into single transfers
+static void block_dispatch(block_device_t* dev) {
+    if (!dev->queue) return;
+    if (dev->ops->plug) dev->ops->plug(dev->drive);
+
+    while (dev->queue) {
+        block_request_t* first = dev->queue;
+        block_request_t* last = first;
+        uint32 count = first->count;
+        uint32 members = 1;
+        int contiguous = 1;
+        while (last->next && block_can_merge(last, last->next, count)) {
+            if (last->buf + last->count * BLOCK_SECTOR_SIZE != last->next->buf) contiguous = 0;
+            last = last->next;
+            count += last->count;
+            members++;
+        }
+
+        uint8* bounce = NULL;
+        if (!contiguous) {
+            bounce = (uint8*)malloc(count * BLOCK_SECTOR_SIZE);
+            if (!bounce) {
+                // No memory to gather into: send the first request on its own
+                last = first;
+                count = first->count;
+                members = 1;
+            }
+        }
+
+        block_io_t* io = block_io_alloc();
+        dev->queue = last->next;
+        last->next = NULL;
+
+        io->bounce = bounce;
+        io->requests = first;
+        uint32 offset = 0;
+        for (block_request_t* req = first; req; req = req->next) {
+            if (bounce && (req->flags & BLOCK_REQ_WRITE)) {
+                memcpy(bounce + offset, req->buf, req->count * BLOCK_SECTOR_SIZE);
+            }
+            offset += req->count * BLOCK_SECTOR_SIZE;
+            req->io = io;
+            req->status = BLOCK_REQ_ACTIVE;
+        }
+
+        ata_request_init(&io->ata, dev->drive, first->lba, count, bounce ? bounce : first->buf,
+                         (first->flags & BLOCK_REQ_WRITE) ? ATA_REQ_WRITE : 0);
+        io->ata.callback = block_io_complete;
+        io->ata.context = io;
+        io->state = BLOCK_IO_INFLIGHT;
+
+        dev->dispatched++;
+        dev->merged += members - 1;
+        if (dev->ops->submit(dev->drive, io) != 0) {
+            io->ata.status = ATA_REQ_ERROR;
+            block_io_complete(&io->ata, io);
+        }
+    }
+
+    if (dev->ops->unplug) dev->ops->unplug(dev->drive);
+}
+
+static int block_overlaps(const block_request_t* a, const block_request_t* b) {
+    return a->lba < b->lba + b->count && b->lba < a->lba + a->count;
+}
+
+int block_submit(block_request_t* req) {
+    block_device_t* dev = block_get_device(req->drive);
+    if (!dev || req->count == 0) return -1;
+
+    uint32 capacity = dev->ops->capacity(dev->drive);
+    if (capacity && (req->lba >= capacity || req->count > capacity - req->lba)) return -1;
+
+    // Keep the buffer cache coherent with transfers that go around it
+    if (req->flags & BLOCK_REQ_WRITE) bcache_update(req->drive, req->lba, req->count, req->buf);
+    else if (bcache_writeback_range(req->drive, req->lba, req->count) != 0) return -1;
+
+    // Sorted insert. A request never moves ahead of one it overlaps, so a read queued after
+    // a write to the same sectors still sees the new data.
+    block_request_t** pos = &dev->queue;
+    for (block_request_t* r = dev->queue; r; r = r->next) {
+        if (r->lba <= req->lba || block_overlaps(r, req)) pos = &r->next;
+    }
+    req->status = BLOCK_REQ_PENDING;
+    req->io = NULL;
+    req->next = *pos;
+    *pos = req;
+    dev->submitted++;
+
+    if (!dev->plugged) block_dispatch(dev);
+    return 0;
+}
+
+void block_plug(uint8 drive) {
+    block_device_t* dev = block_get_device(drive);
+    if (dev) dev->plugged++;
+}
+
+void block_unplug(uint8 drive) {
+    block_device_t* dev = block_get_device(drive);
+    if (!dev || !dev->plugged) return;
+    if (--dev->plugged == 0) block_dispatch(dev);
+}
+
+int block_wait(block_request_t* req, uint32 timeout_ms) {
+    block_device_t* dev = block_get_device(req->drive);
+    if (!dev) return -1;
+
+    // Waiting on a held request means the caller needs it now
+    if (req->status == BLOCK_REQ_PENDING) block_dispatch(dev);
+    if (req->status == BLOCK_REQ_ACTIVE) dev->ops->wait(req->io, timeout_ms);
+    return req->status == BLOCK_REQ_DONE ? 0 : -1;
+}
+
+int block_flush(uint8 drive) {
+    block_device_t* dev = block_get_device(drive);
+    if (!dev) return -1;
+
+    int result = bcache_writeback(drive);
+    block_dispatch(dev);
+    for (int i = 0; i < BLOCK_MAX_INFLIGHT; i++) {
+        block_io_t* io = &block_ios[i];
+        if (io->state == BLOCK_IO_INFLIGHT && io->ata.drive == drive) {
+            dev->ops->wait(io, ATA_REQUEST_TIMEOUT_MS);
+        }
+    }
+    if (dev->ops->flush && dev->ops->flush(drive) != 0) result = -1;
+    return result;
+}
+
+int block_read(uint8 drive, uint32 lba, uint32 count, uint8* buf) {
+    return bcache_read(drive, lba, count, buf);
+}
+
+int block_write(uint8 drive, uint32 lba, uint32 count, const uint8* buf) {
+    return bcache_write(drive, lba, count, buf);
+}
+
+int block_fill(uint8 drive, uint32 lba, uint32 count, const uint8* sector) {
+    block_request_t* reqs = (block_request_t*)malloc(BLOCK_FILL_BATCH * sizeof(block_request_t));
+    if (!reqs) {
+        for (uint32 i = 0; i < count; i++) {
+            if (block_write(drive, lba + i, 1, sector) != 0) return -1;
+        }
+        return 0;
+    }
+
+    // One request per sector; the elevator gathers each batch into a few large writes
+    int result = 0;
+    while (count > 0 && result == 0) {
+        uint32 batch = count < BLOCK_FILL_BATCH ? count : BLOCK_FILL_BATCH;
+        uint32 queued = 0;
+        block_plug(drive);
+        for (; queued < batch; queued++) {
+            block_request_init(&reqs[queued], drive, lba + queued, 1, (uint8*)sector, BLOCK_REQ_WRITE);
+            if (block_submit(&reqs[queued]) != 0) { result = -1; break; }
+        }
+        block_unplug(drive);
+        for (uint32 i = 0; i < queued; i++) {
+            if (block_wait(&reqs[i], ATA_REQUEST_TIMEOUT_MS) != 0) result = -1;
+        }
+        lba += batch;
+        count -= batch;
+    }
+    free(reqs);
+    return result;
+}
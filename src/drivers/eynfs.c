@@ -5,35 +5,156 @@
 #include <util.h>
 #include <math.h> // For quicksort and boyer-moore
 #include <stdint.h>
+#include <block.h>
+#include <bcache.h>
+#include <timer.h>
 
-// Forward declarations for ATA sector I/O
-extern int ata_read_sector(uint8 drive, uint32 lba, uint8* buf);
-extern int ata_write_sector(uint8 drive, uint32 lba, const uint8* buf);
+#define EYNFS_SUPERBLOCK_LBA 2048 // Standard superblock location (a sector, not a block number)
 
-#define EYNFS_BLOCK_SIZE 512 // For now, fixed block size
-#define EYNFS_SUPERBLOCK_LBA 2048 // Standard superblock location
+// Block size of each drive's filesystem, learned from its superblock (0 = not seen yet, 512)
+#define EYNFS_MAX_DRIVES 8
+static uint16_t drive_block_size[EYNFS_MAX_DRIVES];
+
+static uint32_t eynfs_bsize(uint8 drive) {
+    if (drive < EYNFS_MAX_DRIVES && drive_block_size[drive]) return drive_block_size[drive];
+    return EYNFS_BLOCK_SIZE;
+}
+
+// Sectors per block
+static uint32_t eynfs_spb(uint8 drive) {
+    return eynfs_bsize(drive) / BLOCK_SECTOR_SIZE;
+}
+
+// A mounted drive. Its superblock is read (and its journal replayed) the first time anything
+// asks for it; later reads are answered from memory. Changes are written back at the next
+// consistency point, and only if a field actually changed.
+typedef struct {
+    uint8_t mounted;
+    uint8_t dirty;      // sb has changed since it was last written
+    uint32_t lba;       // Sector holding the superblock
+    eynfs_superblock_t sb;
+} eynfs_mount_t;
+
+static eynfs_mount_t mounts[EYNFS_MAX_DRIVES];
+
+// Metadata journal (v14). Metadata blocks changed by an operation are kept in memory as images
+// of their home blocks instead of being written in place. A commit writes every image changed
+// since the last one to the log as a single sequential record; a checkpoint later writes the
+// logged images home and empties the log. Reads see the images until then. Operations join
+// the running transaction and are committed in groups, so a burst of them costs one journal
+// write, and a block they all touch (a bitmap or directory block) goes home only once.
+#define EYNFS_JOURNAL_GROUP_OPS 64  // Operations per group commit
+#define EYNFS_JOURNAL_GROUP_MS  500 // Commit sooner once the running transaction is this old (also when idle)
+#define EYNFS_JOURNAL_BATCH 16      // Checkpoint writes queued at once
+
+#define EYNFS_JIMAGE_RUNNING 0x01   // Changed in the running transaction
+#define EYNFS_JIMAGE_LOGGED  0x02   // A committed version is in the log, awaiting checkpoint
+
+typedef struct {
+    uint32_t block;
+    uint8_t flags;
+    uint8_t *data;      // Newest contents
+    uint8_t *frozen;    // Logged contents, once the running transaction has changed the block
+} eynfs_jimage_t;
 
-// Performance optimization: Block cache
-#define EYNFS_CACHE_SIZE 16
 typedef struct {
-    uint32_t block_num;
-    uint8_t data[EYNFS_BLOCK_SIZE];
-    uint8_t dirty;
     uint8_t valid;
-} eynfs_cache_entry_t;
+    uint8 drive;
+    uint32_t start;     // Header block; the log follows it
+    uint32_t blocks;    // Journal length, header included
+    uint32_t sequence;  // Sequence number of the next commit
+    uint32_t head;      // Log position (relative to start) of the next commit
+    uint32_t max_txn;   // Most images one commit carries
+    eynfs_jimage_t *images;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t running;   // Images changed in the running transaction
+    uint32_t ops;       // Operations in the running transaction
+    uint32_t began;     // timer_ms() when the running transaction took its first image
+    eynfs_extent_t *freed; // Blocks the running transaction freed. Until it commits they may
+    uint32_t freed_count;  // still hold data the on-disk metadata points to, so they aren't
+    uint32_t freed_capacity; // handed out again.
+} eynfs_journal_t;
 
-static eynfs_cache_entry_t block_cache[EYNFS_CACHE_SIZE];
-static uint32_t cache_hits = 0;
-static uint32_t cache_misses = 0;
+// Each mounted drive keeps its own journal, so working on one volume never checkpoints another
+static eynfs_journal_t journals[EYNFS_MAX_DRIVES];
 
-// Performance optimization: Free block tracking
-#define EYNFS_FREE_BLOCK_CACHE_SIZE 64
-static uint32_t free_block_cache[EYNFS_FREE_BLOCK_CACHE_SIZE];
-static uint32_t free_block_cache_count = 0;
-static uint8_t free_block_cache_valid = 0;
+static eynfs_journal_t* eynfs_journal_for(uint8 drive) {
+    return drive < EYNFS_MAX_DRIVES && journals[drive].valid ? &journals[drive] : NULL;
+}
 
-// Performance optimization: Directory entry cache
+static eynfs_jimage_t* eynfs_journal_find(eynfs_journal_t *jr, uint32_t block) {
+    for (uint32_t i = 0; i < jr->count; i++) {
+        if (jr->images[i].block == block) return &jr->images[i];
+    }
+    return NULL;
+}
+
+// Lay journal images over sectors just read, so reads see metadata that isn't home yet
+static void eynfs_journal_overlay(uint8 drive, uint32_t lba, uint32_t sectors, uint8_t *buf) {
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (!jr) return;
+    uint32_t spb = eynfs_spb(drive);
+    for (uint32_t i = 0; i < jr->count; i++) {
+        uint32_t first = jr->images[i].block * spb;
+        uint32_t from = first > lba ? first : lba;
+        uint32_t to = first + spb < lba + sectors ? first + spb : lba + sectors;
+        if (from >= to) continue;
+        memcpy(buf + (from - lba) * BLOCK_SECTOR_SIZE, jr->images[i].data + (from - first) * BLOCK_SECTOR_SIZE,
+               (to - from) * BLOCK_SECTOR_SIZE);
+    }
+}
+
+// Block-addressed wrappers around the block layer, which serves them from the buffer cache
+// (bcache.h). Metadata reads go through these so they see the journal.
+static int eynfs_dev_read_sectors(uint8 drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if (block_read(drive, lba, count, buf) != 0) return -1;
+    eynfs_journal_overlay(drive, lba, count, buf);
+    return 0;
+}
+
+static int eynfs_dev_read(uint8 drive, uint32_t block, uint32_t count, uint8_t* buf) {
+    uint32_t spb = eynfs_spb(drive);
+    return eynfs_dev_read_sectors(drive, block * spb, count * spb, buf);
+}
+
+static int eynfs_dev_write(uint8 drive, uint32_t block, uint32_t count, const uint8_t* buf) {
+    uint32_t spb = eynfs_spb(drive);
+    return block_write(drive, block * spb, count * spb, buf);
+}
+
+static void eynfs_request_init(block_request_t* req, uint8 drive, uint32_t block, uint32_t count, uint8_t* buf, uint8 flags) {
+    uint32_t spb = eynfs_spb(drive);
+    block_request_init(req, drive, block * spb, count * spb, buf, flags);
+}
+
+// Performance optimization: Resident free block bitmap
+// Every bitmap block stays in memory, and a summary tier keeps each block's free count so
+// allocation goes straight to a bitmap block with space instead of scanning full ones.
+// Changed bitmap blocks are written back at the next consistency point (eynfs_sync).
 typedef struct {
+    uint8_t valid;
+    uint8 drive;
+    uint32_t map_block;     // First bitmap block on disk
+    uint32_t blocks;        // Bitmap blocks
+    uint32_t block_size;
+    uint32_t total_blocks;  // Blocks the bitmap covers
+    uint8_t *bits;          // blocks * block_size bytes, 1 = used
+    uint16_t *free_count;   // Summary tier: free blocks tracked by each bitmap block
+    uint8_t *dirty;         // Bitmap blocks changed since the last write-back
+    uint32_t free_total;
+    uint32_t next;          // Next-fit cursor: allocations continue here so files stay contiguous
+} eynfs_bitmap_t;
+
+static eynfs_bitmap_t block_bitmap;
+
+// Directory chains longer than this are not followed
+#define EYNFS_DIR_MAX_BLOCKS 32
+
+// Performance optimization: Directory entry cache, keyed by (drive, table block) like the
+// chain cache: images made by the same formatter share block numbers
+typedef struct {
+    uint8 drive;
     uint32_t dir_block;
     eynfs_dir_entry_t* entries;
     int count;
@@ -42,15 +163,76 @@ typedef struct {
 
 #define EYNFS_DIR_CACHE_SIZE 8
 static eynfs_dir_cache_entry_t dir_cache[EYNFS_DIR_CACHE_SIZE];
+static int dir_cache_victim = 0;
+
+// Performance optimization: Path lookup (dentry) cache
+// Maps (drive, parent directory, name) to the entry and its index, so resolving a path that
+// was resolved before costs no reads. Negative entries remember names that aren't there.
+// Single-slot updates keep it current; a directory relinked, rewritten or freed drops its names.
+typedef struct {
+    uint8_t valid;
+    uint8_t negative;       // The name is known not to exist; only entry.name is set
+    uint8 drive;
+    uint32_t parent;
+    uint32_t index;
+    uint32_t used;          // Last use, for replacement within the set
+    eynfs_dir_entry_t entry;
+} eynfs_dentry_t;
+
+#define EYNFS_DENTRY_SETS 64
+#define EYNFS_DENTRY_WAYS 4
+static eynfs_dentry_t dentries[EYNFS_DENTRY_SETS][EYNFS_DENTRY_WAYS];
+static uint32_t dentry_clock = 0;
+
+// Recently walked directory chains, so finding the block that holds entry i costs no reads.
+// A directory's chain is forgotten whenever it may have been relinked or freed.
+typedef struct {
+    uint8_t valid;
+    uint8 drive;
+    uint32_t dir_block;
+    int count;
+    uint32_t blocks[EYNFS_DIR_MAX_BLOCKS];
+} eynfs_dir_chain_cache_t;
+
+#define EYNFS_DIR_CHAIN_CACHE_SIZE 4
+static eynfs_dir_chain_cache_t dir_chains[EYNFS_DIR_CHAIN_CACHE_SIZE];
+static int dir_chain_victim = 0;
+
+// Performance optimization: Chain batching
+// Physically adjacent chain blocks are moved with one multi-sector ATA command. Batches are
+// sized in bytes so large blocks don't inflate the buffers.
+#define EYNFS_CHAIN_BATCH_BYTES 8192
+
+static uint32_t eynfs_chain_batch(uint8 drive) {
+    return EYNFS_CHAIN_BATCH_BYTES / eynfs_bsize(drive);
+}
+
+// Performance optimization: Sequential read-ahead
+// Files read in order (from offset 0, or where the last read ended) have the blocks ahead of
+// the reader fetched into the buffer cache in one transfer. The window starts small and
+// doubles on each prefetch that turns out to be needed; any other access turns it off.
+typedef struct {
+    uint8_t valid;
+    uint8 drive;
+    uint32_t first_block;   // Identifies the file
+    uint32_t next_offset;   // Where a sequential read continues
+    uint32_t ahead;         // File blocks below this one have been prefetched
+    uint32_t window;        // Blocks the next prefetch fetches, 0 while access looks random
+} eynfs_readahead_t;
+
+#define EYNFS_READAHEAD_STREAMS 4
+#define EYNFS_READAHEAD_MIN 4
+#define EYNFS_READAHEAD_MAX 64
+static eynfs_readahead_t readahead[EYNFS_READAHEAD_STREAMS];
+static int readahead_victim = 0;
+
+// Data bytes in a chained (v11) file block, after its next pointer
+static uint32_t eynfs_payload_size(uint8 drive) {
+    return eynfs_bsize(drive) - 4;
+}
 
 // Initialize caches
 static void eynfs_init_caches() {
-    // Initialize block cache
-    for (int i = 0; i < EYNFS_CACHE_SIZE; i++) {
-        block_cache[i].valid = 0;
-        block_cache[i].dirty = 0;
-    }
-    
     // Initialize directory cache
     for (int i = 0; i < EYNFS_DIR_CACHE_SIZE; i++) {
         dir_cache[i].entries = NULL;
@@ -58,84 +240,506 @@ static void eynfs_init_caches() {
         dir_cache[i].sorted = 0;
     }
     
-    // Initialize free block cache
-    free_block_cache_valid = 0;
-    free_block_cache_count = 0;
 }
 
-// Block cache functions
-static int eynfs_cache_get_block(uint8 drive, uint32_t block_num, uint8_t* data) {
-    // Look for block in cache
-    for (int i = 0; i < EYNFS_CACHE_SIZE; i++) {
-        if (block_cache[i].valid && block_cache[i].block_num == block_num) {
-            // Cache hit - copy data
-            memcpy(data, block_cache[i].data, EYNFS_BLOCK_SIZE);
-            cache_hits++;
-            return 0;
+// --- Metadata journal ---
+
+static uint32_t eynfs_journal_checksum(uint32_t sum, const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i += 4) {
+        sum ^= *(const uint32_t*)(data + i);
+        sum *= 16777619; // FNV prime
+    }
+    return sum;
+}
+
+static void eynfs_journal_remove(eynfs_journal_t *jr, uint32_t i) {
+    if (jr->images[i].flags & EYNFS_JIMAGE_RUNNING) jr->running--;
+    free(jr->images[i].data);
+    if (jr->images[i].frozen) free(jr->images[i].frozen);
+    jr->images[i] = jr->images[--jr->count];
+}
+
+static void eynfs_journal_release(eynfs_journal_t *jr) {
+    while (jr->count) eynfs_journal_remove(jr, jr->count - 1);
+    if (jr->images) free(jr->images);
+    if (jr->freed) free(jr->freed);
+    memset(jr, 0, sizeof(eynfs_journal_t));
+}
+
+// Checkpoint: write every logged image home, then move the header's sequence number past the
+// log so it replays nothing. Images the running transaction has changed since are kept.
+static int eynfs_journal_checkpoint(eynfs_journal_t *jr) {
+    if (jr->head == 1) return 0; // Log already empty
+    block_request_t reqs[EYNFS_JOURNAL_BATCH];
+    uint32_t i = 0;
+    int failed = 0;
+    while (i < jr->count && !failed) {
+        uint32_t queued = 0;
+        block_plug(jr->drive);
+        for (; i < jr->count && queued < EYNFS_JOURNAL_BATCH; i++) {
+            eynfs_jimage_t *im = &jr->images[i];
+            if (!(im->flags & EYNFS_JIMAGE_LOGGED)) continue;
+            eynfs_request_init(&reqs[queued], jr->drive, im->block, 1, im->frozen ? im->frozen : im->data, BLOCK_REQ_WRITE);
+            if (block_submit(&reqs[queued]) != 0) { failed = 1; break; }
+            queued++;
+        }
+        block_unplug(jr->drive);
+        for (uint32_t k = 0; k < queued; k++) {
+            if (block_wait(&reqs[k], ATA_REQUEST_TIMEOUT_MS) != 0) failed = 1;
         }
     }
-    
-    // Cache miss - read from disk
-    if (ata_read_sector(drive, block_num, data) != 0) return -1;
-    
-    // Find least recently used cache entry
-    int lru_index = 0;
-    uint32_t oldest_time = 0xFFFFFFFF;
-    for (int i = 0; i < EYNFS_CACHE_SIZE; i++) {
-        if (!block_cache[i].valid) {
-            lru_index = i;
-            break;
+    if (failed || block_flush(jr->drive) != 0) return -1;
+    
+    uint8 sector[BLOCK_SECTOR_SIZE] = {0};
+    eynfs_journal_header_t *hdr = (eynfs_journal_header_t*)sector;
+    hdr->magic = EYNFS_JOURNAL_MAGIC;
+    hdr->sequence = jr->sequence;
+    if (block_write(jr->drive, jr->start * eynfs_spb(jr->drive), 1, sector) != 0 || block_flush(jr->drive) != 0) return -1;
+    
+    jr->head = 1;
+    i = 0;
+    while (i < jr->count) {
+        eynfs_jimage_t *im = &jr->images[i];
+        if (im->flags & EYNFS_JIMAGE_LOGGED) {
+            im->flags &= ~EYNFS_JIMAGE_LOGGED;
+            if (im->frozen) {
+                free(im->frozen);
+                im->frozen = NULL;
+            } else if (!(im->flags & EYNFS_JIMAGE_RUNNING)) {
+                eynfs_journal_remove(jr, i);
+                continue;
+            }
         }
-        // Simple LRU: use block number as time (lower = older)
-        if (block_cache[i].block_num < oldest_time) {
-            oldest_time = block_cache[i].block_num;
-            lru_index = i;
+        i++;
+    }
+    return 0;
+}
+
+// Commit the running transaction as one log record: descriptor, images, commit block, queued
+// under one plug so they go out as a single sequential transfer. File data the same operations
+// wrote is flushed first, so a replayed transaction never names data that didn't reach the disk.
+static int eynfs_journal_commit(eynfs_journal_t *jr) {
+    if (jr->running == 0) return 0;
+    uint32_t n = jr->running;
+    if (jr->head + n + 2 > jr->blocks && eynfs_journal_checkpoint(jr) != 0) return -1;
+    
+    uint32_t bs = eynfs_bsize(jr->drive);
+    uint8 *desc = (uint8*)malloc(2 * bs); // Descriptor, then commit block
+    block_request_t *reqs = (block_request_t*)malloc((n + 2) * sizeof(block_request_t));
+    if (!desc || !reqs) {
+        if (desc) free(desc);
+        if (reqs) free(reqs);
+        return -1;
+    }
+    memset(desc, 0, 2 * bs);
+    eynfs_journal_header_t *hdr = (eynfs_journal_header_t*)desc;
+    hdr->magic = EYNFS_JOURNAL_DESC_MAGIC;
+    hdr->sequence = jr->sequence;
+    hdr->count = n;
+    uint32_t *tags = (uint32_t*)(desc + sizeof(eynfs_journal_header_t));
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < jr->count; i++) {
+        if (jr->images[i].flags & EYNFS_JIMAGE_RUNNING) tags[k++] = jr->images[i].block;
+    }
+    uint32_t sum = eynfs_journal_checksum(0x811C9DC5, desc, bs);
+    for (uint32_t i = 0; i < jr->count; i++) {
+        if (jr->images[i].flags & EYNFS_JIMAGE_RUNNING) sum = eynfs_journal_checksum(sum, jr->images[i].data, bs);
+    }
+    eynfs_journal_header_t *commit = (eynfs_journal_header_t*)(desc + bs);
+    commit->magic = EYNFS_JOURNAL_COMMIT_MAGIC;
+    commit->sequence = jr->sequence;
+    commit->count = n;
+    commit->checksum = sum;
+    
+    int failed = block_flush(jr->drive) != 0;
+    uint32_t at = jr->start + jr->head;
+    uint32_t queued = 0;
+    if (!failed) {
+        block_plug(jr->drive);
+        eynfs_request_init(&reqs[queued], jr->drive, at, 1, desc, BLOCK_REQ_WRITE);
+        failed = block_submit(&reqs[queued]) != 0;
+        if (!failed) queued++;
+        for (uint32_t i = 0; i < jr->count && !failed; i++) {
+            if (!(jr->images[i].flags & EYNFS_JIMAGE_RUNNING)) continue;
+            eynfs_request_init(&reqs[queued], jr->drive, at + queued, 1, jr->images[i].data, BLOCK_REQ_WRITE);
+            if (block_submit(&reqs[queued]) != 0) failed = 1;
+            else queued++;
+        }
+        if (!failed) {
+            eynfs_request_init(&reqs[queued], jr->drive, at + queued, 1, desc + bs, BLOCK_REQ_WRITE);
+            if (block_submit(&reqs[queued]) != 0) failed = 1;
+            else queued++;
         }
+        block_unplug(jr->drive);
     }
-    
-    // Write dirty block if needed
-    if (block_cache[lru_index].valid && block_cache[lru_index].dirty) {
-        ata_write_sector(drive, block_cache[lru_index].block_num, block_cache[lru_index].data);
+    for (uint32_t i = 0; i < queued; i++) {
+        if (block_wait(&reqs[i], ATA_REQUEST_TIMEOUT_MS) != 0) failed = 1;
     }
-    
-    // Cache the new block
-    block_cache[lru_index].block_num = block_num;
-    memcpy(block_cache[lru_index].data, data, EYNFS_BLOCK_SIZE);
-    block_cache[lru_index].valid = 1;
-    block_cache[lru_index].dirty = 0;
-    
-    cache_misses++;
+    free(reqs);
+    free(desc);
+    if (failed || block_flush(jr->drive) != 0) return -1;
+    
+    // The log now holds the newest contents, so any older logged copy can go
+    for (uint32_t i = 0; i < jr->count; i++) {
+        eynfs_jimage_t *im = &jr->images[i];
+        if (!(im->flags & EYNFS_JIMAGE_RUNNING)) continue;
+        im->flags = EYNFS_JIMAGE_LOGGED;
+        if (im->frozen) {
+            free(im->frozen);
+            im->frozen = NULL;
+        }
+    }
+    jr->head += n + 2;
+    jr->sequence++;
+    jr->running = 0;
+    jr->ops = 0;
+    jr->freed_count = 0;
     return 0;
 }
 
-static int eynfs_cache_write_block(uint8 drive, uint32_t block_num, const uint8_t* data) {
-    // Look for block in cache
-    for (int i = 0; i < EYNFS_CACHE_SIZE; i++) {
-        if (block_cache[i].valid && block_cache[i].block_num == block_num) {
-            // Update cache
-            memcpy(block_cache[i].data, data, EYNFS_BLOCK_SIZE);
-            block_cache[i].dirty = 1;
-            return 0;
+// The running transaction's image of a block, for the caller to change in place. A new image
+// starts as the block's current contents if `fill` is set. A full transaction is committed
+// first, and when memory runs short the journal is checkpointed to free its images.
+static uint8_t* eynfs_journal_image(eynfs_journal_t *jr, uint32_t block, int fill) {
+    eynfs_jimage_t *im = eynfs_journal_find(jr, block);
+    if (im && (im->flags & EYNFS_JIMAGE_RUNNING)) return im->data;
+    
+    uint32_t bs = eynfs_bsize(jr->drive);
+    if (jr->running >= jr->max_txn && eynfs_journal_commit(jr) != 0) return NULL;
+    uint8_t *data = (uint8_t*)malloc(bs);
+    if (!data && eynfs_journal_commit(jr) == 0 && eynfs_journal_checkpoint(jr) == 0) {
+        data = (uint8_t*)malloc(bs);
+    }
+    if (!data) return NULL;
+    
+    im = eynfs_journal_find(jr, block); // A commit or checkpoint above may have moved it
+    if (im) {
+        // Logged and unchanged since: the checkpoint still needs the logged contents
+        memcpy(data, im->data, bs);
+        im->frozen = im->data;
+        im->data = data;
+    } else {
+        if (jr->count == jr->capacity || (fill && eynfs_dev_read(jr->drive, block, 1, data) != 0)) {
+            free(data);
+            return NULL;
+        }
+        im = &jr->images[jr->count++];
+        im->block = block;
+        im->flags = 0;
+        im->data = data;
+        im->frozen = NULL;
+    }
+    if (jr->running == 0) jr->began = timer_ms();
+    im->flags |= EYNFS_JIMAGE_RUNNING;
+    jr->running++;
+    return im->data;
+}
+
+// Put whole metadata blocks into the running transaction. Returns 1 if the drive has no
+// journal (the caller writes them to disk itself), 0 once they are in, -1 on error.
+static int eynfs_journal_write(uint8 drive, uint32_t block_num, uint32_t count, const uint8_t *data) {
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (!jr) return 1;
+    uint32_t bs = eynfs_bsize(drive);
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t *image = eynfs_journal_image(jr, block_num + i, 0);
+        if (!image) return -1;
+        memcpy(image, data + i * bs, bs);
+    }
+    return 0;
+}
+
+// File data is about to be written to blocks that may have held metadata earlier in the
+// journal's life. No image of them may be written over the data later, at checkpoint or at
+// replay, so logged ones are checkpointed now and the rest dropped.
+static int eynfs_journal_forget(uint8 drive, uint32_t block_num, uint32_t count) {
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (!jr) return 0;
+    int logged = 0;
+    for (uint32_t i = 0; i < jr->count; i++) {
+        eynfs_jimage_t *im = &jr->images[i];
+        if (im->block >= block_num && im->block < block_num + count && (im->flags & EYNFS_JIMAGE_LOGGED)) logged = 1;
+    }
+    if (logged && eynfs_journal_checkpoint(jr) != 0) return -1;
+    uint32_t i = 0;
+    while (i < jr->count) {
+        if (jr->images[i].block >= block_num && jr->images[i].block < block_num + count) eynfs_journal_remove(jr, i);
+        else i++;
+    }
+    return 0;
+}
+
+// Remember blocks the running transaction frees. -1 if they can't be tracked; the caller then
+// leaves them allocated, leaking them rather than risking their reuse.
+static int eynfs_journal_freed(uint8 drive, uint32_t start, uint32_t count) {
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (!jr) return 0;
+    if (jr->freed_count && jr->freed[jr->freed_count - 1].start + jr->freed[jr->freed_count - 1].count == start) {
+        jr->freed[jr->freed_count - 1].count += count;
+        return 0;
+    }
+    if (jr->freed_count == jr->freed_capacity) {
+        uint32_t capacity = jr->freed_capacity ? jr->freed_capacity * 2 : 16;
+        eynfs_extent_t *freed = (eynfs_extent_t*)realloc(jr->freed, capacity * sizeof(eynfs_extent_t));
+        if (!freed) return -1;
+        jr->freed = freed;
+        jr->freed_capacity = capacity;
+    }
+    jr->freed[jr->freed_count].start = start;
+    jr->freed[jr->freed_count].count = count;
+    jr->freed_count++;
+    return 0;
+}
+
+// If `block` was freed by the running transaction, the block just past that freed run; else 0
+static uint32_t eynfs_journal_freed_end(eynfs_journal_t *jr, uint32_t block) {
+    for (uint32_t i = 0; i < jr->freed_count; i++) {
+        if (block >= jr->freed[i].start && block < jr->freed[i].start + jr->freed[i].count) {
+            return jr->freed[i].start + jr->freed[i].count;
         }
     }
+    return 0;
+}
+
+// Start of the first run the running transaction freed at or after `block` (0xFFFFFFFF if none)
+static uint32_t eynfs_journal_freed_next(eynfs_journal_t *jr, uint32_t block) {
+    uint32_t next = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < jr->freed_count; i++) {
+        if (jr->freed[i].start >= block && jr->freed[i].start < next) next = jr->freed[i].start;
+    }
+    return next;
+}
+
+// An operation has finished: commit the running transaction once the group is large or old
+// enough, or once another operation of the same size might not fit beside it
+static int eynfs_journal_end_op(eynfs_journal_t *jr) {
+    if (jr->running == 0) return 0;
+    jr->ops++;
+    if (jr->ops < EYNFS_JOURNAL_GROUP_OPS && jr->running * 2 <= jr->max_txn &&
+        !(timer_running() && timer_ms() - jr->began >= EYNFS_JOURNAL_GROUP_MS)) {
+        return 0;
+    }
+    return eynfs_journal_commit(jr);
+}
+
+// Write metadata blocks: into the running journal transaction if the drive has a journal,
+// otherwise straight to disk
+static int eynfs_write_blocks(uint8 drive, uint32_t block_num, uint32_t count, const uint8_t* data) {
+    int journaled = eynfs_journal_write(drive, block_num, count, data);
+    if (journaled <= 0) return journaled;
+    return eynfs_dev_write(drive, block_num, count, data);
+}
+
+// Overwrite `len` bytes at `offset` within a block, reading and writing only the sectors they
+// span; with a journal, the block's image is patched instead. The bytes replaced are returned in `old` if given.
+static int eynfs_patch_block(uint8 drive, uint32_t block_num, uint32_t offset, const void *data, uint32_t len, void *old) {
+    uint32_t first = offset / BLOCK_SECTOR_SIZE;
+    uint32_t sectors = (offset + len + BLOCK_SECTOR_SIZE - 1) / BLOCK_SECTOR_SIZE - first;
+    uint32_t lba = block_num * eynfs_spb(drive) + first;
+    if (len == 0 || sectors > 2) return -1;
+    
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (jr) {
+        uint8_t *image = eynfs_journal_image(jr, block_num, 1);
+        if (!image) return -1;
+        if (old) memcpy(old, image + offset, len);
+        memcpy(image + offset, data, len);
+        return 0;
+    }
     
-    // Not in cache - write directly to disk
-    return ata_write_sector(drive, block_num, data);
+    uint8 buf[2 * BLOCK_SECTOR_SIZE];
+    if (block_read(drive, lba, sectors, buf) != 0) return -1;
+    offset -= first * BLOCK_SECTOR_SIZE;
+    if (old) memcpy(old, buf + offset, len);
+    memcpy(buf + offset, data, len);
+    return block_write(drive, lba, sectors, buf);
 }
 
-static void eynfs_cache_flush(uint8 drive) {
-    for (int i = 0; i < EYNFS_CACHE_SIZE; i++) {
-        if (block_cache[i].valid && block_cache[i].dirty) {
-            ata_write_sector(drive, block_cache[i].block_num, block_cache[i].data);
-            block_cache[i].dirty = 0;
+// Write back the bitmap blocks changed since the last consistency point, one transfer per run
+static int eynfs_bitmap_writeback(eynfs_bitmap_t *bm) {
+    if (!bm->valid) return 0;
+    int result = 0;
+    uint32_t s = 0;
+    while (s < bm->blocks) {
+        if (!bm->dirty[s]) { s++; continue; }
+        uint32_t run = 1;
+        while (s + run < bm->blocks && bm->dirty[s + run]) run++;
+        if (eynfs_write_blocks(bm->drive, bm->map_block + s, run, bm->bits + s * bm->block_size) != 0) {
+            result = -1;
+        } else {
+            memset(bm->dirty + s, 0, run);
         }
+        s += run;
+    }
+    return result;
+}
+
+// Write the superblock sector: into the running journal transaction if there is one
+static int eynfs_superblock_store(uint8 drive, uint32 lba, const eynfs_superblock_t *sb) {
+    uint8 buf[BLOCK_SECTOR_SIZE] = {0};
+    memcpy(buf, sb, sizeof(eynfs_superblock_t));
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (jr) {
+        uint32_t spb = eynfs_spb(drive);
+        uint8_t *image = eynfs_journal_image(jr, lba / spb, 1);
+        if (!image) return -1;
+        memcpy(image + (lba % spb) * BLOCK_SECTOR_SIZE, buf, BLOCK_SECTOR_SIZE);
+        return 0;
+    }
+    return block_write(drive, lba, 1, buf);
+}
+
+static int eynfs_mount_writeback(uint8 drive) {
+    if (drive >= EYNFS_MAX_DRIVES || !mounts[drive].mounted || !mounts[drive].dirty) return 0;
+    if (eynfs_superblock_store(drive, mounts[drive].lba, &mounts[drive].sb) != 0) return -1;
+    mounts[drive].dirty = 0;
+    return 0;
+}
+
+// Consistency point: push the changed superblock and bitmap blocks, then write back the buffer
+// cache and have the drive commit its write cache. Called once per metadata operation rather than after
+// every sector. With a journal the operation's metadata joins the running transaction
+// instead, which commits with its group.
+static int eynfs_sync(uint8 drive) {
+    int result = eynfs_mount_writeback(drive);
+    if (block_bitmap.valid && block_bitmap.drive == drive) result = eynfs_bitmap_writeback(&block_bitmap);
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (jr) {
+        if (eynfs_journal_end_op(jr) != 0) result = -1;
+    } else if (block_flush(drive) != 0) {
+        result = -1;
     }
+    return result;
+}
+
+static int eynfs_files_flush(uint8 drive); // With the file table below
+
+int eynfs_flush(uint8 drive) {
+    int result = eynfs_files_flush(drive);
+    if (eynfs_mount_writeback(drive) != 0) result = -1;
+    if (block_bitmap.valid && block_bitmap.drive == drive && eynfs_bitmap_writeback(&block_bitmap) != 0) result = -1;
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (jr) {
+        if (eynfs_journal_commit(jr) != 0 || eynfs_journal_checkpoint(jr) != 0) result = -1;
+    } else if (block_flush(drive) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+int eynfs_commit_idle(void) {
+    int result = 0;
+    for (uint8 drive = 0; drive < EYNFS_MAX_DRIVES; drive++) {
+        eynfs_journal_t *jr = &journals[drive];
+        if (!jr->valid || jr->running == 0) continue;
+        if (!timer_running() || timer_ms() - jr->began < EYNFS_JOURNAL_GROUP_MS) continue;
+        if (eynfs_journal_commit(jr) != 0) result = -1;
+    }
+    return result;
+}
+
+int eynfs_unmount(uint8 drive) {
+    if (eynfs_flush(drive) != 0) return -1; // The journal's images may be the only copy of that metadata
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (jr) eynfs_journal_release(jr);
+    if (drive < EYNFS_MAX_DRIVES) memset(&mounts[drive], 0, sizeof(eynfs_mount_t));
+    return 0;
+}
+
+// Attach a drive's journal when it is mounted. Every complete transaction
+// in the log is replayed: the commit block's checksum is checked in a first pass and the
+// images written home in a second, so a torn record is never applied. The header then moves
+// past them and the log starts empty. Returns 1 if anything was replayed, 0 if not, -1 on error.
+static int eynfs_journal_mount(uint8 drive, const eynfs_superblock_t *sb) {
+    if (sb->version < EYNFS_VERSION_JOURNAL || sb->journal_blocks < 4 ||
+        sb->journal_block + sb->journal_blocks > sb->total_blocks) {
+        return 0; // No journal: metadata is written in place
+    }
+    if (drive >= EYNFS_MAX_DRIVES) return 0;
+    
+    uint32_t bs = sb->block_size;
+    uint32_t start = sb->journal_block;
+    uint32_t blocks = sb->journal_blocks;
+    uint32_t tags = EYNFS_JOURNAL_TAGS(bs);
+    uint8 *desc = (uint8*)malloc(2 * bs);
+    if (!desc) return -1;
+    uint8 *blk = desc + bs;
+    const eynfs_journal_header_t *hdr = (const eynfs_journal_header_t*)desc;
+    if (eynfs_dev_read(drive, start, 1, desc) != 0) { free(desc); return -1; }
+    int formatted = hdr->magic == EYNFS_JOURNAL_MAGIC;
+    uint32_t sequence = formatted ? hdr->sequence : 1;
+    uint32_t pos = 1;
+    int replayed = 0;
+    int failed = 0;
+    while (formatted && pos + 2 <= blocks) {
+        if (eynfs_dev_read(drive, start + pos, 1, desc) != 0) { failed = 1; break; }
+        uint32_t n = hdr->count;
+        if (hdr->magic != EYNFS_JOURNAL_DESC_MAGIC || hdr->sequence != sequence || n == 0 || n > tags ||
+            pos + n + 2 > blocks) break;
+        uint32_t sum = eynfs_journal_checksum(0x811C9DC5, desc, bs);
+        for (uint32_t i = 0; i < n && !failed; i++) {
+            if (eynfs_dev_read(drive, start + pos + 1 + i, 1, blk) != 0) failed = 1;
+            else sum = eynfs_journal_checksum(sum, blk, bs);
+        }
+        if (failed || eynfs_dev_read(drive, start + pos + n + 1, 1, blk) != 0) { failed = 1; break; }
+        const eynfs_journal_header_t *commit = (const eynfs_journal_header_t*)blk;
+        if (commit->magic != EYNFS_JOURNAL_COMMIT_MAGIC || commit->sequence != sequence ||
+            commit->count != n || commit->checksum != sum) break;
+        
+        const uint32_t *home = (const uint32_t*)(desc + sizeof(eynfs_journal_header_t));
+        for (uint32_t i = 0; i < n && !failed; i++) {
+            if (home[i] >= sb->total_blocks) continue;
+            if (eynfs_dev_read(drive, start + pos + 1 + i, 1, blk) != 0 ||
+                eynfs_dev_write(drive, home[i], 1, blk) != 0) failed = 1;
+        }
+        if (failed) break;
+        replayed++;
+        sequence++;
+        pos += n + 2;
+    }
+    free(desc);
+    if (failed) return -1;
+    
+    if (!formatted || replayed) {
+        uint8 sector[BLOCK_SECTOR_SIZE] = {0};
+        eynfs_journal_header_t *h = (eynfs_journal_header_t*)sector;
+        h->magic = EYNFS_JOURNAL_MAGIC;
+        h->sequence = sequence;
+        if (block_flush(drive) != 0 || block_write(drive, start * eynfs_spb(drive), 1, sector) != 0 ||
+            block_flush(drive) != 0) return -1;
+    }
+    if (replayed) {
+        printf("%cEYNFS: replayed %d journal transaction(s) on drive %d\n", 255, 255, 0, replayed, drive);
+        eynfs_cache_clear(); // Anything read before the replay is stale
+    }
+    
+    eynfs_journal_t *jr = &journals[drive];
+    uint32_t max_txn = blocks - 3;
+    if (max_txn > tags) max_txn = tags;
+    jr->images = (eynfs_jimage_t*)malloc((blocks + max_txn) * sizeof(eynfs_jimage_t));
+    if (jr->images) {
+        jr->valid = 1;
+        jr->drive = drive;
+        jr->start = start;
+        jr->blocks = blocks;
+        jr->sequence = sequence;
+        jr->head = 1;
+        jr->max_txn = max_txn;
+        jr->count = 0;
+        jr->capacity = blocks + max_txn;
+        jr->running = 0;
+        jr->ops = 0;
+    } else {
+        // The log is empty, so running without the journal is safe, just not crash-proof
+        printf("%cWarning: Out of memory for the EYNFS journal; writing metadata in place\n", 255, 165, 0);
+    }
+    return replayed ? 1 : 0;
 }
 
 // Directory cache functions
-static eynfs_dir_cache_entry_t* eynfs_dir_cache_find(uint32_t dir_block) {
+static eynfs_dir_cache_entry_t* eynfs_dir_cache_find(uint8 drive, uint32_t dir_block) {
     for (int i = 0; i < EYNFS_DIR_CACHE_SIZE; i++) {
-        if (dir_cache[i].entries && dir_cache[i].dir_block == dir_block) {
+        if (dir_cache[i].entries && dir_cache[i].drive == drive && dir_cache[i].dir_block == dir_block) {
             // Don't set sorted flag since we're not actually sorting
             return &dir_cache[i];
         }
@@ -143,28 +747,140 @@ static eynfs_dir_cache_entry_t* eynfs_dir_cache_find(uint32_t dir_block) {
     return NULL;
 }
 
-static eynfs_dir_cache_entry_t* eynfs_dir_cache_alloc() {
-    // Find free slot or evict least recently used
-    for (int i = 0; i < EYNFS_DIR_CACHE_SIZE; i++) {
-        if (!dir_cache[i].entries) {
-            // Allocate enough space for larger directory entries (16KB limit)
-            dir_cache[i].entries = (eynfs_dir_entry_t*)malloc(16384);
-            if (dir_cache[i].entries) {
-                return &dir_cache[i];
+static eynfs_dentry_t* eynfs_dentry_set(uint32_t parent, const char *name) {
+    uint32_t hash = parent * 2654435761u;
+    for (int i = 0; i < EYNFS_NAME_MAX && name[i]; i++) hash = (hash ^ (uint8_t)name[i]) * 16777619;
+    return dentries[hash % EYNFS_DENTRY_SETS];
+}
+
+static eynfs_dentry_t* eynfs_dentry_find(uint8 drive, uint32_t parent, const char *name) {
+    eynfs_dentry_t *set = eynfs_dentry_set(parent, name);
+    for (int w = 0; w < EYNFS_DENTRY_WAYS; w++) {
+        eynfs_dentry_t *d = &set[w];
+        if (d->valid && d->drive == drive && d->parent == parent && strncmp(d->entry.name, name, EYNFS_NAME_MAX) == 0) {
+            d->used = ++dentry_clock;
+            return d;
+        }
+    }
+    return NULL;
+}
+
+// Remember a lookup's result; entry NULL records that the name doesn't exist
+static void eynfs_dentry_store(uint8 drive, uint32_t parent, const char *name, const eynfs_dir_entry_t *entry, uint32_t index) {
+    eynfs_dentry_t *d = eynfs_dentry_find(drive, parent, name);
+    if (!d) {
+        eynfs_dentry_t *set = eynfs_dentry_set(parent, name);
+        d = &set[0];
+        for (int w = 0; w < EYNFS_DENTRY_WAYS && d->valid; w++) {
+            if (!set[w].valid || set[w].used < d->used) d = &set[w];
+        }
+    }
+    d->valid = 1;
+    d->drive = drive;
+    d->parent = parent;
+    d->index = index;
+    d->used = ++dentry_clock;
+    if (entry) {
+        d->negative = 0;
+        d->entry = *entry;
+    } else {
+        d->negative = 1;
+        memset(&d->entry, 0, sizeof(eynfs_dir_entry_t));
+        strncpy(d->entry.name, name, EYNFS_NAME_MAX);
+    }
+}
+
+// A directory slot was rewritten: its cached entry follows it if the name is unchanged, and a
+// negative entry for the name now in it is dropped
+static void eynfs_dentry_slot_changed(uint8 drive, uint32_t parent, uint32_t index, const eynfs_dir_entry_t *entry) {
+    for (int i = 0; i < EYNFS_DENTRY_SETS; i++) {
+        for (int w = 0; w < EYNFS_DENTRY_WAYS; w++) {
+            eynfs_dentry_t *d = &dentries[i][w];
+            if (!d->valid || d->parent != parent) continue;
+            if (!d->negative && d->index == index) {
+                if (d->drive == drive && entry->name[0] && strncmp(d->entry.name, entry->name, EYNFS_NAME_MAX) == 0) {
+                    d->entry = *entry;
+                } else {
+                    d->valid = 0;
+                }
+            } else if (d->negative && entry->name[0] && strncmp(d->entry.name, entry->name, EYNFS_NAME_MAX) == 0) {
+                d->valid = 0;
             }
         }
     }
-    
-    // Evict first entry (simple LRU)
-    if (dir_cache[0].entries) {
-        free(dir_cache[0].entries);
-        dir_cache[0].entries = (eynfs_dir_entry_t*)malloc(16384);
-        if (dir_cache[0].entries) {
-            return &dir_cache[0];
+}
+
+// Forget every name cached under a directory (parent 0 forgets them all)
+static void eynfs_dentry_forget(uint32_t parent) {
+    for (int i = 0; i < EYNFS_DENTRY_SETS; i++) {
+        for (int w = 0; w < EYNFS_DENTRY_WAYS; w++) {
+            if (!parent || dentries[i][w].parent == parent) dentries[i][w].valid = 0;
         }
     }
-    
-    return NULL;
+}
+
+// Drop a directory's cached entries after it has been rewritten
+static void eynfs_dir_cache_invalidate(uint8 drive, uint32_t dir_block) {
+    eynfs_dir_cache_entry_t* cache_entry = eynfs_dir_cache_find(drive, dir_block);
+    if (cache_entry) {
+        free(cache_entry->entries);
+        cache_entry->entries = NULL;
+        cache_entry->count = 0;
+    }
+}
+
+// Keep a directory's cached entries in step with a single-entry update
+static void eynfs_dir_cache_update(uint8 drive, uint32_t dir_block, uint32_t index, const eynfs_dir_entry_t *entry) {
+    eynfs_dir_cache_entry_t* cache_entry = eynfs_dir_cache_find(drive, dir_block);
+    if (!cache_entry) return;
+    if (index < (uint32_t)cache_entry->count) {
+        cache_entry->entries[index] = *entry;
+    } else {
+        eynfs_dir_cache_invalidate(drive, dir_block);
+    }
+}
+
+// Forget a remembered directory chain (dir_block 0 forgets them all)
+static void eynfs_dir_chain_forget(uint32_t dir_block) {
+    for (int i = 0; i < EYNFS_DIR_CHAIN_CACHE_SIZE; i++) {
+        if (!dir_block || dir_chains[i].dir_block == dir_block) dir_chains[i].valid = 0;
+    }
+}
+
+// A slot holding `size` bytes of entries: a free one, else the slots are reused in turn
+static eynfs_dir_cache_entry_t* eynfs_dir_cache_alloc(size_t size) {
+    eynfs_dir_cache_entry_t* slot = NULL;
+    for (int i = 0; i < EYNFS_DIR_CACHE_SIZE && !slot; i++) {
+        if (!dir_cache[i].entries) slot = &dir_cache[i];
+    }
+    if (!slot) {
+        slot = &dir_cache[dir_cache_victim];
+        dir_cache_victim = (dir_cache_victim + 1) % EYNFS_DIR_CACHE_SIZE;
+        free(slot->entries);
+    }
+    slot->entries = (eynfs_dir_entry_t*)malloc(size);
+    return slot->entries ? slot : NULL;
+}
+
+// Cache a directory's whole table
+static void eynfs_dir_cache_store(uint8 drive, uint32_t dir_block, const eynfs_dir_entry_t* entries, int count) {
+    if (count <= 0) return;
+    
+    // Bounds check for memory copy
+    size_t copy_size = count * sizeof(eynfs_dir_entry_t);
+    if (copy_size > 16384) {
+        printf("%cWarning: Cache copy size too large (%d bytes)\n", 255, 165, 0, copy_size);
+        return;
+    }
+    eynfs_dir_cache_invalidate(drive, dir_block);
+    eynfs_dir_cache_entry_t* new_cache = eynfs_dir_cache_alloc(copy_size);
+    if (new_cache) {
+        new_cache->drive = drive;
+        new_cache->dir_block = dir_block;
+        new_cache->count = count;
+        memcpy(new_cache->entries, entries, copy_size);
+        new_cache->sorted = 0; // Not sorted, use linear search
+    }
 }
 
 // Binary search for directory entries (requires sorted entries)
@@ -193,50 +909,59 @@ static int eynfs_binary_search_dir(const eynfs_dir_entry_t* entries, int count,
     return -1;
 }
 
-// Helper: Read the free block bitmap
-static int eynfs_read_bitmap(uint8 drive, const eynfs_superblock_t *sb, uint8 *bitmap) {
-    return ata_read_sector(drive, sb->free_block_map, bitmap);
-}
-
-// Helper: Write the free block bitmap
-static int eynfs_write_bitmap(uint8 drive, const eynfs_superblock_t *sb, const uint8 *bitmap) {
-    return ata_write_sector(drive, sb->free_block_map, bitmap);
-}
-
-// Optimized block allocation using free block cache
-static int eynfs_alloc_block_optimized(uint8 drive, eynfs_superblock_t *sb) {
-    // Try cache first
-    if (free_block_cache_valid && free_block_cache_count > 0) {
-        uint32_t block = free_block_cache[--free_block_cache_count];
-        return block;
+// Read a run of chained blocks starting at `block` with a single multi-sector command.
+// Up to max_blocks blocks are fetched speculatively; the return value is how many of
+// them continue the chain contiguously (block, block+1, ...), and *next_out receives
+// the block that follows the run. Returns -1 on I/O error.
+static int eynfs_read_chain_run(uint8 drive, uint32_t block, uint32_t max_blocks, uint8 *buf, uint32_t *next_out) {
+    uint32_t bs = eynfs_bsize(drive);
+    if (max_blocks > eynfs_chain_batch(drive)) max_blocks = eynfs_chain_batch(drive);
+    if (max_blocks > 1 && eynfs_dev_read(drive, block, max_blocks, buf) != 0) {
+        max_blocks = 1; // Speculative batch failed (e.g. past end of disk) - retry one block
     }
-    
-    // Refill cache
-    uint8 bitmap[EYNFS_BLOCK_SIZE];
-    if (eynfs_read_bitmap(drive, sb, bitmap) != 0) return -1;
-    
-    free_block_cache_count = 0;
-    for (uint32_t i = 0; i < EYNFS_BLOCK_SIZE * 8 && i < sb->total_blocks && free_block_cache_count < EYNFS_FREE_BLOCK_CACHE_SIZE; ++i) {
-        uint32_t byte = i / 8;
-        uint8_t bit = i % 8;
-        if (!(bitmap[byte] & (1 << bit))) {
-            free_block_cache[free_block_cache_count++] = i;
-        }
+    if (max_blocks <= 1) {
+        max_blocks = 1;
+        if (eynfs_dev_read(drive, block, 1, buf) != 0) return -1;
     }
     
-    if (free_block_cache_count > 0) {
-        free_block_cache_valid = 1;
-        uint32_t block = free_block_cache[--free_block_cache_count];
-        return block;
+    uint32_t run = 1;
+    while (run < max_blocks && *(uint32_t*)(buf + (run - 1) * bs) == block + run) {
+        run++;
     }
-    
-    return -1; // No free blocks
+    *next_out = *(uint32_t*)(buf + (run - 1) * bs);
+    return (int)run;
+}
+
+// Free every block of a chain, walking it in batched runs.
+// max_blocks is a hint for how long the chain is expected to be.
+static void eynfs_free_chain(uint8 drive, eynfs_superblock_t *sb, uint32_t first_block, uint32_t max_blocks) {
+    uint8 *batch = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+    if (!batch) return;
+    uint32_t block_num = first_block;
+    while (block_num != 0) {
+        uint32_t next_block;
+        int run = eynfs_read_chain_run(drive, block_num, max_blocks ? max_blocks : 1, batch, &next_block);
+        if (run < 0) break;
+        for (int i = 0; i < run; i++) {
+            eynfs_free_block(drive, sb, block_num + i);
+        }
+        if (max_blocks > (uint32_t)run) max_blocks -= run;
+        else max_blocks = eynfs_chain_batch(drive);
+        block_num = next_block;
+    }
+    free(batch);
 }
 
 // Read the EYNFS superblock from disk
 int eynfs_read_superblock(uint8 drive, uint32 lba, eynfs_superblock_t *sb) {
-    uint8 buf[EYNFS_BLOCK_SIZE];
-    if (ata_read_sector(drive, lba, buf) != 0) {
+    eynfs_mount_t *m = drive < EYNFS_MAX_DRIVES ? &mounts[drive] : NULL;
+    if (m && m->mounted && m->lba == lba) {
+        memcpy(sb, &m->sb, sizeof(eynfs_superblock_t));
+        return 0;
+    }
+    
+    uint8 buf[BLOCK_SECTOR_SIZE];
+    if (eynfs_dev_read_sectors(drive, lba, 1, buf) != 0) {
         return -1;
     }
     memcpy(sb, buf, sizeof(eynfs_superblock_t));
@@ -248,67 +973,191 @@ int eynfs_read_superblock(uint8 drive, uint32 lba, eynfs_superblock_t *sb) {
         caches_initialized = 1;
     }
     
+    // Mount. Every later block number on this drive is in units of the superblock's block size.
+    if (m && !m->mounted && sb->magic == EYNFS_MAGIC && EYNFS_VALID_BLOCK_SIZE(sb->block_size)) {
+        if (drive_block_size[drive] && drive_block_size[drive] != sb->block_size) eynfs_cache_clear();
+        drive_block_size[drive] = (uint16_t)sb->block_size;
+        
+        // Replay the journal, after which the superblock itself may have changed
+        int replayed = eynfs_journal_mount(drive, sb);
+        if (replayed < 0) return -1;
+        if (replayed && eynfs_dev_read_sectors(drive, lba, 1, buf) == 0) memcpy(sb, buf, sizeof(eynfs_superblock_t));
+        memcpy(&m->sb, sb, sizeof(eynfs_superblock_t));
+        m->lba = lba;
+        m->dirty = 0;
+        m->mounted = 1;
+    }
+    
     return 0;
 }
 
 // Write the EYNFS superblock to disk
 int eynfs_write_superblock(uint8 drive, uint32 lba, const eynfs_superblock_t *sb) {
-    uint8 buf[EYNFS_BLOCK_SIZE] = {0};
-    memcpy(buf, sb, sizeof(eynfs_superblock_t));
-    if (ata_write_sector(drive, lba, buf) != 0) {
-        return -1;
+    eynfs_mount_t *m = drive < EYNFS_MAX_DRIVES ? &mounts[drive] : NULL;
+    if (m && m->mounted && m->lba == lba) {
+        if (!m->dirty && memcmp(&m->sb, sb, sizeof(eynfs_superblock_t)) == 0) return 0; // Unchanged
+        memcpy(&m->sb, sb, sizeof(eynfs_superblock_t));
+        m->dirty = 1;
+        return eynfs_mount_writeback(drive);
     }
-    return 0;
+    return eynfs_superblock_store(drive, lba, sb);
 }
 
 // Read a directory table from disk (multi-block chain)
 int eynfs_read_dir_table(uint8 drive, uint32 lba, eynfs_dir_entry_t *entries, size_t max_entries) {
     size_t total_entries = 0;
     uint32_t current_block = lba;
-    uint8 buf[EYNFS_BLOCK_SIZE];
+    uint32_t bs = eynfs_bsize(drive);
+    size_t entry_count = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
+    uint8 *batch = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+    if (!batch) return -1;
     while (current_block && total_entries < max_entries) {
-        if (ata_read_sector(drive, current_block, buf) != 0) return -1;
-        uint32_t next_block = *(uint32_t*)buf;
-        size_t entry_count = (EYNFS_BLOCK_SIZE - 4) / sizeof(eynfs_dir_entry_t);
-        size_t entries_to_copy = entry_count;
-        if (max_entries - total_entries < entry_count) entries_to_copy = max_entries - total_entries;
-        memcpy(&entries[total_entries], buf + 4, entries_to_copy * sizeof(eynfs_dir_entry_t));
-        total_entries += entries_to_copy;
-        if (total_entries >= max_entries) break;
+        // Never fetch more blocks than the caller has room for
+        uint32_t blocks_wanted = (max_entries - total_entries + entry_count - 1) / entry_count;
+        uint32_t next_block;
+        int run = eynfs_read_chain_run(drive, current_block, blocks_wanted, batch, &next_block);
+        if (run < 0) { free(batch); return -1; }
+        for (int i = 0; i < run && total_entries < max_entries; i++) {
+            size_t entries_to_copy = entry_count;
+            if (max_entries - total_entries < entry_count) entries_to_copy = max_entries - total_entries;
+            memcpy(&entries[total_entries], batch + i * bs + 4, entries_to_copy * sizeof(eynfs_dir_entry_t));
+            total_entries += entries_to_copy;
+        }
         current_block = next_block;
     }
+    free(batch);
     return (int)total_entries;
 }
 
-// Helper: Write a single directory block
+// Helper: Queue a single directory block write. buf and req must stay alive until it completes;
+// the caller plugs the drive so adjacent directory blocks go out as one transfer. `tail`, if
+// given, is the index tail kept at the end of the directory's first block. With a journal the
+// block goes into the running transaction and req is returned already complete.
 static int eynfs_write_dir_block(uint8 drive, uint32_t block_num, const eynfs_dir_entry_t *entries, 
-                                size_t num_entries, uint32_t next_block) {
-    uint8 buf[EYNFS_BLOCK_SIZE] = {0};
+                                size_t num_entries, uint32_t next_block, const uint8 *tail,
+                                uint8 *buf, block_request_t *req) {
+    uint32_t bs = eynfs_bsize(drive);
+    memset(buf, 0, bs);
     *(uint32_t*)buf = next_block;
-    size_t entries_to_write = (EYNFS_BLOCK_SIZE - 4) / sizeof(eynfs_dir_entry_t);
+    size_t entries_to_write = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
     if (num_entries < entries_to_write) entries_to_write = num_entries;
     memcpy(buf + 4, entries, entries_to_write * sizeof(eynfs_dir_entry_t));
-    return ata_write_sector(drive, block_num, buf);
+    if (tail) memcpy(buf + bs - sizeof(eynfs_dir_index_tail_t), tail, sizeof(eynfs_dir_index_tail_t));
+    eynfs_request_init(req, drive, block_num, 1, buf, BLOCK_REQ_WRITE);
+    int journaled = eynfs_journal_write(drive, block_num, 1, buf);
+    if (journaled <= 0) {
+        req->status = BLOCK_REQ_DONE;
+        return journaled;
+    }
+    return block_submit(req);
+}
+
+// Blocks of a directory chain in order, at most max. Only each block's first sector (holding
+// its next pointer) is read; a read error ends the walk early. Complete walks are remembered.
+static int eynfs_dir_chain(uint8 drive, uint32_t dir_block, uint32_t *blocks, int max) {
+    for (int i = 0; i < EYNFS_DIR_CHAIN_CACHE_SIZE; i++) {
+        eynfs_dir_chain_cache_t *c = &dir_chains[i];
+        if (c->valid && c->drive == drive && c->dir_block == dir_block) {
+            int count = c->count < max ? c->count : max;
+            memcpy(blocks, c->blocks, count * sizeof(uint32_t));
+            return count;
+        }
+    }
+    
+    // Walk the whole chain (up to the limit) so the memo serves any later max
+    eynfs_dir_chain_cache_t *c = &dir_chains[dir_chain_victim];
+    uint8 sector[BLOCK_SECTOR_SIZE];
+    uint32_t spb = eynfs_spb(drive);
+    c->valid = 0;
+    c->drive = drive;
+    c->dir_block = dir_block;
+    c->count = 0;
+    int complete = 0;
+    while (dir_block && c->count < EYNFS_DIR_MAX_BLOCKS) {
+        c->blocks[c->count++] = dir_block;
+        if (eynfs_dev_read_sectors(drive, dir_block * spb, 1, sector) != 0) break;
+        dir_block = *(uint32_t*)sector;
+        complete = dir_block == 0 || c->count == EYNFS_DIR_MAX_BLOCKS;
+    }
+    if (complete) {
+        c->valid = 1;
+        dir_chain_victim = (dir_chain_victim + 1) % EYNFS_DIR_CHAIN_CACHE_SIZE;
+    }
+    int count = c->count < max ? c->count : max;
+    memcpy(blocks, c->blocks, count * sizeof(uint32_t));
+    return count;
+}
+
+// Write `count` consecutive directory entries starting at `index` in place; they must share a
+// block. Only the one or two sectors holding them are rewritten, so updating an entry costs
+// the same in any size of directory. The entries replaced are returned in `old` if given.
+static int eynfs_dir_slots_write(uint8 drive, uint32_t dir_block, uint32_t index, const eynfs_dir_entry_t *entries, uint32_t count, eynfs_dir_entry_t *old) {
+    uint32_t per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(eynfs_bsize(drive));
+    uint32_t chain[EYNFS_DIR_MAX_BLOCKS];
+    uint32_t pos = index / per_block;
+    if (count == 0 || index % per_block + count > per_block) return -1;
+    if (pos >= EYNFS_DIR_MAX_BLOCKS || (uint32_t)eynfs_dir_chain(drive, dir_block, chain, pos + 1) <= pos) return -1;
+    uint32_t offset = 4 + (index % per_block) * sizeof(eynfs_dir_entry_t);
+    if (eynfs_patch_block(drive, chain[pos], offset, entries, count * sizeof(eynfs_dir_entry_t), old) != 0) return -1;
+    for (uint32_t i = 0; i < count; i++) {
+        eynfs_dir_cache_update(drive, dir_block, index + i, &entries[i]);
+        eynfs_dentry_slot_changed(drive, dir_block, index + i, &entries[i]);
+    }
+    return 0;
+}
+
+static int eynfs_dir_entry_write(uint8 drive, uint32_t dir_block, uint32_t index, const eynfs_dir_entry_t *entry, eynfs_dir_entry_t *old) {
+    return eynfs_dir_slots_write(drive, dir_block, index, entry, 1, old);
+}
+
+// Add a block to the end of a directory chain (at chain position `pos`) holding `entry` as
+// its first entry. The block is written before the previous one links to it.
+static int eynfs_dir_append_block(uint8 drive, eynfs_superblock_t *sb, uint32_t dir_block, uint32_t pos, const eynfs_dir_entry_t *entry) {
+    uint32_t chain[EYNFS_DIR_MAX_BLOCKS];
+    if (pos == 0 || pos >= EYNFS_DIR_MAX_BLOCKS || (uint32_t)eynfs_dir_chain(drive, dir_block, chain, EYNFS_DIR_MAX_BLOCKS) != pos) return -1;
+    int block = eynfs_alloc_block(drive, sb);
+    if (block < 0) return -1;
+    
+    uint32_t bs = eynfs_bsize(drive);
+    uint8 *buf = (uint8*)malloc(bs);
+    block_request_t req;
+    int result = -1;
+    if (buf && eynfs_write_dir_block(drive, block, entry, 1, 0, NULL, buf, &req) == 0 &&
+        block_wait(&req, ATA_REQUEST_TIMEOUT_MS) == 0) {
+        uint32_t next = (uint32_t)block;
+        result = eynfs_patch_block(drive, chain[pos - 1], 0, &next, sizeof(next), NULL);
+    }
+    if (buf) free(buf);
+    if (result != 0) {
+        eynfs_free_block(drive, sb, block);
+        return -1;
+    }
+    eynfs_dir_chain_forget(dir_block);
+    eynfs_dir_cache_invalidate(drive, dir_block);
+    eynfs_dentry_forget(dir_block);
+    return 0;
 }
 
 // Helper: Count directory entries without allocating memory
 int eynfs_count_dir_entries(uint8 drive, uint32_t lba) {
     int total_entries = 0;
     uint32_t current_block = lba;
-    uint8 buf[EYNFS_BLOCK_SIZE];
     int block_count = 0;
     
     // Limit to reasonable number of blocks to prevent excessive allocation
-    const int max_blocks = 32; // 32 blocks = ~288 entries max (much more reasonable)
+    const int max_blocks = EYNFS_DIR_MAX_BLOCKS;
     
+    uint8 *batch = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+    if (!batch) return -1;
     while (current_block && block_count < max_blocks) {
-        if (ata_read_sector(drive, current_block, buf) != 0) return -1;
-        uint32_t next_block = *(uint32_t*)buf;
-        size_t entry_count = (EYNFS_BLOCK_SIZE - 4) / sizeof(eynfs_dir_entry_t);
-        total_entries += entry_count;
+        uint32_t next_block;
+        int run = eynfs_read_chain_run(drive, current_block, max_blocks - block_count, batch, &next_block);
+        if (run < 0) { free(batch); return -1; }
+        total_entries += EYNFS_DIR_ENTRIES_PER_BLOCK(eynfs_bsize(drive)) * run;
         current_block = next_block;
-        block_count++;
+        block_count += run;
     }
+    free(batch);
     
     // If we hit the limit, return a conservative estimate
     if (block_count >= max_blocks && current_block) {
@@ -323,14 +1172,7 @@ static int eynfs_free_dir_chain(uint8 drive, uint32_t first_block) {
     eynfs_superblock_t sb;
     if (eynfs_read_superblock(drive, EYNFS_SUPERBLOCK_LBA, &sb) != 0) return -1;
     
-    uint32_t block_num = first_block;
-    while (block_num != 0) {
-        uint8 buf[EYNFS_BLOCK_SIZE];
-        if (ata_read_sector(drive, block_num, buf) != 0) break;
-        uint32_t next_block = *(uint32_t*)buf;
-        eynfs_free_block(drive, &sb, block_num);
-        block_num = next_block;
-    }
+    eynfs_free_chain(drive, &sb, first_block, eynfs_chain_batch(drive));
     return 0;
 }
 
@@ -342,21 +1184,38 @@ int eynfs_write_dir_table(uint8 drive, uint32 lba, const eynfs_dir_entry_t *entr
     eynfs_superblock_t sb;
     if (eynfs_read_superblock(drive, EYNFS_SUPERBLOCK_LBA, &sb) != 0) return -1;
     
-    // First, read the existing block chain to preserve it
-    uint32_t original_blocks[32]; // Support up to 32 blocks
-    int block_count = 0;
-    uint32_t current_block = lba;
-    
-    while (current_block && block_count < 32) {
-        original_blocks[block_count++] = current_block;
-        uint8 buf[EYNFS_BLOCK_SIZE];
-        if (ata_read_sector(drive, current_block, buf) != 0) break;
-        current_block = *(uint32_t*)buf;
+    // First, read the existing block chain to preserve it. The rewrite may relink it.
+    uint32_t original_blocks[EYNFS_DIR_MAX_BLOCKS];
+    int block_count = eynfs_dir_chain(drive, lba, original_blocks, EYNFS_DIR_MAX_BLOCKS);
+    eynfs_dir_chain_forget(lba);
+    eynfs_dir_cache_invalidate(drive, lba);
+    eynfs_dentry_forget(lba);
+    
+    // Keep the first block's index tail; the table rewrite doesn't move any entry
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t spb = eynfs_spb(drive);
+    uint8 tail_sector[BLOCK_SECTOR_SIZE];
+    const uint8 *tail = NULL;
+    if (eynfs_dev_read_sectors(drive, lba * spb + spb - 1, 1, tail_sector) == 0) {
+        tail = tail_sector + BLOCK_SECTOR_SIZE - sizeof(eynfs_dir_index_tail_t);
     }
     
     uint32_t prev_block = 0;
     size_t written = 0;
-    size_t entries_per_block = (EYNFS_BLOCK_SIZE - 4) / sizeof(eynfs_dir_entry_t);
+    size_t entries_per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
+    
+    // One buffer and request per block written; everything is queued, then waited for together
+    size_t blocks_needed = (num_entries + entries_per_block - 1) / entries_per_block;
+    uint8 *bufs = (uint8*)malloc(blocks_needed * bs);
+    block_request_t *reqs = (block_request_t*)malloc(blocks_needed * sizeof(block_request_t));
+    if (!bufs || !reqs) {
+        if (bufs) free(bufs);
+        if (reqs) free(reqs);
+        return -1;
+    }
+    size_t queued = 0;
+    int failed = 0;
+    block_plug(drive);
     
     // Write all entries using the preserved block chain
     uint32_t allocated_next_block = 0; // Store the allocated block for the second loop
@@ -377,16 +1236,20 @@ int eynfs_write_dir_table(uint8 drive, uint32 lba, const eynfs_dir_entry_t *entr
                 next_block = eynfs_alloc_block(drive, &sb);
                 if (next_block < 0) {
                     printf("%c[DEBUG] eynfs_write_dir_table: Failed to allocate new block\n", 0, 255, 0);
-                    return -1;
+                    failed = 1;
+                    break;
                 }
                 allocated_next_block = next_block; // Store for the second loop
             }
         }
         
         // Write the block
-        if (eynfs_write_dir_block(drive, current_block, &entries[written], to_write, next_block) != 0) {
-            return -1;
+        if (eynfs_write_dir_block(drive, current_block, &entries[written], to_write, next_block,
+                                  block_idx == 0 ? tail : NULL, bufs + queued * bs, &reqs[queued]) != 0) {
+            failed = 1;
+            break;
         }
+        queued++;
         
         written += to_write;
         
@@ -398,7 +1261,7 @@ int eynfs_write_dir_table(uint8 drive, uint32 lba, const eynfs_dir_entry_t *entr
     }
     
     // Continue writing to newly allocated blocks if needed
-    while (written < num_entries) {
+    while (!failed && written < num_entries) {
         // Use the allocated_next_block that was allocated in the previous loop
         uint32_t new_block = allocated_next_block;
         if (new_block == 0) {
@@ -406,7 +1269,8 @@ int eynfs_write_dir_table(uint8 drive, uint32 lba, const eynfs_dir_entry_t *entr
             new_block = eynfs_alloc_block(drive, &sb);
             if (new_block < 0) {
                 printf("%c[DEBUG] eynfs_write_dir_table: Failed to allocate additional block\n", 0, 255, 0);
-                return -1;
+                failed = 1;
+                break;
             }
         }
         
@@ -418,17 +1282,30 @@ int eynfs_write_dir_table(uint8 drive, uint32 lba, const eynfs_dir_entry_t *entr
             next_block = eynfs_alloc_block(drive, &sb);
             if (next_block < 0) {
                 printf("%c[DEBUG] eynfs_write_dir_table: Failed to allocate next block\n", 0, 255, 0);
-                return -1;
+                failed = 1;
+                break;
             }
         }
         
-        if (eynfs_write_dir_block(drive, new_block, &entries[written], to_write, next_block) != 0) {
-            return -1;
+        if (eynfs_write_dir_block(drive, new_block, &entries[written], to_write, next_block,
+                                  NULL, bufs + queued * bs, &reqs[queued]) != 0) {
+            failed = 1;
+            break;
         }
+        queued++;
         
         written += to_write;
+        allocated_next_block = next_block; // The block just linked is written next
     }
     
+    block_unplug(drive);
+    for (size_t i = 0; i < queued; i++) {
+        if (block_wait(&reqs[i], ATA_REQUEST_TIMEOUT_MS) != 0) failed = 1;
+    }
+    free(bufs);
+    free(reqs);
+    if (failed) return -1;
+    
     return (int)written;
 }
 
@@ -436,70 +1313,1073 @@ int eynfs_write_dir_table(uint8 drive, uint32 lba, const eynfs_dir_entry_t *entr
 static int eynfs_validate_superblock(const eynfs_superblock_t *sb) {
     if (!sb) return -1;
     if (sb->magic != EYNFS_MAGIC) return -1;
-    if (sb->version != EYNFS_VERSION) return -1;
-    if (sb->block_size != EYNFS_BLOCK_SIZE) return -1;
+    if (sb->version < EYNFS_VERSION_CHAINED || sb->version > EYNFS_VERSION) return -1;
+    if (!EYNFS_VALID_BLOCK_SIZE(sb->block_size)) return -1;
     if (sb->total_blocks == 0) return -1;
     if (sb->root_dir_block >= sb->total_blocks) return -1;
     if (sb->free_block_map >= sb->total_blocks) return -1;
     return 0;
 }
 
-// Helper: Validate directory entry
-static int eynfs_validate_dir_entry(const eynfs_dir_entry_t *entry) {
-    if (!entry) return -1;
-    if (entry->name[0] == '\0') return -1; // Empty name
-    if (entry->type != EYNFS_TYPE_FILE && entry->type != EYNFS_TYPE_DIR) return -1;
-    return 0;
+// Helper: Validate directory entry
+static int eynfs_validate_dir_entry(const eynfs_dir_entry_t *entry) {
+    if (!entry) return -1;
+    if (entry->name[0] == '\0') return -1; // Empty name
+    if (entry->type != EYNFS_TYPE_FILE && entry->type != EYNFS_TYPE_DIR) return -1;
+    return 0;
+}
+
+// Free blocks among the first `bits` bits of a bitmap block
+static uint32_t eynfs_bitmap_count_free(const uint8_t *sector, uint32_t bits) {
+    static const uint8_t zeros[16] = {4, 3, 3, 2, 3, 2, 2, 1, 3, 2, 2, 1, 2, 1, 1, 0};
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= bits; i += 8) {
+        uint8_t byte = sector[i / 8];
+        count += zeros[byte & 0x0F] + zeros[byte >> 4];
+    }
+    for (; i < bits; i++) {
+        if (!(sector[i / 8] & (1 << (i % 8)))) count++;
+    }
+    return count;
+}
+
+static void eynfs_bitmap_release(eynfs_bitmap_t *bm) {
+    if (bm->bits) free(bm->bits);
+    memset(bm, 0, sizeof(eynfs_bitmap_t));
+}
+
+// Get the resident bitmap for a filesystem, reading it in with one transfer the first time.
+// Images from before multi-block bitmaps (bitmap_blocks == 0) have a single block.
+static eynfs_bitmap_t* eynfs_bitmap_get(uint8 drive, const eynfs_superblock_t *sb) {
+    eynfs_bitmap_t *bm = &block_bitmap;
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t blocks = sb->bitmap_blocks ? sb->bitmap_blocks : 1;
+    uint32_t per_block = EYNFS_BLOCKS_PER_BITMAP_BLOCK(bs);
+    uint32_t total = sb->total_blocks;
+    if (total > blocks * per_block) total = blocks * per_block;
+    if (bm->valid && bm->drive == drive && bm->map_block == sb->free_block_map &&
+        bm->blocks == blocks && bm->block_size == bs && bm->total_blocks == total) {
+        return bm;
+    }
+    
+    // Another filesystem's bitmap is resident: put it back before switching
+    if (bm->valid) eynfs_bitmap_writeback(bm);
+    eynfs_bitmap_release(bm);
+    
+    // One allocation holds the bits, the summary tier and the dirty flags
+    uint8_t *mem = (uint8_t*)malloc(blocks * (bs + sizeof(uint16_t) + 1));
+    if (!mem) {
+        printf("%cError: Out of memory for the EYNFS block bitmap (%d blocks)\n", 255, 0, 0, blocks);
+        return NULL;
+    }
+    if (eynfs_dev_read(drive, sb->free_block_map, blocks, mem) != 0) {
+        free(mem);
+        return NULL;
+    }
+    bm->bits = mem;
+    bm->free_count = (uint16_t*)(mem + blocks * bs);
+    bm->dirty = mem + blocks * (bs + sizeof(uint16_t));
+    memset(bm->dirty, 0, blocks);
+    bm->drive = drive;
+    bm->map_block = sb->free_block_map;
+    bm->blocks = blocks;
+    bm->block_size = bs;
+    bm->total_blocks = total;
+    bm->free_total = 0;
+    bm->next = 0;
+    for (uint32_t s = 0; s < blocks; s++) {
+        uint32_t first = s * per_block;
+        uint32_t bits = total - first < per_block ? total - first : per_block;
+        bm->free_count[s] = (uint16_t)eynfs_bitmap_count_free(bm->bits + s * bs, bits);
+        bm->free_total += bm->free_count[s];
+    }
+    bm->valid = 1;
+    return bm;
+}
+
+// Mark `count` blocks from `start` used or free, keeping the summary tier in step
+static void eynfs_bitmap_mark(eynfs_bitmap_t *bm, uint32_t start, uint32_t count, int used) {
+    for (uint32_t block = start; block < start + count; block++) {
+        uint8_t *byte = &bm->bits[block / 8];
+        uint8_t mask = (uint8_t)(1 << (block % 8));
+        if (!(*byte & mask) == !used) continue; // Already in that state
+        uint32_t s = block / EYNFS_BLOCKS_PER_BITMAP_BLOCK(bm->block_size);
+        if (used) {
+            *byte |= mask;
+            bm->free_count[s]--;
+            bm->free_total--;
+        } else {
+            *byte &= ~mask;
+            bm->free_count[s]++;
+            bm->free_total++;
+        }
+        bm->dirty[s] = 1;
+    }
+}
+
+// Find a free block at or after `from` within bitmap block s (-1 if there is none)
+static int eynfs_bitmap_scan(const eynfs_bitmap_t *bm, uint32_t s, uint32_t from) {
+    uint32_t end = (s + 1) * EYNFS_BLOCKS_PER_BITMAP_BLOCK(bm->block_size);
+    if (end > bm->total_blocks) end = bm->total_blocks;
+    uint32_t block = from;
+    while (block < end) {
+        // Skip whole bytes of used blocks
+        if ((block % 8) == 0 && bm->bits[block / 8] == 0xFF) {
+            block += 8;
+            continue;
+        }
+        if (!(bm->bits[block / 8] & (1 << (block % 8)))) return (int)block;
+        block++;
+    }
+    return -1;
+}
+
+// Next-fit search: from the cursor to the end of the volume, then wrapping round.
+// Bitmap blocks the summary tier reports as full are skipped without touching their bits.
+static int eynfs_bitmap_find(eynfs_bitmap_t *bm) {
+    if (bm->free_total == 0) return -1;
+    if (bm->next >= bm->total_blocks) bm->next = 0;
+    uint32_t per_block = EYNFS_BLOCKS_PER_BITMAP_BLOCK(bm->block_size);
+    uint32_t first = bm->next / per_block;
+    for (uint32_t i = 0; i <= bm->blocks; i++) {
+        uint32_t s = (first + i) % bm->blocks;
+        if (bm->free_count[s] == 0) continue;
+        uint32_t from = s * per_block;
+        if (i == 0) from = bm->next; // Part of the cursor's bitmap block is still ahead of it
+        int block = eynfs_bitmap_scan(bm, s, from);
+        if (block >= 0) return block;
+    }
+    return -1;
+}
+
+// Whether `block` can be allocated: free in the bitmap and not freed by the running transaction
+static int eynfs_bitmap_usable(const eynfs_bitmap_t *bm, eynfs_journal_t *jr, uint32_t block) {
+    if (block >= bm->total_blocks || (bm->bits[block / 8] & (1 << (block % 8)))) return 0;
+    return !(jr && jr->freed_count && eynfs_journal_freed_end(jr, block));
+}
+
+// First-fit search for `count` contiguous usable blocks. Returns the start of the first such
+// run with *found = count; failing that, the start of the longest run there is, with its
+// length in *found; -1 if nothing is usable. Bitmap blocks the summary tier reports as full
+// end a run without their bits being read, and whole free bytes extend it eight at a time.
+static int eynfs_bitmap_find_run(const eynfs_bitmap_t *bm, eynfs_journal_t *jr, uint32_t count, uint32_t *found) {
+    uint32_t per_block = EYNFS_BLOCKS_PER_BITMAP_BLOCK(bm->block_size);
+    uint32_t best = 0, best_len = 0;
+    uint32_t run = 0, run_len = 0;
+    uint32_t fence = 0xFFFFFFFF; // Next block the running transaction freed, which ends the run
+    uint32_t block = 0;
+    while (block < bm->total_blocks) {
+        uint8_t byte = bm->bits[block / 8];
+        if (bm->free_count[block / per_block] == 0) {
+            run_len = 0;
+            block = (block / per_block + 1) * per_block;
+            continue;
+        }
+        if ((block % 8) == 0 && byte == 0xFF) {
+            run_len = 0;
+            block += 8;
+            continue;
+        }
+        if ((byte & (1 << (block % 8))) || block == fence) {
+            run_len = 0;
+            block++;
+            continue;
+        }
+        if (run_len == 0) {
+            if (jr && jr->freed_count) {
+                uint32_t end = eynfs_journal_freed_end(jr, block);
+                if (end) {
+                    block = end;
+                    continue;
+                }
+                fence = eynfs_journal_freed_next(jr, block);
+            }
+            run = block;
+        }
+        uint32_t step = 1;
+        if ((block % 8) == 0 && byte == 0 && block + 8 <= bm->total_blocks && block + 8 <= fence) step = 8;
+        run_len += step;
+        block += step;
+        if (run_len >= count) {
+            *found = count;
+            return (int)run;
+        }
+        if (run_len > best_len) {
+            best = run;
+            best_len = run_len;
+        }
+    }
+    *found = best_len;
+    return best_len ? (int)best : -1;
+}
+
+// Allocate a free block, mark it as used in the bitmap, and return its block number
+int eynfs_alloc_block(uint8 drive, eynfs_superblock_t *sb) {
+    eynfs_bitmap_t *bm = eynfs_bitmap_get(drive, sb);
+    if (!bm) return -1;
+    int block = eynfs_bitmap_find(bm);
+    
+    // Skip blocks freed by the uncommitted transaction. If nothing else is free, commit it so
+    // they can be reused.
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    uint32_t skipped = 0;
+    while (jr && block >= 0 && jr->freed_count) {
+        uint32_t end = eynfs_journal_freed_end(jr, (uint32_t)block);
+        if (!end) break;
+        skipped += end - (uint32_t)block;
+        if (skipped >= bm->free_total) {
+            if (eynfs_journal_commit(jr) != 0) return -1;
+        } else {
+            bm->next = end;
+        }
+        block = eynfs_bitmap_find(bm);
+    }
+    if (block < 0) return -1; // No free block found
+    eynfs_bitmap_mark(bm, (uint32_t)block, 1, 1);
+    bm->next = (uint32_t)block + 1;
+    return block;
+}
+
+// Free a block (mark as unused in the bitmap)
+int eynfs_free_block(uint8 drive, eynfs_superblock_t *sb, uint32_t block) {
+    eynfs_bitmap_t *bm = eynfs_bitmap_get(drive, sb);
+    if (!bm || block >= bm->total_blocks) return -1;
+    if (eynfs_journal_freed(drive, block, 1) != 0) return -1;
+    eynfs_bitmap_mark(bm, block, 1, 0);
+    return 0;
+}
+
+int eynfs_count_free_blocks(uint8 drive, const eynfs_superblock_t *sb) {
+    eynfs_bitmap_t *bm = eynfs_bitmap_get(drive, sb);
+    return bm ? (int)bm->free_total : -1;
+}
+
+int eynfs_block_in_use(uint8 drive, const eynfs_superblock_t *sb, uint32_t block) {
+    eynfs_bitmap_t *bm = eynfs_bitmap_get(drive, sb);
+    if (!bm) return -1;
+    if (block >= bm->total_blocks) return 1; // Past the bitmap: never allocatable
+    return (bm->bits[block / 8] >> (block % 8)) & 1;
+}
+
+// --- Extents (v12 file layout) ---
+
+// Requests eynfs_extent_io keeps queued at once
+#define EYNFS_EXTENT_BATCH 8
+
+// One extent of a file in memory; logical is the file block it starts at, so the extent
+// holding any offset is found by binary search
+typedef struct {
+    uint32_t logical;
+    uint32_t start;
+    uint32_t count;
+} eynfs_extent_run_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    eynfs_extent_run_t *runs;
+} eynfs_extent_map_t;
+
+static void eynfs_extent_map_init(eynfs_extent_map_t *map) {
+    map->count = 0;
+    map->capacity = 0;
+    map->runs = NULL;
+}
+
+static void eynfs_extent_map_release(eynfs_extent_map_t *map) {
+    if (map->runs) free(map->runs);
+    eynfs_extent_map_init(map);
+}
+
+// Append `count` blocks starting at `start`, growing the last extent when they follow it
+static int eynfs_extent_push(eynfs_extent_map_t *map, uint32_t start, uint32_t count) {
+    if (count == 0) return 0;
+    if (map->count > 0) {
+        eynfs_extent_run_t *last = &map->runs[map->count - 1];
+        if (last->start + last->count == start) {
+            last->count += count;
+            return 0;
+        }
+    }
+    if (map->count == map->capacity) {
+        uint32_t capacity = map->capacity ? map->capacity * 2 : 8;
+        eynfs_extent_run_t *runs = (eynfs_extent_run_t*)realloc(map->runs, capacity * sizeof(eynfs_extent_run_t));
+        if (!runs) return -1;
+        map->runs = runs;
+        map->capacity = capacity;
+    }
+    eynfs_extent_run_t *run = &map->runs[map->count];
+    run->logical = map->count ? map->runs[map->count - 1].logical + map->runs[map->count - 1].count : 0;
+    run->start = start;
+    run->count = count;
+    map->count++;
+    return 0;
+}
+
+// Index of the extent holding file block `index`
+static uint32_t eynfs_extent_find(const eynfs_extent_map_t *map, uint32_t index) {
+    uint32_t lo = 0;
+    uint32_t hi = map->count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (map->runs[mid].logical <= index) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Load the extent list of an EYNFS_FLAG_EXTENTS file: the first extent from the entry, the
+// rest from its map blocks
+static int eynfs_extent_load(uint8 drive, const eynfs_dir_entry_t *entry, eynfs_extent_map_t *map) {
+    eynfs_extent_map_init(map);
+    if (eynfs_extent_push(map, entry->first_block, entry->extra[0]) != 0) return -1;
+    
+    uint32_t map_block = entry->extra[1];
+    if (!map_block) return 0;
+    uint32_t bs = eynfs_bsize(drive);
+    uint8 *buf = (uint8*)malloc(bs);
+    if (!buf) {
+        eynfs_extent_map_release(map);
+        return -1;
+    }
+    int result = 0;
+    while (map_block && result == 0) {
+        const eynfs_extent_header_t *hdr = (const eynfs_extent_header_t*)buf;
+        if (eynfs_dev_read(drive, map_block, 1, buf) != 0 ||
+            hdr->magic != EYNFS_EXTENT_MAGIC || hdr->count > EYNFS_EXTENTS_PER_BLOCK(bs)) {
+            result = -1;
+            break;
+        }
+        const eynfs_extent_t *ext = (const eynfs_extent_t*)(buf + sizeof(eynfs_extent_header_t));
+        for (uint32_t i = 0; i < hdr->count && result == 0; i++) {
+            result = eynfs_extent_push(map, ext[i].start, ext[i].count);
+        }
+        map_block = hdr->next;
+    }
+    free(buf);
+    if (result != 0) eynfs_extent_map_release(map);
+    return result;
+}
+
+// Move `count` whole blocks of file data, starting at file block `index`, between buf and
+// the disk. Each extent piece is one request and a batch of them is queued under one plug,
+// so a contiguous file moves in a few large transfers. buf must be word-aligned for DMA.
+static int eynfs_extent_io(uint8 drive, const eynfs_extent_map_t *map, uint32_t index, uint32_t count, uint8 *buf, uint8 flags) {
+    if (count == 0) return 0;
+    if (map->count == 0) return -1;
+    block_request_t reqs[EYNFS_EXTENT_BATCH];
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t i = eynfs_extent_find(map, index);
+    int failed = 0;
+    bcache_stats_t cache;
+    bcache_get_stats(&cache);
+    while (count > 0 && !failed) {
+        uint32_t queued = 0;
+        block_plug(drive);
+        while (count > 0 && queued < EYNFS_EXTENT_BATCH) {
+            const eynfs_extent_run_t *run = &map->runs[i];
+            if (i >= map->count || index >= run->logical + run->count) { failed = 1; break; }
+            uint32_t skip = index - run->logical;
+            uint32_t n = run->count - skip;
+            if (n > count) n = count;
+            eynfs_request_init(&reqs[queued], drive, run->start + skip, n, buf, flags);
+            int submit = 1;
+            if (flags & BLOCK_REQ_WRITE) {
+                if (eynfs_journal_forget(drive, run->start + skip, n) != 0) { failed = 1; break; }
+                // A piece the buffer cache can hold waits there for the next write-back. The
+                // journal writes it back before committing the metadata that names it; a sector
+                // that fails to go out stays dirty, so that commit fails instead of naming lost data.
+                if (reqs[queued].count <= cache.max_transfer) {
+                    if (bcache_write(drive, reqs[queued].lba, reqs[queued].count, buf) != 0) { failed = 1; break; }
+                    submit = 0;
+                }
+            } else if (bcache_lookup(drive, reqs[queued].lba, reqs[queued].count, buf) == 0) {
+                submit = 0; // A read the buffer cache holds in full needs no transfer
+            }
+            if (submit) {
+                if (block_submit(&reqs[queued]) != 0) { failed = 1; break; }
+                queued++;
+            }
+            buf += n * bs;
+            index += n;
+            count -= n;
+            i++;
+        }
+        block_unplug(drive);
+        for (uint32_t k = 0; k < queued; k++) {
+            if (block_wait(&reqs[k], ATA_REQUEST_TIMEOUT_MS) != 0) failed = 1;
+            else if (!(flags & BLOCK_REQ_WRITE)) bcache_insert(drive, reqs[k].lba, reqs[k].count, reqs[k].buf);
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+// Called before reading len bytes at offset: if the file is being read sequentially and the
+// read reaches past the prefetched blocks, fetch the next window into the buffer cache
+static void eynfs_readahead(uint8 drive, const eynfs_dir_entry_t *entry, const eynfs_extent_map_t *map, size_t offset, size_t len) {
+    if (len == 0) return;
+    eynfs_readahead_t *ra = NULL;
+    for (int i = 0; i < EYNFS_READAHEAD_STREAMS && !ra; i++) {
+        if (readahead[i].valid && readahead[i].drive == drive && readahead[i].first_block == entry->first_block) ra = &readahead[i];
+    }
+    if (!ra) {
+        ra = &readahead[readahead_victim];
+        readahead_victim = (readahead_victim + 1) % EYNFS_READAHEAD_STREAMS;
+        ra->valid = 1;
+        ra->drive = drive;
+        ra->first_block = entry->first_block;
+        ra->next_offset = 0xFFFFFFFF;
+        ra->window = 0;
+    }
+    
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t first = offset / bs;
+    uint32_t last = (offset + len - 1) / bs;
+    if (offset != ra->next_offset && offset != 0) {
+        ra->window = 0;
+    } else if (ra->window == 0 || offset == 0) {
+        ra->window = EYNFS_READAHEAD_MIN;
+        ra->ahead = first;
+    }
+    ra->next_offset = offset + len;
+    if (ra->window == 0 || last < ra->ahead) return;
+    
+    // Prefetches the cache couldn't keep are pointless
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    uint32_t limit = stats.max_transfer / eynfs_spb(drive);
+    uint32_t start = ra->ahead > first ? ra->ahead : first;
+    uint32_t blocks = (entry->size + bs - 1) / bs;
+    uint32_t count = last - start + 1 + ra->window; // The read itself, then the window past it
+    if (count > limit) count = limit;
+    if (start >= blocks) return;
+    if (count > blocks - start) count = blocks - start;
+    if (count <= last - start + 1) {
+        ra->ahead = last + 1; // The read moves that much by itself
+        return;
+    }
+    
+    uint8 *buf = (uint8*)malloc(count * bs);
+    if (!buf) return;
+    if (eynfs_extent_io(drive, map, start, count, buf, 0) == 0) {
+        ra->ahead = start + count;
+        if (ra->window < EYNFS_READAHEAD_MAX) ra->window *= 2;
+    }
+    free(buf);
+}
+
+// Read bytes_left bytes at offset from an extent-mapped file. Whole blocks go straight into
+// the caller's buffer; partial blocks (and unaligned buffers) are staged through a bounce buffer.
+static int eynfs_read_extents(uint8 drive, const eynfs_dir_entry_t *entry, uint8 *out, size_t bytes_left, size_t offset) {
+    eynfs_extent_map_t map;
+    if (eynfs_extent_load(drive, entry, &map) != 0) return -1;
+    eynfs_readahead(drive, entry, &map, offset, bytes_left);
+    
+    uint8 *bounce = NULL;
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t index = offset / bs;
+    size_t within = offset % bs;
+    size_t total = 0;
+    int failed = 0;
+    while (bytes_left > 0) {
+        if (within == 0 && bytes_left >= bs && !((uint32_t)(out + total) & 1)) {
+            uint32_t n = bytes_left / bs;
+            if (eynfs_extent_io(drive, &map, index, n, out + total, 0) != 0) { failed = 1; break; }
+            index += n;
+            total += n * bs;
+            bytes_left -= n * bs;
+            continue;
+        }
+        if (!bounce) bounce = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+        if (!bounce) { failed = 1; break; }
+        uint32_t n = (within + bytes_left + bs - 1) / bs;
+        if (n > eynfs_chain_batch(drive)) n = eynfs_chain_batch(drive);
+        if (eynfs_extent_io(drive, &map, index, n, bounce, 0) != 0) { failed = 1; break; }
+        size_t chunk = n * bs - within;
+        if (chunk > bytes_left) chunk = bytes_left;
+        memcpy(out + total, bounce + within, chunk);
+        index += n;
+        total += chunk;
+        bytes_left -= chunk;
+        within = 0;
+    }
+    if (bounce) free(bounce);
+    eynfs_extent_map_release(&map);
+    return failed ? -1 : (int)total;
+}
+
+// Write `size` bytes from the start of an extent-mapped file's blocks, zero-padding the last one
+static int eynfs_write_extents(uint8 drive, const eynfs_extent_map_t *map, const uint8 *data, size_t size) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t index = 0;
+    size_t pos = 0;
+    if (!((uint32_t)data & 1) && size >= bs) {
+        index = size / bs;
+        pos = index * bs;
+        if (eynfs_extent_io(drive, map, 0, index, (uint8*)data, BLOCK_REQ_WRITE) != 0) return -1;
+    }
+    if (pos == size) return 0;
+    
+    uint8 *bounce = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+    if (!bounce) return -1;
+    int result = 0;
+    while (pos < size && result == 0) {
+        size_t chunk = size - pos;
+        if (chunk > EYNFS_CHAIN_BATCH_BYTES) chunk = EYNFS_CHAIN_BATCH_BYTES;
+        uint32_t n = (chunk + bs - 1) / bs;
+        memset(bounce + (n - 1) * bs, 0, bs);
+        memcpy(bounce, data + pos, chunk);
+        result = eynfs_extent_io(drive, map, index, n, bounce, BLOCK_REQ_WRITE);
+        index += n;
+        pos += chunk;
+    }
+    free(bounce);
+    return result;
+}
+
+// Release `count` consecutive blocks
+static int eynfs_free_range(uint8 drive, eynfs_superblock_t *sb, uint32_t start, uint32_t count) {
+    if (count == 0) return 0;
+    eynfs_bitmap_t *bm = eynfs_bitmap_get(drive, sb);
+    if (!bm || start >= bm->total_blocks || count > bm->total_blocks - start) return -1;
+    if (eynfs_journal_freed(drive, start, count) != 0) return -1;
+    eynfs_bitmap_mark(bm, start, count, 0);
+    return 0;
+}
+
+static void eynfs_extent_map_free_blocks(uint8 drive, eynfs_superblock_t *sb, const eynfs_extent_map_t *map) {
+    for (uint32_t i = 0; i < map->count; i++) {
+        eynfs_free_range(drive, sb, map->runs[i].start, map->runs[i].count);
+    }
+}
+
+// Allocate `count` blocks of file data into `map` as a few long runs: first the free blocks
+// from `goal` on (the block after a growing file's last extent; 0 for none), then the first
+// run that holds all the rest, or if free space is too fragmented for that, the longest runs
+// there are. Each run is marked used in the resident bitmap in one step, so a file of any
+// size costs a single bitmap update at the operation's consistency point.
+static int eynfs_extent_alloc(uint8 drive, eynfs_superblock_t *sb, uint32_t count, uint32_t goal, eynfs_extent_map_t *map) {
+    eynfs_bitmap_t *bm = eynfs_bitmap_get(drive, sb);
+    if (!bm) return -1;
+    eynfs_journal_t *jr = eynfs_journal_for(drive);
+    if (goal) {
+        uint32_t n = 0;
+        while (n < count && eynfs_bitmap_usable(bm, jr, goal + n)) n++;
+        if (n && eynfs_extent_push(map, goal, n) == 0) {
+            eynfs_bitmap_mark(bm, goal, n, 1);
+            count -= n;
+        }
+    }
+    while (count > 0) {
+        uint32_t found = 0;
+        int start = eynfs_bitmap_find_run(bm, jr, count, &found);
+        if (start < 0 && jr && jr->freed_count && bm->free_total) {
+            // Only blocks the running transaction freed are left: commit it so they can be reused
+            if (eynfs_journal_commit(jr) != 0) break;
+            continue;
+        }
+        if (start < 0 || eynfs_extent_push(map, (uint32_t)start, found) != 0) break;
+        eynfs_bitmap_mark(bm, (uint32_t)start, found, 1);
+        count -= found;
+    }
+    if (count == 0) return 0;
+    eynfs_extent_map_free_blocks(drive, sb, map);
+    eynfs_extent_map_release(map);
+    return -1;
+}
+
+// Record an extent list in a directory entry. The first extent lives in the entry itself;
+// the rest are spilled into newly allocated map blocks.
+static int eynfs_extent_store(uint8 drive, eynfs_superblock_t *sb, const eynfs_extent_map_t *map, eynfs_dir_entry_t *entry) {
+    entry->flags |= EYNFS_FLAG_EXTENTS;
+    entry->first_block = map->count ? map->runs[0].start : 0;
+    entry->extra[0] = map->count ? map->runs[0].count : 0;
+    entry->extra[1] = 0;
+    if (map->count <= 1) return 0;
+    
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t per_block = EYNFS_EXTENTS_PER_BLOCK(bs);
+    uint32_t spill = map->count - 1;
+    uint32_t map_blocks = (spill + per_block - 1) / per_block;
+    uint32_t *blocks = (uint32_t*)malloc(map_blocks * sizeof(uint32_t));
+    uint8 *buf = (uint8*)malloc(bs);
+    if (!blocks || !buf) {
+        if (blocks) free(blocks);
+        if (buf) free(buf);
+        return -1;
+    }
+    for (uint32_t b = 0; b < map_blocks; b++) {
+        int block = eynfs_alloc_block(drive, sb);
+        if (block < 0) {
+            for (uint32_t k = 0; k < b; k++) eynfs_free_block(drive, sb, blocks[k]);
+            free(blocks);
+            free(buf);
+            return -1;
+        }
+        blocks[b] = (uint32_t)block;
+    }
+    
+    int result = 0;
+    for (uint32_t b = 0; b < map_blocks && result == 0; b++) {
+        memset(buf, 0, bs);
+        eynfs_extent_header_t *hdr = (eynfs_extent_header_t*)buf;
+        eynfs_extent_t *ext = (eynfs_extent_t*)(buf + sizeof(eynfs_extent_header_t));
+        uint32_t first = 1 + b * per_block;
+        hdr->magic = EYNFS_EXTENT_MAGIC;
+        hdr->count = map->count - first;
+        if (hdr->count > per_block) hdr->count = per_block;
+        hdr->next = (b + 1 < map_blocks) ? blocks[b + 1] : 0;
+        for (uint32_t k = 0; k < hdr->count; k++) {
+            ext[k].start = map->runs[first + k].start;
+            ext[k].count = map->runs[first + k].count;
+        }
+        result = eynfs_write_blocks(drive, blocks[b], 1, buf);
+    }
+    if (result == 0) {
+        entry->extra[1] = blocks[0];
+    } else {
+        for (uint32_t b = 0; b < map_blocks; b++) eynfs_free_block(drive, sb, blocks[b]);
+    }
+    free(blocks);
+    free(buf);
+    return result;
+}
+
+// Release the map blocks starting at map_block, and the extents they list if `data` is set
+static void eynfs_extent_free_map(uint8 drive, eynfs_superblock_t *sb, uint32_t map_block, int data) {
+    if (!map_block) return;
+    uint32_t bs = eynfs_bsize(drive);
+    uint8 *buf = (uint8*)malloc(bs);
+    if (!buf) return;
+    while (map_block) {
+        const eynfs_extent_header_t *hdr = (const eynfs_extent_header_t*)buf;
+        if (eynfs_dev_read(drive, map_block, 1, buf) != 0 ||
+            hdr->magic != EYNFS_EXTENT_MAGIC || hdr->count > EYNFS_EXTENTS_PER_BLOCK(bs)) break;
+        const eynfs_extent_t *ext = (const eynfs_extent_t*)(buf + sizeof(eynfs_extent_header_t));
+        for (uint32_t i = 0; i < hdr->count && data; i++) {
+            eynfs_free_range(drive, sb, ext[i].start, ext[i].count);
+        }
+        uint32_t next = hdr->next;
+        eynfs_free_block(drive, sb, map_block);
+        map_block = next;
+    }
+    free(buf);
+}
+
+// Release the data and map blocks of an extent-mapped file
+static void eynfs_extent_free(uint8 drive, eynfs_superblock_t *sb, const eynfs_dir_entry_t *entry) {
+    eynfs_free_range(drive, sb, entry->first_block, entry->extra[0]);
+    eynfs_extent_free_map(drive, sb, entry->extra[1], 1);
+}
+
+// Release a file's storage, whichever layout it uses. Inline files own no blocks; their data
+// slots are cleared by whoever rewrites the directory entry.
+static void eynfs_free_file(uint8 drive, eynfs_superblock_t *sb, const eynfs_dir_entry_t *entry) {
+    if (entry->flags & EYNFS_FLAG_INLINE) return;
+    if (entry->flags & EYNFS_FLAG_EXTENTS) {
+        eynfs_extent_free(drive, sb, entry);
+    } else if (entry->first_block) {
+        uint32_t payload = eynfs_payload_size(drive);
+        eynfs_free_chain(drive, sb, entry->first_block, (entry->size + payload - 1) / payload);
+    }
+}
+
+// Raise the filesystem version once it holds something older drivers can't read. On a
+// mounted drive the superblock goes out with the rest of the operation at its consistency point.
+static int eynfs_mark_version(uint8 drive, eynfs_superblock_t *sb, uint32_t version) {
+    if (sb->version >= version) return 0;
+    sb->version = version;
+    eynfs_mount_t *m = drive < EYNFS_MAX_DRIVES ? &mounts[drive] : NULL;
+    if (m && m->mounted && m->lba == EYNFS_SUPERBLOCK_LBA) {
+        if (m->sb.version < version) {
+            m->sb.version = version;
+            m->dirty = 1;
+        }
+        return 0;
+    }
+    return eynfs_write_superblock(drive, EYNFS_SUPERBLOCK_LBA, sb);
+}
+
+// Extent-mapped entries cannot be read by v11 drivers, so the first one marks the filesystem v12
+static int eynfs_mark_extents(uint8 drive, eynfs_superblock_t *sb) {
+    return eynfs_mark_version(drive, sb, EYNFS_VERSION_EXTENTS);
+}
+
+// --- Inline files (v13) ---
+
+// Copy bytes_left bytes at offset out of an inline file's data slots
+static int eynfs_read_inline(uint8 drive, const eynfs_dir_entry_t *entry, uint8 *out, size_t bytes_left, size_t offset) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t slot = entry->extra[0];
+    uint32_t slots = entry->extra[1];
+    if (slots > EYNFS_INLINE_MAX_SLOTS || slot + slots > EYNFS_DIR_ENTRIES_PER_BLOCK(bs) ||
+        entry->size > slots * EYNFS_INLINE_SLOT_BYTES) return -1;
+    uint8 *buf = (uint8*)malloc(bs);
+    if (!buf) return -1;
+    if (eynfs_dev_read(drive, entry->first_block, 1, buf) != 0) {
+        free(buf);
+        return -1;
+    }
+    
+    const eynfs_inline_slot_t *data = (const eynfs_inline_slot_t*)(buf + 4) + slot;
+    size_t total = 0;
+    int result = 0;
+    while (bytes_left > 0) {
+        const eynfs_inline_slot_t *s = &data[offset / EYNFS_INLINE_SLOT_BYTES];
+        if (s->empty != 0 || s->mark != EYNFS_INLINE_MARK) { result = -1; break; }
+        size_t within = offset % EYNFS_INLINE_SLOT_BYTES;
+        size_t chunk = EYNFS_INLINE_SLOT_BYTES - within;
+        if (chunk > bytes_left) chunk = bytes_left;
+        memcpy(out + total, s->data + within, chunk);
+        total += chunk;
+        offset += chunk;
+        bytes_left -= chunk;
+    }
+    free(buf);
+    return result < 0 ? -1 : (int)total;
+}
+
+// Store a small file's contents in the directory slots following its entry, if they are free
+// (or already its own). The entry and its data go out in one write of the sectors holding
+// them, and slots the file no longer needs are cleared in the same write. Returns 1 if the
+// file was stored inline, 0 if it doesn't fit (nothing is changed), or -1 on error; *old
+// receives the on-disk entry that was replaced.
+static int eynfs_write_inline(uint8 drive, eynfs_dir_entry_t *entry, const uint8 *data, size_t size,
+                              uint32_t parent_block, uint32_t entry_index, eynfs_dir_entry_t *old) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
+    uint32_t slot = entry_index % per_block;
+    uint32_t slots = (size + EYNFS_INLINE_SLOT_BYTES - 1) / EYNFS_INLINE_SLOT_BYTES;
+    uint32_t chain[EYNFS_DIR_MAX_BLOCKS];
+    uint32_t pos = entry_index / per_block;
+    if (size == 0 || size > EYNFS_INLINE_MAX || slot + 1 + slots > per_block) return 0;
+    if (pos >= EYNFS_DIR_MAX_BLOCKS || (uint32_t)eynfs_dir_chain(drive, parent_block, chain, pos + 1) <= pos) return -1;
+    
+    // The slots must be free, or be this file's current data
+    eynfs_dir_entry_t *table = (eynfs_dir_entry_t*)malloc(bs);
+    if (!table) return -1;
+    if (eynfs_dev_read(drive, chain[pos], 1, (uint8*)table) != 0) {
+        free(table);
+        return -1;
+    }
+    eynfs_dir_entry_t *slot_entries = (eynfs_dir_entry_t*)((uint8*)table + 4) + slot;
+    *old = slot_entries[0];
+    uint32_t owned = 0;
+    if ((old->flags & EYNFS_FLAG_INLINE) && old->first_block == chain[pos] && old->extra[0] == slot + 1 &&
+        old->extra[1] <= EYNFS_INLINE_MAX_SLOTS && slot + 1 + old->extra[1] <= per_block) {
+        owned = old->extra[1];
+    }
+    uint32_t span = 1 + (slots > owned ? slots : owned);
+    for (uint32_t i = 1 + owned; i <= slots; i++) {
+        if (slot_entries[i].name[0] != '\0' || EYNFS_SLOT_IS_INLINE(&slot_entries[i])) {
+            free(table);
+            return 0;
+        }
+    }
+    
+    eynfs_dir_entry_t updated = *entry;
+    updated.flags = (updated.flags & ~EYNFS_FLAG_EXTENTS) | EYNFS_FLAG_INLINE;
+    updated.size = size;
+    updated.first_block = chain[pos];
+    updated.extra[0] = slot + 1;
+    updated.extra[1] = slots;
+    slot_entries[0] = updated;
+    for (uint32_t i = 1; i < span; i++) {
+        eynfs_inline_slot_t *s = (eynfs_inline_slot_t*)&slot_entries[i];
+        memset(s, 0, sizeof(eynfs_inline_slot_t));
+        if (i > slots) continue; // Released
+        size_t at = (i - 1) * EYNFS_INLINE_SLOT_BYTES;
+        size_t chunk = size - at < EYNFS_INLINE_SLOT_BYTES ? size - at : EYNFS_INLINE_SLOT_BYTES;
+        s->mark = EYNFS_INLINE_MARK;
+        memcpy(s->data, data + at, chunk);
+    }
+    int result = eynfs_dir_slots_write(drive, parent_block, entry_index, slot_entries, span, NULL);
+    free(table);
+    if (result != 0) return -1;
+    *entry = updated;
+    return 1;
+}
+
+// Clear the data slots of an inline file whose entry has been rewritten
+static int eynfs_inline_clear(uint8 drive, uint32_t parent_block, uint32_t entry_index, const eynfs_dir_entry_t *old) {
+    uint32_t slots = old->extra[1];
+    if (!(old->flags & EYNFS_FLAG_INLINE) || slots == 0 || slots > EYNFS_INLINE_MAX_SLOTS) return 0;
+    eynfs_dir_entry_t empty[EYNFS_INLINE_MAX_SLOTS];
+    memset(empty, 0, sizeof(empty));
+    return eynfs_dir_slots_write(drive, parent_block, entry_index + 1, empty, slots, NULL);
+}
+
+// --- Directory hash index ---
+
+// FNV-1a over the name: the low bits pick the leaf and starting slot, the high half is the tag
+static uint32_t eynfs_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < EYNFS_NAME_MAX && name[i]; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Index root of the directory starting at dir_block, or 0 if it has none. buf holds a block.
+static uint32_t eynfs_dir_index_root(uint8 drive, uint32_t dir_block, uint8 *buf) {
+    if (eynfs_dev_read(drive, dir_block, 1, buf) != 0) return 0;
+    const eynfs_dir_index_tail_t *tail = (const eynfs_dir_index_tail_t*)(buf + eynfs_bsize(drive) - sizeof(eynfs_dir_index_tail_t));
+    return tail->magic == EYNFS_DIR_INDEX_MAGIC ? tail->root : 0;
+}
+
+// Point a directory's first block at a new index root (0 drops the index)
+static int eynfs_dir_index_set_root(uint8 drive, uint32_t dir_block, uint32_t root, uint8 *buf) {
+    if (eynfs_dev_read(drive, dir_block, 1, buf) != 0) return -1;
+    eynfs_dir_index_tail_t *tail = (eynfs_dir_index_tail_t*)(buf + eynfs_bsize(drive) - sizeof(eynfs_dir_index_tail_t));
+    memset(tail, 0, sizeof(eynfs_dir_index_tail_t));
+    if (root) {
+        tail->magic = EYNFS_DIR_INDEX_MAGIC;
+        tail->root = root;
+    }
+    return eynfs_write_blocks(drive, dir_block, 1, buf);
+}
+
+// Read an index block into buf, checking its magic and count
+static int eynfs_dir_index_load(uint8 drive, uint32_t block, uint32_t magic, uint8 *buf) {
+    uint32_t bs = eynfs_bsize(drive);
+    const eynfs_dir_index_header_t *hdr = (const eynfs_dir_index_header_t*)buf;
+    if (eynfs_dev_read(drive, block, 1, buf) != 0 || hdr->magic != magic) return -1;
+    if (magic == EYNFS_DIR_ROOT_MAGIC && (hdr->count == 0 || hdr->count > EYNFS_DIR_INDEX_LEAVES(bs))) return -1;
+    if (magic == EYNFS_DIR_LEAF_MAGIC && hdr->count > EYNFS_DIR_INDEX_SLOTS(bs)) return -1;
+    return 0;
+}
+
+// Release an index root and its leaves
+static void eynfs_dir_index_free(uint8 drive, eynfs_superblock_t *sb, uint32_t root, uint8 *buf) {
+    if (eynfs_dir_index_load(drive, root, EYNFS_DIR_ROOT_MAGIC, buf) == 0) {
+        const eynfs_dir_index_header_t *hdr = (const eynfs_dir_index_header_t*)buf;
+        const uint32_t *leaves = (const uint32_t*)(buf + sizeof(eynfs_dir_index_header_t));
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            if (leaves[i]) eynfs_free_block(drive, sb, leaves[i]);
+        }
+    }
+    eynfs_free_block(drive, sb, root);
+}
+
+// Put a slot into a leaf with linear probing from the hash's starting slot. Returns -1 if the
+// leaf has no empty slot.
+static int eynfs_dir_leaf_insert(uint32_t bs, uint8 *leaf, uint32_t hash, uint32_t block, uint32_t index) {
+    eynfs_dir_index_header_t *hdr = (eynfs_dir_index_header_t*)leaf;
+    eynfs_dir_index_slot_t *slots = (eynfs_dir_index_slot_t*)(leaf + sizeof(eynfs_dir_index_header_t));
+    uint32_t capacity = EYNFS_DIR_INDEX_SLOTS(bs);
+    uint32_t start = (hash >> 8) % capacity;
+    for (uint32_t k = 0; k < capacity; k++) {
+        eynfs_dir_index_slot_t *slot = &slots[(start + k) % capacity];
+        if (slot->block != 0 && slot->block != EYNFS_DIR_SLOT_TOMBSTONE) continue;
+        if (slot->block == 0) hdr->count++; // Reusing a tombstone doesn't raise the load
+        slot->block = block;
+        slot->index = (uint16_t)index;
+        slot->tag = (uint16_t)(hash >> 16);
+        return 0;
+    }
+    return -1;
+}
+
+// Rebuild a directory's index from its table (`entries`, `count` entries laid out over the
+// chain) and swap it in for the old one. A directory that fits in one block gets no index.
+static int eynfs_dir_index_build(uint8 drive, eynfs_superblock_t *sb, uint32_t dir_block, const eynfs_dir_entry_t *entries, int count) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
+    uint32_t capacity = EYNFS_DIR_INDEX_SLOTS(bs);
+    uint32_t chain[EYNFS_DIR_MAX_BLOCKS];
+    int chain_len = eynfs_dir_chain(drive, dir_block, chain, EYNFS_DIR_MAX_BLOCKS);
+    
+    uint32_t named = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].name[0] != '\0') named++;
+    }
+    
+    uint8 *scratch = (uint8*)malloc(bs);
+    if (!scratch) return -1;
+    uint32_t old_root = eynfs_dir_index_root(drive, dir_block, scratch);
+    if (chain_len <= 1) {
+        // Small enough to scan in one read
+        int result = 0;
+        if (old_root) {
+            result = eynfs_dir_index_set_root(drive, dir_block, 0, scratch);
+            if (result == 0) eynfs_dir_index_free(drive, sb, old_root, scratch);
+        }
+        free(scratch);
+        return result;
+    }
+    
+    // Size for a load of at most half, then retry with more leaves if one still overflows
+    uint32_t leaf_count = (named * 2 + capacity - 1) / capacity;
+    if (leaf_count == 0) leaf_count = 1;
+    uint8 *mem = NULL;
+    for (;;) {
+        if (leaf_count > EYNFS_DIR_INDEX_LEAVES(bs)) break;
+        mem = (uint8*)malloc((1 + leaf_count) * bs);
+        if (!mem) break;
+        memset(mem, 0, (1 + leaf_count) * bs);
+        int overflow = 0;
+        for (int i = 0; i < count && !overflow; i++) {
+            if (entries[i].name[0] == '\0') continue;
+            if ((uint32_t)i / per_block >= (uint32_t)chain_len) break;
+            uint32_t hash = eynfs_name_hash(entries[i].name);
+            uint8 *leaf = mem + (1 + hash % leaf_count) * bs;
+            overflow = eynfs_dir_leaf_insert(bs, leaf, hash, chain[i / per_block], i) != 0;
+        }
+        if (!overflow) break;
+        free(mem);
+        mem = NULL;
+        leaf_count *= 2;
+    }
+    if (!mem) {
+        free(scratch);
+        return -1;
+    }
+    
+    // Allocate and write the root and leaves, then switch the directory over to them
+    uint32_t *blocks = (uint32_t*)(mem + sizeof(eynfs_dir_index_header_t));
+    int result = 0;
+    uint32_t allocated = 0;
+    int root = eynfs_alloc_block(drive, sb);
+    if (root < 0) result = -1;
+    for (; result == 0 && allocated < leaf_count; allocated++) {
+        int leaf = eynfs_alloc_block(drive, sb);
+        if (leaf < 0) { result = -1; break; }
+        blocks[allocated] = (uint32_t)leaf;
+    }
+    if (result == 0) {
+        eynfs_dir_index_header_t *hdr = (eynfs_dir_index_header_t*)mem;
+        hdr->magic = EYNFS_DIR_ROOT_MAGIC;
+        hdr->count = leaf_count;
+        result = eynfs_write_blocks(drive, (uint32_t)root, 1, mem);
+        for (uint32_t l = 0; l < leaf_count && result == 0; l++) {
+            uint8 *leaf = mem + (1 + l) * bs;
+            ((eynfs_dir_index_header_t*)leaf)->magic = EYNFS_DIR_LEAF_MAGIC;
+            result = eynfs_write_blocks(drive, blocks[l], 1, leaf);
+        }
+    }
+    if (result == 0) result = eynfs_dir_index_set_root(drive, dir_block, (uint32_t)root, scratch);
+    if (result == 0) {
+        if (old_root) eynfs_dir_index_free(drive, sb, old_root, scratch);
+    } else {
+        for (uint32_t l = 0; l < allocated; l++) eynfs_free_block(drive, sb, blocks[l]);
+        if (root >= 0) eynfs_free_block(drive, sb, (uint32_t)root);
+    }
+    free(mem);
+    free(scratch);
+    return result;
+}
+
+// Record a new entry at table position `index` in the directory's index, building the index
+// once the directory outgrows its first block and rebuilding it when a leaf gets three-quarters
+// full. `entries` is the directory table as just written.
+static int eynfs_dir_index_add(uint8 drive, eynfs_superblock_t *sb, uint32_t dir_block, const eynfs_dir_entry_t *entries, int count, uint32_t index) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
+    uint8 *buf = (uint8*)malloc(bs);
+    if (!buf) return -1;
+    uint32_t root = eynfs_dir_index_root(drive, dir_block, buf);
+    if (!root) {
+        free(buf);
+        return (uint32_t)count > per_block ? eynfs_dir_index_build(drive, sb, dir_block, entries, count) : 0;
+    }
+    
+    uint32_t hash = eynfs_name_hash(entries[index].name);
+    uint32_t chain[EYNFS_DIR_MAX_BLOCKS];
+    int chain_len = eynfs_dir_chain(drive, dir_block, chain, EYNFS_DIR_MAX_BLOCKS);
+    int result = -1;
+    if (index / per_block < (uint32_t)chain_len && eynfs_dir_index_load(drive, root, EYNFS_DIR_ROOT_MAGIC, buf) == 0) {
+        const eynfs_dir_index_header_t *hdr = (const eynfs_dir_index_header_t*)buf;
+        uint32_t leaf_block = ((const uint32_t*)(buf + sizeof(eynfs_dir_index_header_t)))[hash % hdr->count];
+        if (eynfs_dir_index_load(drive, leaf_block, EYNFS_DIR_LEAF_MAGIC, buf) == 0 &&
+            ((eynfs_dir_index_header_t*)buf)->count + 1 <= EYNFS_DIR_INDEX_SLOTS(bs) * 3 / 4 &&
+            eynfs_dir_leaf_insert(bs, buf, hash, chain[index / per_block], index) == 0) {
+            result = eynfs_write_blocks(drive, leaf_block, 1, buf);
+        }
+    }
+    free(buf);
+    if (result != 0) result = eynfs_dir_index_build(drive, sb, dir_block, entries, count);
+    return result;
 }
 
-// Allocate a free block, mark it as used in the bitmap, and return its block number
-int eynfs_alloc_block(uint8 drive, eynfs_superblock_t *sb) {
-    // Use optimized allocation with caching
-    int block = eynfs_alloc_block_optimized(drive, sb);
-    if (block >= 0) {
-        // Mark as used in bitmap
-        uint8 bitmap[EYNFS_BLOCK_SIZE];
-        if (eynfs_read_bitmap(drive, sb, bitmap) != 0) return -1;
-        uint32_t byte = block / 8;
-        uint8_t bit = block % 8;
-        bitmap[byte] |= (1 << bit);
-        if (eynfs_write_bitmap(drive, sb, bitmap) != 0) return -1;
-        return block;
-    }
-    
-    // Fallback to original method if cache is empty
-    uint8 bitmap[EYNFS_BLOCK_SIZE];
-    if (eynfs_read_bitmap(drive, sb, bitmap) != 0) return -1;
-    for (uint32_t i = 0; i < EYNFS_BLOCK_SIZE * 8 && i < sb->total_blocks; ++i) {
-        uint32_t byte = i / 8;
-        uint8_t bit = i % 8;
-        if (!(bitmap[byte] & (1 << bit))) {
-            // Mark as used
-            bitmap[byte] |= (1 << bit);
-            if (eynfs_write_bitmap(drive, sb, bitmap) != 0) return -1;
-            return i;
-        }
-    }
-    return -1; // No free block found
+// Turn the slot for the entry at table position `index` into a tombstone
+static int eynfs_dir_index_remove(uint8 drive, uint32_t dir_block, const char *name, uint32_t index) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint8 *buf = (uint8*)malloc(bs);
+    if (!buf) return -1;
+    uint32_t root = eynfs_dir_index_root(drive, dir_block, buf);
+    int result = 0;
+    if (root) {
+        result = -1;
+        uint32_t hash = eynfs_name_hash(name);
+        if (eynfs_dir_index_load(drive, root, EYNFS_DIR_ROOT_MAGIC, buf) == 0) {
+            const eynfs_dir_index_header_t *hdr = (const eynfs_dir_index_header_t*)buf;
+            uint32_t leaf_block = ((const uint32_t*)(buf + sizeof(eynfs_dir_index_header_t)))[hash % hdr->count];
+            if (eynfs_dir_index_load(drive, leaf_block, EYNFS_DIR_LEAF_MAGIC, buf) == 0) {
+                eynfs_dir_index_slot_t *slots = (eynfs_dir_index_slot_t*)(buf + sizeof(eynfs_dir_index_header_t));
+                uint32_t capacity = EYNFS_DIR_INDEX_SLOTS(bs);
+                uint32_t start = (hash >> 8) % capacity;
+                for (uint32_t k = 0; k < capacity; k++) {
+                    eynfs_dir_index_slot_t *slot = &slots[(start + k) % capacity];
+                    if (slot->block == 0) break;
+                    if (slot->block == EYNFS_DIR_SLOT_TOMBSTONE || slot->index != index) continue;
+                    slot->block = EYNFS_DIR_SLOT_TOMBSTONE;
+                    result = eynfs_write_blocks(drive, leaf_block, 1, buf);
+                    break;
+                }
+            }
+        }
+        // An index that doesn't know the entry can't be trusted for anything else either
+        if (result != 0) result = eynfs_dir_index_set_root(drive, dir_block, 0, buf);
+    }
+    free(buf);
+    return result;
 }
 
-// Free a block (mark as unused in the bitmap)
-int eynfs_free_block(uint8 drive, eynfs_superblock_t *sb, uint32_t block) {
-    if (block >= sb->total_blocks) return -1;
-    uint8 bitmap[EYNFS_BLOCK_SIZE];
-    if (eynfs_read_bitmap(drive, sb, bitmap) != 0) return -1;
-    uint32_t byte = block / 8;
-    uint8_t bit = block % 8;
-    bitmap[byte] &= ~(1 << bit);
-    if (eynfs_write_bitmap(drive, sb, bitmap) != 0) return -1;
-    return 0;
+// Look a name up through the directory's index: the first block (for the tail), the root, one
+// leaf and the directory block each candidate slot points at. Returns 0 if found, -1 if the
+// name is not in the directory, or -2 if there is no usable index.
+static int eynfs_dir_index_lookup(uint8 drive, uint32_t dir_block, const char *name, eynfs_dir_entry_t *out_entry, uint32_t *out_index) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(bs);
+    uint8 *buf = (uint8*)malloc(bs * 2);
+    if (!buf) return -2;
+    uint8 *dir_buf = buf + bs;
+    
+    int result = -2;
+    uint32_t root = eynfs_dir_index_root(drive, dir_block, buf);
+    uint32_t hash = eynfs_name_hash(name);
+    if (root && eynfs_dir_index_load(drive, root, EYNFS_DIR_ROOT_MAGIC, buf) == 0) {
+        const eynfs_dir_index_header_t *hdr = (const eynfs_dir_index_header_t*)buf;
+        uint32_t leaf_block = ((const uint32_t*)(buf + sizeof(eynfs_dir_index_header_t)))[hash % hdr->count];
+        if (eynfs_dir_index_load(drive, leaf_block, EYNFS_DIR_LEAF_MAGIC, buf) == 0) {
+            const eynfs_dir_index_slot_t *slots = (const eynfs_dir_index_slot_t*)(buf + sizeof(eynfs_dir_index_header_t));
+            uint32_t capacity = EYNFS_DIR_INDEX_SLOTS(bs);
+            uint32_t start = (hash >> 8) % capacity;
+            result = -1;
+            for (uint32_t k = 0; k < capacity && result == -1; k++) {
+                const eynfs_dir_index_slot_t *slot = &slots[(start + k) % capacity];
+                if (slot->block == 0) break;
+                if (slot->block == EYNFS_DIR_SLOT_TOMBSTONE || slot->tag != (uint16_t)(hash >> 16)) continue;
+                if (eynfs_dev_read(drive, slot->block, 1, dir_buf) != 0) { result = -2; break; }
+                const eynfs_dir_entry_t *entry = (const eynfs_dir_entry_t*)(dir_buf + 4) + slot->index % per_block;
+                if (entry->name[0] == '\0' || strncmp(entry->name, name, EYNFS_NAME_MAX) != 0) continue;
+                if (out_entry) *out_entry = *entry;
+                if (out_index) *out_index = slot->index;
+                result = 0;
+            }
+        }
+    }
+    free(buf);
+    return result;
 }
 
-// Find an entry by name in a directory block
-// Returns 0 if found, -1 if not found
-int eynfs_find_in_dir(uint8 drive, const eynfs_superblock_t *sb, uint32_t dir_block, const char *name, eynfs_dir_entry_t *out_entry, uint32_t *out_index) {
+// Look a name up in a directory: 0 if found, 1 if it definitely isn't there, -1 if the
+// directory couldn't be searched in full
+static int eynfs_dir_lookup(uint8 drive, uint32_t dir_block, const char *name, eynfs_dir_entry_t *out_entry, uint32_t *out_index) {
     // Check directory cache first
-    eynfs_dir_cache_entry_t* cache_entry = eynfs_dir_cache_find(dir_block);
+    eynfs_dir_cache_entry_t* cache_entry = eynfs_dir_cache_find(drive, dir_block);
     if (cache_entry) {
         // Use linear search on cached entries
         for (int i = 0; i < cache_entry->count; ++i) {
@@ -510,9 +2390,13 @@ int eynfs_find_in_dir(uint8 drive, const eynfs_superblock_t *sb, uint32_t dir_bl
                 return 0;
             }
         }
-        return -1;
+        return 1;
     }
     
+    // Directories large enough to carry a hash index are looked up through it
+    int indexed = eynfs_dir_index_lookup(drive, dir_block, name, out_entry, out_index);
+    if (indexed != -2) return indexed == 0 ? 0 : 1;
+    
     // Count entries first, then allocate exactly what we need
     int entry_count = eynfs_count_dir_entries(drive, dir_block);
     if (entry_count < 0) return -1;
@@ -521,10 +2405,12 @@ int eynfs_find_in_dir(uint8 drive, const eynfs_superblock_t *sb, uint32_t dir_bl
     size_t allocation_size = sizeof(eynfs_dir_entry_t) * entry_count;
     
     // Safety check: limit allocation to prevent memory exhaustion
+    int truncated = 0;
     if (allocation_size > 16384) { // 16KB limit for directory operations
         printf("%cWarning: Directory allocation too large (%d bytes), limiting to 16KB\n", 255, 165, 0, allocation_size);
         entry_count = 16384 / sizeof(eynfs_dir_entry_t);
         allocation_size = 16384;
+        truncated = 1;
     }
     
     eynfs_dir_entry_t* entries = (eynfs_dir_entry_t*)malloc(allocation_size);
@@ -547,25 +2433,32 @@ int eynfs_find_in_dir(uint8 drive, const eynfs_superblock_t *sb, uint32_t dir_bl
     }
     
     // Cache the directory entries for future use
-    if (count > 0) {
-        eynfs_dir_cache_entry_t* new_cache = eynfs_dir_cache_alloc();
-        if (new_cache) {
-            new_cache->dir_block = dir_block;
-            new_cache->count = count;
-            
-            // Bounds check for memory copy
-            size_t copy_size = count * sizeof(eynfs_dir_entry_t);
-            if (copy_size <= 16384) {
-                memcpy(new_cache->entries, entries, copy_size);
-                new_cache->sorted = 0; // Not sorted, use linear search
-            } else {
-                printf("%cWarning: Cache copy size too large (%d bytes)\n", 255, 165, 0, copy_size);
-            }
-        }
-    }
+    if (!truncated) eynfs_dir_cache_store(drive, dir_block, entries, count);
     
     free(entries);
-    return -1;
+    return truncated ? -1 : 1;
+}
+
+// Find an entry by name in a directory block
+// Returns 0 if found, -1 if not found
+int eynfs_find_in_dir(uint8 drive, const eynfs_superblock_t *sb, uint32_t dir_block, const char *name, eynfs_dir_entry_t *out_entry, uint32_t *out_index) {
+    eynfs_dentry_t *d = eynfs_dentry_find(drive, dir_block, name);
+    if (d) {
+        if (d->negative) return -1;
+        if (out_entry) *out_entry = d->entry;
+        if (out_index) *out_index = d->index;
+        return 0;
+    }
+    
+    eynfs_dir_entry_t entry;
+    uint32_t index = 0;
+    int found = eynfs_dir_lookup(drive, dir_block, name, &entry, &index);
+    if (found < 0) return -1;
+    eynfs_dentry_store(drive, dir_block, name, found == 0 ? &entry : NULL, index);
+    if (found != 0) return -1;
+    if (out_entry) *out_entry = entry;
+    if (out_index) *out_index = index;
+    return 0;
 }
 
 // Traverse a path from root, return the entry for the last component
@@ -615,28 +2508,38 @@ int eynfs_create_entry(uint8 drive, eynfs_superblock_t *sb, uint32_t parent_bloc
     if (!name || !name[0]) return -1;
     if (type != EYNFS_TYPE_FILE && type != EYNFS_TYPE_DIR) return -1;
     
-    // Count entries first, then allocate exactly what we need
-    int entry_count = eynfs_count_dir_entries(drive, parent_block);
+    // Count entries first, then allocate exactly what we need. Single-entry updates keep the
+    // directory cache current, so a cached table saves reading the directory at all.
+    eynfs_dir_cache_entry_t* cached = eynfs_dir_cache_find(drive, parent_block);
+    int entry_count = cached ? cached->count : eynfs_count_dir_entries(drive, parent_block);
     if (entry_count < 0) return -1;
     
     // Allocate exactly the number of entries we need
     size_t allocation_size = sizeof(eynfs_dir_entry_t) * entry_count;
+    int truncated = 0;
     
     // Safety check: limit allocation to prevent memory exhaustion
     if (allocation_size > 16384) { // 16KB limit for directory operations
         printf("%cWarning: Directory allocation too large (%d bytes), limiting to 16KB\n", 255, 165, 0, allocation_size);
         entry_count = 16384 / sizeof(eynfs_dir_entry_t);
         allocation_size = 16384;
+        truncated = 1;
     }
     
     eynfs_dir_entry_t* entries = (eynfs_dir_entry_t*)malloc(allocation_size);
     if (!entries) return -1;
     
-    // Initialize all entries to zero to ensure clean state
-    memset(entries, 0, allocation_size);
-    
-    int count = eynfs_read_dir_table(drive, parent_block, entries, entry_count);
-    if (count < 0) { free(entries); return -1; }
+    int count;
+    if (cached) {
+        memcpy(entries, cached->entries, allocation_size);
+        count = entry_count;
+    } else {
+        // Initialize all entries to zero to ensure clean state
+        memset(entries, 0, allocation_size);
+        count = eynfs_read_dir_table(drive, parent_block, entries, entry_count);
+        if (count < 0) { free(entries); return -1; }
+        if (!truncated) eynfs_dir_cache_store(drive, parent_block, entries, count);
+    }
     
     // Check if entry already exists
     for (int i = 0; i < count; ++i) {
@@ -648,41 +2551,36 @@ int eynfs_create_entry(uint8 drive, eynfs_superblock_t *sb, uint32_t parent_bloc
     
     int free_idx = -1;
     for (int i = 0; i < count; ++i) {
-        if (entries[i].name[0] == '\0') {
+        if (entries[i].name[0] == '\0' && !EYNFS_SLOT_IS_INLINE(&entries[i])) {
             free_idx = i;
             break;
         }
     }
-    if (free_idx == -1) {
-        // Need to add a new entry - check if we can safely reallocate
-        size_t new_allocation_size = sizeof(eynfs_dir_entry_t) * (entry_count + 1);
-        if (new_allocation_size > 16384) { // 16KB limit
+    uint32_t per_block = EYNFS_DIR_ENTRIES_PER_BLOCK(eynfs_bsize(drive));
+    int grow = free_idx == -1;
+    if (grow) {
+        // Every slot is taken: the entry opens a new block at the end of the chain, which is
+        // only safe when the whole chain was read
+        size_t new_allocation_size = sizeof(eynfs_dir_entry_t) * (count + 1);
+        if (new_allocation_size > 16384 || count % per_block != 0 || count / per_block >= EYNFS_DIR_MAX_BLOCKS) {
             printf("%cWarning: Cannot add new entry - directory allocation would exceed 16KB limit\n", 255, 165, 0);
             free(entries);
             return -1;
         }
         
-        eynfs_dir_entry_t* new_entries = (eynfs_dir_entry_t*)malloc(new_allocation_size);
+        eynfs_dir_entry_t* new_entries = (eynfs_dir_entry_t*)realloc(entries, new_allocation_size);
         if (!new_entries) { free(entries); return -1; }
-        
-        // Bounds check for memory copy
-        if (entry_count * sizeof(eynfs_dir_entry_t) <= new_allocation_size) {
-            memcpy(new_entries, entries, entry_count * sizeof(eynfs_dir_entry_t));
-        } else {
-            printf("%cWarning: Memory copy bounds check failed in create_entry\n", 255, 165, 0);
-            free(new_entries);
-            free(entries);
-            return -1;
-        }
-        
-        free(entries);
         entries = new_entries;
-        free_idx = entry_count;
-        count = entry_count + 1;
+        free_idx = count;
+        count++;
     }
     
-    int new_block = eynfs_alloc_block(drive, sb);
-    if (new_block < 0) { free(entries); return -1; }
+    // New files start as an empty extent list; directories get their first table block
+    int new_block = 0;
+    if (type == EYNFS_TYPE_DIR) {
+        new_block = eynfs_alloc_block(drive, sb);
+        if (new_block < 0) { free(entries); return -1; }
+    }
     
     memset(&entries[free_idx], 0, sizeof(eynfs_dir_entry_t));
     strncpy(entries[free_idx].name, name, EYNFS_NAME_MAX-1);
@@ -690,239 +2588,588 @@ int eynfs_create_entry(uint8 drive, eynfs_superblock_t *sb, uint32_t parent_bloc
     entries[free_idx].type = type;
     entries[free_idx].first_block = new_block;
     entries[free_idx].size = 0;
+    if (type == EYNFS_TYPE_FILE) entries[free_idx].flags = EYNFS_FLAG_EXTENTS;
     
     if (type == EYNFS_TYPE_DIR) {
-        uint8 zero_block[EYNFS_BLOCK_SIZE] = {0};
-        if (ata_write_sector(drive, new_block, zero_block) != 0) { 
+        uint32_t bs = eynfs_bsize(drive);
+        uint8 *zero_block = (uint8*)malloc(bs);
+        if (zero_block) memset(zero_block, 0, bs);
+        if (!zero_block || eynfs_write_blocks(drive, new_block, 1, zero_block) != 0) { 
+            if (zero_block) free(zero_block);
             eynfs_free_block(drive, sb, new_block);
             free(entries); 
             return -1; 
         }
+        free(zero_block);
     }
     
-    int res = eynfs_write_dir_table(drive, parent_block, entries, count);
-    free(entries);
+    // Only the new entry is written: in place, or as the first entry of a new chain block
+    int res;
+    if (grow) {
+        res = eynfs_dir_append_block(drive, sb, parent_block, free_idx / per_block, &entries[free_idx]);
+    } else {
+        res = eynfs_dir_entry_write(drive, parent_block, free_idx, &entries[free_idx], NULL);
+    }
     if (res < 0) {
-        eynfs_free_block(drive, sb, new_block);
+        free(entries);
+        if (new_block) eynfs_free_block(drive, sb, new_block);
         return -1;
     }
+    // Without an index entry the name would be invisible, so a failure here drops the index
+    if (eynfs_dir_index_add(drive, sb, parent_block, entries, count, free_idx) != 0) {
+        uint8 *buf = (uint8*)malloc(eynfs_bsize(drive));
+        if (buf) {
+            eynfs_dir_index_set_root(drive, parent_block, 0, buf);
+            free(buf);
+        }
+    }
+    free(entries);
+    if (type == EYNFS_TYPE_FILE && eynfs_mark_extents(drive, sb) != 0) return -1;
     
-    // Clear cache to ensure new entries are visible
-    eynfs_cache_clear();
-    
-    return 0;
+    return eynfs_sync(drive);
 }
 
 // Delete a file or directory entry by name from the given parent directory
 int eynfs_delete_entry(uint8 drive, eynfs_superblock_t *sb, uint32_t parent_block, const char *name) {
     if (!name || !name[0]) return -1;
     
-    // Count entries first, then allocate exactly what we need
-    int entry_count = eynfs_count_dir_entries(drive, parent_block);
-    if (entry_count < 0) return -1;
-    
-    // Allocate exactly the number of entries we need
-    size_t allocation_size = sizeof(eynfs_dir_entry_t) * entry_count;
-    
-    // Safety check: limit allocation to prevent memory exhaustion
-    if (allocation_size > 16384) { // 16KB limit for directory operations
-        printf("%cWarning: Directory allocation too large (%d bytes), limiting to 16KB\n", 255, 165, 0, allocation_size);
-        entry_count = 16384 / sizeof(eynfs_dir_entry_t);
-        allocation_size = 16384;
-    }
-    
-    eynfs_dir_entry_t* entries = (eynfs_dir_entry_t*)malloc(allocation_size);
-    if (!entries) return -1;
-    
-    // Initialize all entries to zero to ensure clean state
-    memset(entries, 0, allocation_size);
+    eynfs_dir_entry_t victim;
+    uint32_t index;
+    if (eynfs_find_in_dir(drive, sb, parent_block, name, &victim, &index) != 0) return -1; // Entry not found
     
-    int count = eynfs_read_dir_table(drive, parent_block, entries, entry_count);
-    if (count < 0) { free(entries); return -1; }
+    // Clear the entry, then release its blocks once the directory no longer points at them.
+    // The on-disk entry is the one whose storage is released.
+    eynfs_dir_entry_t empty;
+    memset(&empty, 0, sizeof(eynfs_dir_entry_t));
+    if (eynfs_dir_entry_write(drive, parent_block, index, &empty, &victim) != 0) return -1;
+    eynfs_inline_clear(drive, parent_block, index, &victim);
+    eynfs_dir_index_remove(drive, parent_block, victim.name, index);
     
-    for (int i = 0; i < count; ++i) {
-        if (entries[i].name[0] == '\0') continue;
-        if (strncmp(entries[i].name, name, EYNFS_NAME_MAX) == 0) {
-            // Free all blocks in the chain
-            uint32_t block_num = entries[i].first_block;
-            while (block_num != 0) {
-                uint8 tmp[EYNFS_BLOCK_SIZE];
-                if (ata_read_sector(drive, block_num, tmp) != 0) break;
-                uint32_t next_block = *(uint32_t*)tmp;
-                eynfs_free_block(drive, sb, block_num);
-                block_num = next_block;
-            }
-            
-            // Clear the entry
-            memset(&entries[i], 0, sizeof(eynfs_dir_entry_t));
-            
-            int res = eynfs_write_dir_table(drive, parent_block, entries, count);
-            free(entries);
-            if (res < 0) return -1;
-            
-            // Clear cache to ensure deleted entries are no longer visible
-            eynfs_cache_clear();
-            
-            return 0;
+    if (victim.type == EYNFS_TYPE_FILE) {
+        eynfs_free_file(drive, sb, &victim);
+    } else {
+        uint8 *buf = (uint8*)malloc(eynfs_bsize(drive));
+        if (buf) {
+            uint32_t root = eynfs_dir_index_root(drive, victim.first_block, buf);
+            if (root) eynfs_dir_index_free(drive, sb, root, buf);
+            free(buf);
         }
+        eynfs_free_chain(drive, sb, victim.first_block, eynfs_chain_batch(drive));
+        eynfs_dir_cache_invalidate(drive, victim.first_block);
+        eynfs_dir_chain_forget(victim.first_block);
+        eynfs_dentry_forget(victim.first_block);
     }
-    free(entries);
-    return -1; // Entry not found
+    
+    return eynfs_sync(drive);
 }
 
-// Read up to bufsize bytes from a file's data block chain, starting at offset
+// Read up to bufsize bytes from a file's extents (or v11 block chain), starting at offset
 // Returns number of bytes read, or -1 on error
-int eynfs_read_file(uint8 drive, const eynfs_superblock_t *sb, const eynfs_dir_entry_t *entry, void *buf, size_t bufsize, size_t offset) {
+// Read up to bufsize bytes at offset. A chained file's walk starts at *cursor when the offset
+// is at or past it, and the cursor is left on the last block read.
+static int eynfs_read_at(uint8 drive, const eynfs_dir_entry_t *entry, void *buf, size_t bufsize, size_t offset, eynfs_read_cursor_t *cursor) {
     if (!entry || entry->type != EYNFS_TYPE_FILE) return -1;
     if (offset >= entry->size) return 0;
-    uint32_t block_num = entry->first_block;
     size_t bytes_left = entry->size - offset;
     if (bufsize < bytes_left) bytes_left = bufsize;
-    size_t total_read = 0;
-    uint8 block[EYNFS_BLOCK_SIZE];
-    size_t skip = offset;
-    // Skip blocks and bytes up to offset
-    while (block_num && skip >= (EYNFS_BLOCK_SIZE-4)) {
-        if (eynfs_cache_get_block(drive, block_num, block) != 0) return -1;
-        uint32_t next_block = *(uint32_t*)block;
-        block_num = next_block;
-        skip -= (EYNFS_BLOCK_SIZE-4);
-    }
-    // Now at the block containing the offset
-    if (block_num && bytes_left > 0) {
-        if (eynfs_cache_get_block(drive, block_num, block) != 0) return -1;
-        uint32_t next_block = *(uint32_t*)block;
-        size_t block_offset = skip;
-        size_t chunk = (EYNFS_BLOCK_SIZE-4) - block_offset;
-        if (chunk > bytes_left) chunk = bytes_left;
-        memcpy((uint8*)buf, block+4+block_offset, chunk);
-        total_read += chunk;
-        bytes_left -= chunk;
-        block_num = next_block;
+    
+    if (entry->flags & EYNFS_FLAG_INLINE) {
+        return eynfs_read_inline(drive, entry, (uint8*)buf, bytes_left, offset);
+    }
+    if (entry->flags & EYNFS_FLAG_EXTENTS) {
+        return eynfs_read_extents(drive, entry, (uint8*)buf, bytes_left, offset);
+    }
+    
+    // Chain position of the block containing offset, and of the last block we need
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t payload = eynfs_payload_size(drive);
+    uint32_t skip_blocks = offset / payload;
+    size_t block_offset = offset % payload;
+    uint32_t blocks_needed = skip_blocks + (block_offset + bytes_left + payload - 1) / payload;
+    
+    uint8 *batch = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+    if (!batch) return -1;
+    
+    uint32_t block_num = entry->first_block;
+    uint32_t index = 0;
+    if (cursor && cursor->first_block == entry->first_block && cursor->index <= skip_blocks) {
+        block_num = cursor->block;
+        index = cursor->index;
     }
-    // Read remaining blocks
+    size_t total_read = 0;
     while (block_num && bytes_left > 0) {
-        if (eynfs_cache_get_block(drive, block_num, block) != 0) return -1;
-        uint32_t next_block = *(uint32_t*)block;
-        size_t chunk = (EYNFS_BLOCK_SIZE-4) < bytes_left ? (EYNFS_BLOCK_SIZE-4) : bytes_left;
-        memcpy((uint8*)buf + total_read, block+4, chunk);
-        total_read += chunk;
-        bytes_left -= chunk;
+        uint32_t next_block;
+        int run = eynfs_read_chain_run(drive, block_num, blocks_needed - index, batch, &next_block);
+        if (run < 0) { free(batch); return -1; }
+        for (int i = 0; i < run && bytes_left > 0; i++, index++) {
+            if (index < skip_blocks) continue; // Still walking up to offset
+            size_t chunk = payload - block_offset;
+            if (chunk > bytes_left) chunk = bytes_left;
+            memcpy((uint8*)buf + total_read, batch + i * bs + 4 + block_offset, chunk);
+            total_read += chunk;
+            bytes_left -= chunk;
+            block_offset = 0;
+            if (cursor) {
+                cursor->first_block = entry->first_block;
+                cursor->block = block_num + i;
+                cursor->index = index;
+            }
+        }
         block_num = next_block;
     }
+    free(batch);
     return (int)total_read;
 }
 
-// Write data to a file, creating a chain of blocks as needed
+int eynfs_read_file(uint8 drive, const eynfs_superblock_t *sb, const eynfs_dir_entry_t *entry, void *buf, size_t bufsize, size_t offset) {
+    return eynfs_read_at(drive, entry, buf, bufsize, offset, NULL);
+}
+
+void eynfs_read_ctx_init(eynfs_read_ctx_t *ctx, uint8 drive, const eynfs_dir_entry_t *entry) {
+    ctx->drive = drive;
+    ctx->entry = *entry;
+    memset(&ctx->cursor, 0, sizeof(ctx->cursor));
+}
+
+int eynfs_read_ctx_read(eynfs_read_ctx_t *ctx, void *buf, size_t bufsize, size_t offset) {
+    return eynfs_read_at(ctx->drive, &ctx->entry, buf, bufsize, offset, &ctx->cursor);
+}
+
+// Replace entry `entry_index` of the directory at parent_block with `updated`, returning the
+// entry it replaced in `old`
+static int eynfs_update_entry(uint8 drive, uint32_t parent_block, uint32_t entry_index, const eynfs_dir_entry_t *updated, eynfs_dir_entry_t *old) {
+    if (eynfs_dir_entry_write(drive, parent_block, entry_index, updated, old) != 0) {
+        printf("Error: Failed to update directory entry %d\n", entry_index);
+        return -1;
+    }
+    return 0;
+}
+
+// Replace a file's contents with `size` bytes laid out in full blocks on new extents, with room
+// for at least `reserve` blocks. The old storage is released only after the directory entry
+// points at the new blocks, so a failed write leaves the file intact.
+static int eynfs_write_extent_file(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const uint8 *data, size_t size,
+                                   uint32_t reserve, uint32_t parent_block, uint32_t entry_index) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t block_count = (size + bs - 1) / bs;
+    if (block_count < reserve) block_count = reserve;
+    eynfs_extent_map_t map;
+    eynfs_extent_map_init(&map);
+    if (block_count > 0) {
+        if (eynfs_extent_alloc(drive, sb, block_count, 0, &map) != 0) return -1;
+        if (eynfs_write_extents(drive, &map, data, size) != 0) {
+            eynfs_extent_map_free_blocks(drive, sb, &map);
+            eynfs_extent_map_release(&map);
+            return -1;
+        }
+    }
+    
+    eynfs_dir_entry_t old;
+    eynfs_dir_entry_t updated = *entry;
+    updated.size = size;
+    updated.flags &= ~EYNFS_FLAG_INLINE;
+    if (eynfs_extent_store(drive, sb, &map, &updated) != 0) {
+        eynfs_extent_map_free_blocks(drive, sb, &map);
+        eynfs_extent_map_release(&map);
+        return -1;
+    }
+    eynfs_extent_map_release(&map);
+    
+    if (eynfs_update_entry(drive, parent_block, entry_index, &updated, &old) != 0) {
+        eynfs_free_file(drive, sb, &updated);
+        return -1;
+    }
+    *entry = updated;
+    
+    // The on-disk entry is authoritative for the old storage (callers may have cleared
+    // first_block in their copy when truncating)
+    if (old.type == EYNFS_TYPE_FILE && strncmp(old.name, updated.name, EYNFS_NAME_MAX) == 0) {
+        if (eynfs_inline_clear(drive, parent_block, entry_index, &old) != 0) return -1;
+        eynfs_free_file(drive, sb, &old);
+    }
+    return eynfs_mark_extents(drive, sb);
+}
+
+// Write data to a file, replacing its contents: inline in the directory when it is small enough
+// and the slots after its entry are free, otherwise on freshly allocated extents
 // Returns number of bytes written, or -1 on error
 int eynfs_write_file(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const void *buf, size_t size, uint32_t parent_block, uint32_t entry_index) {
     if (!entry || entry->type != EYNFS_TYPE_FILE) return -1;
     if (!buf && size > 0) return -1;
     
-    // Free existing blocks if this is a rewrite
-    if (entry->first_block != 0) {
-        uint32_t block_num = entry->first_block;
-        while (block_num != 0) {
-            uint8 tmp[EYNFS_BLOCK_SIZE];
-            if (ata_read_sector(drive, block_num, tmp) != 0) break;
-            uint32_t next_block = *(uint32_t*)tmp;
-            eynfs_free_block(drive, sb, block_num);
-            block_num = next_block;
+    eynfs_dir_entry_t old;
+    int inlined = eynfs_write_inline(drive, entry, (const uint8*)buf, size, parent_block, entry_index, &old);
+    if (inlined < 0) return -1;
+    if (inlined) {
+        if (!(old.flags & EYNFS_FLAG_INLINE) && old.type == EYNFS_TYPE_FILE &&
+            strncmp(old.name, entry->name, EYNFS_NAME_MAX) == 0) {
+            eynfs_free_file(drive, sb, &old);
         }
+        if (eynfs_mark_version(drive, sb, EYNFS_VERSION_INLINE) != 0) return -1;
+        if (eynfs_sync(drive) != 0) return -1;
+        return (int)size;
     }
     
-    uint32_t prev_block = 0;
-    uint32_t first_block = 0;
-    size_t bytes_left = size;
-    size_t total_written = 0;
-    const uint8* data = (const uint8*)buf;
+    if (eynfs_write_extent_file(drive, sb, entry, (const uint8*)buf, size, 0, parent_block, entry_index) != 0) return -1;
     
-    while (bytes_left > 0) {
-        int new_block = eynfs_alloc_block(drive, sb);
-        if (new_block < 0) return -1;
-        
-        if (!first_block) first_block = new_block;
+    // Data, bitmap and directory entry are all written: make them durable together
+    if (eynfs_sync(drive) != 0) return -1;
+    
+    return (int)size;
+} 
+
+// Write `size` bytes at `offset` without rewriting the rest of the file. Blocks the write
+// touches are overwritten in place (only a partially covered first or last block is read
+// first), blocks past the end are allocated and appended to the extent list, and a gap
+// between the old end and offset reads back as zeros. The directory entry is rewritten only
+// when the size or extent list changes, so appending costs O(bytes appended).
+// Returns number of bytes written, or -1 on error
+int eynfs_pwrite(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const void *buf, size_t size, size_t offset, uint32_t parent_block, uint32_t entry_index) {
+    if (!entry || entry->type != EYNFS_TYPE_FILE) return -1;
+    if (!buf && size > 0) return -1;
+    if (size == 0) return 0;
+    
+    size_t end = offset + size;
+    size_t new_size = end > entry->size ? end : entry->size;
+    
+    // A chained (v11) or inline file has no blocks to update in place, and a file small enough
+    // to live inline is cheaper to rewrite whole: eynfs_write_file picks the layout. Blocks
+    // reserved by eynfs_fallocate are kept by writing into them instead.
+    int reserved = (entry->flags & EYNFS_FLAG_EXTENTS) && entry->extra[0];
+    if ((!(entry->flags & EYNFS_FLAG_EXTENTS) && entry->first_block) || (new_size <= EYNFS_INLINE_MAX && !reserved)) {
+        uint8 *data = (uint8*)malloc(new_size);
+        if (!data) return -1;
+        memset(data, 0, new_size);
+        int n = eynfs_read_file(drive, sb, entry, data, entry->size, 0);
+        if (n < 0) {
+            free(data);
+            return -1;
+        }
+        memcpy(data + offset, buf, size);
+        n = eynfs_write_file(drive, sb, entry, data, new_size, parent_block, entry_index);
+        free(data);
+        return n < 0 ? -1 : (int)size;
+    }
+    
+    eynfs_extent_map_t map;
+    if (entry->flags & EYNFS_FLAG_EXTENTS) {
+        if (eynfs_extent_load(drive, entry, &map) != 0) return -1;
+    } else {
+        eynfs_extent_map_init(&map);
+    }
+    
+    // Allocate the blocks the file grows by and add them to the end of its extent list
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t old_blocks = map.count ? map.runs[map.count - 1].logical + map.runs[map.count - 1].count : 0;
+    uint32_t new_blocks = (new_size + bs - 1) / bs;
+    eynfs_extent_map_t grown;
+    eynfs_extent_map_init(&grown);
+    if (new_blocks > old_blocks) {
+        uint32_t goal = map.count ? map.runs[map.count - 1].start + map.runs[map.count - 1].count : 0;
+        if (eynfs_extent_alloc(drive, sb, new_blocks - old_blocks, goal, &grown) != 0) {
+            eynfs_extent_map_release(&map);
+            return -1;
+        }
+        for (uint32_t i = 0; i < grown.count; i++) {
+            if (eynfs_extent_push(&map, grown.runs[i].start, grown.runs[i].count) != 0) {
+                eynfs_extent_map_free_blocks(drive, sb, &grown);
+                eynfs_extent_map_release(&grown);
+                eynfs_extent_map_release(&map);
+                return -1;
+            }
+        }
+    }
+    
+    // Bytes from the old end up to offset are part of the write, as zeros
+    const uint8 *data = (const uint8*)buf;
+    size_t pos = offset < entry->size ? offset : entry->size;
+    uint8 *bounce = NULL;
+    int failed = 0;
+    while (pos < end && !failed) {
+        uint32_t index = pos / bs;
+        size_t within = pos % bs;
         
-        if (prev_block) {
-            // Update previous block's next_block pointer
-            uint8 tmp[EYNFS_BLOCK_SIZE];
-            if (ata_read_sector(drive, prev_block, tmp) != 0) return -1;
-            *(uint32_t*)tmp = new_block;
-            if (ata_write_sector(drive, prev_block, tmp) != 0) return -1;
+        // Whole blocks of caller data go straight from its buffer
+        if (within == 0 && pos >= offset && end - pos >= bs && !((uint32_t)(data + (pos - offset)) & 1)) {
+            uint32_t n = (end - pos) / bs;
+            if (eynfs_extent_io(drive, &map, index, n, (uint8*)data + (pos - offset), BLOCK_REQ_WRITE) != 0) failed = 1;
+            pos += n * bs;
+            continue;
         }
         
-        uint8 block[EYNFS_BLOCK_SIZE] = {0};
-        size_t chunk = bytes_left < (EYNFS_BLOCK_SIZE-4) ? bytes_left : (EYNFS_BLOCK_SIZE-4);
-        *(uint32_t*)block = 0; // next_block = 0 for now
+        if (!bounce) bounce = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+        if (!bounce) { failed = 1; break; }
+        uint32_t n = (within + (end - pos) + bs - 1) / bs;
+        if (n > eynfs_chain_batch(drive)) n = eynfs_chain_batch(drive);
+        size_t chunk = n * bs - within;
+        if (chunk > end - pos) chunk = end - pos;
         
-        // Bounds check for memory copy
-        if (chunk <= (EYNFS_BLOCK_SIZE-4) && (data+total_written) && (block+4)) {
-            memcpy(block+4, data+total_written, chunk);
-        } else {
-            printf("%cWarning: Memory copy bounds check failed in write_file\n", 255, 165, 0);
-            return -1;
+        // Partially covered edge blocks keep their old contents; new blocks start zeroed
+        uint32_t last = index + n - 1;
+        if (within) {
+            if (index < old_blocks) failed = eynfs_extent_io(drive, &map, index, 1, bounce, 0) != 0;
+            else memset(bounce, 0, bs);
+        }
+        if (within + chunk < n * bs && (last != index || !within)) {
+            if (last < old_blocks) failed |= eynfs_extent_io(drive, &map, last, 1, bounce + (n - 1) * bs, 0) != 0;
+            else memset(bounce + (n - 1) * bs, 0, bs);
         }
+        if (failed) break;
         
-        if (ata_write_sector(drive, new_block, block) != 0) return -1;
-        total_written += chunk;
-        bytes_left -= chunk;
-        prev_block = new_block;
+        size_t zeros = pos < offset ? offset - pos : 0;
+        if (zeros > chunk) zeros = chunk;
+        memset(bounce + within, 0, zeros);
+        memcpy(bounce + within + zeros, data + (pos + zeros - offset), chunk - zeros);
+        if (eynfs_extent_io(drive, &map, index, n, bounce, BLOCK_REQ_WRITE) != 0) failed = 1;
+        pos += chunk;
+    }
+    if (bounce) free(bounce);
+    
+    eynfs_dir_entry_t updated = *entry;
+    updated.size = new_size;
+    if (!failed && grown.count && eynfs_extent_store(drive, sb, &map, &updated) != 0) failed = 1;
+    if (!failed && (grown.count || new_size != entry->size)) {
+        eynfs_dir_entry_t old;
+        if (eynfs_update_entry(drive, parent_block, entry_index, &updated, &old) != 0) {
+            if (updated.extra[1] != entry->extra[1]) eynfs_extent_free_map(drive, sb, updated.extra[1], 0);
+            failed = 1;
+        }
+    }
+    if (failed) {
+        eynfs_extent_map_free_blocks(drive, sb, &grown);
+    } else if (grown.count && entry->extra[1]) {
+        // The extent list was stored afresh; the old map blocks are no longer referenced
+        eynfs_extent_free_map(drive, sb, entry->extra[1], 0);
     }
+    eynfs_extent_map_release(&grown);
+    eynfs_extent_map_release(&map);
+    if (failed) return -1;
     
-    // Update entry with new first block and size
-    entry->first_block = first_block;
-    entry->size = size;
+    *entry = updated;
+    if (eynfs_mark_extents(drive, sb) != 0) return -1;
+    if (eynfs_sync(drive) != 0) return -1;
+    return (int)size;
+}
+
+// Append `size` bytes to the end of a file
+int eynfs_append(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, const void *buf, size_t size, uint32_t parent_block, uint32_t entry_index) {
+    if (!entry) return -1;
+    return eynfs_pwrite(drive, sb, entry, buf, size, entry->size, parent_block, entry_index);
+}
+
+// Reserve blocks for a file to grow to `size` bytes without changing its size. They are taken
+// as one run after the file's last extent where possible, so writes and appends up to `size`
+// need no allocation and keep the file contiguous. Reserved blocks past the end are never
+// read; rewriting the whole file releases them. Chained and inline files are moved onto
+// extents first. Returns 0, or -1 on error.
+int eynfs_fallocate(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry, size_t size, uint32_t parent_block, uint32_t entry_index) {
+    if (!entry || entry->type != EYNFS_TYPE_FILE) return -1;
+    if (size <= entry->size || size <= EYNFS_INLINE_MAX) return 0; // Small files live inline
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t want = (size + bs - 1) / bs;
+    
+    if (!(entry->flags & EYNFS_FLAG_EXTENTS)) {
+        uint8 *data = entry->size ? (uint8*)malloc(entry->size) : NULL;
+        if (entry->size && (!data || eynfs_read_file(drive, sb, entry, data, entry->size, 0) != (int)entry->size)) {
+            if (data) free(data);
+            return -1;
+        }
+        int result = eynfs_write_extent_file(drive, sb, entry, data, entry->size, want, parent_block, entry_index);
+        if (data) free(data);
+        if (result != 0) return -1;
+        return eynfs_sync(drive);
+    }
     
-    // Update directory table - count entries first, then allocate exactly what we need
-    int entry_count = eynfs_count_dir_entries(drive, parent_block);
-    if (entry_count < 0) {
-        printf("Error: Failed to count directory entries\n");
+    eynfs_extent_map_t map;
+    if (eynfs_extent_load(drive, entry, &map) != 0) return -1;
+    uint32_t have = map.count ? map.runs[map.count - 1].logical + map.runs[map.count - 1].count : 0;
+    if (want <= have) {
+        eynfs_extent_map_release(&map);
+        return 0;
+    }
+    uint32_t goal = map.count ? map.runs[map.count - 1].start + map.runs[map.count - 1].count : 0;
+    eynfs_extent_map_t grown;
+    eynfs_extent_map_init(&grown);
+    if (eynfs_extent_alloc(drive, sb, want - have, goal, &grown) != 0) {
+        eynfs_extent_map_release(&map);
         return -1;
     }
-    
-    size_t allocation_size = sizeof(eynfs_dir_entry_t) * entry_count;
-    
-    // Safety check: limit allocation to prevent memory exhaustion
-    if (allocation_size > 16384) { // 16KB limit for directory operations
-        printf("%cWarning: Directory allocation too large (%d bytes), limiting to 16KB\n", 255, 165, 0, allocation_size);
-        entry_count = 16384 / sizeof(eynfs_dir_entry_t);
-        allocation_size = 16384;
+    int failed = 0;
+    for (uint32_t i = 0; i < grown.count && !failed; i++) {
+        if (eynfs_extent_push(&map, grown.runs[i].start, grown.runs[i].count) != 0) failed = 1;
     }
     
-    eynfs_dir_entry_t* entries = (eynfs_dir_entry_t*)malloc(allocation_size);
-    if (!entries) {
-        printf("Error: Out of memory for directory update\n");
-        return -1;
+    eynfs_dir_entry_t updated = *entry;
+    if (!failed && eynfs_extent_store(drive, sb, &map, &updated) != 0) failed = 1;
+    if (!failed) {
+        eynfs_dir_entry_t old;
+        if (eynfs_update_entry(drive, parent_block, entry_index, &updated, &old) != 0) {
+            if (updated.extra[1] != entry->extra[1]) eynfs_extent_free_map(drive, sb, updated.extra[1], 0);
+            failed = 1;
+        }
+    }
+    if (failed) {
+        eynfs_extent_map_free_blocks(drive, sb, &grown);
+    } else if (entry->extra[1]) {
+        eynfs_extent_free_map(drive, sb, entry->extra[1], 0);
     }
+    eynfs_extent_map_release(&grown);
+    eynfs_extent_map_release(&map);
+    if (failed) return -1;
     
-    int count = eynfs_read_dir_table(drive, parent_block, entries, entry_count);
-    if (count < 0) {
-        free(entries);
+    *entry = updated;
+    if (eynfs_mark_extents(drive, sb) != 0) return -1;
+    return eynfs_sync(drive);
+}
+
+// --- In-place upgrade from v11 ---
+
+// Copy a chained file onto new extents, packing its payloads (block size less the next
+// pointer) into full blocks. Only `entry` is updated; the caller releases the old chain
+// once the directory is written.
+static int eynfs_upgrade_file(uint8 drive, eynfs_superblock_t *sb, eynfs_dir_entry_t *entry) {
+    uint32_t bs = eynfs_bsize(drive);
+    uint32_t payload = eynfs_payload_size(drive);
+    uint32_t batch = eynfs_chain_batch(drive);
+    uint32_t block_count = (entry->size + bs - 1) / bs;
+    eynfs_extent_map_t map;
+    eynfs_extent_map_init(&map);
+    if (block_count > 0 && eynfs_extent_alloc(drive, sb, block_count, 0, &map) != 0) return -1;
+    
+    const size_t out_size = EYNFS_CHAIN_BATCH_BYTES;
+    uint8 *in = (uint8*)malloc(EYNFS_CHAIN_BATCH_BYTES);
+    uint8 *out = (uint8*)malloc(out_size);
+    int failed = !in || !out;
+    
+    uint32_t block = entry->first_block;
+    size_t left = entry->size;
+    size_t fill = 0;
+    uint32_t index = 0;
+    if (out) memset(out, 0, out_size);
+    while (!failed && left > 0 && block) {
+        uint32_t next_block;
+        int run = eynfs_read_chain_run(drive, block, (left + payload - 1) / payload, in, &next_block);
+        if (run < 0) { failed = 1; break; }
+        for (int i = 0; i < run && left > 0 && !failed; i++) {
+            size_t chunk = left < payload ? left : payload;
+            const uint8 *src = in + i * bs + 4;
+            left -= chunk;
+            while (chunk > 0) {
+                size_t n = out_size - fill < chunk ? out_size - fill : chunk;
+                memcpy(out + fill, src, n);
+                fill += n;
+                src += n;
+                chunk -= n;
+                if (fill == out_size) {
+                    if (eynfs_extent_io(drive, &map, index, batch, out, BLOCK_REQ_WRITE) != 0) { failed = 1; break; }
+                    index += batch;
+                    fill = 0;
+                    memset(out, 0, out_size);
+                }
+            }
+        }
+        block = next_block;
+    }
+    if (!failed && left > 0) failed = 1; // Chain ended before the recorded size
+    if (!failed && fill > 0) {
+        failed = eynfs_extent_io(drive, &map, index, (fill + bs - 1) / bs, out, BLOCK_REQ_WRITE) != 0;
+    }
+    if (in) free(in);
+    if (out) free(out);
+    
+    eynfs_dir_entry_t updated = *entry;
+    if (!failed && eynfs_extent_store(drive, sb, &map, &updated) != 0) failed = 1;
+    if (failed) eynfs_extent_map_free_blocks(drive, sb, &map);
+    eynfs_extent_map_release(&map);
+    if (failed) return -1;
+    *entry = updated;
+    return 0;
+}
+
+// Convert the chained files of one directory and queue its subdirectories on the stack.
+// Returns the number of files converted, or -1 on error.
+static int eynfs_upgrade_dir(uint8 drive, eynfs_superblock_t *sb, uint32_t dir_block,
+                             uint32_t **stack, uint32_t *depth, uint32_t *capacity) {
+    int entry_count = eynfs_count_dir_entries(drive, dir_block);
+    if (entry_count <= 0) return entry_count;
+    if (entry_count * sizeof(eynfs_dir_entry_t) > 16384) entry_count = 16384 / sizeof(eynfs_dir_entry_t);
+    
+    eynfs_dir_entry_t *entries = (eynfs_dir_entry_t*)malloc(entry_count * sizeof(eynfs_dir_entry_t));
+    eynfs_dir_entry_t *old = (eynfs_dir_entry_t*)malloc(entry_count * sizeof(eynfs_dir_entry_t));
+    if (!entries || !old) {
+        if (entries) free(entries);
+        if (old) free(old);
         return -1;
     }
+    int count = eynfs_read_dir_table(drive, dir_block, entries, entry_count);
+    if (count < 0) { free(entries); free(old); return -1; }
+    memcpy(old, entries, count * sizeof(eynfs_dir_entry_t));
     
-    // Validate entry_index
-    if (entry_index >= (uint32_t)count) {
-        printf("Warning: entry_index %d >= count %d, truncating\n", entry_index, count);
-        entry_index = count - 1;
+    int converted = 0;
+    int failed = 0;
+    for (int i = 0; i < count && !failed; i++) {
+        if (entries[i].name[0] == '\0') continue;
+        if (entries[i].type == EYNFS_TYPE_DIR) {
+            if (*depth == *capacity) {
+                uint32_t *grown = (uint32_t*)realloc(*stack, *capacity * 2 * sizeof(uint32_t));
+                if (!grown) { failed = 1; break; }
+                *stack = grown;
+                *capacity *= 2;
+            }
+            (*stack)[(*depth)++] = entries[i].first_block;
+        } else if (entries[i].type == EYNFS_TYPE_FILE && !(entries[i].flags & (EYNFS_FLAG_EXTENTS | EYNFS_FLAG_INLINE))) {
+            if (eynfs_upgrade_file(drive, sb, &entries[i]) != 0) { failed = 1; break; }
+            converted++;
+        }
     }
     
-    // Update the entry
-    entries[entry_index] = *entry;
-    
-    // Write back the directory table with error checking
-    int write_result = eynfs_write_dir_table(drive, parent_block, entries, count);
+    // Point the directory at the new copies before any chain is released
+    if (!failed && converted > 0 && eynfs_write_dir_table(drive, dir_block, entries, count) < 0) failed = 1;
+    for (int i = 0; i < count; i++) {
+        if ((entries[i].flags & EYNFS_FLAG_EXTENTS) && !(old[i].flags & EYNFS_FLAG_EXTENTS) && old[i].type == EYNFS_TYPE_FILE) {
+            eynfs_free_file(drive, sb, failed ? &entries[i] : &old[i]);
+        }
+    }
     free(entries);
-    if (write_result < 0) {
-        printf("Error: Failed to write directory table\n");
-        return -1;
+    free(old);
+    if (failed) return -1;
+    if (converted > 0 && eynfs_sync(drive) != 0) return -1;
+    return converted;
+}
+
+// Walk the whole tree (with a heap stack; the kernel stack is small), converting chained
+// files to extents one directory at a time, then mark the filesystem v12
+int eynfs_upgrade(uint8 drive) {
+    eynfs_superblock_t sb;
+    if (eynfs_read_superblock(drive, EYNFS_SUPERBLOCK_LBA, &sb) != 0) return -1;
+    if (sb.magic != EYNFS_MAGIC || sb.version < EYNFS_VERSION_CHAINED || sb.version > EYNFS_VERSION) return -1;
+    
+    uint32_t capacity = 16;
+    uint32_t *stack = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    if (!stack) return -1;
+    uint32_t depth = 0;
+    stack[depth++] = sb.root_dir_block;
+    
+    int converted = 0;
+    uint32_t visited = 0;
+    while (depth > 0) {
+        // A directory cycle would otherwise never end
+        if (++visited > sb.total_blocks) { converted = -1; break; }
+        int n = eynfs_upgrade_dir(drive, &sb, stack[--depth], &stack, &depth, &capacity);
+        if (n < 0) { converted = -1; break; }
+        converted += n;
     }
+    free(stack);
+    eynfs_cache_clear();
+    if (converted < 0) return -1;
     
-    return (int)size;
-} 
+    if (eynfs_mark_extents(drive, &sb) != 0 || eynfs_sync(drive) != 0) return -1;
+    return converted;
+}
 
 // --- Unix-like File Table and Open/Close Implementation ---
 #define EYNFS_MAX_OPEN_FILES 32
+#define EYNFS_WRITE_BUFFER_MAX (64 * 1024) // Most bytes a descriptor holds back before writing them
 
 typedef struct {
     int used;
@@ -933,10 +3180,43 @@ typedef struct {
     int mode; // 0 = read, 1 = write, 2 = append
     uint32_t parent_block;
     uint32_t entry_index;
+    uint8 *pending;         // Written bytes not yet handed to the filesystem; they end at offset
+    uint32_t pending_len;
+    uint32_t pending_cap;
+    eynfs_read_cursor_t cursor; // Where sequential read()s pick up the block chain
 } eynfs_file_t;
 
 static eynfs_file_t eynfs_files[EYNFS_MAX_OPEN_FILES];
 
+// Write through to the filesystem at `pos`. In write mode a write at the start replaces the
+// (truncated) contents; later writes and appends land at their position without rewriting
+// what is already there.
+static int eynfs_file_write_at(eynfs_file_t *f, const void *buf, int size, uint32_t pos) {
+    memset(&f->cursor, 0, sizeof(f->cursor)); // The blocks may move
+    if (f->mode == 2) return eynfs_append(f->drive, &f->sb, &f->entry, buf, size, f->parent_block, f->entry_index);
+    if (pos == 0) return eynfs_write_file(f->drive, &f->sb, &f->entry, buf, size, f->parent_block, f->entry_index);
+    return eynfs_pwrite(f->drive, &f->sb, &f->entry, buf, size, pos, f->parent_block, f->entry_index);
+}
+
+// Delayed allocation: hand a descriptor's buffered writes to the filesystem in one call, so
+// their blocks are allocated together as one run rather than a write() at a time. The buffer
+// is emptied even if the write fails; the error is reported here instead.
+static int eynfs_file_flush(eynfs_file_t *f) {
+    if (!f->pending_len) return 0;
+    uint32_t len = f->pending_len;
+    f->pending_len = 0;
+    return eynfs_file_write_at(f, f->pending, len, f->offset - len) == (int)len ? 0 : -1;
+}
+
+// Flush the buffered writes of every descriptor open on a drive
+static int eynfs_files_flush(uint8 drive) {
+    int result = 0;
+    for (int i = 0; i < EYNFS_MAX_OPEN_FILES; i++) {
+        if (eynfs_files[i].used && eynfs_files[i].drive == drive && eynfs_file_flush(&eynfs_files[i]) != 0) result = -1;
+    }
+    return result;
+}
+
 // EYNFS-specific file operations with full path support
 int eynfs_open(const char* path, int mode) {
     if (!path) return -1;
@@ -956,6 +3236,10 @@ int eynfs_open(const char* path, int mode) {
     eynfs_files[fd].drive = 0; // TODO: support multiple drives
     eynfs_files[fd].offset = 0;
     eynfs_files[fd].mode = mode;
+    eynfs_files[fd].pending = NULL;
+    eynfs_files[fd].pending_len = 0;
+    eynfs_files[fd].pending_cap = 0;
+    memset(&eynfs_files[fd].cursor, 0, sizeof(eynfs_read_cursor_t));
     
     uint8_t disk = 0;
     if (eynfs_read_superblock(disk, EYNFS_SUPERBLOCK_LBA, &eynfs_files[fd].sb) != 0 || 
@@ -1046,12 +3330,16 @@ int open(const char* path, int mode) {
     return eynfs_open(path, mode);
 }
 
-// Close a file descriptor
+// Close a file descriptor, writing out what it still holds back. Returns -1 if that fails.
 int close(int fd) {
     if (fd < 0 || fd >= EYNFS_MAX_OPEN_FILES || !eynfs_files[fd].used)
         return -1;
+    int result = eynfs_file_flush(&eynfs_files[fd]);
+    if (eynfs_files[fd].pending) free(eynfs_files[fd].pending);
+    eynfs_files[fd].pending = NULL;
+    eynfs_files[fd].pending_cap = 0;
     eynfs_files[fd].used = 0;
-    return 0;
+    return result;
 } 
 
 // Read from a file descriptor
@@ -1059,6 +3347,7 @@ int read(int fd, void* buf, int size) {
     if (fd < 0 || fd >= EYNFS_MAX_OPEN_FILES || !eynfs_files[fd].used)
         return -1;
     eynfs_file_t* f = &eynfs_files[fd];
+    if (eynfs_file_flush(f) != 0) return -1;
     
     // Check if it's a directory
     if (f->entry.type == EYNFS_TYPE_DIR) {
@@ -1091,7 +3380,7 @@ int read(int fd, void* buf, int size) {
     int to_read = size;
     if (f->offset + to_read > f->entry.size)
         to_read = f->entry.size - f->offset;
-    int n = eynfs_read_file(f->drive, &f->sb, &f->entry, buf, to_read, f->offset);
+    int n = eynfs_read_at(f->drive, &f->entry, buf, to_read, f->offset, &f->cursor);
     if (n > 0) f->offset += n;
     return n;
 }
@@ -1107,68 +3396,49 @@ int write(int fd, const void* buf, int size) {
     // Can't write to directories
     if (f->entry.type == EYNFS_TYPE_DIR) return -1;
     
-    // For append mode, we need to read existing data first
-    if (f->mode == 2 && f->offset > 0) {
-        // Read existing data
-        uint8_t* existing_data = (uint8_t*)malloc(f->entry.size);
-        if (!existing_data) return -1;
-        
-        int existing_read = eynfs_read_file(f->drive, &f->sb, &f->entry, existing_data, f->entry.size, 0);
-        if (existing_read < 0) {
-            free(existing_data);
-            return -1;
-        }
-        
-        // Combine existing data with new data
-        uint8_t* combined_data = (uint8_t*)malloc(existing_read + size);
-        if (!combined_data) {
-            free(existing_data);
-            return -1;
-        }
-        
-        memcpy(combined_data, existing_data, existing_read);
-        memcpy(combined_data + existing_read, buf, size);
-        
-        // Write combined data
-        int n = eynfs_write_file(f->drive, &f->sb, &f->entry, combined_data, existing_read + size, 
-                                f->parent_block, f->entry_index);
-        
-        free(existing_data);
-        free(combined_data);
-        
-        if (n > 0) {
-            f->offset = n;
-            f->entry.size = n;
-        }
-        return n;
-    } else {
-        // Regular write (overwrite or new file)
-        int n = eynfs_write_file(f->drive, &f->sb, &f->entry, buf, size, f->parent_block, f->entry_index);
-        if (n > 0) {
-            f->offset = n;
-            f->entry.size = n;
+    if (size < 0) return -1;
+    
+    // Hold the bytes back until the buffer fills, the descriptor is read or closed, or the
+    // drive is flushed. Nothing is allocated for them until then.
+    if (f->pending_len + (uint32_t)size > EYNFS_WRITE_BUFFER_MAX && eynfs_file_flush(f) != 0) return -1;
+    if (size > 0 && f->pending_len + (uint32_t)size > f->pending_cap && (uint32_t)size <= EYNFS_WRITE_BUFFER_MAX) {
+        uint32_t cap = f->pending_cap ? f->pending_cap * 2 : 4096;
+        while (cap < f->pending_len + (uint32_t)size) cap *= 2;
+        if (cap > EYNFS_WRITE_BUFFER_MAX) cap = EYNFS_WRITE_BUFFER_MAX;
+        uint8 *grown = (uint8*)realloc(f->pending, cap);
+        if (grown) {
+            f->pending = grown;
+            f->pending_cap = cap;
         }
-        return n;
     }
+    if (size > 0 && f->pending_len + (uint32_t)size <= f->pending_cap) {
+        memcpy(f->pending + f->pending_len, buf, size);
+        f->pending_len += size;
+        f->offset += size;
+        return size;
+    }
+    
+    // Too large to hold back (or no memory to): write it through
+    if (eynfs_file_flush(f) != 0) return -1;
+    int n = eynfs_file_write_at(f, buf, size, f->offset);
+    if (n > 0) f->offset = f->mode == 2 ? f->entry.size : f->offset + n;
+    return n;
 } 
 
 // Performance monitoring functions
 void eynfs_get_cache_stats(uint32_t* hits, uint32_t* misses) {
-    if (hits) *hits = cache_hits;
-    if (misses) *misses = cache_misses;
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    if (hits) *hits = stats.hits;
+    if (misses) *misses = stats.misses;
 }
 
 void eynfs_reset_cache_stats() {
-    cache_hits = 0;
-    cache_misses = 0;
+    bcache_reset_stats();
 }
 
 void eynfs_cache_clear() {
-    eynfs_cache_flush(0); // Flush all dirty blocks
-    for (int i = 0; i < EYNFS_CACHE_SIZE; i++) {
-        block_cache[i].valid = 0;
-        block_cache[i].dirty = 0;
-    }
+    for (uint8 drive = 0; drive < EYNFS_MAX_DRIVES; drive++) bcache_invalidate(drive); // Dirty sectors are written first
     
     // Clear directory cache
     for (int i = 0; i < EYNFS_DIR_CACHE_SIZE; i++) {
@@ -1180,12 +3450,15 @@ void eynfs_cache_clear() {
         dir_cache[i].sorted = 0;
     }
     
-    // Clear free block cache
-    free_block_cache_valid = 0;
-    free_block_cache_count = 0;
+    eynfs_dir_chain_forget(0);
+    eynfs_dentry_forget(0);
+    
+    // Drop the resident bitmap; it is read back in on the next allocation
+    eynfs_bitmap_writeback(&block_bitmap);
+    eynfs_bitmap_release(&block_bitmap);
 }
 
 // Enhanced block allocation with performance tracking
 int eynfs_alloc_block_fast(uint8 drive, eynfs_superblock_t *sb) {
-    return eynfs_alloc_block_optimized(drive, sb);
+    return eynfs_alloc_block(drive, sb);
 } 
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <multiboot.h>
 #include <util.h>
 #include <system.h>
+#include <block.h>
 #include <string.h>
 
 extern multiboot_info_t *g_mbi;
@@ -262,7 +263,7 @@ int fat32_write_file(void* disk_img, struct fat32_bpb* bpb, const char* filename
 int fat32_read_bpb_sector(uint8 drive, uint32 partition_lba_start, struct fat32_bpb* bpb) {
     if (!bpb) return -1;
     uint8 sector[512];
-    if (ata_read_sector(drive, partition_lba_start, sector) != 0) {
+    if (block_read(drive, partition_lba_start, 1, sector) != 0) {
         return -1;
     }
             memcpy(bpb, (char*)sector, sizeof(struct fat32_bpb));
@@ -285,7 +286,7 @@ int fat32_list_root_sector(uint8 drive, uint32 partition_lba_start, struct fat32
     while (cluster < 0x0FFFFFF8) {
         uint32 cluster_first_sec = first_data_sec + ((cluster - 2) * sec_per_clus);
         for (uint32 sec = 0; sec < sec_per_clus; sec++) {
-            if (ata_read_sector(drive, partition_lba_start + cluster_first_sec + sec, sector) != 0) {
+            if (block_read(drive, partition_lba_start + cluster_first_sec + sec, 1, sector) != 0) {
                 return -2;
             }
             struct fat32_dir_entry* entries = (struct fat32_dir_entry*)sector;
@@ -323,7 +324,7 @@ int fat32_read_file_sector(uint8 drive, uint32 partition_lba_start, struct fat32
     while (cluster < 0x0FFFFFF8) {
         uint32 cluster_first_sec = first_data_sec + ((cluster - 2) * sec_per_clus);
     for (uint32 sec = 0; sec < sec_per_clus; sec++) {
-            if (ata_read_sector(drive, partition_lba_start + cluster_first_sec + sec, sector) != 0) {
+            if (block_read(drive, partition_lba_start + cluster_first_sec + sec, 1, sector) != 0) {
                 return -2;
             }
         struct fat32_dir_entry* entries = (struct fat32_dir_entry*)sector;
@@ -349,7 +350,7 @@ int fat32_read_file_sector(uint8 drive, uint32 partition_lba_start, struct fat32
                     while (current_clus < 0x0FFFFFF8 && bytes_read < file_size) {
                         uint32 data_sec = first_data_sec + ((current_clus - 2) * sec_per_clus);
                     for (uint32 s = 0; s < sec_per_clus && bytes_read < file_size; s++) {
-                            if (ata_read_sector(drive, partition_lba_start + data_sec + s, sector) != 0) {
+                            if (block_read(drive, partition_lba_start + data_sec + s, 1, sector) != 0) {
                                 return -4;
                             }
                         uint32 to_copy = byts_per_sec;
@@ -390,7 +391,7 @@ int fat32_write_file_sector(uint8 drive, uint32 partition_lba_start, struct fat3
     while(cluster < 0x0FFFFFF8) {
         uint32 cluster_first_sec = first_data_sec + ((cluster - 2) * sec_per_clus);
         for (uint32 sec = 0; sec < sec_per_clus; sec++) {
-            if (ata_read_sector(drive, partition_lba_start + cluster_first_sec + sec, sector) != 0) return -10;
+            if (block_read(drive, partition_lba_start + cluster_first_sec + sec, 1, sector) != 0) return -10;
             struct fat32_dir_entry* entries = (struct fat32_dir_entry*)sector;
             for (int i = 0; i < (byts_per_sec / sizeof(struct fat32_dir_entry)); i++) {
                 if (entries[i].Name[0] == 0x00 || entries[i].Name[0] == 0xE5) {
@@ -419,7 +420,7 @@ int fat32_write_file_sector(uint8 drive, uint32 partition_lba_start, struct fat3
 
     for(uint32 i = 2; i < total_clusters + 2; i++) {
         uint32 current_fat_sec = rsvd_sec_cnt + (i * 4 / byts_per_sec);
-        if (ata_read_sector(drive, partition_lba_start + current_fat_sec, sector) != 0) return -5;
+        if (block_read(drive, partition_lba_start + current_fat_sec, 1, sector) != 0) return -5;
         uint32* fat = (uint32*)sector;
         uint32 fat_idx = i % (byts_per_sec/4);
         if((fat[fat_idx] & 0x0FFFFFFF) == 0) {
@@ -439,18 +440,18 @@ int fat32_write_file_sector(uint8 drive, uint32 partition_lba_start, struct fat3
     if(write_bytes > 512) write_bytes = 512;
             memcpy((char*)sector, buf, write_bytes);
             if(write_bytes < 512) memset(sector + write_bytes, 0, 512 - write_bytes);
-    if(ata_write_sector(drive, partition_lba_start + data_sec, sector) != 0) return -6;
+    if(block_write(drive, partition_lba_start + data_sec, 1, sector) != 0) return -6;
 
     // Update FAT
     uint32 fat_sector_for_free_clus = rsvd_sec_cnt + (free_clus * 4 / byts_per_sec);
-    if (ata_read_sector(drive, partition_lba_start + fat_sector_for_free_clus, sector) != 0) return -7;
+    if (block_read(drive, partition_lba_start + fat_sector_for_free_clus, 1, sector) != 0) return -7;
     uint32* fat = (uint32*)sector;
     uint32 fat_idx = free_clus % (byts_per_sec / 4);
     fat[fat_idx] = 0x0FFFFFF8; // EOC
-    if (ata_write_sector(drive, partition_lba_start + fat_sector_for_free_clus, sector) != 0) return -8;
+    if (block_write(drive, partition_lba_start + fat_sector_for_free_clus, 1, sector) != 0) return -8;
 
     // Update directory entry
-    if(ata_read_sector(drive, free_entry_sec_in_disk, sector) != 0) return -9;
+    if(block_read(drive, free_entry_sec_in_disk, 1, sector) != 0) return -9;
     struct fat32_dir_entry* entries = (struct fat32_dir_entry*)sector;
     struct fat32_dir_entry* entry = &entries[free_entry_idx];
     for (int j=0; j<11; j++) entry->Name[j] = filename[j];
@@ -464,8 +465,10 @@ int fat32_write_file_sector(uint8 drive, uint32 partition_lba_start, struct fat3
     entry->FstClusLO = free_clus & 0xFFFF;
     entry->FileSize = write_bytes;
 
-    if (ata_write_sector(drive, free_entry_sec_in_disk, sector) != 0) return -9;
+    if (block_write(drive, free_entry_sec_in_disk, 1, sector) != 0) return -9;
 
+    // The writes above sit in the buffer cache until now
+    if (block_flush(drive) != 0) return -11;
     return 0;
 }
 
@@ -474,7 +477,7 @@ uint32 fat32_next_cluster_sector(uint8 drive, uint32 partition_lba_start, struct
     uint8 sector[512];
     uint32 fat_offset = bpb->RsvdSecCnt;
     uint32 fat_sec_num = fat_offset + (cluster * 4 / bpb->BytsPerSec);
-    if (ata_read_sector(drive, partition_lba_start + fat_sec_num, sector) != 0) {
+    if (block_read(drive, partition_lba_start + fat_sec_num, 1, sector) != 0) {
         return 0x0FFFFFF8; // error condition
     }
     uint32* fat = (uint32*)sector;
@@ -485,7 +488,7 @@ uint32 fat32_next_cluster_sector(uint8 drive, uint32 partition_lba_start, struct
 // Find and return the LBA start of the first valid FAT32 partition
 uint32 fat32_get_partition_lba_start(uint8 drive) {
     uint8 mbr[512];
-    if (ata_read_sector(drive, 0, mbr) != 0) {
+    if (block_read(drive, 0, 1, mbr) != 0) {
         return 0; // Cannot read MBR
     }
     // Check for MBR signature
@@ -521,7 +524,7 @@ int fat32_format_partition(uint8 drive, uint8 partition_num) {
     if (partition_num < 1 || partition_num > 4) return -1;
 
     uint8 mbr[512];
-    if (ata_read_sector(drive, 0, mbr) != 0) return -2;
+    if (block_read(drive, 0, 1, mbr) != 0) return -2;
     if (mbr[510] != 0x55 || mbr[511] != 0xAA) return -3;
 
     uint8* entry_ptr = mbr + 0x1BE + (partition_num - 1) * 16;
@@ -567,8 +570,8 @@ int fat32_format_partition(uint8 drive, uint8 partition_num) {
             memset(sector + sizeof(bpb), 0, 512 - sizeof(bpb));
     sector[510] = 0x55; sector[511] = 0xAA;
 
-    if (ata_write_sector(drive, start_lba, sector) != 0) return -5;
-    if (ata_write_sector(drive, start_lba + bpb.BkBootSec, sector) != 0) return -6;
+    if (block_write(drive, start_lba, 1, sector) != 0) return -5;
+    if (block_write(drive, start_lba + bpb.BkBootSec, 1, sector) != 0) return -6;
 
     memset(sector, 0, 512);
     sector[0] = 0x52; sector[1] = 0x52; sector[2] = 0x61; sector[3] = 0x41;
@@ -577,14 +580,12 @@ int fat32_format_partition(uint8 drive, uint8 partition_num) {
     *((uint32*)(sector + 488)) = free_clusters;
     *((uint32*)(sector + 492)) = 3; // Next free
     sector[510] = 0x55; sector[511] = 0xAA;
-    if (ata_write_sector(drive, start_lba + bpb.FSInfo, sector) != 0) return -7;
+    if (block_write(drive, start_lba + bpb.FSInfo, 1, sector) != 0) return -7;
 
     memset(sector, 0, 512);
     for (uint32 f = 0; f < bpb.NumFATs; f++) {
         uint32 fat_start = start_lba + bpb.RsvdSecCnt + (f * bpb.FATSz32);
-        for (uint32 i = 0; i < bpb.FATSz32; i++) {
-            if (ata_write_sector(drive, fat_start + i, sector) != 0) return -8;
-        }
+        if (block_fill(drive, fat_start, bpb.FATSz32, sector) != 0) return -8;
     }
     
     memset(sector, 0, 512);
@@ -594,15 +595,14 @@ int fat32_format_partition(uint8 drive, uint8 partition_num) {
     fat[2] = 0x0FFFFFFF;
     for (uint32 f = 0; f < bpb.NumFATs; f++) {
         uint32 fat_start = start_lba + bpb.RsvdSecCnt + (f * bpb.FATSz32);
-        if (ata_write_sector(drive, fat_start, sector) != 0) return -9;
+        if (block_write(drive, fat_start, 1, sector) != 0) return -9;
     }
     
     uint32 first_data_sec = bpb.RsvdSecCnt + (bpb.NumFATs * bpb.FATSz32);
     uint32 root_dir_start_sec = start_lba + first_data_sec;
     memset(sector, 0, 512);
-    for (uint8 i = 0; i < bpb.SecPerClus; i++) {
-        if (ata_write_sector(drive, root_dir_start_sec + i, sector) != 0) return -12;
-    }
+    if (block_fill(drive, root_dir_start_sec, bpb.SecPerClus, sector) != 0) return -12;
+    if (block_flush(drive) != 0) return -13;
 
     return 0;
 }
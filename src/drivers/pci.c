@@ -0,0 +1,97 @@
+#include <pci.h>
+#include <system.h>
+#include <types.h>
+
+static uint32 pci_address(uint8 bus, uint8 slot, uint8 func, uint8 offset) {
+    return 0x80000000 | ((uint32)bus << 16) | ((uint32)(slot & 0x1F) << 11) |
+           ((uint32)(func & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32 pci_config_read32(uint8 bus, uint8 slot, uint8 func, uint8 offset) {
+    outportl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    return inportl(PCI_CONFIG_DATA);
+}
+
+uint16 pci_config_read16(uint8 bus, uint8 slot, uint8 func, uint8 offset) {
+    uint32 value = pci_config_read32(bus, slot, func, offset);
+    return (uint16)((value >> ((offset & 2) * 8)) & 0xFFFF);
+}
+
+uint8 pci_config_read8(uint8 bus, uint8 slot, uint8 func, uint8 offset) {
+    uint32 value = pci_config_read32(bus, slot, func, offset);
+    return (uint8)((value >> ((offset & 3) * 8)) & 0xFF);
+}
+
+void pci_config_write32(uint8 bus, uint8 slot, uint8 func, uint8 offset, uint32 value) {
+    outportl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    outportl(PCI_CONFIG_DATA, value);
+}
+
+void pci_config_write16(uint8 bus, uint8 slot, uint8 func, uint8 offset, uint16 value) {
+    uint32 old = pci_config_read32(bus, slot, func, offset);
+    uint32 shift = (offset & 2) * 8;
+    old = (old & ~(0xFFFF << shift)) | ((uint32)value << shift);
+    pci_config_write32(bus, slot, func, offset, old);
+}
+
+static void pci_fill_device(uint8 bus, uint8 slot, uint8 func, pci_device_t* out) {
+    uint32 id = pci_config_read32(bus, slot, func, PCI_VENDOR_ID);
+    uint32 class_reg = pci_config_read32(bus, slot, func, 0x08);
+    out->bus = bus;
+    out->slot = slot;
+    out->func = func;
+    out->vendor_id = id & 0xFFFF;
+    out->device_id = (id >> 16) & 0xFFFF;
+    out->class_code = (class_reg >> 24) & 0xFF;
+    out->subclass = (class_reg >> 16) & 0xFF;
+    out->prog_if = (class_reg >> 8) & 0xFF;
+    out->irq_line = pci_config_read8(bus, slot, func, PCI_INTERRUPT_LINE);
+}
+
+// Brute-force scan of every bus/slot/function; match() decides which ones count
+static int pci_scan(int (*match)(const pci_device_t*, uint32, uint32), uint32 a, uint32 b, int index, pci_device_t* out) {
+    for (uint32 bus = 0; bus < 256; bus++) {
+        for (uint8 slot = 0; slot < 32; slot++) {
+            if (pci_config_read16(bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF) continue;
+            uint8 functions = (pci_config_read8(bus, slot, 0, PCI_HEADER_TYPE) & 0x80) ? 8 : 1;
+            for (uint8 func = 0; func < functions; func++) {
+                if (pci_config_read16(bus, slot, func, PCI_VENDOR_ID) == 0xFFFF) continue;
+                pci_device_t dev;
+                pci_fill_device(bus, slot, func, &dev);
+                if (match(&dev, a, b) && index-- == 0) {
+                    *out = dev;
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+static int pci_match_class(const pci_device_t* dev, uint32 class_code, uint32 subclass) {
+    return dev->class_code == class_code && dev->subclass == subclass;
+}
+
+static int pci_match_id(const pci_device_t* dev, uint32 vendor_id, uint32 device_id) {
+    return dev->vendor_id == vendor_id && dev->device_id == device_id;
+}
+
+int pci_find_class(uint8 class_code, uint8 subclass, int index, pci_device_t* out) {
+    return pci_scan(pci_match_class, class_code, subclass, index, out);
+}
+
+int pci_find_device(uint16 vendor_id, uint16 device_id, int index, pci_device_t* out) {
+    return pci_scan(pci_match_id, vendor_id, device_id, index, out);
+}
+
+uint32 pci_read_bar(const pci_device_t* dev, int bar) {
+    uint32 value = pci_config_read32(dev->bus, dev->slot, dev->func, PCI_BAR0 + bar * 4);
+    if (value & 1) return value & ~0x3;   // I/O space BAR
+    return value & ~0xF;                  // Memory space BAR
+}
+
+void pci_enable_bus_master(const pci_device_t* dev) {
+    uint16 command = pci_config_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    pci_config_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, command);
+}
@@ -114,40 +114,8 @@ void shell_log_flush() {
         }
     }
     
-    int old_size = entry.size;
-    
-    // Memory safety: limit total allocation size
-    size_t total_size = old_size + shell_log_pos;
-    size_t max_log_size = (shell_log_buf_size > 8192) ? 8192 : shell_log_buf_size;
-    if (total_size > max_log_size) { // Dynamic limit based on buffer size
-        printf("%cWarning: Log operation too large (%d bytes), limiting to %d bytes\n", 255, 165, 0, total_size, max_log_size);
-        if (old_size > max_log_size / 2) old_size = max_log_size / 2;
-        if (shell_log_pos > (int)shell_log_buf_size) shell_log_pos = shell_log_buf_size;
-        total_size = old_size + shell_log_pos;
-    }
-    
-    char* newbuf = (char*)malloc(total_size);
-    if (!newbuf) {
-        printf("%cWarning: Out of memory for log operation\n", 255, 165, 0);
-        return;
-    }
-    
-    int n = 0;
-    if (old_size > 0) n = eynfs_read_file(0, &sb, &entry, newbuf, old_size, 0);
-    if (n < 0) n = 0;
-    
-    // Bounds check for memory copy
-    if (n + shell_log_pos <= total_size) {
-        memcpy(newbuf + n, shell_log_buf, shell_log_pos);
-    } else {
-        printf("%cWarning: Log buffer overflow prevented\n", 255, 165, 0);
-        free(newbuf);
-        return;
-    }
-    
-    int written = eynfs_write_file(0, &sb, &entry, newbuf, n + shell_log_pos, sb.root_dir_block, entry_idx);
-    free(newbuf);
-    
+    // Only the new lines are written; the existing log is left where it is
+    int written = eynfs_append(0, &sb, &entry, shell_log_buf, shell_log_pos, sb.root_dir_block, entry_idx);
     if (written < 0) {
         printf("%cWarning: Failed to write log file\n", 255, 165, 0);
     }
@@ -0,0 +1,500 @@
+#include <types.h>
+#include <system.h>
+#include <string.h>
+#include <util.h>
+#include <pci.h>
+#include <irq.h>
+#include <ata.h>
+#include <virtio_blk.h>
+
+#define VIRTIO_VENDOR_ID            0x1AF4
+#define VIRTIO_BLK_LEGACY_DEVICE_ID 0x1001  // Legacy and transitional virtio-blk
+
+// Legacy virtio PCI registers, relative to I/O BAR0
+#define VIRTIO_PCI_HOST_FEATURES  0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN      0x08
+#define VIRTIO_PCI_QUEUE_SIZE     0x0C
+#define VIRTIO_PCI_QUEUE_SEL      0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10
+#define VIRTIO_PCI_STATUS         0x12
+#define VIRTIO_PCI_ISR            0x13
+#define VIRTIO_PCI_CONFIG         0x14  // Device config (MSI-X is never enabled)
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_ISR_QUEUE  0x01
+
+// virtio-blk config: capacity in 512-byte sectors (64-bit)
+#define VIRTIO_BLK_CFG_CAPACITY 0x00
+
+// Feature bits
+#define VIRTIO_BLK_F_FLUSH (1u << 9)  // Device has a write-back cache and takes FLUSH requests
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK    0
+
+// Split virtqueue
+#define VIRTQ_DESC_F_NEXT   0x0001
+#define VIRTQ_DESC_F_WRITE  0x0002  // Device writes this buffer
+#define VIRTQ_USED_F_NO_NOTIFY 0x0001
+#define VIRTIO_QUEUE_ALIGN  4096   // Legacy layout: used ring on its own page, PFN in 4 KiB units
+
+// Each chain is header + data + status (a flush has no data descriptor)
+#define VIRTIO_BLK_CHAIN_DESCS 3
+// Sectors per chain; larger requests become several chains in the same batch
+#define VIRTIO_BLK_MAX_SECTORS 1024
+
+typedef struct __attribute__((packed)) {
+    uint32 addr_lo;
+    uint32 addr_hi;
+    uint32 len;
+    uint16 flags;
+    uint16 next;
+} virtq_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint16 flags;
+    uint16 idx;
+    uint16 ring[];
+} virtq_avail_t;
+
+typedef struct __attribute__((packed)) {
+    uint32 id;
+    uint32 len;
+} virtq_used_elem_t;
+
+typedef struct __attribute__((packed)) {
+    uint16 flags;
+    uint16 idx;
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+typedef struct __attribute__((packed)) {
+    uint32 type;
+    uint32 reserved;
+    uint32 sector_lo;
+    uint32 sector_hi;
+} virtio_blk_req_hdr_t;
+
+typedef struct {
+    uint16 io_base;
+    uint8 present;
+    uint8 plugged;
+    uint8 notify_pending;
+    uint8 flush;                    // VIRTIO_BLK_F_FLUSH was negotiated
+    uint8 flushing;                 // A flush is in the ring; nothing is issued beside it
+    uint16 size;                    // Descriptors in the queue (fixed by the device)
+    volatile virtq_desc_t* desc;
+    volatile virtq_avail_t* avail;
+    volatile virtq_used_t* used;
+    uint16 free_head;               // Free descriptors, linked through .next
+    uint16 num_free;
+    uint16 last_used;               // Used ring entries consumed so far
+    uint32 capacity;                // Sectors, clamped to the 32-bit block API
+    uint8* ring;                    // Page-aligned ring memory
+    uint32 ring_bytes;
+    virtio_blk_req_hdr_t* headers;  // Per chain head: request header the device reads
+    uint8* status;                  // Per chain head: status byte the device writes
+    ata_request_t** chain_req;      // Per chain head: owning request
+    uint32* chain_count;            // Per chain head: sectors in the chain
+    ata_request_t* head;            // Requests waiting for descriptors; the head may be partly issued
+    ata_request_t* tail;
+} virtio_blk_dev_t;
+
+static virtio_blk_dev_t virtio_blk_devs[VIRTIO_BLK_MAX_DEVICES];
+static uint8 virtio_blk_count = 0;
+
+// Set on a request when one of its chains failed; it completes with an error once all return
+#define VIRTIO_REQ_FAILED 0x80
+
+static uint32 virtio_align(uint32 value) {
+    return (value + VIRTIO_QUEUE_ALIGN - 1) & ~(VIRTIO_QUEUE_ALIGN - 1);
+}
+
+static void virtio_barrier(void) {
+    __asm__ __volatile__("" : : : "memory");
+}
+
+// Reset the device, lay out an empty virtqueue and hand it over. Used at init and after an abort.
+static int virtio_blk_start(virtio_blk_dev_t* dev) {
+    uint16 io = dev->io_base;
+
+    outportb(io + VIRTIO_PCI_STATUS, 0);
+    outportb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outportb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    // Only FLUSH is negotiated; without it the device must write through
+    uint32 features = inportl(io + VIRTIO_PCI_HOST_FEATURES) & VIRTIO_BLK_F_FLUSH;
+    outportl(io + VIRTIO_PCI_GUEST_FEATURES, features);
+    dev->flush = features ? 1 : 0;
+
+    outw(io + VIRTIO_PCI_QUEUE_SEL, 0);
+    memset(dev->ring, 0, dev->ring_bytes);
+
+    uint16 n = dev->size;
+    for (uint16 i = 0; i < n; i++) {
+        dev->desc[i].next = (uint16)(i + 1);
+        dev->chain_req[i] = NULL;
+    }
+    dev->free_head = 0;
+    dev->num_free = n;
+    dev->last_used = 0;
+    dev->notify_pending = 0;
+    dev->flushing = 0;
+
+    outportl(io + VIRTIO_PCI_QUEUE_PFN, (uint32)dev->ring / VIRTIO_QUEUE_ALIGN);
+    outportb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    if (inportb(io + VIRTIO_PCI_STATUS) & VIRTIO_STATUS_FAILED) return -1;
+    return 0;
+}
+
+static void virtio_blk_notify(virtio_blk_dev_t* dev) {
+    virtio_barrier();
+    dev->notify_pending = 0;
+    if (!(dev->used->flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        outw(dev->io_base + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+    }
+}
+
+// Turn waiting requests into descriptor chains until the ring is full; one notification covers
+// every chain added here (deferred while the device is plugged)
+static void virtio_blk_issue(virtio_blk_dev_t* dev) {
+    uint16 added = 0;
+
+    while (dev->head && dev->num_free >= VIRTIO_BLK_CHAIN_DESCS && !dev->flushing) {
+        ata_request_t* req = dev->head;
+
+        if (req->flags & ATA_REQ_FLUSH) {
+            // A flush only covers writes the device has completed, so it waits for an empty ring
+            if (dev->num_free != dev->size) break;
+            uint16 h = dev->free_head;
+            uint16 s = dev->desc[h].next;
+            dev->free_head = dev->desc[s].next;
+            dev->num_free -= 2;
+
+            virtio_blk_req_hdr_t* hdr = &dev->headers[h];
+            hdr->type = VIRTIO_BLK_T_FLUSH;
+            hdr->reserved = 0;
+            hdr->sector_lo = 0;
+            hdr->sector_hi = 0;
+            dev->status[h] = 0xFF;
+
+            dev->desc[h].addr_lo = (uint32)hdr;
+            dev->desc[h].addr_hi = 0;
+            dev->desc[h].len = sizeof(virtio_blk_req_hdr_t);
+            dev->desc[h].flags = VIRTQ_DESC_F_NEXT;
+            dev->desc[h].next = s;
+
+            dev->desc[s].addr_lo = (uint32)&dev->status[h];
+            dev->desc[s].addr_hi = 0;
+            dev->desc[s].len = 1;
+            dev->desc[s].flags = VIRTQ_DESC_F_WRITE;
+            dev->desc[s].next = 0;
+
+            dev->chain_req[h] = req;
+            dev->chain_count[h] = 0;
+            dev->avail->ring[(uint16)(dev->avail->idx + added) % dev->size] = h;
+            added++;
+
+            req->status = ATA_REQ_ACTIVE;
+            ata_stats_command(req);
+            dev->flushing = 1;
+            dev->head = req->next;
+            if (!dev->head) dev->tail = NULL;
+            req->next = NULL;
+            break;
+        }
+
+        int write = (req->flags & ATA_REQ_WRITE) ? 1 : 0;
+        uint32 count = req->count - req->issued;
+        if (count > VIRTIO_BLK_MAX_SECTORS) count = VIRTIO_BLK_MAX_SECTORS;
+
+        uint16 h = dev->free_head;
+        uint16 d = dev->desc[h].next;
+        uint16 s = dev->desc[d].next;
+        dev->free_head = dev->desc[s].next;
+        dev->num_free -= VIRTIO_BLK_CHAIN_DESCS;
+
+        virtio_blk_req_hdr_t* hdr = &dev->headers[h];
+        hdr->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        hdr->reserved = 0;
+        hdr->sector_lo = req->lba + req->issued;
+        hdr->sector_hi = 0;
+        dev->status[h] = 0xFF;
+
+        dev->desc[h].addr_lo = (uint32)hdr;
+        dev->desc[h].addr_hi = 0;
+        dev->desc[h].len = sizeof(virtio_blk_req_hdr_t);
+        dev->desc[h].flags = VIRTQ_DESC_F_NEXT;
+        dev->desc[h].next = d;
+
+        dev->desc[d].addr_lo = (uint32)(req->buf + req->issued * 512);
+        dev->desc[d].addr_hi = 0;
+        dev->desc[d].len = count * 512;
+        dev->desc[d].flags = VIRTQ_DESC_F_NEXT | (write ? 0 : VIRTQ_DESC_F_WRITE);
+        dev->desc[d].next = s;
+
+        dev->desc[s].addr_lo = (uint32)&dev->status[h];
+        dev->desc[s].addr_hi = 0;
+        dev->desc[s].len = 1;
+        dev->desc[s].flags = VIRTQ_DESC_F_WRITE;
+        dev->desc[s].next = 0;
+
+        dev->chain_req[h] = req;
+        dev->chain_count[h] = count;
+
+        dev->avail->ring[(uint16)(dev->avail->idx + added) % dev->size] = h;
+        added++;
+
+        req->status = ATA_REQ_ACTIVE;
+        ata_stats_command(req);
+        req->issued += count;
+        if (req->issued == req->count) {
+            dev->head = req->next;
+            if (!dev->head) dev->tail = NULL;
+            req->next = NULL;
+        }
+    }
+
+    if (added == 0) return;
+
+    // Descriptors and ring slots must be visible before the index that publishes them
+    virtio_barrier();
+    dev->avail->idx = (uint16)(dev->avail->idx + added);
+
+    if (dev->plugged) {
+        dev->notify_pending = 1;
+    } else {
+        virtio_blk_notify(dev);
+    }
+}
+
+static void virtio_blk_finish(ata_request_t* req) {
+    uint8 status = (req->flags & VIRTIO_REQ_FAILED) ? ATA_REQ_ERROR : ATA_REQ_DONE;
+    req->flags &= ~VIRTIO_REQ_FAILED;
+    ata_request_finish(req, status);
+}
+
+// Return a chain's descriptors to the free list
+static void virtio_blk_free_chain(virtio_blk_dev_t* dev, uint16 h) {
+    uint16 last = h;
+    uint16 n = 1;
+    while (dev->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+        last = dev->desc[last].next;
+        n++;
+    }
+    dev->desc[last].next = dev->free_head;
+    dev->free_head = h;
+    dev->num_free += n;
+    dev->chain_req[h] = NULL;
+}
+
+// Consume the used ring. Runs from the device interrupt and from ata_wait as a poll.
+static void virtio_blk_service(virtio_blk_dev_t* dev) {
+    virtio_barrier();
+    while (dev->last_used != dev->used->idx) {
+        uint16 h = (uint16)dev->used->ring[dev->last_used % dev->size].id;
+        dev->last_used++;
+
+        ata_request_t* req = dev->chain_req[h];
+        uint32 count = dev->chain_count[h];
+        uint8 status = dev->status[h];
+        virtio_blk_free_chain(dev, h);
+        if (req && (req->flags & ATA_REQ_FLUSH)) dev->flushing = 0;
+        if (!req) continue;
+
+        if (status != VIRTIO_BLK_S_OK) req->flags |= VIRTIO_REQ_FAILED;
+        req->done += count;
+        if (req->done == req->count) virtio_blk_finish(req);
+    }
+
+    virtio_blk_issue(dev);
+}
+
+static void virtio_blk_irq(regs_t* r) {
+    (void)r;
+    for (int i = 0; i < virtio_blk_count; i++) {
+        // Reading ISR status acknowledges (and deasserts) the device's interrupt
+        if (inportb(virtio_blk_devs[i].io_base + VIRTIO_PCI_ISR) & VIRTIO_ISR_QUEUE) {
+            virtio_blk_service(&virtio_blk_devs[i]);
+        }
+    }
+}
+
+// Allocate the ring and per-descriptor bookkeeping for a queue of `n` descriptors
+static int virtio_blk_alloc_queue(virtio_blk_dev_t* dev, uint16 n) {
+    uint32 desc_bytes = n * sizeof(virtq_desc_t);
+    uint32 avail_bytes = 6 + 2 * n;
+    uint32 used_offset = virtio_align(desc_bytes + avail_bytes);
+    uint32 used_bytes = virtio_align(6 + sizeof(virtq_used_elem_t) * n);
+
+    dev->size = n;
+    dev->ring_bytes = used_offset + used_bytes;
+
+    // Over-allocate so the ring can start on a page boundary (no paging: the address is physical)
+    uint8* raw = (uint8*)malloc(dev->ring_bytes + VIRTIO_QUEUE_ALIGN);
+    dev->headers = (virtio_blk_req_hdr_t*)malloc(n * sizeof(virtio_blk_req_hdr_t));
+    dev->status = (uint8*)malloc(n);
+    dev->chain_req = (ata_request_t**)malloc(n * sizeof(ata_request_t*));
+    dev->chain_count = (uint32*)malloc(n * sizeof(uint32));
+    if (!raw || !dev->headers || !dev->status || !dev->chain_req || !dev->chain_count) {
+        if (raw) free(raw);
+        if (dev->headers) free(dev->headers);
+        if (dev->status) free(dev->status);
+        if (dev->chain_req) free(dev->chain_req);
+        if (dev->chain_count) free(dev->chain_count);
+        return -1;
+    }
+
+    dev->ring = (uint8*)virtio_align((uint32)raw);
+    dev->desc = (volatile virtq_desc_t*)dev->ring;
+    dev->avail = (volatile virtq_avail_t*)(dev->ring + desc_bytes);
+    dev->used = (volatile virtq_used_t*)(dev->ring + used_offset);
+    return 0;
+}
+
+void virtio_blk_init(void) {
+    virtio_blk_count = 0;
+
+    pci_device_t pci;
+    for (int index = 0; virtio_blk_count < VIRTIO_BLK_MAX_DEVICES &&
+         pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_LEGACY_DEVICE_ID, index, &pci) == 0; index++) {
+        uint32 bar0 = pci_config_read32(pci.bus, pci.slot, pci.func, PCI_BAR0);
+        if (!(bar0 & 1)) continue; // Legacy interface lives in an I/O BAR
+
+        virtio_blk_dev_t* dev = &virtio_blk_devs[virtio_blk_count];
+        memset(dev, 0, sizeof(*dev));
+        dev->io_base = (uint16)(bar0 & ~0x3);
+        pci_enable_bus_master(&pci);
+
+        outportb(dev->io_base + VIRTIO_PCI_STATUS, 0);
+        outw(dev->io_base + VIRTIO_PCI_QUEUE_SEL, 0);
+        uint16 n = inw(dev->io_base + VIRTIO_PCI_QUEUE_SIZE);
+        if (n < VIRTIO_BLK_CHAIN_DESCS) continue;
+        if (virtio_blk_alloc_queue(dev, n) != 0) continue;
+        if (virtio_blk_start(dev) != 0) continue;
+
+        uint32 cap_lo = inportl(dev->io_base + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_CAPACITY);
+        uint32 cap_hi = inportl(dev->io_base + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_CAPACITY + 4);
+        dev->capacity = cap_hi ? 0xFFFFFFFF : cap_lo;
+        dev->present = 1;
+
+        uint16 identify[256];
+        virtio_blk_count++;
+        virtio_blk_identify((uint8)(virtio_blk_count - 1), identify);
+        if (ata_register_drive(ATA_BACKEND_VIRTIO, (uint8)(virtio_blk_count - 1), identify) < 0) {
+            dev->present = 0;
+            outportb(dev->io_base + VIRTIO_PCI_STATUS, 0);
+            virtio_blk_count--;
+            break; // Drive table is full
+        }
+
+        if (pci.irq_line < IRQ_COUNT) irq_install_handler(pci.irq_line, virtio_blk_irq);
+    }
+}
+
+int virtio_blk_submit(uint8 unit, ata_request_t* req) {
+    if (unit >= virtio_blk_count || !virtio_blk_devs[unit].present) return -1;
+
+    virtio_blk_dev_t* dev = &virtio_blk_devs[unit];
+    req->status = ATA_REQ_QUEUED;
+    req->done = 0;
+    req->issued = 0;
+    req->flags &= ~VIRTIO_REQ_FAILED;
+    req->next = NULL;
+
+    // A write-through device has nothing to flush
+    if ((req->flags & ATA_REQ_FLUSH) && !dev->flush) {
+        virtio_blk_finish(req);
+        return 0;
+    }
+
+    uint32 flags = irq_save();
+    if (dev->tail) {
+        dev->tail->next = req;
+    } else {
+        dev->head = req;
+    }
+    dev->tail = req;
+    virtio_blk_issue(dev);
+    irq_restore(flags);
+    return 0;
+}
+
+void virtio_blk_plug(uint8 unit) {
+    if (unit >= virtio_blk_count) return;
+    virtio_blk_devs[unit].plugged = 1;
+}
+
+void virtio_blk_unplug(uint8 unit) {
+    if (unit >= virtio_blk_count) return;
+    virtio_blk_dev_t* dev = &virtio_blk_devs[unit];
+    uint32 flags = irq_save();
+    dev->plugged = 0;
+    if (dev->notify_pending) virtio_blk_notify(dev);
+    irq_restore(flags);
+}
+
+void virtio_blk_poll(uint8 unit) {
+    if (unit >= virtio_blk_count) return;
+    virtio_blk_dev_t* dev = &virtio_blk_devs[unit];
+    // A poll must not strand chains behind a plug
+    if (dev->notify_pending) virtio_blk_notify(dev);
+    virtio_blk_service(dev);
+}
+
+void virtio_blk_abort(uint8 unit) {
+    if (unit >= virtio_blk_count) return;
+    virtio_blk_dev_t* dev = &virtio_blk_devs[unit];
+
+    // Every request with a chain in the ring fails; waiting requests are reissued afterwards
+    for (uint16 h = 0; h < dev->size; h++) {
+        ata_request_t* req = dev->chain_req[h];
+        if (!req || req->status != ATA_REQ_ACTIVE) continue;
+        if (dev->head == req) {
+            dev->head = req->next;
+            if (!dev->head) dev->tail = NULL;
+            req->next = NULL;
+        }
+        req->flags |= VIRTIO_REQ_FAILED;
+        virtio_blk_finish(req);
+    }
+
+    if (virtio_blk_start(dev) != 0) dev->present = 0;
+    virtio_blk_issue(dev);
+}
+
+// Store an ASCII string in IDENTIFY byte order (two characters per word, first in the high byte)
+static void virtio_blk_identify_string(uint16* words, int count, const char* text) {
+    for (int i = 0; i < count; i++) {
+        char hi = *text ? *text++ : ' ';
+        char lo = *text ? *text++ : ' ';
+        words[i] = (uint16)(((uint8)hi << 8) | (uint8)lo);
+    }
+}
+
+int virtio_blk_identify(uint8 unit, uint16* identify_data) {
+    if (unit >= virtio_blk_count || !virtio_blk_devs[unit].present) return -1;
+    uint32 sectors = virtio_blk_devs[unit].capacity;
+
+    memset(identify_data, 0, 512);
+    virtio_blk_identify_string(&identify_data[27], 20, "VIRTIO BLOCK DEVICE");
+    identify_data[49] = 0x0300;                 // LBA and DMA supported
+    identify_data[60] = (uint16)((sectors > 0x0FFFFFFF ? 0x0FFFFFFF : sectors) & 0xFFFF);
+    identify_data[61] = (uint16)((sectors > 0x0FFFFFFF ? 0x0FFFFFFF : sectors) >> 16);
+    identify_data[83] = 0x4400;                 // 48-bit address feature set
+    if (virtio_blk_devs[unit].flush) {
+        identify_data[82] = 0x0020;             // Write cache supported...
+        identify_data[85] = 0x0020;             // ...and enabled
+    }
+    identify_data[100] = (uint16)(sectors & 0xFFFF);
+    identify_data[101] = (uint16)(sectors >> 16);
+    return 0;
+}
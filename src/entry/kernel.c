@@ -1,6 +1,8 @@
 #include <kb.h>
 #include <isr.h>
 #include <idt.h>
+#include <irq.h>
+#include <timer.h>
 #include <util.h>
 #include <shell.h>
 #include <vga.h>
@@ -9,6 +11,7 @@
 #include <system.h>
 #include <predictive_memory.h>
 #include <zero_copy.h>
+#include <boottime.h>
 
 void* fat32_disk_img = 0;
 multiboot_info_t *g_mbi = 0;
@@ -24,23 +27,38 @@ int kmain(uint32 magic, multiboot_info_t *mbi)
 		fat32_disk_img = (void*)mods[0].mod_start;
 	}
 
-	// Full initialization - all services
+	// Full initialization - all services (each phase is recorded for 'boottime')
+	int phase = boot_phase_begin("ISR install");
 	isr_install();
+	irq_install();
+	timer_init();
+	irq_enable();
+	boot_phase_end(phase);
+
+	phase = boot_phase_begin("clearScreen");
 	clearScreen();
+	boot_phase_end(phase);
 	
 	printf("EYN-OS Release 13\n");
 	printf("Type 'help' for a list of commands.\n\n");
 	
-	// Initialize ATA drives immediately
+	// Initialize ATA drives immediately. Drives 0-3 finish probing in the background.
+	phase = boot_phase_begin("ATA init");
 	ata_init_drives();
+	boot_phase_end(phase);
 
 	// Initialize predictive memory management system
+	phase = boot_phase_begin("predictive_memory_init");
 	predictive_memory_init();
+	boot_phase_end(phase);
 	
 	// Initialize zero-copy file operations system
+	phase = boot_phase_begin("zero_copy_init");
 	zero_copy_init();
+	boot_phase_end(phase);
 	
 	// Launch shell with full initialization
+	boot_timeline_close();
 	launch_shell(0);
 	
 	return 0;
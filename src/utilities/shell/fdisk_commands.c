@@ -3,6 +3,7 @@
 #include <vga.h>
 #include <util.h>
 #include <system.h>
+#include <block.h>
 #include <string.h>
 #include <stdint.h>
 #include <shell_command_info.h>
@@ -10,7 +11,7 @@
 // fdisk_list implementation
 void fdisk_list() {
     uint8 mbr[512];
-    if (ata_read_sector(0, 0, mbr) != 0) {
+    if (block_read(0, 0, 1, mbr) != 0) {
         printf("%cFailed to read MBR from drive 0\n", 255, 0, 0);
         return;
     }
@@ -34,7 +35,7 @@ void fdisk_list() {
 // fdisk_create_partition implementation
 void fdisk_create_partition(uint32 start_lba, uint32 size, uint8 type) {
     uint8 mbr[512];
-    if (ata_read_sector(0, 0, mbr) != 0) {
+    if (block_read(0, 0, 1, mbr) != 0) {
         printf("%cFailed to read MBR from drive 0\n", 255, 0, 0);
         return;
     }
@@ -68,7 +69,7 @@ void fdisk_create_partition(uint32 start_lba, uint32 size, uint8 type) {
     entry[15] = (size >> 24) & 0xFF;
     mbr[510] = 0x55;
     mbr[511] = 0xAA;
-    if (ata_write_sector(0, 0, mbr) != 0) {
+    if (block_write(0, 0, 1, mbr) != 0 || block_flush(0) != 0) {
         printf("%cFailed to write MBR to drive 0\n", 255, 0, 0);
         return;
     }
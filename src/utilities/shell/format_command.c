@@ -3,6 +3,7 @@
 #include <types.h>
 #include <stdint.h>
 #include <system.h>
+#include <block.h>
 #include <string.h>
 #include <util.h>
 #include <eynfs.h>
@@ -11,13 +12,17 @@
 
 extern char* readStr();
 
-// Helper function to format a partition as EYNFS
-int eynfs_format_partition(uint8 drive, uint8 part_num) {
+// Helper function to format a partition as EYNFS with the given block size (512-4096)
+int eynfs_format_partition(uint8 drive, uint8 part_num, uint32_t block_size) {
+    if (!EYNFS_VALID_BLOCK_SIZE(block_size)) {
+        printf("%cUnsupported block size %d (use 512, 1024, 2048 or 4096)\n", 255, 0, 0, block_size);
+        return -2;
+    }
     printf("%cStarting EYNFS format for partition %d...\n", 255, 255, 0, part_num);
     
     // Read MBR to get partition info
     uint8 mbr[512];
-    if (ata_read_sector(drive, 0, mbr) != 0) {
+    if (block_read(drive, 0, 1, mbr) != 0) {
         printf("%cFailed to read MBR\n", 255, 0, 0);
         return -1;
     }
@@ -34,73 +39,132 @@ int eynfs_format_partition(uint8 drive, uint8 part_num) {
         
         if (start_lba == 0 || size == 0) {
             start_lba = 0;
-            size = 1024000; // Assume 500MB disk (1024000 sectors)
+            size = ata_drive_sectors(drive);
         }
     } else {
         // No valid MBR, treat as superfloppy
         start_lba = 0;
-        size = 1024000; // Assume 500MB disk (1024000 sectors)
+        size = ata_drive_sectors(drive);
+    }
+    if (size == 0) {
+        size = 1024000; // Capacity unknown: assume 500MB disk (1024000 sectors)
+    }
+    
+    // Block n lives at sector n * spb, so the partition has to start on a block boundary
+    uint32 spb = block_size / BLOCK_SECTOR_SIZE;
+    if (start_lba % spb != 0) {
+        printf("%cPartition start %d is not aligned to %d-byte blocks\n", 255, 0, 0, start_lba, block_size);
+        return -2;
     }
     
-    printf("%cUsing start_lba=%d, size=%d\n", 255, 255, 0, start_lba, size);
+    printf("%cUsing start_lba=%d, size=%d, block size=%d\n", 255, 255, 0, start_lba, size, block_size);
     
     // ERASE THE DISK: Zero out the first 2048 sectors to remove old FAT32 data
     printf("%cErasing disk...\n", 255, 255, 0);
-    uint8 zero_sector[EYNFS_BLOCK_SIZE] = {0};
-    for (uint32 i = 0; i < 2048; i++) {
-        int write_result = ata_write_sector(drive, start_lba + i, zero_sector);
-        if (write_result != 0) {
-            printf("%cFailed to erase sector %d\n", 255, 0, 0, i);
-            return -7;
-        }
-        // No delay needed for modern disk controllers
+    uint8 zero_sector[BLOCK_SECTOR_SIZE] = {0};
+    if (block_fill(drive, start_lba, 2048, zero_sector) != 0) {
+        printf("%cFailed to erase disk\n", 255, 0, 0);
+        return -7;
     }
     
     printf("%cWriting EYNFS structures...\n", 255, 255, 0);
     
-    // EYNFS layout: superblock at start_lba + 2048
+    // EYNFS layout, in blocks: the superblock in the block holding sector start_lba + 2048,
+    // then one bitmap block per block_size * 8 blocks, the name table, the root directory and
+    // the metadata journal
+    uint32 total_blocks = size / spb;
+    uint32 bitmap_blocks = EYNFS_BITMAP_BLOCKS(total_blocks, block_size);
     uint32 eynfs_superblock_lba = start_lba + 2048;
-    uint32 eynfs_bitmap_lba = start_lba + 2049;
-    uint32 eynfs_nametable_lba = start_lba + 2050;
-    uint32 eynfs_rootdir_lba = start_lba + 2051;
+    uint32 eynfs_bitmap_block = eynfs_superblock_lba / spb + 1;
+    uint32 eynfs_nametable_block = eynfs_bitmap_block + bitmap_blocks;
+    uint32 eynfs_rootdir_block = eynfs_nametable_block + 1;
+    uint32 eynfs_journal_block = eynfs_rootdir_block + 1;
+    uint32 journal_blocks = EYNFS_JOURNAL_BLOCKS(block_size);
+    uint32 first_data_block = eynfs_journal_block + journal_blocks;
+    uint32 per_bitmap_block = EYNFS_BLOCKS_PER_BITMAP_BLOCK(block_size);
+    
+    // Any mounted, cached or journaled state belongs to the filesystem being replaced
+    eynfs_unmount(drive);
+    eynfs_cache_clear();
     
     // Write superblock
     eynfs_superblock_t sb = {0};
     sb.magic = EYNFS_MAGIC;
     sb.version = EYNFS_VERSION;
-    sb.block_size = EYNFS_BLOCK_SIZE;
-    sb.total_blocks = size;
-    sb.root_dir_block = eynfs_rootdir_lba;
-    sb.free_block_map = eynfs_bitmap_lba;
-    sb.name_table_block = eynfs_nametable_lba;
+    sb.block_size = block_size;
+    sb.total_blocks = total_blocks;
+    sb.root_dir_block = eynfs_rootdir_block;
+    sb.free_block_map = eynfs_bitmap_block;
+    sb.name_table_block = eynfs_nametable_block;
+    sb.bitmap_blocks = bitmap_blocks;
+    sb.journal_block = eynfs_journal_block;
+    sb.journal_blocks = journal_blocks;
     if (eynfs_write_superblock(drive, eynfs_superblock_lba, &sb) != 0) {
         printf("%cFailed to write superblock\n", 255, 0, 0);
         return -3;
     }
     
-    // Write zeroed free block bitmap
-    uint8 bitmap[EYNFS_BLOCK_SIZE] = {0};
-    // Mark reserved blocks as used (superblock, bitmap, nametable, rootdir)
-    for (int i = 0; i < 4; i++) bitmap[i/8] |= (1 << (i%8));
-    if (ata_write_sector(drive, eynfs_bitmap_lba, bitmap) != 0) {
-        printf("%cFailed to write bitmap\n", 255, 0, 0);
+    // Write the free block bitmap. Blocks below the first data block (everything up to and
+    // including the journal) and bits past the end of the volume are marked used;
+    // bitmap blocks in between are all free and are zero-filled in large batches.
+    uint8 *bitmap = (uint8*)malloc(block_size);
+    if (!bitmap) {
+        printf("%cOut of memory for the bitmap\n", 255, 0, 0);
         return -4;
     }
+    uint32 s = 0;
+    while (s < bitmap_blocks) {
+        uint32 bitmap_first = s * per_bitmap_block;
+        uint32 bitmap_end = bitmap_first + per_bitmap_block;
+        if (bitmap_first >= first_data_block && bitmap_end <= total_blocks) {
+            uint32 run = 1;
+            while (s + run < bitmap_blocks && (s + run + 1) * per_bitmap_block <= total_blocks) run++;
+            if (block_fill(drive, (eynfs_bitmap_block + s) * spb, run * spb, zero_sector) != 0) {
+                printf("%cFailed to write bitmap\n", 255, 0, 0);
+                free(bitmap);
+                return -4;
+            }
+            s += run;
+            continue;
+        }
+        memset(bitmap, 0, block_size);
+        for (uint32 i = 0; i < per_bitmap_block; i++) {
+            uint32 block = bitmap_first + i;
+            if (block < first_data_block || block >= total_blocks) bitmap[i / 8] |= (1 << (i % 8));
+        }
+        if (block_write(drive, (eynfs_bitmap_block + s) * spb, spb, bitmap) != 0) {
+            printf("%cFailed to write bitmap\n", 255, 0, 0);
+            free(bitmap);
+            return -4;
+        }
+        s++;
+    }
+    free(bitmap);
     
     // Write empty name table
-    uint8 name_table[EYNFS_BLOCK_SIZE] = {0};
-    if (ata_write_sector(drive, eynfs_nametable_lba, name_table) != 0) {
+    if (block_fill(drive, eynfs_nametable_block * spb, spb, zero_sector) != 0) {
         printf("%cFailed to write name table\n", 255, 0, 0);
         return -5;
     }
     
     // Write empty root directory block
-    uint8 root_dir[EYNFS_BLOCK_SIZE] = {0};
-    if (ata_write_sector(drive, eynfs_rootdir_lba, root_dir) != 0) {
+    if (block_fill(drive, eynfs_rootdir_block * spb, spb, zero_sector) != 0) {
         printf("%cFailed to write root directory\n", 255, 0, 0);
         return -6;
     }
     
+    // Empty journal; the driver writes its header on first mount
+    if (block_fill(drive, eynfs_journal_block * spb, journal_blocks * spb, zero_sector) != 0) {
+        printf("%cFailed to write journal\n", 255, 0, 0);
+        return -6;
+    }
+    
+    // The superblock and bitmap writes are still in the buffer cache
+    if (block_flush(drive) != 0) {
+        printf("%cFailed to flush the drive\n", 255, 0, 0);
+        return -8;
+    }
+    
     printf("%cEYNFS format completed successfully\n", 0, 255, 0);
     return 0;
 }
@@ -111,10 +175,11 @@ void format_cmd_handler(string ch) {
     while (ch[i] && ch[i] != ' ') i++;
     while (ch[i] && ch[i] == ' ') i++;
     if (!ch[i]) {
-        printf("%cUsage: format <partition_num (0-3)> [filesystem_type]\n", 255, 255, 255);
-        printf("%cFilesystem types: fat32, eynfs\n", 255, 255, 255);
+        printf("%cUsage: format <partition_num (0-3)> [filesystem_type] [block_size]\n", 255, 255, 255);
+        printf("%cFilesystem types: fat32, eynfs (block size 512, 1024, 2048 or 4096; default 512)\n", 255, 255, 255);
         printf("%cExample: format 0 fat32\n", 255, 255, 255);
         printf("%cExample: format 1 eynfs\n", 255, 255, 255);
+        printf("%cExample: format 1 eynfs 4096\n", 255, 255, 255);
         return;
     }
     char part_str[16];
@@ -128,6 +193,7 @@ void format_cmd_handler(string ch) {
     }
     while (ch[i] && ch[i] == ' ') i++;
     int format_eynfs = 0;
+    uint32_t block_size = EYNFS_BLOCK_SIZE;
     if (ch[i]) {
         char fs_type[16];
         j = 0;
@@ -141,6 +207,18 @@ void format_cmd_handler(string ch) {
             return;
         }
     }
+    while (ch[i] && ch[i] == ' ') i++;
+    if (ch[i]) {
+        char bs_str[16];
+        j = 0;
+        while (ch[i] && ch[i] != ' ' && j < 15) bs_str[j++] = ch[i++];
+        bs_str[j] = '\0';
+        block_size = (uint32_t)str_to_int(bs_str);
+        if (!format_eynfs || !EYNFS_VALID_BLOCK_SIZE(block_size)) {
+            printf("%cBlock size must be 512, 1024, 2048 or 4096 (EYNFS only)\n", 255, 0, 0);
+            return;
+        }
+    }
     printf("%cThis will erase all data on partition %d. Are you sure? (y/n): ", 255, 165, 0, part_num);
     string confirm = readStr();
     printf("\n");
@@ -148,8 +226,9 @@ void format_cmd_handler(string ch) {
         printf("%cFormatting partition %d as %s...\n", 255, 255, 255, part_num, format_eynfs ? "EYNFS" : "FAT32");
         int res;
         if (format_eynfs) {
-            res = eynfs_format_partition(0, part_num);
+            res = eynfs_format_partition(0, part_num, block_size);
         } else {
+            eynfs_unmount(0); // The drive may hold a mounted EYNFS
             res = fat32_format_partition(0, part_num);
         }
         if (res == 0) {
@@ -162,4 +241,4 @@ void format_cmd_handler(string ch) {
     }
 } 
 
-REGISTER_SHELL_COMMAND(format, "format", format_cmd_handler, CMD_STREAMING, "Format partition n (0-3) as FAT32 or EYNFS.\nFAT32: widely supported, max 4GB files.\nEYNFS: native, supports long filenames, fast directory access.\nUsage: format <partition_num> <filesystem_type>", "format 1 fat32"); 
\ No newline at end of file
+REGISTER_SHELL_COMMAND(format, "format", format_cmd_handler, CMD_STREAMING, "Format partition n (0-3) as FAT32 or EYNFS.\nFAT32: widely supported, max 4GB files.\nEYNFS: native, supports long filenames, fast directory access.\nUsage: format <partition_num> <filesystem_type> [block_size]", "format 1 eynfs 4096"); 
\ No newline at end of file
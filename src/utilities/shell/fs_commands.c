@@ -23,6 +23,7 @@ void cd(string arg);
 void makedir(string arg);
 void deldir(string arg);
 void fscheck(string arg);
+void fsupgrade(string arg);
 void copy_cmd(string arg);
 void move_cmd(string arg);
 
@@ -844,6 +845,23 @@ void fscheck(string ch) {
     }
 }
 
+// fsupgrade command implementation
+void fsupgrade(string ch) {
+    uint8 disk = g_current_drive;
+    eynfs_superblock_t sb;
+    if (eynfs_read_superblock(disk, EYNFS_SUPERBLOCK_LBA, &sb) != 0 || sb.magic != EYNFS_MAGIC) {
+        printf("%cError: No EYNFS filesystem on drive %d.\n", 255, 0, 0, disk);
+        return;
+    }
+    printf("Converting EYNFS v%d on drive %d to extents (v%d)...\n", sb.version, disk, EYNFS_VERSION_EXTENTS);
+    int converted = eynfs_upgrade(disk);
+    if (converted < 0) {
+        printf("%cUpgrade failed; files not yet converted are still readable.\n", 255, 0, 0);
+        return;
+    }
+    printf("%cUpgrade complete: %d file(s) converted.\n", 0, 255, 0, converted);
+}
+
 // Copy command implementation - rewritten from scratch
 void copy_cmd(string ch) {
     uint8 i = 0;
@@ -1125,5 +1143,6 @@ REGISTER_SHELL_COMMAND(cd, "cd", cd, CMD_STREAMING, "Change the current director
 REGISTER_SHELL_COMMAND(makedir, "makedir", makedir, CMD_STREAMING, "Create a new directory.\nUsage: makedir <directory>", "makedir myfolder");
 REGISTER_SHELL_COMMAND(deldir, "deldir", deldir, CMD_STREAMING, "Delete an empty directory.\nUsage: deldir <directory>", "deldir myfolder");
 REGISTER_SHELL_COMMAND(fscheck, "fscheck", fscheck, CMD_STREAMING, "Check filesystem integrity.\nUsage: fscheck", "fscheck");
+REGISTER_SHELL_COMMAND(fsupgrade, "fsupgrade", fsupgrade, CMD_STREAMING, "Convert a v11 EYNFS filesystem's files from block chains to extents, in place.\nUsage: fsupgrade", "fsupgrade");
 REGISTER_SHELL_COMMAND(copy_cmd, "copy", copy_cmd, CMD_STREAMING, "Copy a file from source to destination.\nUsage: copy <source> <destination>", "copy file1.txt file2.txt");
 REGISTER_SHELL_COMMAND(move_cmd, "move", move_cmd, CMD_STREAMING, "Move a file from source to destination.\nUsage: move <source> <destination>", "move file1.txt /backup/file1.txt");
\ No newline at end of file
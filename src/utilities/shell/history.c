@@ -260,6 +260,8 @@ string readStr_with_history(command_history_t* history) {
                 buffstr[i] = c;
                 i++;
             }
+        } else {
+            shell_idle();
         }
     }
     
@@ -21,6 +21,8 @@
 #include <game_engine.h>
 #include <tui.h>
 #include <shell_command_info.h>
+#include <bcache.h>
+#include <timer.h>
 
 // Circular buffer variables for logging
 extern int shell_log_current_line_start;
@@ -105,6 +107,7 @@ void spam_cmd(string arg) {
 void format_cmd_handler(string arg);
 void fdisk_cmd_handler(string arg);
 void fscheck(string arg);
+void fsupgrade(string arg);
 void copy_cmd(string arg);
 void move_cmd(string arg);
 void del(string arg);
@@ -326,9 +329,12 @@ void handler_cmd(string arg) {
     launch_shell(1); // Always launches a new shell at depth 1
 }
 void handler_exit(string arg) {
+    if (sync_drives() != 0) {
+        printf("%cWarning: some data could not be written to disk\n", 255, 0, 0);
+    }
     printf("%cGoodbye!\n", 255, 140, 0); // Orange
-    // For now, just exit the shell
-    asm("hlt");
+    // For now, just exit the shell (interrupts off so the timer cannot wake us)
+    asm("cli; hlt");
 }
 
 void handler_assemble(string arg) {
@@ -423,6 +429,18 @@ void status_cmd(string arg) {
     printf("%c  Registration: Linker-based automatic\n", 255, 255, 255);
 }
 
+// Background work while the prompt waits for a key: commit an EYNFS journal group that has
+// stopped growing, and write back dirty buffers that are old or too many
+#define SHELL_IDLE_INTERVAL_MS 100
+
+void shell_idle(void) {
+    static uint32 last = 0;
+    if (!timer_running() || timer_ms() - last < SHELL_IDLE_INTERVAL_MS) return;
+    last = timer_ms();
+    eynfs_commit_idle();
+    bcache_flush_idle();
+}
+
 void launch_shell(int n) {
     while (1) {
         if (shell_log_active) {
@@ -14,6 +14,10 @@
 #include <isr.h>
 #include <stdint.h>
 #include <help_tui.h>
+#include <ata.h>
+#include <timer.h>
+#include <irq.h>
+#include <boottime.h>
 
 // Forward declarations for command handlers
 void help_cmd(string arg);
@@ -26,6 +30,8 @@ void drive_cmd(string arg);
 void memory_cmd(string arg);
 void log_cmd(string arg);
 void lsata_cmd(string arg);
+void iostat_cmd(string arg);
+void boottime_cmd(string arg);
 void handler_exit(string arg);
 void clear_cmd(string arg);
 void catram_cmd(string arg);
@@ -253,20 +259,21 @@ void search_recursive(uint8 drive, const eynfs_superblock_t* sb, uint32_t dir_bl
             uint8_t buffer[512]; // Small buffer for streaming
             uint32_t offset = 0;
             int found_in_content = 0;
+            eynfs_read_ctx_t ctx; // Each chunk picks up where the last one ended
+            eynfs_read_ctx_init(&ctx, drive, entry);
             
             while (offset < entry->size && !found_in_content) {
-                uint32_t bytes_to_read = (entry->size - offset) > sizeof(buffer) ? 
-                                        sizeof(buffer) : (entry->size - offset);
+                uint32_t bytes_to_read = (entry->size - offset) > sizeof(buffer) - 1 ? 
+                                        sizeof(buffer) - 1 : (entry->size - offset);
                 
-                int bytes_read = eynfs_read_file(drive, sb, entry, buffer, bytes_to_read, offset);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0'; // Null-terminate for string search
-                    
-                    if (boyer_moore_search((char*)buffer, pattern) != -1) {
-                        printf("%c[CONTENT] %s\n", 255, 255, 0, full_path);
-                        (*found_count)++;
-                        found_in_content = 1;
-                    }
+                int bytes_read = eynfs_read_ctx_read(&ctx, buffer, bytes_to_read, offset);
+                if (bytes_read <= 0) break;
+                buffer[bytes_read] = '\0'; // Null-terminate for string search
+                
+                if (boyer_moore_search((char*)buffer, pattern) != -1) {
+                    printf("%c[CONTENT] %s\n", 255, 255, 0, full_path);
+                    (*found_count)++;
+                    found_in_content = 1;
                 }
                 offset += bytes_read;
             }
@@ -465,6 +472,7 @@ void help()
     printf("%c  format   - Format drive\n", 255, 255, 255);
     printf("%c  fdisk    - Partition management\n", 255, 255, 255);
     printf("%c  fscheck  - Check filesystem integrity\n", 255, 255, 255);
+    printf("%c  fsupgrade - Convert EYNFS v11 files to extents\n", 255, 255, 255);
     printf("%c  copy     - Copy files\n", 255, 255, 255);
     printf("%c  move     - Move files\n", 255, 255, 255);
     printf("%c  del      - Delete files\n", 255, 255, 255);
@@ -482,6 +490,7 @@ void help()
     printf("%c  validate - Input validation\n", 255, 255, 255);
     printf("%c  drive    - Change drive\n", 255, 255, 255);
     printf("%c  lsata    - List ATA drives\n", 255, 255, 255);
+    printf("%c  iostat   - Drive I/O statistics\n", 255, 255, 255);
     printf("%c  read     - Read files\n", 255, 255, 255);
     printf("%c  write    - Edit files\n", 255, 255, 255);
     printf("%c  run      - Run programs\n", 255, 255, 255);
@@ -521,9 +530,12 @@ REGISTER_SHELL_COMMAND(spam, "spam", spam_cmd, CMD_STREAMING, "Spam 'EYN-OS' to
 REGISTER_SHELL_COMMAND(calc, "calc", calc_cmd, CMD_STREAMING, "32-bit fixed-point calculator. Supports +, -, *, /.\nUsage: calc <expression>", "calc 2.5+3.7");
 REGISTER_SHELL_COMMAND(draw, "draw", draw_cmd_handler, CMD_STREAMING, "Draw a rectangle.\nUsage: draw <x> <y> <width> <height> <r> <g> <b>.\nExample: draw 10 20 100 50 255 0 0 draws a red rectangle.", "draw 10 20 100 50 255 0 0");
 REGISTER_SHELL_COMMAND(drive, "drive", drive_cmd, CMD_STREAMING, "Change between different drives (from lsata).\nUsage: drive <n>", "drive 0");
+REGISTER_SHELL_COMMAND(sync, "sync", sync_cmd, CMD_STREAMING, "Write everything held in memory (buffered writes, metadata, cached sectors) to every drive.\nUsage: sync", "sync");
 REGISTER_SHELL_COMMAND(memory, "memory", memory_cmd, CMD_ESSENTIAL, "Memory management and testing.\nUsage: memory stats | test | stress", "memory stats");
 REGISTER_SHELL_COMMAND(log, "log", log_cmd, CMD_STREAMING, "Enable or disable shell logging.\nUsage: log on|off", "log on");
 REGISTER_SHELL_COMMAND(lsata, "lsata", lsata_cmd, CMD_STREAMING, "List detected ATA drives and their details.\nUsage: lsata", "lsata");
+REGISTER_SHELL_COMMAND(boottime, "boottime", boottime_cmd, CMD_STREAMING, "Show how long each boot phase took and when the shell started.\nUsage: boottime", "boottime");
+REGISTER_SHELL_COMMAND(iostat, "iostat", iostat_cmd, CMD_STREAMING, "Show per-drive I/O counters and request latency. With an interval, refresh every <seconds> (Ctrl+C stops).\nUsage: iostat [reset | <seconds> [count]]", "iostat 2 5");
 REGISTER_SHELL_COMMAND(exit, "exit", handler_exit, CMD_ESSENTIAL, "Exits the kernel and shuts down the system.\nUsage: exit", "exit");
 REGISTER_SHELL_COMMAND(clear, "clear", clear_cmd, CMD_ESSENTIAL, "Clears the screen and resets the shell display.\nUsage: clear", "clear");
 REGISTER_SHELL_COMMAND(catram, "catram", catram_cmd, CMD_STREAMING, "Display contents of a file from RAM disk (FAT32).\nUsage: catram <filename>", "catram test.txt");
@@ -625,23 +637,18 @@ void calc(string str)
     }
 }
 
-// lsata implementation
+// lsata implementation (reads the drive table the boot probe filled in; nothing is reprobed)
 void lsata() {
     printf("%cDetected Drives:\n", 255, 255, 255);
     printf("%c================\n", 255, 255, 255);
     
     int found_drives = 0;
     for (int d = 0; d < 8; d++) {
-        uint16 id[256];
-        int res = ata_identify(d, id);
-        if (res == 0) {
+        drive_info_t* info = ata_get_drive_info(d);
+        if (info && info->present) {
             found_drives++;
             char model[41];
-            for (int i = 0; i < 20; i++) {
-                model[i*2] = (id[27+i] >> 8) & 0xFF;
-                model[i*2+1] = id[27+i] & 0xFF;
-            }
-            model[40] = '\0';
+            strcpy(model, info->model);
             
             // Clean up model name (remove trailing spaces)
             int len = strlen(model);
@@ -650,20 +657,15 @@ void lsata() {
                 len--;
             }
             
-            uint32 sectors = id[60] | (id[61] << 16);
-            uint32 mb = (sectors / 2048);
+            uint32 mb = info->size_mb;
             uint32 gb = mb / 1024;
-            
-            // Determine drive type
-            const char* drive_type = "IDE";
-            if (id[83] & 0x0400) {
-                drive_type = "SATA";
-            }
+            const char* drive_type = (info->type == 1) ? "SATA" : "IDE";
             
             printf("%cDrive %d: %s\n", 255, 255, 255, d, model);
-            printf("%c  Type: %s\n", 255, 255, 255, drive_type);
+            printf("%c  Type: %s%s\n", 255, 255, 255, drive_type, info->lba48 ? " (LBA48)" : "");
             printf("%c  Size: %d MB (%d GB)\n", 255, 255, 255, mb, gb);
-            printf("%c  Sectors: %d\n", 255, 255, 255, sectors);
+            printf("%c  Sectors: %d\n", 255, 255, 255, info->sectors);
+            printf("%c  Write cache: %s\n", 255, 255, 255, info->write_cache ? "enabled" : "off");
             printf("%c  Status: Present and responding\n", 0, 255, 0);
             printf("\n");
         } else {
@@ -735,6 +737,14 @@ void drive_cmd(string ch) {
             drive = drive * 10 + (ch[i] - '0');
             i++;
         }
+        if (drive >= 8 || !ata_drive_present((uint8)drive)) {
+            printf("%cDrive %d is not present (see lsata)\n", 255, 0, 0, drive);
+            return;
+        }
+        // Leave nothing of the old drive in memory, in case its disk is swapped out next
+        if (drive != g_current_drive && ata_drive_present(g_current_drive) && eynfs_flush(g_current_drive) != 0) {
+            printf("%cWarning: failed to flush drive %d\n", 255, 0, 0, g_current_drive);
+        }
         g_current_drive = (uint8_t)drive;
         printf("%cSwitched to drive %d\n", 0, 255, 0, g_current_drive);
     } else {
@@ -742,6 +752,138 @@ void drive_cmd(string ch) {
     }
 }
 
+int sync_drives(void) {
+    int result = 0;
+    for (uint8 d = 0; d < 8; d++) {
+        // Descriptors' buffered writes, EYNFS metadata, the buffer cache, then the drive's own cache
+        if (ata_drive_present(d) && eynfs_flush(d) != 0) result = -1;
+    }
+    return result;
+}
+
+// sync implementation
+void sync_cmd(string ch) {
+    if (sync_drives() != 0) {
+        printf("%cFailed to write some data to disk\n", 255, 0, 0);
+        return;
+    }
+    printf("%cAll drives synced\n", 0, 255, 0);
+}
+
+// Print the counters of every drive that has seen traffic
+static void iostat_print(void) {
+    int shown = 0;
+    for (uint8 d = 0; d < 8; d++) {
+        const ata_io_stats_t* st = ata_get_stats(d);
+        if (!ata_drive_present(d) && st->requests == 0) continue;
+        shown++;
+
+        printf("%cDrive %d:\n", 255, 255, 0, d);
+        printf("%c  Requests: %d  Commands: %d  Flushes: %d\n", 255, 255, 255,
+               st->requests, st->commands, st->flushes);
+        // Large totals switch to MB so the count fits the int printf takes
+        int big = st->bytes >= (1ULL << 30);
+        printf("%c  Sectors read: %d  written: %d  (%d %s moved)\n", 255, 255, 255,
+               st->sectors_read, st->sectors_written, (int)(st->bytes >> (big ? 20 : 10)), big ? "MB" : "KB");
+        printf("%c  Status polls: %d  Timeouts: %d  Errors: %d\n", 255, 255, 255,
+               st->poll_iterations, st->timeouts, st->errors);
+
+        // Latency histogram, skipping empty buckets
+        if (st->requests == 0) continue;
+        printf("%c  Latency (ms):", 255, 255, 255);
+        for (int b = 0; b < ATA_LATENCY_BUCKETS; b++) {
+            if (st->latency[b] == 0) continue;
+            if (b == 0) {
+                printf("%c <1:%d", 255, 255, 255, st->latency[b]);
+            } else if (b == ATA_LATENCY_BUCKETS - 1) {
+                printf("%c >=%d:%d", 255, 255, 255, 1 << (b - 1), st->latency[b]);
+            } else {
+                printf("%c %d-%d:%d", 255, 255, 255, 1 << (b - 1), (1 << b) - 1, st->latency[b]);
+            }
+        }
+        printf("\n");
+    }
+    if (shown == 0) printf("%cNo drives detected.\n", 255, 165, 0);
+}
+
+// iostat [reset | <seconds> [count]]
+void iostat_cmd(string ch) {
+    uint8 i = 0;
+    while (ch[i] && ch[i] != ' ') i++;
+    while (ch[i] && ch[i] == ' ') i++;
+
+    if (!ch[i]) {
+        iostat_print();
+        return;
+    }
+    if (strEql(&ch[i], "reset")) {
+        ata_reset_stats(0xFF);
+        printf("%cI/O counters cleared\n", 0, 255, 0);
+        return;
+    }
+    if (ch[i] < '0' || ch[i] > '9') {
+        printf("%cUsage: iostat [reset | <seconds> [count]]\n", 255, 255, 255);
+        return;
+    }
+
+    uint32 interval = 0;
+    while (ch[i] >= '0' && ch[i] <= '9') interval = interval * 10 + (ch[i++] - '0');
+    while (ch[i] == ' ') i++;
+    uint32 count = 0; // 0 = until Ctrl+C
+    while (ch[i] >= '0' && ch[i] <= '9') count = count * 10 + (ch[i++] - '0');
+    if (interval == 0) interval = 1;
+
+    g_user_interrupt = 0;
+    for (uint32 n = 0; count == 0 || n < count; n++) {
+        if (n > 0) printf("\n");
+        iostat_print();
+        if (count && n + 1 == count) break;
+
+        uint32 start = timer_ms();
+        while (timer_ms() - start < interval * 1000) {
+            poll_keyboard_for_ctrl_c();
+            if (g_user_interrupt) {
+                printf("%c^C [Interrupted by user]\n", 255, 0, 0);
+                g_user_interrupt = 0;
+                return;
+            }
+            if (irq_enabled()) __asm__ __volatile__("hlt"); // Wake on the next timer tick
+        }
+    }
+}
+
+// Print a microsecond count as milliseconds with three decimals
+static void boottime_print_ms(uint32 us) {
+    char frac[4];
+    frac[0] = '0' + (us / 100) % 10;
+    frac[1] = '0' + (us / 10) % 10;
+    frac[2] = '0' + us % 10;
+    frac[3] = '\0';
+    printf("%c%d.%s ms", 255, 255, 255, us / 1000, frac);
+}
+
+void boottime_cmd(string ch) {
+    printf("%cBoot timeline:\n", 255, 255, 0);
+    for (int i = 0; i < boot_phase_count(); i++) {
+        const boot_phase_t* p = boot_phase_get(i);
+        printf("%c  %s: ", 255, 255, 255, p->name);
+        if (!p->done) {
+            printf("%cstill running\n", 255, 165, 0);
+            continue;
+        }
+        boottime_print_ms(p->end_us - p->start_us);
+        printf("%c (at ", 255, 255, 255);
+        boottime_print_ms(p->start_us);
+        printf("%c)\n", 255, 255, 255);
+    }
+    printf("%c  Shell started at ", 0, 255, 0);
+    boottime_print_ms(boot_shell_start_us());
+    printf("\n");
+    if (!boot_timeline_precise()) {
+        printf("%c  (no TSC: 1 ms resolution, phases before the timer read as 0)\n", 255, 165, 0);
+    }
+}
+
 // memory_cmd implementation
 void memory_cmd(string ch) {
     printf("%cMemory Management Commands:\n", 255, 255, 255);
@@ -5,6 +5,8 @@
 #include <util.h>
 #include <vga.h>
 #include <system.h>
+#include <block.h>
+#include <bcache.h>
 #include <fs_commands.h>
 #include <stdint.h>
 
@@ -596,24 +598,21 @@ void fsstat_cmd(string ch) {
     printf("%cFilesystem: EYNFS v%d\n", 255, 255, 255, sb.version);
     printf("%cTotal blocks: %d\n", 255, 255, 255, sb.total_blocks);
     printf("%cRoot directory block: %d\n", 255, 255, 255, sb.root_dir_block);
-    printf("%cBlock size: %d bytes\n", 255, 255, 255, EYNFS_BLOCK_SIZE);
+    printf("%cBlock size: %d bytes\n", 255, 255, 255, sb.block_size);
     printf("%cTotal capacity: %.2f MB\n", 255, 255, 255, 
-           (sb.total_blocks * EYNFS_BLOCK_SIZE) / (1024.0 * 1024.0));
+           (sb.total_blocks * (double)sb.block_size) / (1024.0 * 1024.0));
     
-    // Calculate free blocks
-    int free_blocks = 0;
-    for (int i = 0; i < sb.total_blocks; i++) {
-        uint8_t bitmap_byte = 0;
-        ata_read_sector(g_current_drive, EYNFS_SUPERBLOCK_LBA + 1 + (i / 8), &bitmap_byte);
-        if (!(bitmap_byte & (1 << (i % 8)))) {
-            free_blocks++;
-        }
+    // Free blocks come from the resident bitmap's summary tier (all bitmap blocks)
+    int free_blocks = eynfs_count_free_blocks(g_current_drive, &sb);
+    if (free_blocks < 0) {
+        printf("%cError: Failed to read block bitmap.\n", 255, 0, 0);
+        return;
     }
     
     printf("%cFree blocks: %d\n", 255, 255, 255, free_blocks);
     printf("%cUsed blocks: %d\n", 255, 255, 255, sb.total_blocks - free_blocks);
     printf("%cFree space: %.2f MB\n", 255, 255, 255, 
-           (free_blocks * EYNFS_BLOCK_SIZE) / (1024.0 * 1024.0));
+           (free_blocks * (double)sb.block_size) / (1024.0 * 1024.0));
     printf("%cUsage: %.1f%%\n", 255, 255, 255, 
            ((sb.total_blocks - free_blocks) * 100.0) / sb.total_blocks);
 }
@@ -634,6 +633,12 @@ void cache_stats_cmd(string ch) {
         printf("%cCache hit rate: %.1f%%\n", 255, 255, 255, hit_rate);
     }
     
+    bcache_stats_t bstats;
+    bcache_get_stats(&bstats);
+    printf("%cBuffer cache: %d/%d sectors (%d KB), %d dirty\n", 255, 255, 255,
+           bstats.used, bstats.capacity, bstats.capacity / 2, bstats.dirty);
+    printf("%cWrite-backs: %d, evictions: %d\n", 255, 255, 255, bstats.writebacks, bstats.evictions);
+    
     printf("%c\n", 255, 255, 255);
     printf("%cUse 'cache_clear' to clear all caches\n", 255, 255, 255);
     printf("%cUse 'cache_reset' to reset statistics\n", 255, 255, 255);
@@ -668,6 +673,11 @@ void blockmap_cmd(string ch) {
         return;
     }
     
+    if (eynfs_count_free_blocks(g_current_drive, &sb) < 0) {
+        printf("%cError: Failed to read block bitmap.\n", 255, 0, 0);
+        return;
+    }
+    
     printf("%cBlock map (0=free, 1=used):\n", 255, 255, 255);
     printf("%c", 255, 255, 255);
     
@@ -678,11 +688,7 @@ void blockmap_cmd(string ch) {
             printf("\n%c", 255, 255, 255);
         }
         
-        // Read bitmap
-        uint8_t bitmap_byte = 0;
-        ata_read_sector(g_current_drive, EYNFS_SUPERBLOCK_LBA + 1 + (i / 8), &bitmap_byte);
-        
-        if (bitmap_byte & (1 << (i % 8))) {
+        if (eynfs_block_in_use(g_current_drive, &sb, i) != 0) {
             printf("%c1", 255, 0, 0); // Red for used
         } else {
             printf("%c0", 0, 255, 0); // Green for free
@@ -713,8 +719,10 @@ void debug_superblock_cmd(string ch) {
     printf("%cVersion: %d\n", 255, 255, 255, sb.version);
     printf("%cTotal blocks: %d\n", 255, 255, 255, sb.total_blocks);
     printf("%cRoot directory block: %d\n", 255, 255, 255, sb.root_dir_block);
-    printf("%cFree block map starts at: LBA %d\n", 255, 255, 255, EYNFS_SUPERBLOCK_LBA + 1);
-    printf("%cBlock size: %d bytes\n", 255, 255, 255, EYNFS_BLOCK_SIZE);
+    printf("%cFree block map starts at: block %d\n", 255, 255, 255, sb.free_block_map);
+    printf("%cFree block map blocks: %d\n", 255, 255, 255, sb.bitmap_blocks ? sb.bitmap_blocks : 1);
+    printf("%cFree blocks: %d\n", 255, 255, 255, eynfs_count_free_blocks(g_current_drive, &sb));
+    printf("%cBlock size: %d bytes\n", 255, 255, 255, sb.block_size);
     printf("%cSuperblock LBA: %d\n", 255, 255, 255, EYNFS_SUPERBLOCK_LBA);
     
     // Show first few bytes of bitmap
@@ -722,10 +730,13 @@ void debug_superblock_cmd(string ch) {
     printf("%cFirst 32 bytes of free block bitmap:\n", 255, 255, 255);
     printf("%c", 255, 255, 255);
     
+    uint8 bitmap[EYNFS_BLOCK_SIZE];
+    if (block_read(g_current_drive, sb.free_block_map * (sb.block_size / EYNFS_BLOCK_SIZE), 1, bitmap) != 0) {
+        printf("%cError: Failed to read block bitmap.\n", 255, 0, 0);
+        return;
+    }
     for (int i = 0; i < 32; i++) {
-        uint8_t bitmap_byte = 0;
-        ata_read_sector(g_current_drive, EYNFS_SUPERBLOCK_LBA + 1 + i, &bitmap_byte);
-        printf("%02X ", bitmap_byte);
+        printf("%02X ", bitmap[i]);
         if ((i + 1) % 16 == 0) {
             printf("\n%c", 255, 255, 255);
         }
@@ -4,6 +4,7 @@
 #include <fat32.h>
 #include <vga.h>
 #include <system.h>
+#include <block.h>
 #include <string.h>
 #include <util.h>
 #include <stdint.h>
@@ -52,9 +53,11 @@ int load_file_to_write_editor(const char* path, uint8 disk) {
             char buf[chunk_size + 1];
             int line = 0;
             int pos = 0;
+            eynfs_read_ctx_t ctx; // Keeps the chunks from re-walking the file each time
+            eynfs_read_ctx_init(&ctx, disk, &entry);
             while (bytes_left > 0 && line < MAX_LINES) {
                 int to_read = (bytes_left < chunk_size) ? bytes_left : chunk_size;
-                int n = eynfs_read_file(disk, &sb, &entry, buf, to_read, offset);
+                int n = eynfs_read_ctx_read(&ctx, buf, to_read, offset);
                 if (n < 0) break;
                 buf[n] = '\0';
                 for (int i = 0; i < n && line < MAX_LINES; i++) {
@@ -99,7 +102,7 @@ int load_file_to_write_editor(const char* path, uint8 disk) {
         while (cluster < 0x0FFFFFF8) {
             uint32 cluster_first_sec = first_data_sec + ((cluster - 2) * sec_per_clus);
             for (uint32 sec = 0; sec < sec_per_clus; sec++) {
-                if (ata_read_sector(disk, partition_lba_start + cluster_first_sec + sec, sector) != 0) break;
+                if (block_read(disk, partition_lba_start + cluster_first_sec + sec, 1, sector) != 0) break;
                 struct fat32_dir_entry* entries = (struct fat32_dir_entry*)sector;
                 for (int i = 0; i < 16; i++) {
                     if (entries[i].Name[0] == 0x00) break;
@@ -117,6 +117,15 @@ void *memmove(void *dest, const void *src, size_t n) {
     return dest;
 }
 
+int memcmp(const void *s1, const void *s2, size_t n) {
+    const uint8_t *a = (const uint8_t*)s1;
+    const uint8_t *b = (const uint8_t*)s2;
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) return a[i] - b[i];
+    }
+    return 0;
+}
+
 /**
  * K&R implementation
  */